@@ -1,16 +1,20 @@
 #include "config.h"
 #include "kiosk-backgrounds.h"
 
+#include <errno.h>
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <glycin.h>
 #include <gio/gio.h>
+#include <glib/gstdio.h>
 #include <clutter/clutter.h>
 #include <cogl/cogl-color.h>
 
 #include <meta/display.h>
 #include <meta/util.h>
+#include <meta/window.h>
 
 #include <meta/meta-context.h>
 #include <meta/meta-backend.h>
@@ -23,6 +27,9 @@
 
 #include "kiosk-compositor.h"
 #include "kiosk-gobject-utils.h"
+#include "kiosk-pixel-utils.h"
+#include "kiosk-service.h"
+#include "main.h"
 
 #define KIOSK_BACKGROUNDS_SCHEMA "org.gnome.desktop.background"
 #define KIOSK_BACKGROUNDS_PICTURE_OPTIONS_SETTING "picture-options"
@@ -31,11 +38,80 @@
 #define KIOSK_BACKGROUNDS_PRIMARY_COLOR_SETTING "primary-color"
 #define KIOSK_BACKGROUNDS_SECONDARY_COLOR_SETTING "secondary-color"
 
+#define KIOSK_BACKGROUNDS_DEFAULT_TEXTURE_CACHE_BUDGET (64 * 1024 * 1024)
+#define KIOSK_BACKGROUNDS_TEXTURE_PIN_KEY "kiosk-backgrounds-texture-pin"
+#define KIOSK_BACKGROUNDS_DEFAULT_SLIDESHOW_INTERVAL 300
+#define KIOSK_BACKGROUNDS_CROSS_FADE_DURATION 1000
+#define KIOSK_BACKGROUNDS_DISK_CACHE_MAX_FILES 16
+#define KIOSK_BACKGROUNDS_DISK_CACHE_MAGIC "KSKBGRD"
+#define KIOSK_BACKGROUNDS_DISK_CACHE_VERSION 1
+
+/* Texture cache key, the same picture is decoded once per size it is
+ * shown at
+ */
+typedef struct
+{
+        GFile                  *file;
+        int                     width;
+        int                     height;
+        GDesktopBackgroundStyle style;
+} TextureCacheKey;
+
+static TextureCacheKey *
+texture_cache_key_new (GFile                   *file,
+                       int                      width,
+                       int                      height,
+                       GDesktopBackgroundStyle  style)
+{
+        TextureCacheKey *key;
+
+        key = g_new0 (TextureCacheKey, 1);
+        key->file = g_object_ref (file);
+        key->width = width;
+        key->height = height;
+        key->style = style;
+
+        return key;
+}
+
+static void
+texture_cache_key_free (TextureCacheKey *key)
+{
+        g_object_unref (key->file);
+        g_free (key);
+}
+
+static guint
+texture_cache_key_hash (const TextureCacheKey *key)
+{
+        guint hash = g_file_hash (key->file);
+
+        hash = hash * 31 + (guint) key->width;
+        hash = hash * 31 + (guint) key->height;
+        hash = hash * 31 + (guint) key->style;
+
+        return hash;
+}
+
+static gboolean
+texture_cache_key_equal (const TextureCacheKey *key_a,
+                         const TextureCacheKey *key_b)
+{
+        return key_a->width == key_b->width &&
+               key_a->height == key_b->height &&
+               key_a->style == key_b->style &&
+               g_file_equal (key_a->file, key_b->file);
+}
+
 /* Texture cache entry */
 typedef struct
 {
+        TextureCacheKey   *key;                  /* owned by the cache */
         CoglTexture       *texture;
         ClutterColorState *color_state;
+        gsize              size;
+        guint              number_of_pins;
+        GList              link;                 /* in recently_used */
 } TextureCacheEntry;
 
 static void
@@ -46,6 +122,15 @@ texture_cache_entry_free (TextureCacheEntry *entry)
         g_free (entry);
 }
 
+/* Keeps a cache entry from being evicted while a background shows it,
+ * attached to the background so it goes away along with it
+ */
+typedef struct
+{
+        struct _KioskBackgrounds *backgrounds;
+        TextureCacheKey        *key;
+} TexturePin;
+
 struct _KioskBackgrounds
 {
         MetaBackgroundGroup parent;
@@ -58,17 +143,47 @@ struct _KioskBackgrounds
         MetaBackend        *backend;
         MetaMonitorManager *monitor_manager;
         ClutterActor       *stage;
+        KioskDBusBackgrounds *dbus_service;
 
         /* strong references */
         GCancellable       *cancellable;
         GSettings          *settings;
         ClutterActor       *background_group;
-        GHashTable         *texture_cache;       /* GFile -> TextureCacheEntry */
+        MetaBackground     *background;
+        GPtrArray          *background_actors;   /* ClutterActor, by monitor index */
+        GHashTable         *texture_cache;       /* TextureCacheKey -> TextureCacheEntry */
+        GQueue              recently_used;       /* TextureCacheEntry, most recent first */
+        guint64             texture_cache_budget;
+        guint64             texture_cache_size;
+        guint64             texture_cache_hits;
+        guint64             texture_cache_misses;
+
+        /* slideshow, when picture-uri is a directory */
+        GCancellable       *slideshow_cancellable;
+        GPtrArray          *slideshow_files;     /* GFile */
+        guint               slideshow_index;
+        guint               slideshow_interval;
+        guint               slideshow_timeout_id;
+        TexturePin         *slideshow_next_pin;
+        gboolean            slideshow_switch_pending;
+
+        gboolean            use_disk_cache;
+
+        /* fullscreen windows covering the backgrounds */
+        gboolean            release_occluded_textures;
+        gboolean            all_backgrounds_occluded;
+        gboolean            textures_released;
+        gboolean            fullscreen_window_unmanaging;
+        GHashTable         *pending_loads;       /* TextureCacheKey -> LoadTextureData, owned by the task */
 };
 
 enum
 {
         PROP_COMPOSITOR = 1,
+        PROP_TEXTURE_CACHE_BUDGET,
+        PROP_SLIDESHOW_INTERVAL,
+        PROP_USE_DISK_CACHE,
+        PROP_RELEASE_OCCLUDED_TEXTURES,
         NUMBER_OF_PROPERTIES
 };
 static GParamSpec *kiosk_backgrounds_properties[NUMBER_OF_PROPERTIES] = { NULL, };
@@ -101,6 +216,24 @@ kiosk_backgrounds_class_init (KioskBackgroundsClass *backgrounds_class)
                                                                              NULL, NULL,
                                                                              KIOSK_TYPE_COMPOSITOR,
                                                                              G_PARAM_CONSTRUCT_ONLY | G_PARAM_WRITABLE | G_PARAM_STATIC_NAME);
+        kiosk_backgrounds_properties[PROP_TEXTURE_CACHE_BUDGET] = g_param_spec_uint64 ("texture-cache-budget",
+                                                                                       NULL, NULL,
+                                                                                       0, G_MAXUINT64,
+                                                                                       KIOSK_BACKGROUNDS_DEFAULT_TEXTURE_CACHE_BUDGET,
+                                                                                       G_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY | G_PARAM_STATIC_STRINGS);
+        kiosk_backgrounds_properties[PROP_SLIDESHOW_INTERVAL] = g_param_spec_uint ("slideshow-interval",
+                                                                                   NULL, NULL,
+                                                                                   1, G_MAXUINT,
+                                                                                   KIOSK_BACKGROUNDS_DEFAULT_SLIDESHOW_INTERVAL,
+                                                                                   G_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY | G_PARAM_STATIC_STRINGS);
+        kiosk_backgrounds_properties[PROP_USE_DISK_CACHE] = g_param_spec_boolean ("use-disk-cache",
+                                                                                  NULL, NULL,
+                                                                                  TRUE,
+                                                                                  G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+        kiosk_backgrounds_properties[PROP_RELEASE_OCCLUDED_TEXTURES] = g_param_spec_boolean ("release-occluded-textures",
+                                                                                             NULL, NULL,
+                                                                                             FALSE,
+                                                                                             G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
         g_object_class_install_properties (object_class, NUMBER_OF_PROPERTIES, kiosk_backgrounds_properties);
 }
 
@@ -141,6 +274,34 @@ gly_memory_format_to_cogl (GlyMemoryFormat  format)
         }
 }
 
+static int
+gly_memory_format_get_bytes_per_pixel (GlyMemoryFormat format)
+{
+        switch ((guint) format) {
+        case GLY_MEMORY_B8G8R8A8_PREMULTIPLIED:
+        case GLY_MEMORY_A8R8G8B8_PREMULTIPLIED:
+        case GLY_MEMORY_R8G8B8A8_PREMULTIPLIED:
+        case GLY_MEMORY_B8G8R8A8:
+        case GLY_MEMORY_A8R8G8B8:
+        case GLY_MEMORY_R8G8B8A8:
+        case GLY_MEMORY_A8B8G8R8:
+                return 4;
+        case GLY_MEMORY_R8G8B8:
+        case GLY_MEMORY_B8G8R8:
+                return 3;
+        case GLY_MEMORY_R16G16B16A16_PREMULTIPLIED:
+        case GLY_MEMORY_R16G16B16A16:
+        case GLY_MEMORY_R16G16B16A16_FLOAT:
+                return 8;
+        case GLY_MEMORY_R32G32B32A32_FLOAT_PREMULTIPLIED:
+        case GLY_MEMORY_R32G32B32A32_FLOAT:
+                return 16;
+        default:
+                /* Not one of glycin_supported_memory_formats () */
+                return 0;
+        }
+}
+
 static GlyMemoryFormatSelection
 glycin_supported_memory_formats (void)
 {
@@ -198,23 +359,569 @@ set_background_color_from_settings (KioskBackgrounds *self,
         }
 }
 
+/* A background waiting for a texture that is still being loaded */
 typedef struct
 {
-        KioskBackgrounds       *backgrounds;
         MetaBackground         *background;
         GDesktopBackgroundStyle style;
-        GFile                  *file;
+} LoadTextureWaiter;
+
+static void
+load_texture_waiter_free (LoadTextureWaiter *waiter)
+{
+        g_object_unref (waiter->background);
+        g_free (waiter);
+}
+
+static void
+publish_texture_cache_stats (KioskBackgrounds *self)
+{
+        KioskBackgroundsTextureCacheStats stats;
+        GVariantBuilder builder;
+
+        if (self->dbus_service == NULL)
+                return;
+
+        kiosk_backgrounds_get_texture_cache_stats (self, &stats);
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{st}"));
+        g_variant_builder_add (&builder, "{st}", "entries", (guint64) stats.number_of_entries);
+        g_variant_builder_add (&builder, "{st}", "size", stats.size);
+        g_variant_builder_add (&builder, "{st}", "budget", stats.budget);
+        g_variant_builder_add (&builder, "{st}", "hits", stats.hits);
+        g_variant_builder_add (&builder, "{st}", "misses", stats.misses);
+
+        kiosk_dbus_backgrounds_set_texture_cache (self->dbus_service, g_variant_builder_end (&builder));
+}
+
+static void
+queue_publish_texture_cache_stats (KioskBackgrounds *self)
+{
+        kiosk_gobject_utils_queue_immediate_callback (G_OBJECT (self),
+                                                      "[kiosk-backgrounds] publish_texture_cache_stats",
+                                                      self->cancellable,
+                                                      KIOSK_OBJECT_CALLBACK (publish_texture_cache_stats),
+                                                      NULL);
+}
+
+static void
+trim_texture_cache (KioskBackgrounds *self,
+                    guint64           budget)
+{
+        GList *node = self->recently_used.tail;
+
+        while (node != NULL && self->texture_cache_size > budget) {
+                TextureCacheEntry *entry = node->data;
+
+                node = node->prev;
+
+                if (entry->number_of_pins > 0)
+                        continue;
+
+                g_debug ("KioskBackgrounds: Evicting %dx%d background texture from cache",
+                         entry->key->width, entry->key->height);
+
+                g_queue_unlink (&self->recently_used, &entry->link);
+                self->texture_cache_size -= entry->size;
+                g_hash_table_remove (self->texture_cache, entry->key);
+        }
+
+        g_debug ("KioskBackgrounds: Texture cache holds %u textures, %" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT " bytes",
+                 g_hash_table_size (self->texture_cache),
+                 self->texture_cache_size,
+                 self->texture_cache_budget);
+
+        queue_publish_texture_cache_stats (self);
+}
+
+static void
+evict_texture_cache_entries (KioskBackgrounds *self)
+{
+        trim_texture_cache (self, self->texture_cache_budget);
+}
+
+static TextureCacheEntry *
+look_up_texture_cache_entry (KioskBackgrounds *self,
+                             TextureCacheKey  *key)
+{
+        TextureCacheEntry *entry;
+
+        queue_publish_texture_cache_stats (self);
+
+        entry = g_hash_table_lookup (self->texture_cache, key);
+        if (entry == NULL) {
+                self->texture_cache_misses++;
+                return NULL;
+        }
+
+        self->texture_cache_hits++;
+
+        g_queue_unlink (&self->recently_used, &entry->link);
+        g_queue_push_head_link (&self->recently_used, &entry->link);
+
+        return entry;
+}
+
+static void
+add_texture_cache_entry (KioskBackgrounds  *self,
+                         TextureCacheKey   *key,
+                         TextureCacheEntry *entry)
+{
+        entry->key = key;
+        entry->link.data = entry;
+
+        g_hash_table_insert (self->texture_cache, key, entry);
+        g_queue_push_head_link (&self->recently_used, &entry->link);
+        self->texture_cache_size += entry->size;
+}
+
+static void
+texture_pin_free (TexturePin *pin)
+{
+        TextureCacheEntry *entry = NULL;
+
+        if (pin->backgrounds != NULL && pin->backgrounds->texture_cache != NULL)
+                entry = g_hash_table_lookup (pin->backgrounds->texture_cache, pin->key);
+
+        if (entry != NULL)
+                entry->number_of_pins--;
+
+        g_clear_weak_pointer (&pin->backgrounds);
+        texture_cache_key_free (pin->key);
+        g_free (pin);
+}
+
+static TexturePin *
+texture_pin_new (KioskBackgrounds  *self,
+                 TextureCacheEntry *entry)
+{
+        TexturePin *pin;
+
+        pin = g_new0 (TexturePin, 1);
+        g_set_weak_pointer (&pin->backgrounds, self);
+        pin->key = texture_cache_key_new (entry->key->file,
+                                          entry->key->width,
+                                          entry->key->height,
+                                          entry->key->style);
+        entry->number_of_pins++;
+
+        return pin;
+}
+
+static void
+set_background_texture (KioskBackgrounds        *self,
+                        MetaBackground          *background,
+                        TextureCacheEntry       *entry,
+                        GDesktopBackgroundStyle  style)
+{
+        TexturePin *pin;
+
+        pin = texture_pin_new (self, entry);
+
+        /* Replaces, and so unpins, the texture the background showed before */
+        g_object_set_data_full (G_OBJECT (background),
+                                KIOSK_BACKGROUNDS_TEXTURE_PIN_KEY,
+                                pin,
+                                (GDestroyNotify) texture_pin_free);
+
+        meta_background_set_texture (background, entry->texture, style, entry->color_state);
+}
+
+/* Decoded picture, ready to be uploaded */
+typedef struct
+{
+        GBytes         *bytes;
+        int             width;
+        int             height;
+        int             stride;
+        GlyMemoryFormat format;
+        gboolean        has_cicp;
+        ClutterCicp     cicp;
+} LoadedPicture;
+
+static void
+loaded_picture_free (LoadedPicture *picture)
+{
+        g_bytes_unref (picture->bytes);
+        g_free (picture);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (LoadedPicture, loaded_picture_free)
+
+typedef struct
+{
+        KioskBackgrounds       *backgrounds;
+        TextureCacheKey        *key;
+        GPtrArray              *waiters;
+
+        /* Set when loading ahead of time for the slideshow, such
+         * pictures get uploaded once the compositor is idle
+         */
+        gboolean                preload;
+        LoadedPicture          *picture;
+
+        /* NULL when the disk cache is turned off */
+        char                   *disk_cache_directory;
+
+        /* Only pictures needed right away, like the one shown at start-up,
+         * get written to the disk cache, so slideshows don't wear out the
+         * storage by writing every picture they go through
+         */
+        gboolean                save_to_disk_cache;
 } LoadTextureData;
 
 static void
 load_texture_data_free (LoadTextureData *data)
 {
         g_object_unref (data->backgrounds);
-        g_object_unref (data->background);
-        g_object_unref (data->file);
+        texture_cache_key_free (data->key);
+        g_ptr_array_unref (data->waiters);
+        g_clear_pointer (&data->picture, loaded_picture_free);
+        g_free (data->disk_cache_directory);
         g_free (data);
 }
 
+/* Figures out how big the picture needs to be to look the same when
+ * shown with the given style on monitors of at most the target size
+ */
+static void
+get_decoded_picture_size (GDesktopBackgroundStyle  style,
+                          int                      target_width,
+                          int                      target_height,
+                          int                      width,
+                          int                      height,
+                          int                     *decoded_width,
+                          int                     *decoded_height)
+{
+        double scale;
+
+        *decoded_width = width;
+        *decoded_height = height;
+
+        switch (style) {
+        case G_DESKTOP_BACKGROUND_STYLE_ZOOM:
+        case G_DESKTOP_BACKGROUND_STYLE_SPANNED:
+                scale = MAX ((double) target_width / width, (double) target_height / height);
+                break;
+        case G_DESKTOP_BACKGROUND_STYLE_SCALED:
+                scale = MIN ((double) target_width / width, (double) target_height / height);
+                break;
+        case G_DESKTOP_BACKGROUND_STYLE_STRETCHED:
+        case G_DESKTOP_BACKGROUND_STYLE_CENTERED:
+                *decoded_width = MIN (width, target_width);
+                *decoded_height = MIN (height, target_height);
+                return;
+        default:
+                return;
+        }
+
+        if (scale >= 1.0)
+                return;
+
+        *decoded_width = CLAMP ((int) ceil (width * scale), 1, width);
+        *decoded_height = CLAMP ((int) ceil (height * scale), 1, height);
+}
+
+static LoadedPicture *
+shrink_frame_to_target_size (GlyFrame               *frame,
+                             GDesktopBackgroundStyle style,
+                             int                     target_width,
+                             int                     target_height)
+{
+        g_autoptr (LoadedPicture) picture = NULL;
+        g_autoptr (GlyCicp) cicp = NULL;
+        GBytes *bytes = gly_frame_get_buf_bytes (frame);
+        int bytes_per_pixel;
+        int width, height;
+
+        picture = g_new0 (LoadedPicture, 1);
+        picture->width = gly_frame_get_width (frame);
+        picture->height = gly_frame_get_height (frame);
+        picture->stride = gly_frame_get_stride (frame);
+        picture->format = gly_frame_get_memory_format (frame);
+
+        cicp = gly_frame_get_color_cicp (frame);
+        if (cicp != NULL) {
+                picture->has_cicp = TRUE;
+                gly_cicp_to_clutter (cicp, &picture->cicp);
+        }
+
+        bytes_per_pixel = gly_memory_format_get_bytes_per_pixel (picture->format);
+
+        get_decoded_picture_size (style, target_width, target_height,
+                                  picture->width, picture->height,
+                                  &width, &height);
+
+        if (width == picture->width && height == picture->height) {
+                picture->bytes = g_bytes_ref (bytes);
+        } else if (style == G_DESKTOP_BACKGROUND_STYLE_CENTERED) {
+                /* Only the middle of a centered picture is ever visible,
+                 * so crop it without copying
+                 */
+                gsize offset = (gsize) ((picture->height - height) / 2) * picture->stride +
+                               (gsize) ((picture->width - width) / 2) * bytes_per_pixel;
+                gsize size = (gsize) (height - 1) * picture->stride + (gsize) width * bytes_per_pixel;
+
+                picture->bytes = g_bytes_new_from_bytes (bytes, offset, size);
+                picture->width = width;
+                picture->height = height;
+        } else if (bytes_per_pixel == 4) {
+                int stride = width * 4;
+                guint8 *data = g_malloc ((gsize) stride * height);
+
+                kiosk_pixel_utils_downscale_argb32 (data, stride, width, height,
+                                                    g_bytes_get_data (bytes, NULL),
+                                                    picture->stride,
+                                                    picture->width, picture->height);
+
+                picture->bytes = g_bytes_new_take (data, (gsize) stride * height);
+                picture->width = width;
+                picture->height = height;
+                picture->stride = stride;
+        } else {
+                /* Deep color pictures are rare enough that they are kept
+                 * at their full size rather than growing a downscaler per
+                 * channel depth
+                 */
+                picture->bytes = g_bytes_ref (bytes);
+        }
+
+        return g_steal_pointer (&picture);
+}
+
+static void
+load_texture_data_add_waiter (LoadTextureData         *data,
+                              MetaBackground          *background,
+                              GDesktopBackgroundStyle  style)
+{
+        LoadTextureWaiter *waiter;
+
+        waiter = g_new0 (LoadTextureWaiter, 1);
+        waiter->background = g_object_ref (background);
+        waiter->style = style;
+
+        g_ptr_array_add (data->waiters, waiter);
+}
+
+/* Header of the files in the disk cache, followed by the pixels exactly
+ * as they get uploaded. The files never leave the machine, so they are
+ * stored in host byte order.
+ */
+typedef struct
+{
+        char    magic[8];
+        guint32 version;
+        guint32 width;
+        guint32 height;
+        guint32 stride;
+        guint32 format;
+        guint32 has_cicp;
+        guint32 cicp_primaries;
+        guint32 cicp_transfer;
+        guint32 cicp_matrix_coefficients;
+        guint32 cicp_video_full_range_flag;
+        guint64 size;
+        guint8  padding[16];
+} DiskCacheHeader;
+
+G_STATIC_ASSERT (sizeof (DiskCacheHeader) == 72);
+
+/* Decoded pictures are only valid for as long as the file they came from
+ * is not changed, so the modification time is part of the name
+ */
+static char *
+get_disk_cache_path (const char      *directory,
+                     TextureCacheKey *key,
+                     GCancellable    *cancellable)
+{
+        g_autoptr (GFileInfo) info = NULL;
+        g_autoptr (GDateTime) modification_time = NULL;
+        g_autofree char *uri = NULL;
+        g_autofree char *description = NULL;
+        g_autofree char *checksum = NULL;
+        g_autofree char *filename = NULL;
+
+        info = g_file_query_info (key->file,
+                                  G_FILE_ATTRIBUTE_TIME_MODIFIED "," G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC,
+                                  G_FILE_QUERY_INFO_NONE,
+                                  cancellable,
+                                  NULL);
+        if (info == NULL)
+                return NULL;
+
+        modification_time = g_file_info_get_modification_date_time (info);
+        if (modification_time == NULL)
+                return NULL;
+
+        uri = g_file_get_uri (key->file);
+        description = g_strdup_printf ("%s\n%" G_GINT64_FORMAT "\n%dx%d\n%d",
+                                       uri,
+                                       g_date_time_to_unix_usec (modification_time),
+                                       key->width,
+                                       key->height,
+                                       key->style);
+        checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA256, description, -1);
+        filename = g_strdup_printf ("%s.raw", checksum);
+
+        return g_build_filename (directory, filename, NULL);
+}
+
+static LoadedPicture *
+load_picture_from_disk_cache (const char *path)
+{
+        g_autoptr (GMappedFile) mapped_file = NULL;
+        g_autoptr (GBytes) mapped_bytes = NULL;
+        g_autoptr (LoadedPicture) picture = NULL;
+        const DiskCacheHeader *header;
+        gsize length;
+
+        mapped_file = g_mapped_file_new (path, FALSE, NULL);
+        if (mapped_file == NULL)
+                return NULL;
+
+        length = g_mapped_file_get_length (mapped_file);
+        if (length < sizeof (DiskCacheHeader))
+                return NULL;
+
+        header = (const DiskCacheHeader *) g_mapped_file_get_contents (mapped_file);
+        if (memcmp (header->magic, KIOSK_BACKGROUNDS_DISK_CACHE_MAGIC, sizeof (header->magic)) != 0 ||
+            header->version != KIOSK_BACKGROUNDS_DISK_CACHE_VERSION ||
+            gly_memory_format_get_bytes_per_pixel (header->format) == 0 ||
+            header->width == 0 || header->height == 0 ||
+            header->width > G_MAXINT || header->height > G_MAXINT || header->stride > G_MAXINT ||
+            header->size != length - sizeof (DiskCacheHeader) ||
+            header->size < (guint64) (header->height - 1) * header->stride +
+                           (guint64) header->width * gly_memory_format_get_bytes_per_pixel (header->format)) {
+                g_debug ("KioskBackgrounds: Ignoring invalid disk cache file %s", path);
+                return NULL;
+        }
+
+        /* The pixels stay in the mapped file, so they get uploaded
+         * without being read into memory first
+         */
+        mapped_bytes = g_mapped_file_get_bytes (mapped_file);
+
+        picture = g_new0 (LoadedPicture, 1);
+        picture->bytes = g_bytes_new_from_bytes (mapped_bytes, sizeof (DiskCacheHeader), header->size);
+        picture->width = header->width;
+        picture->height = header->height;
+        picture->stride = header->stride;
+        picture->format = header->format;
+        picture->has_cicp = header->has_cicp;
+        picture->cicp.primaries = header->cicp_primaries;
+        picture->cicp.transfer = header->cicp_transfer;
+        picture->cicp.matrix_coefficients = header->cicp_matrix_coefficients;
+        picture->cicp.video_full_range_flag = header->cicp_video_full_range_flag;
+
+        return g_steal_pointer (&picture);
+}
+
+/* Cache files get their modification time updated whenever they are
+ * used, so the least recently used ones go first
+ */
+static int
+compare_file_infos_by_modification_time (GFileInfo **info_a,
+                                         GFileInfo **info_b)
+{
+        g_autoptr (GDateTime) time_a = g_file_info_get_modification_date_time (*info_a);
+        g_autoptr (GDateTime) time_b = g_file_info_get_modification_date_time (*info_b);
+
+        return g_date_time_compare (time_b, time_a);
+}
+
+static void
+prune_disk_cache (const char *directory)
+{
+        g_autoptr (GFile) directory_file = g_file_new_for_path (directory);
+        g_autoptr (GFileEnumerator) enumerator = NULL;
+        g_autoptr (GPtrArray) infos = NULL;
+        guint i;
+
+        enumerator = g_file_enumerate_children (directory_file,
+                                                G_FILE_ATTRIBUTE_STANDARD_NAME ","
+                                                G_FILE_ATTRIBUTE_TIME_MODIFIED,
+                                                G_FILE_QUERY_INFO_NONE,
+                                                NULL,
+                                                NULL);
+        if (enumerator == NULL)
+                return;
+
+        infos = g_ptr_array_new_with_free_func (g_object_unref);
+
+        while (TRUE) {
+                GFileInfo *info;
+
+                if (!g_file_enumerator_iterate (enumerator, &info, NULL, NULL, NULL) || info == NULL)
+                        break;
+
+                if (!g_str_has_suffix (g_file_info_get_name (info), ".raw"))
+                        continue;
+
+                g_ptr_array_add (infos, g_object_ref (info));
+        }
+
+        if (infos->len <= KIOSK_BACKGROUNDS_DISK_CACHE_MAX_FILES)
+                return;
+
+        g_ptr_array_sort (infos, (GCompareFunc) compare_file_infos_by_modification_time);
+
+        for (i = KIOSK_BACKGROUNDS_DISK_CACHE_MAX_FILES; i < infos->len; i++) {
+                GFileInfo *info = g_ptr_array_index (infos, i);
+                g_autofree char *path = g_build_filename (directory, g_file_info_get_name (info), NULL);
+
+                g_debug ("KioskBackgrounds: Removing old disk cache file %s", path);
+                g_unlink (path);
+        }
+}
+
+static void
+save_picture_to_disk_cache (const char    *directory,
+                            const char    *path,
+                            LoadedPicture *picture)
+{
+        g_autoptr (GFile) file = NULL;
+        g_autoptr (GFileOutputStream) stream = NULL;
+        g_autoptr (GError) error = NULL;
+        DiskCacheHeader header = { 0 };
+        gsize size;
+
+        if (g_mkdir_with_parents (directory, 0700) != 0) {
+                g_debug ("KioskBackgrounds: Could not create disk cache directory %s: %s",
+                         directory, g_strerror (errno));
+                return;
+        }
+
+        size = g_bytes_get_size (picture->bytes);
+
+        memcpy (header.magic, KIOSK_BACKGROUNDS_DISK_CACHE_MAGIC, sizeof (header.magic));
+        header.version = KIOSK_BACKGROUNDS_DISK_CACHE_VERSION;
+        header.width = picture->width;
+        header.height = picture->height;
+        header.stride = picture->stride;
+        header.format = picture->format;
+        header.has_cicp = picture->has_cicp;
+        header.cicp_primaries = picture->cicp.primaries;
+        header.cicp_transfer = picture->cicp.transfer;
+        header.cicp_matrix_coefficients = picture->cicp.matrix_coefficients;
+        header.cicp_video_full_range_flag = picture->cicp.video_full_range_flag;
+        header.size = size;
+
+        /* Replacing writes to a temporary file first, so a crash never
+         * leaves a truncated file behind under the final name
+         */
+        file = g_file_new_for_path (path);
+        stream = g_file_replace (file, NULL, FALSE, G_FILE_CREATE_PRIVATE | G_FILE_CREATE_REPLACE_DESTINATION, NULL, &error);
+        if (stream == NULL ||
+            !g_output_stream_write_all (G_OUTPUT_STREAM (stream), &header, sizeof (header), NULL, NULL, &error) ||
+            !g_output_stream_write_all (G_OUTPUT_STREAM (stream), g_bytes_get_data (picture->bytes, NULL), size, NULL, NULL, &error) ||
+            !g_output_stream_close (G_OUTPUT_STREAM (stream), NULL, &error)) {
+                g_debug ("KioskBackgrounds: Could not write disk cache file %s: %s", path, error->message);
+                return;
+        }
+
+        prune_disk_cache (directory);
+}
+
 static void
 load_texture_thread (GTask        *task,
                      gpointer      source_object,
@@ -225,10 +932,29 @@ load_texture_thread (GTask        *task,
         g_autoptr (GFileInputStream) stream = NULL;
         g_autoptr (GlyLoader) loader = NULL;
         g_autoptr (GlyImage) image = NULL;
-        GlyFrame *frame;
+        g_autoptr (GlyFrame) frame = NULL;
+        g_autofree char *disk_cache_path = NULL;
+        g_autoptr (LoadedPicture) saved_picture = NULL;
+        LoadedPicture *picture;
         GError *error = NULL;
 
-        stream = g_file_read (data->file, cancellable, &error);
+        if (data->disk_cache_directory != NULL)
+                disk_cache_path = get_disk_cache_path (data->disk_cache_directory, data->key, cancellable);
+
+        if (disk_cache_path != NULL) {
+                picture = load_picture_from_disk_cache (disk_cache_path);
+                if (picture != NULL) {
+                        g_debug ("KioskBackgrounds: Loaded background from disk cache");
+
+                        if (data->save_to_disk_cache)
+                                g_utime (disk_cache_path, NULL);
+
+                        g_task_return_pointer (task, picture, (GDestroyNotify) loaded_picture_free);
+                        return;
+                }
+        }
+
+        stream = g_file_read (data->key->file, cancellable, &error);
         if (stream == NULL) {
                 g_task_return_error (task, error);
                 return;
@@ -249,45 +975,75 @@ load_texture_thread (GTask        *task,
                 return;
         }
 
-        g_task_return_pointer (task, frame, (GDestroyNotify) g_object_unref);
+        picture = shrink_frame_to_target_size (frame,
+                                               data->key->style,
+                                               data->key->width,
+                                               data->key->height);
+
+        if (disk_cache_path == NULL || !data->save_to_disk_cache) {
+                g_task_return_pointer (task, picture, (GDestroyNotify) loaded_picture_free);
+                return;
+        }
+
+        /* Write the cache file after handing out the picture, so the
+         * background doesn't have to wait for it
+         */
+        saved_picture = g_new0 (LoadedPicture, 1);
+        *saved_picture = *picture;
+        saved_picture->bytes = g_bytes_ref (picture->bytes);
+
+        g_task_return_pointer (task, picture, (GDestroyNotify) loaded_picture_free);
+
+        save_picture_to_disk_cache (data->disk_cache_directory, disk_cache_path, saved_picture);
 }
 
+static void on_slideshow_picture_uploaded (KioskBackgrounds  *self,
+                                           TextureCacheEntry *entry);
+static void on_slideshow_picture_failed (KioskBackgrounds *self,
+                                         TextureCacheKey  *key);
+
 static void
-on_texture_loaded (GObject      *source_object,
-                   GAsyncResult *result,
-                   gpointer      user_data)
+fail_picture_load (KioskBackgrounds *self,
+                   LoadTextureData  *data)
+{
+        guint i;
+
+        /* Show the color instead of a picture that never comes */
+        for (i = 0; i < data->waiters->len; i++) {
+                LoadTextureWaiter *waiter = g_ptr_array_index (data->waiters, i);
+
+                set_background_color_from_settings (self, waiter->background);
+        }
+
+        if (data->preload)
+                on_slideshow_picture_failed (self, data->key);
+}
+
+static void
+upload_picture (KioskBackgrounds *self,
+                LoadTextureData  *data,
+                LoadedPicture    *picture)
 {
-        GTask *task = G_TASK (result);
-        LoadTextureData *data = g_task_get_task_data (task);
-        KioskBackgrounds *self = data->backgrounds;
-        g_autoptr (GError) error = NULL;
         g_autoptr (GError) local_error = NULL;
-        g_autoptr (GlyFrame) frame = NULL;
         ClutterContext *clutter_context = clutter_actor_get_context (self->stage);
         ClutterBackend *clutter_backend = clutter_context_get_backend (clutter_context);
         CoglContext *ctx = clutter_backend_get_cogl_context (clutter_backend);
         CoglTexture *texture = NULL;
         int width, height, row_stride;
         GlyMemoryFormat format;
-        g_autoptr (GlyCicp) cicp = NULL;
-        GBytes *bytes;
         const guint8 *data_ptr;
         TextureCacheEntry *entry;
+        guint i;
 
-        frame = g_task_propagate_pointer (task, &error);
-        if (frame == NULL) {
-                g_autofree char *uri = g_file_get_uri (data->file);
-                g_warning ("Failed to load background '%s': %s", uri, error->message);
-                return;
-        }
+        g_hash_table_remove (self->pending_loads, data->key);
 
-        width = gly_frame_get_width (frame);
-        height = gly_frame_get_height (frame);
-        row_stride = gly_frame_get_stride (frame);
-        bytes = gly_frame_get_buf_bytes (frame);
-        format = gly_frame_get_memory_format (frame);
-        cicp = gly_frame_get_color_cicp (frame);
-        data_ptr = g_bytes_get_data (bytes, NULL);
+        width = picture->width;
+        height = picture->height;
+        row_stride = picture->stride;
+        format = picture->format;
+        data_ptr = g_bytes_get_data (picture->bytes, NULL);
+
+        g_debug ("KioskBackgrounds: Uploading %dx%d background", width, height);
 
         /* Create texture */
         texture = COGL_TEXTURE (cogl_texture_2d_new_with_size (ctx, width, height));
@@ -315,21 +1071,19 @@ on_texture_loaded (GObject      *source_object,
                                     &local_error)) {
                 g_warning ("Failed to set texture data for background: %s", local_error->message);
                 g_clear_object (&texture);
+                fail_picture_load (self, data);
                 return;
         }
 
         /* Cache the texture */
         entry = g_new0 (TextureCacheEntry, 1);
         entry->texture = texture;
+        entry->size = (gsize) width * height * gly_memory_format_get_bytes_per_pixel (format);
 
-        if (cicp) {
-                ClutterCicp clutter_cicp;
-
-                gly_cicp_to_clutter (cicp, &clutter_cicp);
-
+        if (picture->has_cicp) {
                 entry->color_state =
                         clutter_color_state_params_new_from_cicp (clutter_context,
-                                                                  &clutter_cicp,
+                                                                  &picture->cicp,
                                                                   &local_error);
                 if (local_error)
                         g_warning ("Failed to create color state from CICP data: %s", local_error->message);
@@ -337,96 +1091,788 @@ on_texture_loaded (GObject      *source_object,
                 entry->color_state = NULL;
         }
 
-        g_hash_table_insert (self->texture_cache, g_object_ref (data->file), entry);
+        add_texture_cache_entry (self,
+                                 texture_cache_key_new (data->key->file,
+                                                        data->key->width,
+                                                        data->key->height,
+                                                        data->key->style),
+                                 entry);
+
+        /* Set the texture on every background that asked for it while loading */
+        for (i = 0; i < data->waiters->len; i++) {
+                LoadTextureWaiter *waiter = g_ptr_array_index (data->waiters, i);
+
+                set_background_texture (self, waiter->background, entry, waiter->style);
+        }
+
+        if (data->preload)
+                on_slideshow_picture_uploaded (self, entry);
 
-        /* Set the texture on the background */
-        meta_background_set_texture (data->background, texture, data->style, entry->color_state);
+        evict_texture_cache_entries (self);
 }
 
-static void
-set_background_file_from_settings (KioskBackgrounds        *self,
-                                   MetaBackground          *background,
-                                   GDesktopBackgroundStyle  background_style)
+static gboolean
+on_idle_upload_picture (GTask *task)
 {
-        g_autofree char *uri = NULL;
-        g_autoptr (GFile) picture_file = NULL;
-        TextureCacheEntry *entry;
-        LoadTextureData *data;
-        GTask *task;
+        LoadTextureData *data = g_task_get_task_data (task);
+        KioskBackgrounds *self = data->backgrounds;
+        g_autoptr (LoadedPicture) picture = g_steal_pointer (&data->picture);
 
-        uri = g_settings_get_string (self->settings, KIOSK_BACKGROUNDS_PICTURE_URI_SETTING);
-        picture_file = g_file_new_for_commandline_arg (uri);
+        if (self->texture_cache == NULL)
+                return G_SOURCE_REMOVE;
 
-        /* Check cache first */
-        entry = g_hash_table_lookup (self->texture_cache, picture_file);
-        if (entry != NULL) {
-                meta_background_set_texture (background, entry->texture, background_style, entry->color_state);
+        g_debug ("KioskBackgrounds: Uploading preloaded background");
+        upload_picture (self, data, picture);
+
+        return G_SOURCE_REMOVE;
+}
+
+static void
+on_texture_loaded (GObject      *source_object,
+                   GAsyncResult *result,
+                   gpointer      user_data)
+{
+        GTask *task = G_TASK (result);
+        LoadTextureData *data = g_task_get_task_data (task);
+        KioskBackgrounds *self = data->backgrounds;
+        g_autoptr (GError) error = NULL;
+        g_autoptr (LoadedPicture) picture = NULL;
+
+        picture = g_task_propagate_pointer (task, &error);
+
+        if (self->texture_cache == NULL)
+                return;
+
+        if (picture == NULL) {
+                g_autofree char *uri = g_file_get_uri (data->key->file);
+
+                g_hash_table_remove (self->pending_loads, data->key);
+                g_warning ("Failed to load background '%s': %s", uri, error->message);
+
+                fail_picture_load (self, data);
                 return;
         }
 
-        /* Load asynchronously */
+        /* Nothing is waiting for a preloaded picture yet, so keep its
+         * upload from competing with painting frames
+         */
+        if (data->preload && data->waiters->len == 0) {
+                GSource *source;
+
+                data->picture = g_steal_pointer (&picture);
+
+                source = g_idle_source_new ();
+                g_source_set_priority (source, G_PRIORITY_LOW);
+                g_source_set_callback (source,
+                                       (GSourceFunc) on_idle_upload_picture,
+                                       g_object_ref (task),
+                                       g_object_unref);
+                g_source_set_name (source, "[kiosk-backgrounds] on_idle_upload_picture");
+                g_source_attach (source, NULL);
+                g_source_unref (source);
+                return;
+        }
+
+        upload_picture (self, data, picture);
+}
+
+/* The largest size, in pixels, the picture is shown at with the given
+ * style, pictures are decoded no bigger than needed for it
+ */
+static void
+get_picture_target_size (KioskBackgrounds        *self,
+                         GDesktopBackgroundStyle  background_style,
+                         int                     *target_width,
+                         int                     *target_height)
+{
+        int i, number_of_monitors;
+
+        *target_width = 0;
+        *target_height = 0;
+
+        if (background_style == G_DESKTOP_BACKGROUND_STYLE_WALLPAPER)
+                return;
+
+        if (background_style == G_DESKTOP_BACKGROUND_STYLE_SPANNED) {
+                meta_display_get_size (self->display, target_width, target_height);
+                return;
+        }
+
+        number_of_monitors = meta_display_get_n_monitors (self->display);
+        for (i = 0; i < number_of_monitors; i++) {
+                MtkRectangle geometry;
+                float scale;
+
+                meta_display_get_monitor_geometry (self->display, i, &geometry);
+                scale = meta_display_get_monitor_scale (self->display, i);
+
+                *target_width = MAX (*target_width, (int) ceilf (geometry.width * scale));
+                *target_height = MAX (*target_height, (int) ceilf (geometry.height * scale));
+        }
+}
+
+static LoadTextureData *
+load_texture (KioskBackgrounds *self,
+              TextureCacheKey  *key,
+              gboolean          preload)
+{
+        LoadTextureData *data;
+        GTask *task;
+
         data = g_new0 (LoadTextureData, 1);
         data->backgrounds = g_object_ref (self);
-        data->background = g_object_ref (background);
-        data->style = background_style;
-        data->file = g_object_ref (picture_file);
+        data->key = texture_cache_key_new (key->file, key->width, key->height, key->style);
+        data->waiters = g_ptr_array_new_with_free_func ((GDestroyNotify) load_texture_waiter_free);
+        data->preload = preload;
+
+        if (self->use_disk_cache) {
+                data->disk_cache_directory = g_build_filename (g_get_user_cache_dir (),
+                                                               "gnome-kiosk",
+                                                               "backgrounds",
+                                                               NULL);
+                data->save_to_disk_cache = !preload;
+        }
+
+        g_hash_table_insert (self->pending_loads, data->key, data);
 
         task = g_task_new (self, self->cancellable, on_texture_loaded, NULL);
         g_task_set_task_data (task, data, (GDestroyNotify) load_texture_data_free);
         g_task_run_in_thread (task, load_texture_thread);
         g_object_unref (task);
+
+        return data;
+}
+
+static GFile *
+get_picture_file (KioskBackgrounds *self)
+{
+        g_autofree char *uri = NULL;
+
+        if (self->slideshow_files != NULL)
+                return g_object_ref (g_ptr_array_index (self->slideshow_files, self->slideshow_index));
+
+        uri = g_settings_get_string (self->settings, KIOSK_BACKGROUNDS_PICTURE_URI_SETTING);
+        return g_file_new_for_commandline_arg (uri);
 }
 
 static void
-create_background_for_monitor (KioskBackgrounds *self,
-                               int               monitor_index)
+set_background_file_from_settings (KioskBackgrounds        *self,
+                                   MetaBackground          *background,
+                                   GDesktopBackgroundStyle  background_style)
 {
-        g_autoptr (MetaBackground) background = NULL;
-        GDesktopBackgroundStyle background_style;
-        MtkRectangle geometry;
-        ClutterActor *background_actor = NULL;
-        MetaBackgroundContent *background_content;
+        g_autoptr (GFile) picture_file = NULL;
+        TextureCacheKey key = { 0 };
+        TextureCacheEntry *entry;
+        LoadTextureData *data;
 
-        g_debug ("KioskBackgrounds: Creating background for monitor %d", monitor_index);
+        picture_file = get_picture_file (self);
+
+        key.file = picture_file;
+        key.style = background_style;
+        get_picture_target_size (self, background_style, &key.width, &key.height);
+
+        /* Check cache first */
+        entry = look_up_texture_cache_entry (self, &key);
+        if (entry != NULL) {
+                set_background_texture (self, background, entry, background_style);
+                return;
+        }
+
+        /* Join a load of the same file that is already in progress, so
+         * monitors sharing a picture only decode and upload it once
+         */
+        data = g_hash_table_lookup (self->pending_loads, &key);
+        if (data != NULL) {
+                g_debug ("KioskBackgrounds: Waiting for pending load of background");
+                load_texture_data_add_waiter (data, background, background_style);
+                return;
+        }
+
+        /* Load asynchronously */
+        data = load_texture (self, &key, FALSE);
+        load_texture_data_add_waiter (data, background, background_style);
+}
+
+static MetaBackground *
+create_background (KioskBackgrounds *self)
+{
+        MetaBackground *background;
+        GDesktopBackgroundStyle background_style;
 
         background = meta_background_new (self->display);
         background_style = g_settings_get_enum (self->settings, KIOSK_BACKGROUNDS_PICTURE_OPTIONS_SETTING);
 
-        if (background_style == G_DESKTOP_BACKGROUND_STYLE_NONE) {
+        if (background_style == G_DESKTOP_BACKGROUND_STYLE_NONE || self->textures_released) {
                 set_background_color_from_settings (self, background);
         } else {
                 set_background_file_from_settings (self, background, background_style);
         }
 
-        background_actor = meta_background_actor_new (self->display, monitor_index);
+        return background;
+}
+
+static void
+update_background_actor_geometry (KioskBackgrounds *self,
+                                  ClutterActor     *background_actor,
+                                  int               monitor_index)
+{
+        MtkRectangle geometry;
 
         meta_display_get_monitor_geometry (self->display, monitor_index, &geometry);
 
         clutter_actor_set_position (background_actor, geometry.x, geometry.y);
         clutter_actor_set_size (background_actor, geometry.width, geometry.height);
+}
+
+static ClutterActor *
+create_background_actor_for_monitor (KioskBackgrounds *self,
+                                     int               monitor_index)
+{
+        ClutterActor *background_actor = NULL;
+        MetaBackgroundContent *background_content;
+
+        g_debug ("KioskBackgrounds: Creating background for monitor %d", monitor_index);
+
+        background_actor = meta_background_actor_new (self->display, monitor_index);
+        update_background_actor_geometry (self, background_actor, monitor_index);
 
         background_content = META_BACKGROUND_CONTENT (clutter_actor_get_content (background_actor));
-        meta_background_content_set_background (background_content, background);
+        meta_background_content_set_background (background_content, self->background);
 
         clutter_actor_add_child (self->background_group, background_actor);
-        clutter_actor_show (background_actor);
+        clutter_actor_set_visible (background_actor,
+                                   !meta_display_get_monitor_in_fullscreen (self->display, monitor_index));
+
+        g_ptr_array_add (self->background_actors, g_object_ref (background_actor));
+
+        return background_actor;
+}
+
+static void
+destroy_background_actor (ClutterActor *background_actor)
+{
+        clutter_actor_destroy (background_actor);
+        g_object_unref (background_actor);
+}
+
+static void reinitialize_backgrounds (KioskBackgrounds *self);
+
+/* Backgrounds of monitors covered by a fullscreen window are hidden, so
+ * they cost nothing to paint and don't stand in the way of scanning out
+ * the window directly
+ */
+static void
+update_background_actors_visibility (KioskBackgrounds *self)
+{
+        gboolean all_backgrounds_occluded = TRUE;
+        guint i;
+
+        for (i = 0; i < self->background_actors->len; i++) {
+                ClutterActor *background_actor = g_ptr_array_index (self->background_actors, i);
+                gboolean occluded;
+
+                /* The display still counts a fullscreen window that is
+                 * going away until the fullscreen state gets updated
+                 */
+                occluded = !self->fullscreen_window_unmanaging &&
+                           meta_display_get_monitor_in_fullscreen (self->display, i);
+                if (!occluded)
+                        all_backgrounds_occluded = FALSE;
+
+                if (clutter_actor_is_visible (background_actor) == !occluded)
+                        continue;
+
+                g_debug ("KioskBackgrounds: %s background of monitor %u",
+                         occluded ? "Hiding" : "Showing", i);
+                clutter_actor_set_visible (background_actor, !occluded);
+        }
+
+        self->all_backgrounds_occluded = all_backgrounds_occluded;
+
+        /* With nothing of the picture visible anywhere, its textures can
+         * go, the color stays as fallback for when a window goes away
+         * before the picture is loaded again
+         */
+        if (self->release_occluded_textures && all_backgrounds_occluded && !self->textures_released) {
+                g_debug ("KioskBackgrounds: Releasing textures of occluded backgrounds");
+                self->textures_released = TRUE;
+                reinitialize_backgrounds (self);
+                trim_texture_cache (self, 0);
+        } else if (self->textures_released && !all_backgrounds_occluded) {
+                g_debug ("KioskBackgrounds: Reloading textures of backgrounds");
+                self->textures_released = FALSE;
+                reinitialize_backgrounds (self);
+        }
 }
 
+static void
+on_in_fullscreen_changed (KioskBackgrounds *self)
+{
+        self->fullscreen_window_unmanaging = FALSE;
+        update_background_actors_visibility (self);
+}
+
+static void
+on_window_unmanaging (KioskBackgrounds *self,
+                      MetaWindow       *window)
+{
+        if (!meta_window_is_fullscreen (window) && !meta_window_is_monitor_sized (window))
+                return;
+
+        /* Don't wait for the fullscreen state to be updated, the
+         * backgrounds have to be there before the window is gone
+         */
+        self->fullscreen_window_unmanaging = TRUE;
+        update_background_actors_visibility (self);
+
+        /* The fullscreen state doesn't change when another fullscreen
+         * window is left on the monitor, so don't count on it to end
+         * this
+         */
+        kiosk_gobject_utils_queue_defer_callback (G_OBJECT (self),
+                                                  "[kiosk-backgrounds] on_fullscreen_window_unmanaged",
+                                                  self->cancellable,
+                                                  KIOSK_OBJECT_CALLBACK (on_in_fullscreen_changed),
+                                                  NULL);
+}
+
+static void
+on_window_created (KioskBackgrounds *self,
+                   MetaWindow       *window)
+{
+        g_signal_connect_object (G_OBJECT (window),
+                                 "unmanaging",
+                                 G_CALLBACK (on_window_unmanaging),
+                                 self,
+                                 G_CONNECT_SWAPPED);
+}
+
+/* Brings the background actors in line with the monitors: actors of
+ * monitors that are still around get moved, only added or removed
+ * monitors get their actor created or destroyed
+ */
+static void
+reconcile_background_actors (KioskBackgrounds *self)
+{
+        int i, number_of_monitors, number_of_actors;
+
+        number_of_monitors = meta_display_get_n_monitors (self->display);
+        number_of_actors = self->background_actors->len;
+
+        for (i = 0; i < MIN (number_of_monitors, number_of_actors); i++)
+                update_background_actor_geometry (self, g_ptr_array_index (self->background_actors, i), i);
+
+        if (number_of_actors > number_of_monitors) {
+                g_debug ("KioskBackgrounds: Removing backgrounds of %d monitors", number_of_actors - number_of_monitors);
+                g_ptr_array_remove_range (self->background_actors, number_of_monitors, number_of_actors - number_of_monitors);
+        }
+
+        for (i = number_of_actors; i < number_of_monitors; i++)
+                create_background_actor_for_monitor (self, i);
+
+        update_background_actors_visibility (self);
+}
+
+static void preload_next_slideshow_picture (KioskBackgrounds *self);
+
 static void
 reinitialize_backgrounds (KioskBackgrounds *self)
 {
-        int i, number_of_monitors;
+        guint i;
+
+        /* Backgrounds get created once it is known whether the picture
+         * is a slideshow
+         */
+        if (self->slideshow_cancellable != NULL)
+                return;
 
         g_debug ("KioskBackgrounds: Recreating backgrounds");
 
-        clutter_actor_destroy_all_children (self->background_group);
+        /* All monitors show the same picture, so they share one background */
+        g_clear_object (&self->background);
+        self->background = create_background (self);
+
+        for (i = 0; i < self->background_actors->len; i++) {
+                ClutterActor *background_actor = g_ptr_array_index (self->background_actors, i);
+                MetaBackgroundContent *background_content;
+
+                background_content = META_BACKGROUND_CONTENT (clutter_actor_get_content (background_actor));
+                meta_background_content_set_background (background_content, self->background);
+        }
+
+        reconcile_background_actors (self);
+
+        preload_next_slideshow_picture (self);
+
+        g_debug ("KioskBackgrounds: Finished recreating backgrounds");
+}
+
+static void
+on_monitors_changed (KioskBackgrounds *self)
+{
+        GDesktopBackgroundStyle background_style;
+
+        if (self->slideshow_cancellable != NULL || self->background == NULL)
+                return;
+
+        g_debug ("KioskBackgrounds: Updating backgrounds for new monitor layout");
+
+        /* The picture may be needed at a different size now, the
+         * background keeps showing the old one until that is loaded.
+         * Released textures get loaded at the right size once a
+         * background is visible again.
+         */
+        background_style = g_settings_get_enum (self->settings, KIOSK_BACKGROUNDS_PICTURE_OPTIONS_SETTING);
+        if (background_style != G_DESKTOP_BACKGROUND_STYLE_NONE && !self->textures_released)
+                set_background_file_from_settings (self, self->background, background_style);
+
+        reconcile_background_actors (self);
+
+        preload_next_slideshow_picture (self);
+}
+
+static void
+on_cross_fade_completed (ClutterTransition *transition,
+                         GPtrArray         *old_background_actors)
+{
+        g_debug ("KioskBackgrounds: Cross-fade complete");
+
+        g_ptr_array_set_size (old_background_actors, 0);
+}
+
+static void
+show_next_slideshow_picture (KioskBackgrounds *self)
+{
+        g_autoptr (GPtrArray) old_background_actors = NULL;
+        ClutterTransition *cross_fade_transition = NULL;
+        int i, number_of_monitors;
+
+        self->slideshow_index = (self->slideshow_index + 1) % self->slideshow_files->len;
+        self->slideshow_switch_pending = FALSE;
+
+        g_debug ("KioskBackgrounds: Showing slideshow picture %u", self->slideshow_index);
+
+        old_background_actors = g_steal_pointer (&self->background_actors);
+        self->background_actors = g_ptr_array_new_with_free_func ((GDestroyNotify) destroy_background_actor);
+
+        g_clear_object (&self->background);
+        self->background = create_background (self);
 
+        /* The new backgrounds go on top of the old ones and fade in,
+         * the old ones go away once they are fully covered
+         */
         number_of_monitors = meta_display_get_n_monitors (self->display);
         for (i = 0; i < number_of_monitors; i++) {
-                create_background_for_monitor (self, i);
+                ClutterActor *background_actor = create_background_actor_for_monitor (self, i);
+
+                if (!kiosk_compositor_are_animations_enabled (self->compositor))
+                        continue;
+
+                clutter_actor_set_opacity (background_actor, 0);
+                clutter_actor_save_easing_state (background_actor);
+                clutter_actor_set_easing_duration (background_actor, KIOSK_BACKGROUNDS_CROSS_FADE_DURATION);
+                clutter_actor_set_easing_mode (background_actor, CLUTTER_EASE_IN_OUT_QUAD);
+                clutter_actor_set_opacity (background_actor, 255);
+                cross_fade_transition = clutter_actor_get_transition (background_actor, "opacity");
+                clutter_actor_restore_easing_state (background_actor);
         }
 
-        g_debug ("KioskBackgrounds: Finished recreating backgrounds");
+        /* The new backgrounds pin the picture from here on */
+        g_clear_pointer (&self->slideshow_next_pin, texture_pin_free);
+
+        if (cross_fade_transition != NULL) {
+                g_signal_connect_data (cross_fade_transition,
+                                       "completed",
+                                       G_CALLBACK (on_cross_fade_completed),
+                                       g_steal_pointer (&old_background_actors),
+                                       (GClosureNotify) g_ptr_array_unref,
+                                       0);
+        } else {
+                on_cross_fade_completed (NULL, old_background_actors);
+        }
+
+        preload_next_slideshow_picture (self);
+}
+
+static void
+on_slideshow_picture_uploaded (KioskBackgrounds  *self,
+                               TextureCacheEntry *entry)
+{
+        TextureCacheKey key = { 0 };
+        guint next_index;
+
+        if (self->slideshow_files == NULL)
+                return;
+
+        next_index = (self->slideshow_index + 1) % self->slideshow_files->len;
+        key.file = g_ptr_array_index (self->slideshow_files, next_index);
+        key.style = g_settings_get_enum (self->settings, KIOSK_BACKGROUNDS_PICTURE_OPTIONS_SETTING);
+        get_picture_target_size (self, key.style, &key.width, &key.height);
+
+        if (!texture_cache_key_equal (&key, entry->key))
+                return;
+
+        g_clear_pointer (&self->slideshow_next_pin, texture_pin_free);
+        self->slideshow_next_pin = texture_pin_new (self, entry);
+
+        if (self->slideshow_switch_pending)
+                show_next_slideshow_picture (self);
+}
+
+static void
+on_slideshow_picture_failed (KioskBackgrounds *self,
+                             TextureCacheKey  *key)
+{
+        guint next_index;
+
+        if (self->slideshow_files == NULL || self->slideshow_files->len < 2)
+                return;
+
+        next_index = (self->slideshow_index + 1) % self->slideshow_files->len;
+        if (!g_file_equal (key->file, g_ptr_array_index (self->slideshow_files, next_index)))
+                return;
+
+        /* Leave out pictures that can't be shown, rather than waiting
+         * for them forever
+         */
+        g_ptr_array_remove_index (self->slideshow_files, next_index);
+        if (next_index < self->slideshow_index)
+                self->slideshow_index--;
+
+        if (self->slideshow_files->len < 2) {
+                g_clear_handle_id (&self->slideshow_timeout_id, g_source_remove);
+                self->slideshow_switch_pending = FALSE;
+                return;
+        }
+
+        preload_next_slideshow_picture (self);
+}
+
+static void
+preload_next_slideshow_picture (KioskBackgrounds *self)
+{
+        TextureCacheKey key = { 0 };
+        TextureCacheEntry *entry;
+        LoadTextureData *data;
+        guint next_index;
+
+        g_clear_pointer (&self->slideshow_next_pin, texture_pin_free);
+
+        if (self->slideshow_files == NULL || self->slideshow_files->len < 2)
+                return;
+
+        /* Nothing is shown while the textures are released, the picture
+         * gets preloaded once they are back
+         */
+        if (self->textures_released)
+                return;
+
+        key.style = g_settings_get_enum (self->settings, KIOSK_BACKGROUNDS_PICTURE_OPTIONS_SETTING);
+        if (key.style == G_DESKTOP_BACKGROUND_STYLE_NONE)
+                return;
+
+        next_index = (self->slideshow_index + 1) % self->slideshow_files->len;
+        key.file = g_ptr_array_index (self->slideshow_files, next_index);
+        get_picture_target_size (self, key.style, &key.width, &key.height);
+
+        entry = g_hash_table_lookup (self->texture_cache, &key);
+        if (entry != NULL) {
+                self->slideshow_next_pin = texture_pin_new (self, entry);
+                return;
+        }
+
+        g_debug ("KioskBackgrounds: Preloading slideshow picture %u", next_index);
+
+        data = g_hash_table_lookup (self->pending_loads, &key);
+        if (data == NULL)
+                data = load_texture (self, &key, TRUE);
+
+        data->preload = TRUE;
+}
+
+static gboolean
+on_slideshow_timeout (KioskBackgrounds *self)
+{
+        GDesktopBackgroundStyle background_style;
+
+        background_style = g_settings_get_enum (self->settings, KIOSK_BACKGROUNDS_PICTURE_OPTIONS_SETTING);
+        if (background_style == G_DESKTOP_BACKGROUND_STYLE_NONE)
+                return G_SOURCE_CONTINUE;
+
+        /* Nobody would see the switch */
+        if (self->all_backgrounds_occluded)
+                return G_SOURCE_CONTINUE;
+
+        /* Switching before the next picture is ready would fade to an
+         * empty background, so wait for it instead
+         */
+        if (self->slideshow_next_pin == NULL) {
+                g_debug ("KioskBackgrounds: Next slideshow picture is not ready yet, waiting for it");
+                self->slideshow_switch_pending = TRUE;
+                return G_SOURCE_CONTINUE;
+        }
+
+        show_next_slideshow_picture (self);
+
+        return G_SOURCE_CONTINUE;
+}
+
+static void
+start_slideshow_timeout (KioskBackgrounds *self)
+{
+        g_clear_handle_id (&self->slideshow_timeout_id, g_source_remove);
+
+        if (self->slideshow_files == NULL || self->slideshow_files->len < 2)
+                return;
+
+        self->slideshow_timeout_id = g_timeout_add_seconds (self->slideshow_interval,
+                                                            (GSourceFunc) on_slideshow_timeout,
+                                                            self);
+        g_source_set_name_by_id (self->slideshow_timeout_id,
+                                 "[kiosk-backgrounds] on_slideshow_timeout");
+}
+
+static void
+stop_slideshow (KioskBackgrounds *self)
+{
+        if (self->slideshow_cancellable != NULL) {
+                g_cancellable_cancel (self->slideshow_cancellable);
+                g_clear_object (&self->slideshow_cancellable);
+        }
+
+        g_clear_handle_id (&self->slideshow_timeout_id, g_source_remove);
+        g_clear_pointer (&self->slideshow_next_pin, texture_pin_free);
+        g_clear_pointer (&self->slideshow_files, g_ptr_array_unref);
+        self->slideshow_index = 0;
+        self->slideshow_switch_pending = FALSE;
+}
+
+static int
+compare_files_by_name (GFile **file_a,
+                       GFile **file_b)
+{
+        g_autofree char *name_a = g_file_get_basename (*file_a);
+        g_autofree char *name_b = g_file_get_basename (*file_b);
+
+        return g_strcmp0 (name_a, name_b);
+}
+
+static void
+list_slideshow_files_thread (GTask        *task,
+                             gpointer      source_object,
+                             gpointer      task_data,
+                             GCancellable *cancellable)
+{
+        GFile *directory = task_data;
+        g_autoptr (GFileEnumerator) enumerator = NULL;
+        g_autoptr (GPtrArray) files = NULL;
+        GError *error = NULL;
+
+        if (g_file_query_file_type (directory, G_FILE_QUERY_INFO_NONE, cancellable) != G_FILE_TYPE_DIRECTORY) {
+                g_task_return_pointer (task, NULL, NULL);
+                return;
+        }
+
+        enumerator = g_file_enumerate_children (directory,
+                                                G_FILE_ATTRIBUTE_STANDARD_NAME ","
+                                                G_FILE_ATTRIBUTE_STANDARD_TYPE ","
+                                                G_FILE_ATTRIBUTE_STANDARD_FAST_CONTENT_TYPE,
+                                                G_FILE_QUERY_INFO_NONE,
+                                                cancellable,
+                                                &error);
+        if (enumerator == NULL) {
+                g_task_return_error (task, error);
+                return;
+        }
+
+        files = g_ptr_array_new_with_free_func (g_object_unref);
+
+        while (TRUE) {
+                GFileInfo *info;
+                GFile *file;
+                const char *content_type;
+                g_autofree char *mime_type = NULL;
+
+                if (!g_file_enumerator_iterate (enumerator, &info, &file, cancellable, &error)) {
+                        g_task_return_error (task, error);
+                        return;
+                }
+
+                if (info == NULL)
+                        break;
+
+                if (g_file_info_get_file_type (info) != G_FILE_TYPE_REGULAR)
+                        continue;
+
+                content_type = g_file_info_get_attribute_string (info, G_FILE_ATTRIBUTE_STANDARD_FAST_CONTENT_TYPE);
+                if (content_type == NULL)
+                        continue;
+
+                mime_type = g_content_type_get_mime_type (content_type);
+                if (mime_type == NULL || !g_str_has_prefix (mime_type, "image/"))
+                        continue;
+
+                g_ptr_array_add (files, g_object_ref (file));
+        }
+
+        g_ptr_array_sort (files, (GCompareFunc) compare_files_by_name);
+
+        g_task_return_pointer (task, g_steal_pointer (&files), (GDestroyNotify) g_ptr_array_unref);
+}
+
+static void
+on_slideshow_files_listed (GObject      *source_object,
+                           GAsyncResult *result,
+                           gpointer      user_data)
+{
+        KioskBackgrounds *self = KIOSK_BACKGROUNDS (source_object);
+        GFile *directory = g_task_get_task_data (G_TASK (result));
+        g_autoptr (GPtrArray) files = NULL;
+        g_autoptr (GError) error = NULL;
+
+        files = g_task_propagate_pointer (G_TASK (result), &error);
+
+        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                return;
+
+        g_clear_object (&self->slideshow_cancellable);
+
+        if (error != NULL) {
+                g_autofree char *uri = g_file_get_uri (directory);
+                g_warning ("Failed to list slideshow pictures in '%s': %s", uri, error->message);
+        } else if (files != NULL && files->len == 0) {
+                g_autofree char *uri = g_file_get_uri (directory);
+                g_warning ("No slideshow pictures found in '%s'", uri);
+                g_clear_pointer (&files, g_ptr_array_unref);
+        }
+
+        if (files != NULL) {
+                g_debug ("KioskBackgrounds: Starting slideshow of %u pictures", files->len);
+                self->slideshow_files = g_steal_pointer (&files);
+                start_slideshow_timeout (self);
+        }
+
+        reinitialize_backgrounds (self);
+}
+
+static void
+reload_picture (KioskBackgrounds *self)
+{
+        g_autofree char *uri = NULL;
+        g_autoptr (GTask) task = NULL;
+
+        stop_slideshow (self);
+
+        self->slideshow_cancellable = g_cancellable_new ();
+
+        /* A directory as picture-uri shows the pictures in it as
+         * slideshow, find out whether that is the case first
+         */
+        uri = g_settings_get_string (self->settings, KIOSK_BACKGROUNDS_PICTURE_URI_SETTING);
+
+        task = g_task_new (self, self->slideshow_cancellable, on_slideshow_files_listed, NULL);
+        g_task_set_task_data (task, g_file_new_for_commandline_arg (uri), g_object_unref);
+        g_task_run_in_thread (task, list_slideshow_files_thread);
 }
 
 static void
@@ -442,6 +1888,22 @@ kiosk_backgrounds_set_property (GObject      *object,
                 g_set_weak_pointer (&self->compositor, g_value_get_object (value));
                 break;
 
+        case PROP_TEXTURE_CACHE_BUDGET:
+                kiosk_backgrounds_set_texture_cache_budget (self, g_value_get_uint64 (value));
+                break;
+
+        case PROP_SLIDESHOW_INTERVAL:
+                kiosk_backgrounds_set_slideshow_interval (self, g_value_get_uint (value));
+                break;
+
+        case PROP_USE_DISK_CACHE:
+                self->use_disk_cache = g_value_get_boolean (value);
+                break;
+
+        case PROP_RELEASE_OCCLUDED_TEXTURES:
+                self->release_occluded_textures = g_value_get_boolean (value);
+                break;
+
         default:
                 G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, param_spec);
                 break;
@@ -454,7 +1916,25 @@ kiosk_backgrounds_get_property (GObject    *object,
                                 GValue     *value,
                                 GParamSpec *param_spec)
 {
+        KioskBackgrounds *self = KIOSK_BACKGROUNDS (object);
+
         switch (property_id) {
+        case PROP_TEXTURE_CACHE_BUDGET:
+                g_value_set_uint64 (value, self->texture_cache_budget);
+                break;
+
+        case PROP_SLIDESHOW_INTERVAL:
+                g_value_set_uint (value, self->slideshow_interval);
+                break;
+
+        case PROP_USE_DISK_CACHE:
+                g_value_set_boolean (value, self->use_disk_cache);
+                break;
+
+        case PROP_RELEASE_OCCLUDED_TEXTURES:
+                g_value_set_boolean (value, self->release_occluded_textures);
+                break;
+
         default:
                 G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, param_spec);
                 break;
@@ -470,12 +1950,20 @@ kiosk_backgrounds_dispose (GObject *object)
                 g_clear_object (&self->cancellable);
         }
 
+        stop_slideshow (self);
+
+        g_clear_pointer (&self->background_actors, g_ptr_array_unref);
+        g_clear_object (&self->background);
         g_clear_object (&self->background_group);
         g_clear_object (&self->settings);
+        g_queue_init (&self->recently_used);
+        self->texture_cache_size = 0;
         g_clear_pointer (&self->texture_cache, g_hash_table_unref);
+        g_clear_pointer (&self->pending_loads, g_hash_table_unref);
 
         g_clear_weak_pointer (&self->context);
         g_clear_weak_pointer (&self->backend);
+        g_clear_weak_pointer (&self->dbus_service);
         g_clear_weak_pointer (&self->stage);
         g_clear_weak_pointer (&self->display);
         g_clear_weak_pointer (&self->window_group);
@@ -485,6 +1973,16 @@ kiosk_backgrounds_dispose (GObject *object)
         G_OBJECT_CLASS (kiosk_backgrounds_parent_class)->dispose (object);
 }
 
+static void
+on_picture_uri_changed (KioskBackgrounds *self)
+{
+        kiosk_gobject_utils_queue_defer_callback (G_OBJECT (self),
+                                                  "[kiosk-backgrounds] on_picture_uri_changed",
+                                                  self->cancellable,
+                                                  KIOSK_OBJECT_CALLBACK (reload_picture),
+                                                  NULL);
+}
+
 static void
 on_settings_changed (KioskBackgrounds *self)
 {
@@ -510,21 +2008,38 @@ kiosk_backgrounds_constructed (GObject *object)
         g_set_weak_pointer (&self->stage, CLUTTER_ACTOR (meta_compositor_get_stage (compositor)));
         g_set_weak_pointer (&self->window_group, meta_compositor_get_window_group (compositor));
         g_set_weak_pointer (&self->monitor_manager, meta_backend_get_monitor_manager (self->backend));
+        g_set_weak_pointer (&self->dbus_service,
+                            KIOSK_DBUS_BACKGROUNDS (kiosk_service_get_backgrounds_skeleton (kiosk_compositor_get_service (self->compositor))));
 
         self->cancellable = g_cancellable_new ();
 
         /* Initialize texture cache */
-        self->texture_cache = g_hash_table_new_full (g_file_hash,
-                                                     (GEqualFunc) g_file_equal,
-                                                     g_object_unref,
+        self->texture_cache = g_hash_table_new_full ((GHashFunc) texture_cache_key_hash,
+                                                     (GEqualFunc) texture_cache_key_equal,
+                                                     (GDestroyNotify) texture_cache_key_free,
                                                      (GDestroyNotify) texture_cache_entry_free);
+        self->pending_loads = g_hash_table_new ((GHashFunc) texture_cache_key_hash,
+                                                (GEqualFunc) texture_cache_key_equal);
+        publish_texture_cache_stats (self);
 
         self->background_group = meta_background_group_new ();
+        self->background_actors = g_ptr_array_new_with_free_func ((GDestroyNotify) destroy_background_actor);
         clutter_actor_insert_child_below (self->window_group, self->background_group, NULL);
 
         g_signal_connect_object (G_OBJECT (self->monitor_manager),
                                  "monitors-changed",
-                                 G_CALLBACK (reinitialize_backgrounds),
+                                 G_CALLBACK (on_monitors_changed),
+                                 self,
+                                 G_CONNECT_SWAPPED);
+
+        g_signal_connect_object (G_OBJECT (self->display),
+                                 "in-fullscreen-changed",
+                                 G_CALLBACK (on_in_fullscreen_changed),
+                                 self,
+                                 G_CONNECT_SWAPPED);
+        g_signal_connect_object (G_OBJECT (self->display),
+                                 "window-created",
+                                 G_CALLBACK (on_window_created),
                                  self,
                                  G_CONNECT_SWAPPED);
 
@@ -537,7 +2052,7 @@ kiosk_backgrounds_constructed (GObject *object)
                                  G_CONNECT_SWAPPED);
         g_signal_connect_object (G_OBJECT (self->settings),
                                  "changed::" KIOSK_BACKGROUNDS_PICTURE_URI_SETTING,
-                                 G_CALLBACK (on_settings_changed),
+                                 G_CALLBACK (on_picture_uri_changed),
                                  self,
                                  G_CONNECT_SWAPPED);
         g_signal_connect_object (G_OBJECT (self->settings),
@@ -557,13 +2072,18 @@ kiosk_backgrounds_constructed (GObject *object)
                                  self,
                                  G_CONNECT_SWAPPED);
 
-        reinitialize_backgrounds (self);
+        reload_picture (self);
 }
 
 static void
 kiosk_backgrounds_init (KioskBackgrounds *self)
 {
         g_debug ("KioskBackgrounds: Initializing");
+
+        g_queue_init (&self->recently_used);
+        self->texture_cache_budget = KIOSK_BACKGROUNDS_DEFAULT_TEXTURE_CACHE_BUDGET;
+        self->slideshow_interval = KIOSK_BACKGROUNDS_DEFAULT_SLIDESHOW_INTERVAL;
+        self->use_disk_cache = TRUE;
 }
 
 KioskBackgrounds *
@@ -573,7 +2093,109 @@ kiosk_backgrounds_new (KioskCompositor *compositor)
 
         object = g_object_new (KIOSK_TYPE_BACKGROUNDS,
                                "compositor", compositor,
+                               "release-occluded-textures", are_occluded_backgrounds_released (),
+                               "texture-cache-budget", get_background_cache_size (),
+                               "slideshow-interval", get_slideshow_interval (),
+                               "use-disk-cache", !is_background_disk_cache_disabled (),
                                NULL);
 
         return KIOSK_BACKGROUNDS (object);
 }
+
+/**
+ * kiosk_backgrounds_set_texture_cache_budget:
+ * @backgrounds: a #KioskBackgrounds
+ * @budget: the number of bytes decoded pictures may take up
+ *
+ * Sets how much memory the textures of previously shown pictures may
+ * keep using. The least recently used textures are dropped first, the
+ * textures currently on screen are kept even when they go over budget.
+ */
+void
+kiosk_backgrounds_set_texture_cache_budget (KioskBackgrounds *self,
+                                            guint64           budget)
+{
+        g_return_if_fail (KIOSK_IS_BACKGROUNDS (self));
+
+        if (self->texture_cache_budget == budget)
+                return;
+
+        self->texture_cache_budget = budget;
+
+        if (self->texture_cache != NULL)
+                evict_texture_cache_entries (self);
+
+        g_object_notify_by_pspec (G_OBJECT (self), kiosk_backgrounds_properties[PROP_TEXTURE_CACHE_BUDGET]);
+}
+
+/**
+ * kiosk_backgrounds_get_texture_cache_stats:
+ * @backgrounds: a #KioskBackgrounds
+ * @stats: (out caller-allocates): return location for the statistics
+ *
+ * Fills in how the texture cache is doing, for diagnostics. The same
+ * numbers are published on the org.gnome.Kiosk.Backgrounds D-Bus
+ * interface.
+ */
+void
+kiosk_backgrounds_get_texture_cache_stats (KioskBackgrounds                  *self,
+                                           KioskBackgroundsTextureCacheStats *stats)
+{
+        g_return_if_fail (KIOSK_IS_BACKGROUNDS (self));
+        g_return_if_fail (stats != NULL);
+
+        stats->number_of_entries = self->texture_cache != NULL ? g_hash_table_size (self->texture_cache) : 0;
+        stats->size = self->texture_cache_size;
+        stats->budget = self->texture_cache_budget;
+        stats->hits = self->texture_cache_hits;
+        stats->misses = self->texture_cache_misses;
+}
+
+/**
+ * kiosk_backgrounds_is_monitor_background_visible:
+ * @backgrounds: a #KioskBackgrounds
+ * @monitor: the index of a monitor
+ *
+ * Returns whether the background of @monitor gets painted, which is
+ * not the case while a fullscreen window covers it.
+ *
+ * Returns: %TRUE if the background of @monitor is visible
+ */
+gboolean
+kiosk_backgrounds_is_monitor_background_visible (KioskBackgrounds *self,
+                                                 int               monitor)
+{
+        g_return_val_if_fail (KIOSK_IS_BACKGROUNDS (self), FALSE);
+
+        if (self->background_actors == NULL ||
+            monitor < 0 || (guint) monitor >= self->background_actors->len)
+                return FALSE;
+
+        return clutter_actor_is_visible (g_ptr_array_index (self->background_actors, monitor));
+}
+
+/**
+ * kiosk_backgrounds_set_slideshow_interval:
+ * @backgrounds: a #KioskBackgrounds
+ * @interval: the number of seconds each picture is shown
+ *
+ * Sets how long each picture of a slideshow is shown before cross-fading
+ * to the next one. Slideshows are shown when picture-uri is a directory.
+ */
+void
+kiosk_backgrounds_set_slideshow_interval (KioskBackgrounds *self,
+                                          guint             interval)
+{
+        g_return_if_fail (KIOSK_IS_BACKGROUNDS (self));
+        g_return_if_fail (interval > 0);
+
+        if (self->slideshow_interval == interval)
+                return;
+
+        self->slideshow_interval = interval;
+
+        if (self->slideshow_timeout_id != 0)
+                start_slideshow_timeout (self);
+
+        g_object_notify_by_pspec (G_OBJECT (self), kiosk_backgrounds_properties[PROP_SLIDESHOW_INTERVAL]);
+}
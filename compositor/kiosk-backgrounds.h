@@ -14,6 +14,32 @@ G_DECLARE_FINAL_TYPE (KioskBackgrounds,
                       KIOSK, BACKGROUNDS,
                       MetaBackgroundGroup);
 
+/**
+ * KioskBackgroundsTextureCacheStats:
+ * @number_of_entries: the number of cached textures
+ * @size: the bytes taken up by the cached textures
+ * @budget: the bytes the cached textures may take up
+ * @hits: how often a picture was found in the cache
+ * @misses: how often a picture had to be loaded
+ */
+typedef struct
+{
+        guint   number_of_entries;
+        guint64 size;
+        guint64 budget;
+        guint64 hits;
+        guint64 misses;
+} KioskBackgroundsTextureCacheStats;
+
 KioskBackgrounds *kiosk_backgrounds_new (KioskCompositor *compositor);
 
+void kiosk_backgrounds_set_texture_cache_budget (KioskBackgrounds *backgrounds,
+                                                 guint64           budget);
+void kiosk_backgrounds_set_slideshow_interval (KioskBackgrounds *backgrounds,
+                                               guint             interval);
+void kiosk_backgrounds_get_texture_cache_stats (KioskBackgrounds                  *backgrounds,
+                                                KioskBackgroundsTextureCacheStats *stats);
+gboolean kiosk_backgrounds_is_monitor_background_visible (KioskBackgrounds *backgrounds,
+                                                          int               monitor);
+
 G_END_DECLS
@@ -20,6 +20,21 @@
 /* Dimming reduces brightness to this fraction of normal */
 #define DIMMING_BRIGHTNESS_FRACTION 0.3
 
+/* Writes go out at most this often, unless configured otherwise */
+#define DEFAULT_MAX_UPDATE_RATE 10.0
+
+/* How long it takes to ramp from no brightness to full brightness */
+#define RAMP_DURATION_MS 500.0
+
+typedef struct
+{
+        MetaBacklight *backlight;
+        char          *connector;
+        int            brightness_min;
+        int            brightness_max;
+        int            brightness;      /* last read or written */
+} KioskBacklight;
+
 struct _KioskBrightness
 {
         KioskShellBrightnessDBusServiceSkeleton parent;
@@ -31,18 +46,27 @@ struct _KioskBrightness
         MetaBackend                            *backend;
         MetaMonitorManager                     *monitor_manager;
 
+        /* strong references */
+        GPtrArray                              *backlights;     /* KioskBacklight */
+
         /* handles */
         guint                                   bus_id;
+        guint                                   update_timeout_id;
 
         /* state */
         gboolean                                dimming_enabled;
+        gboolean                                idle_dimming_enabled;
         double                                  auto_brightness_target;
+        double                                  current_brightness;
+        double                                  max_update_rate;
         gboolean                                has_backlight;
+        gboolean                                brightness_requested;
 };
 
 enum
 {
         PROP_COMPOSITOR = 1,
+        PROP_MAX_UPDATE_RATE,
         NUMBER_OF_PROPERTIES
 };
 
@@ -69,6 +93,10 @@ kiosk_brightness_set_property (GObject      *object,
                 g_set_weak_pointer (&self->compositor, g_value_get_object (value));
                 break;
 
+        case PROP_MAX_UPDATE_RATE:
+                self->max_update_rate = g_value_get_double (value);
+                break;
+
         default:
                 G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, param_spec);
                 break;
@@ -81,7 +109,13 @@ kiosk_brightness_get_property (GObject    *object,
                                GValue     *value,
                                GParamSpec *param_spec)
 {
+        KioskBrightness *self = KIOSK_BRIGHTNESS (object);
+
         switch (property_id) {
+        case PROP_MAX_UPDATE_RATE:
+                g_value_set_double (value, self->max_update_rate);
+                break;
+
         default:
                 G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, param_spec);
                 break;
@@ -89,12 +123,21 @@ kiosk_brightness_get_property (GObject    *object,
 }
 
 static void
-kiosk_brightness_update_has_brightness_control (KioskBrightness *self)
+kiosk_backlight_free (KioskBacklight *backlight)
+{
+        g_clear_object (&backlight->backlight);
+        g_free (backlight->connector);
+        g_free (backlight);
+}
+
+static void
+kiosk_brightness_update_backlights (KioskBrightness *self)
 {
         GList *monitors;
         GList *l;
+        double brightness_sum = 0.0;
 
-        self->has_backlight = FALSE;
+        g_ptr_array_set_size (self->backlights, 0);
 
         if (self->monitor_manager == NULL)
                 goto out;
@@ -103,17 +146,48 @@ kiosk_brightness_update_has_brightness_control (KioskBrightness *self)
 
         for (l = monitors; l != NULL; l = l->next) {
                 MetaMonitor *monitor = META_MONITOR (l->data);
+                MetaBacklight *meta_backlight;
+                KioskBacklight *backlight;
 
                 if (!meta_monitor_is_active (monitor))
                         continue;
 
-                if (meta_monitor_get_backlight (monitor) != NULL) {
-                        self->has_backlight = TRUE;
-                        break;
-                }
+                meta_backlight = meta_monitor_get_backlight (monitor);
+                if (meta_backlight == NULL)
+                        continue;
+
+                backlight = g_new0 (KioskBacklight, 1);
+                backlight->backlight = g_object_ref (meta_backlight);
+                backlight->connector = g_strdup (meta_monitor_get_connector (monitor));
+                meta_backlight_get_brightness_info (meta_backlight,
+                                                    &backlight->brightness_min,
+                                                    &backlight->brightness_max);
+
+                backlight->brightness = meta_backlight_get_brightness (meta_backlight);
+
+                if (backlight->brightness_max > backlight->brightness_min)
+                        brightness_sum += (double) (backlight->brightness - backlight->brightness_min) /
+                                          (backlight->brightness_max - backlight->brightness_min);
+                else
+                        brightness_sum += 1.0;
+
+                g_ptr_array_add (self->backlights, backlight);
         }
 
 out:
+        self->has_backlight = self->backlights->len > 0;
+
+        /* Until a brightness gets asked for, ramps start from whatever
+         * level the backlights are at, afterwards from the level last
+         * written
+         */
+        if (self->has_backlight && !self->brightness_requested) {
+                self->current_brightness = CLAMP (brightness_sum / self->backlights->len, 0.0, 1.0);
+
+                g_debug ("KioskBrightness: Backlights are at brightness %f",
+                         self->current_brightness);
+        }
+
         g_debug ("KioskBrightness: HasBrightnessControl = %s",
                  self->has_backlight ? "TRUE" : "FALSE");
 
@@ -121,67 +195,146 @@ out:
                 KIOSK_SHELL_BRIGHTNESS_DBUS_SERVICE (self), self->has_backlight);
 }
 
-static void
-kiosk_brightness_apply_brightness (KioskBrightness *self)
+static double
+kiosk_brightness_get_effective_target (KioskBrightness *self)
 {
-        GList *monitors;
-        GList *l;
         double effective_target;
 
-        if (!self->has_backlight)
-                return;
-
-        if (self->monitor_manager == NULL)
-                return;
-
-        /* Calculate effective brightness based on auto_brightness_target and dimming */
         effective_target = self->auto_brightness_target;
 
-        if (self->dimming_enabled)
+        if (self->dimming_enabled || self->idle_dimming_enabled)
                 effective_target *= DIMMING_BRIGHTNESS_FRACTION;
 
-        monitors = meta_monitor_manager_get_monitors (self->monitor_manager);
-
-        for (l = monitors; l != NULL; l = l->next) {
-                MetaMonitor *monitor = META_MONITOR (l->data);
-                MetaBacklight *backlight;
-                int brightness_min, brightness_max;
-                int target_brightness;
+        return effective_target;
+}
 
-                if (!meta_monitor_is_active (monitor))
-                        continue;
+static void
+kiosk_brightness_write_backlights (KioskBrightness *self)
+{
+        guint i;
 
-                backlight = meta_monitor_get_backlight (monitor);
-                if (backlight == NULL)
-                        continue;
+        if (self->backlights == NULL)
+                return;
 
-                meta_backlight_get_brightness_info (backlight,
-                                                    &brightness_min,
-                                                    &brightness_max);
+        for (i = 0; i < self->backlights->len; i++) {
+                KioskBacklight *backlight = g_ptr_array_index (self->backlights, i);
+                int target_brightness;
 
                 /* Map [0, 1] to [brightness_min, brightness_max] */
-                target_brightness = (int) (brightness_min +
-                                           effective_target * (brightness_max - brightness_min));
+                target_brightness = (int) round (backlight->brightness_min +
+                                                 self->current_brightness * (backlight->brightness_max - backlight->brightness_min));
 
                 /* Clamp to valid range */
-                target_brightness = CLAMP (target_brightness, brightness_min, brightness_max);
+                target_brightness = CLAMP (target_brightness, backlight->brightness_min, backlight->brightness_max);
 
-                g_debug ("KioskBrightness: Setting brightness to %d on %s (range: %d-%d, target: %f, dimming: %s)",
+                /* Most steps of a ramp don't change the level of backlights
+                 * with few levels, and writing is slow over DDC/CI
+                 */
+                if (target_brightness == backlight->brightness)
+                        continue;
+
+                g_debug ("KioskBrightness: Setting brightness to %d on %s (range: %d-%d, brightness: %f)",
                          target_brightness,
-                         meta_monitor_get_connector (monitor),
-                         brightness_min, brightness_max,
-                         effective_target, self->dimming_enabled ? "enabled" : "disabled");
+                         backlight->connector,
+                         backlight->brightness_min, backlight->brightness_max,
+                         self->current_brightness);
+
+                meta_backlight_set_brightness (backlight->backlight, target_brightness);
+                backlight->brightness = target_brightness;
+        }
+}
+
+static gboolean
+kiosk_brightness_step_brightness (KioskBrightness *self)
+{
+        double effective_target;
+        double step;
+
+        effective_target = kiosk_brightness_get_effective_target (self);
 
-                meta_backlight_set_brightness (backlight, target_brightness);
+        if (self->current_brightness == effective_target) {
+                /* Backlights that showed up since the last write still
+                 * need to be brought to the current brightness
+                 */
+                kiosk_brightness_write_backlights (self);
+                return FALSE;
         }
+
+        /* Ramps go across the whole range in RAMP_DURATION_MS, in steps
+         * of one update interval
+         */
+        step = (1000.0 / self->max_update_rate) / RAMP_DURATION_MS;
+
+        if (fabs (effective_target - self->current_brightness) <= step)
+                self->current_brightness = effective_target;
+        else if (effective_target > self->current_brightness)
+                self->current_brightness += step;
+        else
+                self->current_brightness -= step;
+
+        kiosk_brightness_write_backlights (self);
+
+        return TRUE;
+}
+
+static gboolean
+on_update_timeout (KioskBrightness *self)
+{
+        /* The timeout keeps running for one more interval once the
+         * target is reached, so updates coming in quick succession
+         * never get written faster than the maximum update rate
+         */
+        if (kiosk_brightness_step_brightness (self))
+                return G_SOURCE_CONTINUE;
+
+        self->update_timeout_id = 0;
+        return G_SOURCE_REMOVE;
+}
+
+static void
+kiosk_brightness_queue_update (KioskBrightness *self)
+{
+        self->brightness_requested = TRUE;
+
+        if (!self->has_backlight)
+                return;
+
+        /* Coalesced with the updates already queued */
+        if (self->update_timeout_id != 0)
+                return;
+
+        if (!kiosk_brightness_step_brightness (self))
+                return;
+
+        self->update_timeout_id = g_timeout_add (MAX (1, (guint) (1000.0 / self->max_update_rate)),
+                                                 (GSourceFunc) on_update_timeout,
+                                                 self);
+        g_source_set_name_by_id (self->update_timeout_id,
+                                 "[kiosk-brightness] on_update_timeout");
+}
+
+static void
+kiosk_brightness_update_now (KioskBrightness *self)
+{
+        g_clear_handle_id (&self->update_timeout_id, g_source_remove);
+
+        self->brightness_requested = TRUE;
+        self->current_brightness = kiosk_brightness_get_effective_target (self);
+        kiosk_brightness_write_backlights (self);
 }
 
 static void
 on_monitors_changed (MetaMonitorManager *monitor_manager,
                      KioskBrightness    *self)
 {
-        g_debug ("KioskBrightness: Monitors changed, updating brightness control status");
-        kiosk_brightness_update_has_brightness_control (self);
+        g_debug ("KioskBrightness: Monitors changed, updating backlights");
+        kiosk_brightness_update_backlights (self);
+
+        /* Leave the brightness of new backlights alone until someone
+         * asked for a brightness
+         */
+        if (self->brightness_requested)
+                kiosk_brightness_queue_update (self);
 }
 
 static void
@@ -207,7 +360,7 @@ kiosk_brightness_constructed (GObject *object)
                           self);
 
         /* Initialize HasBrightnessControl property */
-        kiosk_brightness_update_has_brightness_control (self);
+        kiosk_brightness_update_backlights (self);
 }
 
 static void
@@ -217,6 +370,9 @@ kiosk_brightness_dispose (GObject *object)
 
         kiosk_brightness_stop (self);
 
+        g_clear_handle_id (&self->update_timeout_id, g_source_remove);
+        g_clear_pointer (&self->backlights, g_ptr_array_unref);
+
         g_signal_handlers_disconnect_by_func (self->monitor_manager,
                                               on_monitors_changed,
                                               self);
@@ -242,7 +398,7 @@ kiosk_brightness_handle_set_dimming (KioskShellBrightnessDBusService *object,
 
         if (self->dimming_enabled != enable) {
                 self->dimming_enabled = enable;
-                kiosk_brightness_apply_brightness (self);
+                kiosk_brightness_queue_update (self);
         }
 
         kiosk_shell_brightness_dbus_service_complete_set_dimming (object, invocation);
@@ -269,7 +425,7 @@ kiosk_brightness_handle_set_auto_brightness_target (KioskShellBrightnessDBusServ
 
         if (!G_APPROX_VALUE (self->auto_brightness_target, target, FLT_EPSILON)) {
                 self->auto_brightness_target = target;
-                kiosk_brightness_apply_brightness (self);
+                kiosk_brightness_queue_update (self);
         }
 
         kiosk_shell_brightness_dbus_service_complete_set_auto_brightness_target (object, invocation);
@@ -302,6 +458,15 @@ kiosk_brightness_class_init (KioskBrightnessClass *brightness_class)
                                      G_PARAM_CONSTRUCT_ONLY
                                      | G_PARAM_WRITABLE
                                      | G_PARAM_STATIC_NAME);
+
+        kiosk_brightness_properties[PROP_MAX_UPDATE_RATE] =
+                g_param_spec_double ("max-update-rate",
+                                     NULL,
+                                     NULL,
+                                     1.0, 1000.0, DEFAULT_MAX_UPDATE_RATE,
+                                     G_PARAM_CONSTRUCT_ONLY
+                                     | G_PARAM_READWRITE
+                                     | G_PARAM_STATIC_NAME);
         g_object_class_install_properties (object_class,
                                            NUMBER_OF_PROPERTIES,
                                            kiosk_brightness_properties);
@@ -313,15 +478,19 @@ kiosk_brightness_init (KioskBrightness *self)
         g_debug ("KioskBrightness: Initializing");
 
         self->auto_brightness_target = 1.0;
+        self->current_brightness = 1.0;
+        self->backlights = g_ptr_array_new_with_free_func ((GDestroyNotify) kiosk_backlight_free);
 }
 
 KioskBrightness *
-kiosk_brightness_new (KioskCompositor *compositor)
+kiosk_brightness_new (KioskCompositor *compositor,
+                      double           max_update_rate)
 {
         GObject *object;
 
         object = g_object_new (KIOSK_TYPE_BRIGHTNESS,
                                "compositor", compositor,
+                               "max-update-rate", max_update_rate,
                                NULL);
 
         return KIOSK_BRIGHTNESS (object);
@@ -392,3 +561,35 @@ kiosk_brightness_stop (KioskBrightness *self)
         g_dbus_interface_skeleton_unexport (G_DBUS_INTERFACE_SKELETON (self));
         g_clear_handle_id (&self->bus_id, g_bus_unown_name);
 }
+
+/**
+ * kiosk_brightness_set_idle_dimming:
+ * @brightness: a #KioskBrightness
+ * @enable: whether to dim the screens
+ *
+ * Dims the screens while the session is idle. This is independent of
+ * dimming requested over D-Bus with SetDimming, the screens are dimmed
+ * while either asks for it.
+ *
+ * Dimming ramps down like other brightness changes, but undimming is
+ * written out right away, so the screens come back as soon as the user
+ * is.
+ */
+void
+kiosk_brightness_set_idle_dimming (KioskBrightness *self,
+                                   gboolean         enable)
+{
+        g_return_if_fail (KIOSK_IS_BRIGHTNESS (self));
+
+        if (self->idle_dimming_enabled == enable)
+                return;
+
+        g_debug ("KioskBrightness: %s idle dimming", enable ? "Enabling" : "Disabling");
+
+        self->idle_dimming_enabled = enable;
+
+        if (enable)
+                kiosk_brightness_queue_update (self);
+        else
+                kiosk_brightness_update_now (self);
+}
@@ -15,9 +15,12 @@ G_DECLARE_FINAL_TYPE (KioskBrightness,
                       KIOSK, BRIGHTNESS,
                       KioskShellBrightnessDBusServiceSkeleton);
 
-KioskBrightness *kiosk_brightness_new (KioskCompositor *compositor);
+KioskBrightness *kiosk_brightness_new (KioskCompositor *compositor,
+                                       double           max_update_rate);
 gboolean kiosk_brightness_start (KioskBrightness *service,
                                  GError         **error);
 void kiosk_brightness_stop (KioskBrightness *service);
+void kiosk_brightness_set_idle_dimming (KioskBrightness *service,
+                                        gboolean         enable);
 
 G_END_DECLS
@@ -0,0 +1,274 @@
+#include "config.h"
+#include "kiosk-buffer-pool.h"
+
+#include <sys/mman.h>
+
+/* Screen captures need buffers of a few megabytes, usually of the very
+ * same size over and over. Getting them from malloc each time fragments
+ * the heap of a long running session, so released buffers are kept
+ * around for the next capture instead. They are mapped directly, so
+ * once a buffer went unused for a while it is unmapped and the memory
+ * really goes back to the system.
+ */
+
+static cairo_user_data_key_t buffer_key;
+
+typedef struct
+{
+        KioskBufferPool *pool;
+        gpointer         data;
+        gsize            size;
+        gint64           release_time;
+} KioskBuffer;
+
+struct _KioskBufferPool
+{
+        GObject  parent;
+
+        /* private, guarded by mutex since buffers may be released from
+         * worker threads
+         */
+        GMutex   mutex;
+        GQueue   free_buffers;    /* KioskBuffer, most recently released first */
+        GSource *trim_source;
+
+        guint    max_free_buffers;
+        guint    idle_timeout;
+};
+
+G_DEFINE_FINAL_TYPE (KioskBufferPool, kiosk_buffer_pool, G_TYPE_OBJECT);
+
+static void
+kiosk_buffer_free (KioskBuffer *buffer)
+{
+        munmap (buffer->data, buffer->size);
+        g_free (buffer);
+}
+
+static void
+kiosk_buffer_pool_finalize (GObject *object)
+{
+        KioskBufferPool *self = KIOSK_BUFFER_POOL (object);
+
+        /* The trim source holds a reference, so it is gone by now */
+        g_assert (self->trim_source == NULL);
+
+        g_queue_clear_full (&self->free_buffers, (GDestroyNotify) kiosk_buffer_free);
+        g_mutex_clear (&self->mutex);
+
+        G_OBJECT_CLASS (kiosk_buffer_pool_parent_class)->finalize (object);
+}
+
+static void
+kiosk_buffer_pool_class_init (KioskBufferPoolClass *pool_class)
+{
+        GObjectClass *object_class = G_OBJECT_CLASS (pool_class);
+
+        object_class->finalize = kiosk_buffer_pool_finalize;
+}
+
+static void
+kiosk_buffer_pool_init (KioskBufferPool *self)
+{
+        g_mutex_init (&self->mutex);
+        g_queue_init (&self->free_buffers);
+}
+
+static void
+trim_free_buffers (KioskBufferPool *self,
+                   gint64           released_before)
+{
+        KioskBuffer *buffer;
+
+        while ((buffer = g_queue_peek_tail (&self->free_buffers)) != NULL) {
+                if (buffer->release_time > released_before)
+                        break;
+
+                g_debug ("KioskBufferPool: Releasing idle %" G_GSIZE_FORMAT " byte buffer",
+                         buffer->size);
+                g_queue_pop_tail (&self->free_buffers);
+                kiosk_buffer_free (buffer);
+        }
+}
+
+static gboolean
+on_trim_timeout (KioskBufferPool *self)
+{
+        g_autoptr (GMutexLocker) locker = g_mutex_locker_new (&self->mutex);
+
+        trim_free_buffers (self,
+                           g_get_monotonic_time () - self->idle_timeout * G_USEC_PER_SEC);
+
+        if (!g_queue_is_empty (&self->free_buffers))
+                return G_SOURCE_CONTINUE;
+
+        g_clear_pointer (&self->trim_source, g_source_unref);
+        return G_SOURCE_REMOVE;
+}
+
+static void
+schedule_trim (KioskBufferPool *self)
+{
+        if (self->trim_source != NULL)
+                return;
+
+        /* This may run on a worker thread, so the source is attached to
+         * the main context explicitly. It keeps the pool alive until all
+         * the free buffers are trimmed.
+         */
+        self->trim_source = g_timeout_source_new_seconds (self->idle_timeout);
+        g_source_set_callback (self->trim_source,
+                               (GSourceFunc) on_trim_timeout,
+                               g_object_ref (self),
+                               g_object_unref);
+        g_source_set_static_name (self->trim_source, "[kiosk-buffer-pool] on_trim_timeout");
+        g_source_attach (self->trim_source, NULL);
+}
+
+static void
+release_buffer (void *data)
+{
+        KioskBuffer *buffer = data;
+        KioskBufferPool *self = buffer->pool;
+
+        buffer->pool = NULL;
+        buffer->release_time = g_get_monotonic_time ();
+
+        g_mutex_lock (&self->mutex);
+
+        g_queue_push_head (&self->free_buffers, buffer);
+
+        while (g_queue_get_length (&self->free_buffers) > self->max_free_buffers)
+                kiosk_buffer_free (g_queue_pop_tail (&self->free_buffers));
+
+        schedule_trim (self);
+
+        g_mutex_unlock (&self->mutex);
+
+        g_object_unref (self);
+}
+
+static KioskBuffer *
+acquire_buffer (KioskBufferPool *self,
+                gsize            size)
+{
+        KioskBuffer *buffer = NULL;
+        GList *node;
+        gpointer data;
+
+        g_mutex_lock (&self->mutex);
+        for (node = self->free_buffers.head; node != NULL; node = node->next) {
+                KioskBuffer *free_buffer = node->data;
+
+                if (free_buffer->size == size) {
+                        buffer = free_buffer;
+                        g_queue_delete_link (&self->free_buffers, node);
+                        break;
+                }
+        }
+        g_mutex_unlock (&self->mutex);
+
+        if (buffer == NULL) {
+                data = mmap (NULL, size, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (data == MAP_FAILED)
+                        return NULL;
+
+                buffer = g_new0 (KioskBuffer, 1);
+                buffer->data = data;
+                buffer->size = size;
+        } else {
+                g_debug ("KioskBufferPool: Reusing %" G_GSIZE_FORMAT " byte buffer", size);
+        }
+
+        buffer->pool = g_object_ref (self);
+
+        return buffer;
+}
+
+/**
+ * kiosk_buffer_pool_create_surface:
+ * @pool: the #KioskBufferPool
+ * @width: the width of the surface
+ * @height: the height of the surface
+ *
+ * Creates an ARGB32 image surface backed by a buffer of the pool. The
+ * buffer goes back to the pool once the surface is destroyed, which may
+ * happen on any thread. The contents of the surface are undefined.
+ *
+ * Returns: (transfer full): a new image surface
+ */
+cairo_surface_t *
+kiosk_buffer_pool_create_surface (KioskBufferPool *pool,
+                                  int              width,
+                                  int              height)
+{
+        KioskBuffer *buffer;
+        cairo_surface_t *surface;
+        int stride;
+
+        g_return_val_if_fail (KIOSK_IS_BUFFER_POOL (pool), NULL);
+
+        stride = cairo_format_stride_for_width (CAIRO_FORMAT_ARGB32, width);
+
+        buffer = acquire_buffer (pool, (gsize) stride * height);
+        if (buffer == NULL)
+                return cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
+
+        surface = cairo_image_surface_create_for_data (buffer->data, CAIRO_FORMAT_ARGB32,
+                                                       width, height, stride);
+
+        if (cairo_surface_status (surface) != CAIRO_STATUS_SUCCESS ||
+            cairo_surface_set_user_data (surface, &buffer_key,
+                                         buffer, release_buffer) != CAIRO_STATUS_SUCCESS) {
+                /* The buffer is back in the pool, so the surface must not
+                 * use it anymore
+                 */
+                release_buffer (buffer);
+                cairo_surface_destroy (surface);
+
+                return cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
+        }
+
+        return surface;
+}
+
+/**
+ * kiosk_buffer_pool_trim:
+ * @pool: the #KioskBufferPool
+ *
+ * Unmaps all the buffers that are not in use right now.
+ */
+void
+kiosk_buffer_pool_trim (KioskBufferPool *pool)
+{
+        g_autoptr (GMutexLocker) locker = NULL;
+
+        g_return_if_fail (KIOSK_IS_BUFFER_POOL (pool));
+
+        locker = g_mutex_locker_new (&pool->mutex);
+        trim_free_buffers (pool, G_MAXINT64);
+}
+
+/**
+ * kiosk_buffer_pool_new:
+ * @max_free_buffers: how many unused buffers to keep around at most
+ * @idle_timeout: the number of seconds after which unused buffers get
+ * unmapped
+ *
+ * Creates a pool of image buffers.
+ *
+ * Returns: (transfer full): a new #KioskBufferPool
+ */
+KioskBufferPool *
+kiosk_buffer_pool_new (guint max_free_buffers,
+                       guint idle_timeout)
+{
+        KioskBufferPool *pool;
+
+        pool = g_object_new (KIOSK_TYPE_BUFFER_POOL, NULL);
+        pool->max_free_buffers = max_free_buffers;
+        pool->idle_timeout = idle_timeout;
+
+        return pool;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <glib-object.h>
+#include <cairo.h>
+
+G_BEGIN_DECLS
+
+#define KIOSK_TYPE_BUFFER_POOL (kiosk_buffer_pool_get_type ())
+G_DECLARE_FINAL_TYPE (KioskBufferPool, kiosk_buffer_pool,
+                      KIOSK, BUFFER_POOL, GObject);
+
+KioskBufferPool *kiosk_buffer_pool_new (guint max_free_buffers,
+                                        guint idle_timeout);
+
+cairo_surface_t *kiosk_buffer_pool_create_surface (KioskBufferPool *pool,
+                                                   int              width,
+                                                   int              height);
+void             kiosk_buffer_pool_trim (KioskBufferPool *pool);
+
+G_END_DECLS
@@ -33,6 +33,7 @@
 #include "kiosk-screensaver-service.h"
 #include "kiosk-window-config.h"
 #include "kiosk-magnifier.h"
+#include "kiosk-direct-scanout.h"
 #include "kiosk-brightness.h"
 #include "kiosk-session-presence.h"
 #include "main.h"
@@ -65,6 +66,7 @@ struct _KioskCompositor
         KioskWindowConfig           *kiosk_window_config;
         KioskShellService           *shell_service;
         KioskMagnifier              *magnifier;
+        KioskDirectScanout          *direct_scanout;
         KioskBrightness             *brightness;
         KioskSessionPresence        *session_presence;
         KioskScreenSaverService     *screensaver_service;
@@ -103,6 +105,7 @@ kiosk_compositor_dispose (GObject *object)
         g_clear_object (&self->tracker);
         g_clear_object (&self->kiosk_window_config);
         g_clear_object (&self->magnifier);
+        g_clear_object (&self->direct_scanout);
         g_clear_object (&self->introspect_service);
         g_clear_object (&self->screenshot_service);
         g_clear_object (&self->shell_service);
@@ -350,13 +353,14 @@ kiosk_compositor_start (MetaPlugin *plugin)
         self->tracker = kiosk_window_tracker_new (self, self->app_system);
         self->kiosk_window_config = kiosk_window_config_new (self);
         self->magnifier = kiosk_magnifier_new (self);
+        self->direct_scanout = kiosk_direct_scanout_new (self);
         self->introspect_service = kiosk_shell_introspect_service_new (self);
         kiosk_shell_introspect_service_start (self->introspect_service, &error);
         self->screenshot_service = kiosk_shell_screenshot_service_new (self);
         kiosk_shell_screenshot_service_start (self->screenshot_service, &error);
         self->shell_service = kiosk_shell_service_new (self);
         kiosk_shell_service_start (self->shell_service, &error);
-        self->brightness = kiosk_brightness_new (self);
+        self->brightness = kiosk_brightness_new (self, get_brightness_update_rate ());
         kiosk_brightness_start (self->brightness, &error);
         self->session_presence = kiosk_session_presence_new (self);
         kiosk_session_presence_start (self->session_presence, &error);
@@ -413,7 +417,7 @@ static void
 kiosk_compositor_map_immediately (KioskCompositor *self,
                                   MetaWindowActor *actor)
 {
-        g_debug ("KioskCompositor: Animations disabled, mapping window immediately");
+        g_debug ("KioskCompositor: Mapping window immediately");
         clutter_actor_set_opacity (CLUTTER_ACTOR (actor), 255);
         meta_plugin_map_completed (META_PLUGIN (self), actor);
 }
@@ -452,6 +456,23 @@ kiosk_compositor_map_with_fade_in (KioskCompositor *self,
                                  G_CONNECT_SWAPPED);
 }
 
+static gboolean
+should_fade_in (KioskCompositor *self,
+                MetaWindow      *window)
+{
+        if (!self->animations_enabled)
+                return FALSE;
+
+        /* The window can't be scanned out directly while it fades in */
+        if (meta_window_is_fullscreen (window) &&
+            kiosk_direct_scanout_get_remove_blockers (self->direct_scanout)) {
+                g_debug ("KioskCompositor: Not fading in fullscreen window to allow direct scanout");
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
 static void
 kiosk_compositor_map (MetaPlugin      *plugin,
                       MetaWindowActor *actor)
@@ -471,7 +492,7 @@ kiosk_compositor_map (MetaPlugin      *plugin,
         clutter_actor_show (self->stage);
         clutter_actor_show (CLUTTER_ACTOR (actor));
 
-        if (self->animations_enabled) {
+        if (should_fade_in (self, window)) {
                 kiosk_compositor_map_with_fade_in (self, actor, window);
         } else {
                 kiosk_compositor_map_immediately (self, actor);
@@ -678,6 +699,14 @@ kiosk_compositor_get_session_presence (KioskCompositor *self)
         return KIOSK_SESSION_PRESENCE (self->session_presence);
 }
 
+KioskBrightness *
+kiosk_compositor_get_brightness (KioskCompositor *self)
+{
+        g_return_val_if_fail (KIOSK_IS_COMPOSITOR (self), NULL);
+
+        return KIOSK_BRIGHTNESS (self->brightness);
+}
+
 gboolean
 kiosk_compositor_are_animations_enabled (KioskCompositor *self)
 {
@@ -4,6 +4,7 @@
 #include <meta/meta-plugin.h>
 
 #include "kiosk-backgrounds.h"
+#include "kiosk-brightness.h"
 #include "kiosk-input-sources-manager.h"
 #include "kiosk-service.h"
 #include "kiosk-app-system.h"
@@ -25,6 +26,7 @@ KioskAppSystem *kiosk_compositor_get_app_system (KioskCompositor *compositor);
 KioskWindowTracker *kiosk_compositor_get_window_tracker (KioskCompositor *compositor);
 KioskWindowConfig *kiosk_compositor_get_window_config (KioskCompositor *compositor);
 KioskSessionPresence *kiosk_compositor_get_session_presence (KioskCompositor *compositor);
+KioskBrightness *kiosk_compositor_get_brightness (KioskCompositor *compositor);
 gboolean kiosk_compositor_are_animations_enabled (KioskCompositor *compositor);
 
 G_END_DECLS
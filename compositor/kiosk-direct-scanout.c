@@ -0,0 +1,510 @@
+#include "config.h"
+#include "kiosk-direct-scanout.h"
+
+#include <clutter/clutter.h>
+#include <mtk/mtk.h>
+
+#include <meta/compositor-mutter.h>
+#include <meta/display.h>
+#include <meta/meta-backend.h>
+#include <meta/meta-context.h>
+#include <meta/meta-monitor-manager.h>
+#include <meta/meta-plugin.h>
+#include <meta/meta-window-actor.h>
+#include <meta/window.h>
+
+#include "kiosk-backgrounds.h"
+#include "kiosk-compositor.h"
+#include "kiosk-gobject-utils.h"
+#include "kiosk-service.h"
+#include "main.h"
+
+/* Reasons the fullscreen window of a monitor can't be scanned out
+ * directly, as documented in org.gnome.Kiosk.xml
+ */
+#define KIOSK_DIRECT_SCANOUT_NO_FULLSCREEN_WINDOW "no-fullscreen-window"
+#define KIOSK_DIRECT_SCANOUT_WINDOW_ABOVE "window-above"
+#define KIOSK_DIRECT_SCANOUT_WINDOW_FADING "window-fading"
+#define KIOSK_DIRECT_SCANOUT_WINDOW_TRANSLUCENT "window-translucent"
+#define KIOSK_DIRECT_SCANOUT_WINDOW_TRANSFORMED "window-transformed"
+#define KIOSK_DIRECT_SCANOUT_STAGE_TRANSFORMED "stage-transformed"
+#define KIOSK_DIRECT_SCANOUT_BACKGROUND_VISIBLE "background-visible"
+#define KIOSK_DIRECT_SCANOUT_OVERLAY_VISIBLE "overlay-visible"
+
+#define KIOSK_DIRECT_SCANOUT_WATCHED_TRANSITION_KEY "kiosk-direct-scanout-watched"
+
+struct _KioskDirectScanout
+{
+        GObject                 parent;
+
+        /* weak references */
+        KioskCompositor        *compositor;
+        MetaDisplay            *display;
+        MetaContext            *context;
+        MetaBackend            *backend;
+        MetaMonitorManager     *monitor_manager;
+        ClutterActor           *stage;
+        ClutterActor           *window_group;
+        KioskDBusDirectScanout *dbus_service;
+
+        /* strong references */
+        GCancellable           *cancellable;
+        GVariant               *monitors_status;
+
+        /* state */
+        gboolean                remove_blockers;
+};
+
+enum
+{
+        PROP_COMPOSITOR = 1,
+        PROP_REMOVE_BLOCKERS,
+        NUMBER_OF_PROPERTIES
+};
+
+static GParamSpec *kiosk_direct_scanout_properties[NUMBER_OF_PROPERTIES] = { NULL, };
+
+G_DEFINE_FINAL_TYPE (KioskDirectScanout, kiosk_direct_scanout, G_TYPE_OBJECT);
+
+static void kiosk_direct_scanout_set_property (GObject      *object,
+                                               guint         property_id,
+                                               const GValue *value,
+                                               GParamSpec   *param_spec);
+static void kiosk_direct_scanout_get_property (GObject    *object,
+                                               guint       property_id,
+                                               GValue     *value,
+                                               GParamSpec *param_spec);
+
+static void kiosk_direct_scanout_constructed (GObject *object);
+static void kiosk_direct_scanout_dispose (GObject *object);
+
+static void
+kiosk_direct_scanout_class_init (KioskDirectScanoutClass *direct_scanout_class)
+{
+        GObjectClass *object_class = G_OBJECT_CLASS (direct_scanout_class);
+
+        object_class->constructed = kiosk_direct_scanout_constructed;
+        object_class->set_property = kiosk_direct_scanout_set_property;
+        object_class->get_property = kiosk_direct_scanout_get_property;
+        object_class->dispose = kiosk_direct_scanout_dispose;
+
+        kiosk_direct_scanout_properties[PROP_COMPOSITOR] = g_param_spec_object ("compositor",
+                                                                                NULL, NULL,
+                                                                                KIOSK_TYPE_COMPOSITOR,
+                                                                                G_PARAM_CONSTRUCT_ONLY | G_PARAM_WRITABLE | G_PARAM_STATIC_NAME);
+        kiosk_direct_scanout_properties[PROP_REMOVE_BLOCKERS] = g_param_spec_boolean ("remove-blockers",
+                                                                                      NULL, NULL,
+                                                                                      FALSE,
+                                                                                      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+        g_object_class_install_properties (object_class, NUMBER_OF_PROPERTIES, kiosk_direct_scanout_properties);
+}
+
+static void
+kiosk_direct_scanout_set_property (GObject      *object,
+                                   guint         property_id,
+                                   const GValue *value,
+                                   GParamSpec   *param_spec)
+{
+        KioskDirectScanout *self = KIOSK_DIRECT_SCANOUT (object);
+
+        switch (property_id) {
+        case PROP_COMPOSITOR:
+                g_set_weak_pointer (&self->compositor, g_value_get_object (value));
+                break;
+
+        case PROP_REMOVE_BLOCKERS:
+                self->remove_blockers = g_value_get_boolean (value);
+                break;
+
+        default:
+                G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, param_spec);
+                break;
+        }
+}
+
+static void
+kiosk_direct_scanout_get_property (GObject    *object,
+                                   guint       property_id,
+                                   GValue     *value,
+                                   GParamSpec *param_spec)
+{
+        KioskDirectScanout *self = KIOSK_DIRECT_SCANOUT (object);
+
+        switch (property_id) {
+        case PROP_REMOVE_BLOCKERS:
+                g_value_set_boolean (value, self->remove_blockers);
+                break;
+
+        default:
+                G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, param_spec);
+                break;
+        }
+}
+
+static void update_monitors_status (KioskDirectScanout *self);
+
+static void
+queue_update_monitors_status (KioskDirectScanout *self)
+{
+        if (self->cancellable == NULL)
+                return;
+
+        kiosk_gobject_utils_queue_immediate_callback (G_OBJECT (self),
+                                                      "[kiosk-direct-scanout] update_monitors_status",
+                                                      self->cancellable,
+                                                      KIOSK_OBJECT_CALLBACK (update_monitors_status),
+                                                      NULL);
+}
+
+static MetaWindowActor *
+find_fullscreen_window_actor (KioskDirectScanout *self,
+                              int                 monitor,
+                              MtkRectangle       *monitor_geometry,
+                              gboolean           *has_window_above)
+{
+        GList *window_actors;
+        GList *node;
+
+        *has_window_above = FALSE;
+
+        /* Window actors are stacked bottom to top */
+        window_actors = meta_get_window_actors (self->display);
+        for (node = g_list_last (window_actors); node != NULL; node = node->prev) {
+                MetaWindowActor *window_actor = node->data;
+                MetaWindow *window = meta_window_actor_get_meta_window (window_actor);
+                MtkRectangle frame_rect;
+
+                if (window == NULL || !clutter_actor_is_visible (CLUTTER_ACTOR (window_actor)))
+                        continue;
+
+                if (meta_window_is_fullscreen (window) && meta_window_get_monitor (window) == monitor)
+                        return window_actor;
+
+                meta_window_get_frame_rect (window, &frame_rect);
+                if (mtk_rectangle_overlap (&frame_rect, monitor_geometry))
+                        *has_window_above = TRUE;
+        }
+
+        return NULL;
+}
+
+static gboolean
+is_overlay_visible (KioskDirectScanout *self,
+                    MtkRectangle       *monitor_geometry)
+{
+        graphene_rect_t monitor_rect = GRAPHENE_RECT_INIT (monitor_geometry->x,
+                                                           monitor_geometry->y,
+                                                           monitor_geometry->width,
+                                                           monitor_geometry->height);
+        ClutterActor *child;
+
+        /* Anything on the stage besides the windows, like the screensaver,
+         * gets painted on top of them
+         */
+        for (child = clutter_actor_get_first_child (self->stage);
+             child != NULL;
+             child = clutter_actor_get_next_sibling (child)) {
+                ClutterActor *overlay_actor;
+
+                if (child == self->window_group || !clutter_actor_is_visible (child))
+                        continue;
+
+                for (overlay_actor = clutter_actor_get_first_child (child);
+                     overlay_actor != NULL;
+                     overlay_actor = clutter_actor_get_next_sibling (overlay_actor)) {
+                        graphene_rect_t extents;
+
+                        if (!clutter_actor_is_visible (overlay_actor))
+                                continue;
+
+                        clutter_actor_get_transformed_extents (overlay_actor, &extents);
+                        if (graphene_rect_intersection (&extents, &monitor_rect, NULL))
+                                return TRUE;
+                }
+        }
+
+        return FALSE;
+}
+
+static gboolean
+is_stage_transformed (KioskDirectScanout *self)
+{
+        graphene_matrix_t transform;
+
+        clutter_actor_get_child_transform (self->stage, &transform);
+
+        return !graphene_matrix_is_identity (&transform);
+}
+
+static void
+watch_transition (KioskDirectScanout *self,
+                  ClutterTransition  *transition)
+{
+        if (g_object_get_data (G_OBJECT (transition), KIOSK_DIRECT_SCANOUT_WATCHED_TRANSITION_KEY) != NULL)
+                return;
+
+        g_object_set_data (G_OBJECT (transition), KIOSK_DIRECT_SCANOUT_WATCHED_TRANSITION_KEY, GINT_TO_POINTER (TRUE));
+        g_signal_connect_object (G_OBJECT (transition),
+                                 "stopped",
+                                 G_CALLBACK (queue_update_monitors_status),
+                                 self,
+                                 G_CONNECT_SWAPPED);
+}
+
+static void
+add_window_actor_reasons (KioskDirectScanout *self,
+                          MetaWindowActor    *window_actor,
+                          GPtrArray          *reasons)
+{
+        ClutterActor *actor = CLUTTER_ACTOR (window_actor);
+        ClutterTransition *transition;
+
+        transition = clutter_actor_get_transition (actor, "opacity");
+        if (transition != NULL) {
+                g_ptr_array_add (reasons, KIOSK_DIRECT_SCANOUT_WINDOW_FADING);
+                watch_transition (self, transition);
+        } else if (clutter_actor_get_opacity (actor) < 255) {
+                g_ptr_array_add (reasons, KIOSK_DIRECT_SCANOUT_WINDOW_TRANSLUCENT);
+        }
+
+        if (clutter_actor_is_scaled (actor) || clutter_actor_is_rotated (actor))
+                g_ptr_array_add (reasons, KIOSK_DIRECT_SCANOUT_WINDOW_TRANSFORMED);
+}
+
+static GVariant *
+get_monitor_status (KioskDirectScanout *self,
+                    int                 monitor)
+{
+        g_autoptr (GPtrArray) reasons = NULL;
+        g_autofree char *reasons_string = NULL;
+        MetaWindowActor *window_actor;
+        MtkRectangle monitor_geometry;
+        gboolean has_window_above;
+        gboolean eligible;
+
+        reasons = g_ptr_array_new ();
+
+        meta_display_get_monitor_geometry (self->display, monitor, &monitor_geometry);
+
+        window_actor = find_fullscreen_window_actor (self, monitor, &monitor_geometry, &has_window_above);
+        if (window_actor == NULL) {
+                g_ptr_array_add (reasons, KIOSK_DIRECT_SCANOUT_NO_FULLSCREEN_WINDOW);
+        } else {
+                KioskBackgrounds *backgrounds = kiosk_compositor_get_backgrounds (self->compositor);
+
+                if (has_window_above)
+                        g_ptr_array_add (reasons, KIOSK_DIRECT_SCANOUT_WINDOW_ABOVE);
+
+                add_window_actor_reasons (self, window_actor, reasons);
+
+                if (backgrounds != NULL && kiosk_backgrounds_is_monitor_background_visible (backgrounds, monitor))
+                        g_ptr_array_add (reasons, KIOSK_DIRECT_SCANOUT_BACKGROUND_VISIBLE);
+        }
+
+        if (is_stage_transformed (self))
+                g_ptr_array_add (reasons, KIOSK_DIRECT_SCANOUT_STAGE_TRANSFORMED);
+
+        if (is_overlay_visible (self, &monitor_geometry))
+                g_ptr_array_add (reasons, KIOSK_DIRECT_SCANOUT_OVERLAY_VISIBLE);
+
+        eligible = reasons->len == 0;
+        g_ptr_array_add (reasons, NULL);
+
+        if (eligible) {
+                g_debug ("KioskDirectScanout: Monitor %d is eligible for direct scanout", monitor);
+        } else {
+                reasons_string = g_strjoinv (", ", (char **) reasons->pdata);
+                g_debug ("KioskDirectScanout: Monitor %d is not eligible for direct scanout: %s",
+                         monitor, reasons_string);
+        }
+
+        return g_variant_new ("(ib^as)", monitor, eligible, (char **) reasons->pdata);
+}
+
+static void
+update_monitors_status (KioskDirectScanout *self)
+{
+        g_autoptr (GVariant) monitors_status = NULL;
+        GVariantBuilder builder;
+        int number_of_monitors;
+        int i;
+
+        if (self->display == NULL)
+                return;
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ibas)"));
+
+        number_of_monitors = meta_display_get_n_monitors (self->display);
+        for (i = 0; i < number_of_monitors; i++)
+                g_variant_builder_add_value (&builder, get_monitor_status (self, i));
+
+        monitors_status = g_variant_ref_sink (g_variant_builder_end (&builder));
+
+        if (self->monitors_status != NULL && g_variant_equal (self->monitors_status, monitors_status))
+                return;
+
+        g_clear_pointer (&self->monitors_status, g_variant_unref);
+        self->monitors_status = g_variant_ref (monitors_status);
+
+        if (self->dbus_service != NULL)
+                kiosk_dbus_direct_scanout_set_monitors (self->dbus_service, monitors_status);
+}
+
+static void
+watch_stage_child (KioskDirectScanout *self,
+                   ClutterActor       *child)
+{
+        if (child == self->window_group)
+                return;
+
+        g_signal_connect_object (G_OBJECT (child),
+                                 "notify::visible",
+                                 G_CALLBACK (queue_update_monitors_status),
+                                 self,
+                                 G_CONNECT_SWAPPED);
+}
+
+static void
+on_stage_child_added (KioskDirectScanout *self,
+                      ClutterActor       *child)
+{
+        watch_stage_child (self, child);
+        queue_update_monitors_status (self);
+}
+
+static void
+kiosk_direct_scanout_constructed (GObject *object)
+{
+        KioskDirectScanout *self = KIOSK_DIRECT_SCANOUT (object);
+        MetaDisplay *display = meta_plugin_get_display (META_PLUGIN (self->compositor));
+        MetaCompositor *compositor = meta_display_get_compositor (display);
+        KioskService *service = kiosk_compositor_get_service (self->compositor);
+        ClutterActor *child;
+
+        G_OBJECT_CLASS (kiosk_direct_scanout_parent_class)->constructed (object);
+
+        g_set_weak_pointer (&self->display, display);
+        g_set_weak_pointer (&self->context, meta_display_get_context (self->display));
+        g_set_weak_pointer (&self->backend, meta_context_get_backend (self->context));
+        g_set_weak_pointer (&self->monitor_manager, meta_backend_get_monitor_manager (self->backend));
+        g_set_weak_pointer (&self->stage, CLUTTER_ACTOR (meta_compositor_get_stage (compositor)));
+        g_set_weak_pointer (&self->window_group, meta_compositor_get_window_group (compositor));
+        g_set_weak_pointer (&self->dbus_service, KIOSK_DBUS_DIRECT_SCANOUT (kiosk_service_get_direct_scanout_skeleton (service)));
+
+        self->cancellable = g_cancellable_new ();
+
+        g_signal_connect_object (G_OBJECT (self->display),
+                                 "in-fullscreen-changed",
+                                 G_CALLBACK (queue_update_monitors_status),
+                                 self,
+                                 G_CONNECT_SWAPPED);
+        g_signal_connect_object (G_OBJECT (self->display),
+                                 "restacked",
+                                 G_CALLBACK (queue_update_monitors_status),
+                                 self,
+                                 G_CONNECT_SWAPPED);
+        g_signal_connect_object (G_OBJECT (self->monitor_manager),
+                                 "monitors-changed",
+                                 G_CALLBACK (queue_update_monitors_status),
+                                 self,
+                                 G_CONNECT_SWAPPED);
+
+        /* Windows get mapped and unmapped by adding and removing their actors */
+        g_signal_connect_object (G_OBJECT (self->window_group),
+                                 "child-added",
+                                 G_CALLBACK (queue_update_monitors_status),
+                                 self,
+                                 G_CONNECT_SWAPPED);
+        g_signal_connect_object (G_OBJECT (self->window_group),
+                                 "child-removed",
+                                 G_CALLBACK (queue_update_monitors_status),
+                                 self,
+                                 G_CONNECT_SWAPPED);
+
+        /* The magnifier zooms by transforming the whole stage */
+        g_signal_connect_object (G_OBJECT (self->stage),
+                                 "notify::child-transform",
+                                 G_CALLBACK (queue_update_monitors_status),
+                                 self,
+                                 G_CONNECT_SWAPPED);
+        g_signal_connect_object (G_OBJECT (self->stage),
+                                 "child-added",
+                                 G_CALLBACK (on_stage_child_added),
+                                 self,
+                                 G_CONNECT_SWAPPED);
+        g_signal_connect_object (G_OBJECT (self->stage),
+                                 "child-removed",
+                                 G_CALLBACK (queue_update_monitors_status),
+                                 self,
+                                 G_CONNECT_SWAPPED);
+
+        for (child = clutter_actor_get_first_child (self->stage);
+             child != NULL;
+             child = clutter_actor_get_next_sibling (child))
+                watch_stage_child (self, child);
+
+        queue_update_monitors_status (self);
+}
+
+static void
+kiosk_direct_scanout_init (KioskDirectScanout *self)
+{
+        g_debug ("KioskDirectScanout: Initializing");
+}
+
+static void
+kiosk_direct_scanout_dispose (GObject *object)
+{
+        KioskDirectScanout *self = KIOSK_DIRECT_SCANOUT (object);
+
+        g_debug ("KioskDirectScanout: Disposing");
+
+        if (self->cancellable != NULL) {
+                g_cancellable_cancel (self->cancellable);
+                g_clear_object (&self->cancellable);
+        }
+
+        g_clear_pointer (&self->monitors_status, g_variant_unref);
+
+        g_clear_weak_pointer (&self->dbus_service);
+        g_clear_weak_pointer (&self->window_group);
+        g_clear_weak_pointer (&self->stage);
+        g_clear_weak_pointer (&self->monitor_manager);
+        g_clear_weak_pointer (&self->backend);
+        g_clear_weak_pointer (&self->context);
+        g_clear_weak_pointer (&self->display);
+        g_clear_weak_pointer (&self->compositor);
+
+        G_OBJECT_CLASS (kiosk_direct_scanout_parent_class)->dispose (object);
+}
+
+KioskDirectScanout *
+kiosk_direct_scanout_new (KioskCompositor *compositor)
+{
+        GObject *object;
+
+        object = g_object_new (KIOSK_TYPE_DIRECT_SCANOUT,
+                               "compositor", compositor,
+                               "remove-blockers", is_direct_scanout_preferred (),
+                               NULL);
+
+        return KIOSK_DIRECT_SCANOUT (object);
+}
+
+/**
+ * kiosk_direct_scanout_get_remove_blockers:
+ * @direct_scanout: a #KioskDirectScanout
+ *
+ * Returns whether effects that keep fullscreen windows from being scanned
+ * out directly, like fading them in when they get mapped, should be
+ * skipped.
+ *
+ * Returns: %TRUE if such effects should be skipped
+ */
+gboolean
+kiosk_direct_scanout_get_remove_blockers (KioskDirectScanout *self)
+{
+        g_return_val_if_fail (KIOSK_IS_DIRECT_SCANOUT (self), FALSE);
+
+        return self->remove_blockers;
+}
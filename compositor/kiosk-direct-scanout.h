@@ -0,0 +1,30 @@
+#pragma once
+
+#include <glib-object.h>
+
+typedef struct _KioskCompositor KioskCompositor;
+
+G_BEGIN_DECLS
+
+/**
+ * KioskDirectScanout:
+ *
+ * Keeps track of whether the fullscreen window of each monitor could be
+ * scanned out directly
+ *
+ * The #KioskDirectScanout object looks at what gets painted on each
+ * monitor besides its topmost fullscreen window, and publishes the result
+ * along with the reasons keeping the window from being scanned out
+ * directly on the org.gnome.Kiosk.DirectScanout D-Bus interface.
+ *
+ */
+#define KIOSK_TYPE_DIRECT_SCANOUT (kiosk_direct_scanout_get_type ())
+
+G_DECLARE_FINAL_TYPE (KioskDirectScanout, kiosk_direct_scanout,
+                      KIOSK, DIRECT_SCANOUT, GObject);
+
+KioskDirectScanout *kiosk_direct_scanout_new (KioskCompositor *compositor);
+
+gboolean kiosk_direct_scanout_get_remove_blockers (KioskDirectScanout *direct_scanout);
+
+G_END_DECLS
@@ -59,6 +59,8 @@ static void kiosk_magnifier_get_property (GObject    *object,
 static void kiosk_magnifier_constructed (GObject *object);
 static void kiosk_magnifier_dispose (GObject *object);
 
+static void kiosk_magnifier_reset_zoom (KioskMagnifier *self);
+
 static void
 kiosk_magnifier_apply_zoom (KioskMagnifier *self)
 {
@@ -67,6 +69,14 @@ kiosk_magnifier_apply_zoom (KioskMagnifier *self)
         graphene_point_t cursor_position;
         float factor = (float) self->mag_factor;
 
+        /* Any child transform on the stage, even an identity one, keeps
+         * the fullscreen window from being scanned out directly
+         */
+        if (factor <= 1.0f) {
+                kiosk_magnifier_reset_zoom (self);
+                return;
+        }
+
         meta_cursor_tracker_get_pointer (self->cursor_tracker, &cursor_position, NULL);
 
         graphene_matrix_init_identity (&modelview);
@@ -84,12 +94,15 @@ kiosk_magnifier_apply_zoom (KioskMagnifier *self)
 static void
 kiosk_magnifier_reset_zoom (KioskMagnifier *self)
 {
-        graphene_matrix_t identity;
+        graphene_matrix_t transform;
+
+        clutter_actor_get_child_transform (self->stage, &transform);
+        if (graphene_matrix_is_identity (&transform))
+                return;
 
         g_debug ("KioskMagnifier: Resetting zoom to default");
 
-        graphene_matrix_init_identity (&identity);
-        clutter_actor_set_child_transform (self->stage, &identity);
+        clutter_actor_set_child_transform (self->stage, NULL);
 }
 
 static void
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef void (*KioskPixelRowFunc) (guint8        *dest,
+                                   const guint32 *src,
+                                   int            width);
+
+typedef void (*KioskPixelAccumulateFunc) (guint32      *sums,
+                                          const guint8 *src,
+                                          int           length);
+
+/* One set of row kernels, the public functions run the last set
+ * kiosk_pixel_utils_get_kernels() returns. Only meant for the tests
+ * and benchmarks comparing them.
+ */
+typedef struct
+{
+        const char               *name;
+        KioskPixelRowFunc         unpremultiply_row;
+        KioskPixelRowFunc         convert_no_alpha_row;
+        KioskPixelAccumulateFunc  accumulate_row;
+} KioskPixelKernels;
+
+const KioskPixelKernels *kiosk_pixel_utils_get_kernels (int *number_of_kernels);
+
+G_END_DECLS
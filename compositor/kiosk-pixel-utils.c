@@ -0,0 +1,822 @@
+#include "config.h"
+#include "kiosk-pixel-utils.h"
+#include "kiosk-pixel-utils-private.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KIOSK_PIXEL_UTILS_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) && !defined(__ARM_BIG_ENDIAN)
+#define KIOSK_PIXEL_UTILS_HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+/* The vectorized kernels below replace the per channel division
+ *
+ *     (channel * 255 + alpha / 2) / alpha
+ *
+ * by a multiplication with 1 / alpha from a lookup table. Adding 0.5 to the
+ * numerator keeps the float product at least 0.5 / alpha away from any
+ * integer boundary, which is far more than the rounding error of a single
+ * precision multiply for numerators below 2^16, so truncating the product
+ * gives exactly the same result as the integer division. The table holds 0
+ * for alpha == 0, which yields the 0 the scalar code special cases.
+ *
+ * Results are truncated to 8 bits rather than saturated, again to match the
+ * scalar code for (invalid) pixels whose color exceeds their alpha.
+ */
+
+#define KIOSK_PIXEL_UTILS_MAX_KERNELS 3
+
+static float reciprocals[256];
+static KioskPixelKernels supported_kernels[KIOSK_PIXEL_UTILS_MAX_KERNELS];
+static int number_of_supported_kernels;
+static const KioskPixelKernels *kernels;
+
+static void
+unpremultiply_row_scalar (guint8        *dest,
+                          const guint32 *src,
+                          int            width)
+{
+        int x;
+
+        for (x = 0; x < width; x++) {
+                unsigned int alpha = src[x] >> 24;
+
+                if (alpha == 0) {
+                        dest[x * 4 + 0] = 0;
+                        dest[x * 4 + 1] = 0;
+                        dest[x * 4 + 2] = 0;
+                } else {
+                        dest[x * 4 + 0] = (((src[x] & 0xff0000) >> 16) * 255 + alpha / 2) / alpha;
+                        dest[x * 4 + 1] = (((src[x] & 0x00ff00) >> 8) * 255 + alpha / 2) / alpha;
+                        dest[x * 4 + 2] = (((src[x] & 0x0000ff) >> 0) * 255 + alpha / 2) / alpha;
+                }
+                dest[x * 4 + 3] = alpha;
+        }
+}
+
+static void
+convert_no_alpha_row_scalar (guint8        *dest,
+                             const guint32 *src,
+                             int            width)
+{
+        int x;
+
+        for (x = 0; x < width; x++) {
+                dest[x * 3 + 0] = src[x] >> 16;
+                dest[x * 3 + 1] = src[x] >> 8;
+                dest[x * 3 + 2] = src[x];
+        }
+}
+
+static void
+accumulate_row_scalar (guint32      *sums,
+                       const guint8 *src,
+                       int           length)
+{
+        int i;
+
+        for (i = 0; i < length; i++)
+                sums[i] += src[i];
+}
+
+#ifdef KIOSK_PIXEL_UTILS_HAVE_X86
+__attribute__((target ("sse4.1")))
+static inline __m128i
+unpremultiply_channel_sse41 (__m128i channel,
+                             __m128i bias,
+                             __m128  reciprocal)
+{
+        __m128i numerator;
+        __m128 value;
+
+        numerator = _mm_add_epi32 (_mm_sub_epi32 (_mm_slli_epi32 (channel, 8), channel), bias);
+        value = _mm_add_ps (_mm_cvtepi32_ps (numerator), _mm_set1_ps (0.5f));
+
+        return _mm_cvttps_epi32 (_mm_mul_ps (value, reciprocal));
+}
+
+__attribute__((target ("sse4.1")))
+static void
+unpremultiply_row_sse41 (guint8        *dest,
+                         const guint32 *src,
+                         int            width)
+{
+        const __m128i mask = _mm_set1_epi32 (0xff);
+        int x;
+
+        for (x = 0; x + 4 <= width; x += 4) {
+                __m128i pixels = _mm_loadu_si128 ((const __m128i *) (src + x));
+                __m128i alpha = _mm_srli_epi32 (pixels, 24);
+                __m128i bias = _mm_srli_epi32 (alpha, 1);
+                __m128 reciprocal = _mm_setr_ps (reciprocals[src[x + 0] >> 24],
+                                                 reciprocals[src[x + 1] >> 24],
+                                                 reciprocals[src[x + 2] >> 24],
+                                                 reciprocals[src[x + 3] >> 24]);
+                __m128i red, green, blue, result;
+
+                red = unpremultiply_channel_sse41 (_mm_and_si128 (_mm_srli_epi32 (pixels, 16), mask),
+                                                   bias, reciprocal);
+                green = unpremultiply_channel_sse41 (_mm_and_si128 (_mm_srli_epi32 (pixels, 8), mask),
+                                                     bias, reciprocal);
+                blue = unpremultiply_channel_sse41 (_mm_and_si128 (pixels, mask),
+                                                    bias, reciprocal);
+
+                result = _mm_and_si128 (red, mask);
+                result = _mm_or_si128 (result, _mm_slli_epi32 (_mm_and_si128 (green, mask), 8));
+                result = _mm_or_si128 (result, _mm_slli_epi32 (_mm_and_si128 (blue, mask), 16));
+                result = _mm_or_si128 (result, _mm_slli_epi32 (alpha, 24));
+
+                _mm_storeu_si128 ((__m128i *) (dest + x * 4), result);
+        }
+
+        unpremultiply_row_scalar (dest + x * 4, src + x, width - x);
+}
+
+__attribute__((target ("sse4.1")))
+static void
+convert_no_alpha_row_sse41 (guint8        *dest,
+                            const guint32 *src,
+                            int            width)
+{
+        const __m128i shuffle = _mm_setr_epi8 (2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12,
+                                               -1, -1, -1, -1);
+        int x;
+
+        for (x = 0; x + 4 <= width; x += 4) {
+                __m128i pixels = _mm_loadu_si128 ((const __m128i *) (src + x));
+                __m128i rgb = _mm_shuffle_epi8 (pixels, shuffle);
+                guint32 tail = (guint32) _mm_cvtsi128_si32 (_mm_srli_si128 (rgb, 8));
+
+                _mm_storel_epi64 ((__m128i *) (dest + x * 3), rgb);
+                memcpy (dest + x * 3 + 8, &tail, sizeof (tail));
+        }
+
+        convert_no_alpha_row_scalar (dest + x * 3, src + x, width - x);
+}
+
+__attribute__((target ("sse4.1")))
+static void
+accumulate_row_sse41 (guint32      *sums,
+                      const guint8 *src,
+                      int           length)
+{
+        int i;
+
+        for (i = 0; i + 16 <= length; i += 16) {
+                __m128i bytes = _mm_loadu_si128 ((const __m128i *) (src + i));
+                __m128i *sum = (__m128i *) (sums + i);
+
+                _mm_storeu_si128 (sum + 0, _mm_add_epi32 (_mm_loadu_si128 (sum + 0),
+                                                          _mm_cvtepu8_epi32 (bytes)));
+                _mm_storeu_si128 (sum + 1, _mm_add_epi32 (_mm_loadu_si128 (sum + 1),
+                                                          _mm_cvtepu8_epi32 (_mm_srli_si128 (bytes, 4))));
+                _mm_storeu_si128 (sum + 2, _mm_add_epi32 (_mm_loadu_si128 (sum + 2),
+                                                          _mm_cvtepu8_epi32 (_mm_srli_si128 (bytes, 8))));
+                _mm_storeu_si128 (sum + 3, _mm_add_epi32 (_mm_loadu_si128 (sum + 3),
+                                                          _mm_cvtepu8_epi32 (_mm_srli_si128 (bytes, 12))));
+        }
+
+        accumulate_row_scalar (sums + i, src + i, length - i);
+}
+
+__attribute__((target ("avx2")))
+static inline __m256i
+unpremultiply_channel_avx2 (__m256i channel,
+                            __m256i bias,
+                            __m256  reciprocal)
+{
+        __m256i numerator;
+        __m256 value;
+
+        numerator = _mm256_add_epi32 (_mm256_sub_epi32 (_mm256_slli_epi32 (channel, 8), channel), bias);
+        value = _mm256_add_ps (_mm256_cvtepi32_ps (numerator), _mm256_set1_ps (0.5f));
+
+        return _mm256_cvttps_epi32 (_mm256_mul_ps (value, reciprocal));
+}
+
+__attribute__((target ("avx2")))
+static void
+unpremultiply_row_avx2 (guint8        *dest,
+                        const guint32 *src,
+                        int            width)
+{
+        const __m256i mask = _mm256_set1_epi32 (0xff);
+        int x;
+
+        for (x = 0; x + 8 <= width; x += 8) {
+                __m256i pixels = _mm256_loadu_si256 ((const __m256i *) (src + x));
+                __m256i alpha = _mm256_srli_epi32 (pixels, 24);
+                __m256i bias = _mm256_srli_epi32 (alpha, 1);
+                __m256 reciprocal = _mm256_i32gather_ps (reciprocals, alpha, sizeof (float));
+                __m256i red, green, blue, result;
+
+                red = unpremultiply_channel_avx2 (_mm256_and_si256 (_mm256_srli_epi32 (pixels, 16), mask),
+                                                  bias, reciprocal);
+                green = unpremultiply_channel_avx2 (_mm256_and_si256 (_mm256_srli_epi32 (pixels, 8), mask),
+                                                    bias, reciprocal);
+                blue = unpremultiply_channel_avx2 (_mm256_and_si256 (pixels, mask),
+                                                   bias, reciprocal);
+
+                result = _mm256_and_si256 (red, mask);
+                result = _mm256_or_si256 (result, _mm256_slli_epi32 (_mm256_and_si256 (green, mask), 8));
+                result = _mm256_or_si256 (result, _mm256_slli_epi32 (_mm256_and_si256 (blue, mask), 16));
+                result = _mm256_or_si256 (result, _mm256_slli_epi32 (alpha, 24));
+
+                _mm256_storeu_si256 ((__m256i *) (dest + x * 4), result);
+        }
+
+        unpremultiply_row_sse41 (dest + x * 4, src + x, width - x);
+}
+
+__attribute__((target ("avx2")))
+static void
+convert_no_alpha_row_avx2 (guint8        *dest,
+                           const guint32 *src,
+                           int            width)
+{
+        const __m256i shuffle = _mm256_setr_epi8 (2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12,
+                                                  -1, -1, -1, -1,
+                                                  2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12,
+                                                  -1, -1, -1, -1);
+        const __m256i compact = _mm256_setr_epi32 (0, 1, 2, 4, 5, 6, 3, 7);
+        int x;
+
+        for (x = 0; x + 8 <= width; x += 8) {
+                __m256i pixels = _mm256_loadu_si256 ((const __m256i *) (src + x));
+                __m256i rgb = _mm256_shuffle_epi8 (pixels, shuffle);
+
+                /* Move the 24 used bytes of both lanes to the front */
+                rgb = _mm256_permutevar8x32_epi32 (rgb, compact);
+
+                _mm_storeu_si128 ((__m128i *) (dest + x * 3), _mm256_castsi256_si128 (rgb));
+                _mm_storel_epi64 ((__m128i *) (dest + x * 3 + 16), _mm256_extracti128_si256 (rgb, 1));
+        }
+
+        convert_no_alpha_row_sse41 (dest + x * 3, src + x, width - x);
+}
+
+__attribute__((target ("avx2")))
+static void
+accumulate_row_avx2 (guint32      *sums,
+                     const guint8 *src,
+                     int           length)
+{
+        int i;
+
+        for (i = 0; i + 16 <= length; i += 16) {
+                __m128i bytes = _mm_loadu_si128 ((const __m128i *) (src + i));
+                __m256i *sum = (__m256i *) (sums + i);
+
+                _mm256_storeu_si256 (sum + 0, _mm256_add_epi32 (_mm256_loadu_si256 (sum + 0),
+                                                                _mm256_cvtepu8_epi32 (bytes)));
+                _mm256_storeu_si256 (sum + 1, _mm256_add_epi32 (_mm256_loadu_si256 (sum + 1),
+                                                                _mm256_cvtepu8_epi32 (_mm_srli_si128 (bytes, 8))));
+        }
+
+        accumulate_row_sse41 (sums + i, src + i, length - i);
+}
+#endif
+
+#ifdef KIOSK_PIXEL_UTILS_HAVE_NEON
+static inline uint32x4_t
+unpremultiply_channel_neon (uint32x4_t  channel,
+                            uint32x4_t  bias,
+                            float32x4_t reciprocal)
+{
+        uint32x4_t numerator;
+        float32x4_t value;
+
+        numerator = vaddq_u32 (vsubq_u32 (vshlq_n_u32 (channel, 8), channel), bias);
+        value = vaddq_f32 (vcvtq_f32_u32 (numerator), vdupq_n_f32 (0.5f));
+
+        return vcvtq_u32_f32 (vmulq_f32 (value, reciprocal));
+}
+
+static void
+unpremultiply_row_neon (guint8        *dest,
+                        const guint32 *src,
+                        int            width)
+{
+        const uint32x4_t mask = vdupq_n_u32 (0xff);
+        int x;
+
+        for (x = 0; x + 4 <= width; x += 4) {
+                uint32x4_t pixels = vld1q_u32 (src + x);
+                uint32x4_t alpha = vshrq_n_u32 (pixels, 24);
+                uint32x4_t bias = vshrq_n_u32 (alpha, 1);
+                float lanes[4] = {
+                        reciprocals[src[x + 0] >> 24],
+                        reciprocals[src[x + 1] >> 24],
+                        reciprocals[src[x + 2] >> 24],
+                        reciprocals[src[x + 3] >> 24],
+                };
+                float32x4_t reciprocal = vld1q_f32 (lanes);
+                uint32x4_t red, green, blue, result;
+
+                red = unpremultiply_channel_neon (vandq_u32 (vshrq_n_u32 (pixels, 16), mask),
+                                                  bias, reciprocal);
+                green = unpremultiply_channel_neon (vandq_u32 (vshrq_n_u32 (pixels, 8), mask),
+                                                    bias, reciprocal);
+                blue = unpremultiply_channel_neon (vandq_u32 (pixels, mask),
+                                                   bias, reciprocal);
+
+                result = vandq_u32 (red, mask);
+                result = vorrq_u32 (result, vshlq_n_u32 (vandq_u32 (green, mask), 8));
+                result = vorrq_u32 (result, vshlq_n_u32 (vandq_u32 (blue, mask), 16));
+                result = vorrq_u32 (result, vshlq_n_u32 (alpha, 24));
+
+                vst1q_u8 (dest + x * 4, vreinterpretq_u8_u32 (result));
+        }
+
+        unpremultiply_row_scalar (dest + x * 4, src + x, width - x);
+}
+
+static void
+convert_no_alpha_row_neon (guint8        *dest,
+                           const guint32 *src,
+                           int            width)
+{
+        int x;
+
+        for (x = 0; x + 16 <= width; x += 16) {
+                uint8x16x4_t pixels = vld4q_u8 ((const uint8_t *) (src + x));
+                uint8x16x3_t rgb;
+
+                rgb.val[0] = pixels.val[2];
+                rgb.val[1] = pixels.val[1];
+                rgb.val[2] = pixels.val[0];
+
+                vst3q_u8 (dest + x * 3, rgb);
+        }
+
+        convert_no_alpha_row_scalar (dest + x * 3, src + x, width - x);
+}
+
+static void
+accumulate_row_neon (guint32      *sums,
+                     const guint8 *src,
+                     int           length)
+{
+        int i;
+
+        for (i = 0; i + 16 <= length; i += 16) {
+                uint8x16_t bytes = vld1q_u8 (src + i);
+                uint16x8_t low = vmovl_u8 (vget_low_u8 (bytes));
+                uint16x8_t high = vmovl_u8 (vget_high_u8 (bytes));
+
+                vst1q_u32 (sums + i + 0, vaddw_u16 (vld1q_u32 (sums + i + 0), vget_low_u16 (low)));
+                vst1q_u32 (sums + i + 4, vaddw_u16 (vld1q_u32 (sums + i + 4), vget_high_u16 (low)));
+                vst1q_u32 (sums + i + 8, vaddw_u16 (vld1q_u32 (sums + i + 8), vget_low_u16 (high)));
+                vst1q_u32 (sums + i + 12, vaddw_u16 (vld1q_u32 (sums + i + 12), vget_high_u16 (high)));
+        }
+
+        accumulate_row_scalar (sums + i, src + i, length - i);
+}
+#endif
+
+static void
+add_kernels (const char               *name,
+             KioskPixelRowFunc         unpremultiply_row,
+             KioskPixelRowFunc         convert_no_alpha_row,
+             KioskPixelAccumulateFunc  accumulate_row)
+{
+        KioskPixelKernels *kernel_set;
+
+        g_assert (number_of_supported_kernels < KIOSK_PIXEL_UTILS_MAX_KERNELS);
+
+        kernel_set = &supported_kernels[number_of_supported_kernels++];
+        kernel_set->name = name;
+        kernel_set->unpremultiply_row = unpremultiply_row;
+        kernel_set->convert_no_alpha_row = convert_no_alpha_row;
+        kernel_set->accumulate_row = accumulate_row;
+}
+
+static void
+initialize_kernels (void)
+{
+        static gsize initialized = 0;
+        int alpha;
+
+        if (!g_once_init_enter (&initialized))
+                return;
+
+        reciprocals[0] = 0.0f;
+        for (alpha = 1; alpha < 256; alpha++)
+                reciprocals[alpha] = 1.0f / (float) alpha;
+
+        /* Ordered from slowest to fastest, the last one gets used */
+        add_kernels ("scalar",
+                     unpremultiply_row_scalar,
+                     convert_no_alpha_row_scalar,
+                     accumulate_row_scalar);
+
+#ifdef KIOSK_PIXEL_UTILS_HAVE_X86
+        if (__builtin_cpu_supports ("sse4.1")) {
+                add_kernels ("SSE4.1",
+                             unpremultiply_row_sse41,
+                             convert_no_alpha_row_sse41,
+                             accumulate_row_sse41);
+        }
+
+        if (__builtin_cpu_supports ("avx2")) {
+                add_kernels ("AVX2",
+                             unpremultiply_row_avx2,
+                             convert_no_alpha_row_avx2,
+                             accumulate_row_avx2);
+        }
+#endif
+
+#ifdef KIOSK_PIXEL_UTILS_HAVE_NEON
+        add_kernels ("NEON",
+                     unpremultiply_row_neon,
+                     convert_no_alpha_row_neon,
+                     accumulate_row_neon);
+#endif
+
+        kernels = &supported_kernels[number_of_supported_kernels - 1];
+
+        g_debug ("KioskPixelUtils: Using %s pixel conversion kernels", kernels->name);
+
+        g_once_init_leave (&initialized, 1);
+}
+
+/**
+ * kiosk_pixel_utils_get_kernels:
+ * @number_of_kernels: (out): the number of kernel sets returned
+ *
+ * Gets every set of row kernels the CPU supports, starting with the
+ * scalar reference kernels and ending with the ones in use.
+ *
+ * Returns: (transfer none) (array length=number_of_kernels): the kernel sets
+ */
+const KioskPixelKernels *
+kiosk_pixel_utils_get_kernels (int *number_of_kernels)
+{
+        initialize_kernels ();
+
+        *number_of_kernels = number_of_supported_kernels;
+        return supported_kernels;
+}
+
+/**
+ * kiosk_pixel_utils_unpremultiply_argb32_to_rgba:
+ * @dest_data: the RGBA destination pixels
+ * @dest_stride: the destination row stride in bytes
+ * @src_data: the native endian premultiplied ARGB32 source pixels
+ * @src_stride: the source row stride in bytes
+ * @width: the number of pixels per row
+ * @height: the number of rows
+ *
+ * Converts premultiplied cairo ARGB32 pixels to the non-premultiplied
+ * RGBA byte order used by #GdkPixbuf, using the fastest kernel the
+ * CPU supports.
+ */
+void
+kiosk_pixel_utils_unpremultiply_argb32_to_rgba (guint8       *dest_data,
+                                                int           dest_stride,
+                                                const guint8 *src_data,
+                                                int           src_stride,
+                                                int           width,
+                                                int           height)
+{
+        int y;
+
+        initialize_kernels ();
+
+        for (y = 0; y < height; y++) {
+                kernels->unpremultiply_row (dest_data, (const guint32 *) src_data, width);
+
+                src_data += src_stride;
+                dest_data += dest_stride;
+        }
+}
+
+/**
+ * kiosk_pixel_utils_convert_xrgb32_to_rgb:
+ * @dest_data: the RGB destination pixels
+ * @dest_stride: the destination row stride in bytes
+ * @src_data: the native endian XRGB32 source pixels
+ * @src_stride: the source row stride in bytes
+ * @width: the number of pixels per row
+ * @height: the number of rows
+ *
+ * Packs cairo RGB24/ARGB32 pixels into the 3 byte RGB order used by
+ * #GdkPixbuf, dropping the alpha byte.
+ */
+void
+kiosk_pixel_utils_convert_xrgb32_to_rgb (guint8       *dest_data,
+                                         int           dest_stride,
+                                         const guint8 *src_data,
+                                         int           src_stride,
+                                         int           width,
+                                         int           height)
+{
+        int y;
+
+        initialize_kernels ();
+
+        for (y = 0; y < height; y++) {
+                kernels->convert_no_alpha_row (dest_data, (const guint32 *) src_data, width);
+
+                src_data += src_stride;
+                dest_data += dest_stride;
+        }
+}
+
+/**
+ * kiosk_pixel_utils_downscale_argb32:
+ * @dest_data: the destination pixels
+ * @dest_stride: the destination row stride in bytes
+ * @dest_width: the destination width, at most @src_width
+ * @dest_height: the destination height, at most @src_height
+ * @src_data: the source pixels
+ * @src_stride: the source row stride in bytes
+ * @src_width: the source width
+ * @src_height: the source height
+ *
+ * Shrinks 32-bit pixels with a box filter: every destination pixel is
+ * the average of the block of source pixels it covers. The four bytes
+ * of a pixel are averaged independently, so this is correct for
+ * premultiplied ARGB32 as is.
+ */
+void
+kiosk_pixel_utils_downscale_argb32 (guint8       *dest_data,
+                                    int           dest_stride,
+                                    int           dest_width,
+                                    int           dest_height,
+                                    const guint8 *src_data,
+                                    int           src_stride,
+                                    int           src_width,
+                                    int           src_height)
+{
+        g_autofree guint32 *sums = NULL;
+        g_autofree int *column_starts = NULL;
+        int x, y;
+
+        g_return_if_fail (dest_width > 0 && dest_width <= src_width);
+        g_return_if_fail (dest_height > 0 && dest_height <= src_height);
+
+        initialize_kernels ();
+
+        sums = g_new (guint32, (gsize) src_width * 4);
+        column_starts = g_new (int, dest_width + 1);
+
+        for (x = 0; x <= dest_width; x++)
+                column_starts[x] = (int) ((gint64) x * src_width / dest_width);
+
+        for (y = 0; y < dest_height; y++) {
+                int first_row = (int) ((gint64) y * src_height / dest_height);
+                int last_row = (int) ((gint64) (y + 1) * src_height / dest_height);
+                guint8 *dest = dest_data + (gsize) y * dest_stride;
+                int row;
+
+                /* Sum the rows of the block column wise first, that is the
+                 * bulk of the work, then add up the columns of each block
+                 */
+                memset (sums, 0, (gsize) src_width * 4 * sizeof (guint32));
+                for (row = first_row; row < last_row; row++)
+                        kernels->accumulate_row (sums, src_data + (gsize) row * src_stride, src_width * 4);
+
+                for (x = 0; x < dest_width; x++) {
+                        int first_column = column_starts[x];
+                        int last_column = column_starts[x + 1];
+                        guint64 count = (guint64) (last_column - first_column) * (last_row - first_row);
+                        guint64 totals[4] = { 0, };
+                        int column, channel;
+
+                        for (column = first_column; column < last_column; column++) {
+                                for (channel = 0; channel < 4; channel++)
+                                        totals[channel] += sums[column * 4 + channel];
+                        }
+
+                        for (channel = 0; channel < 4; channel++)
+                                dest[x * 4 + channel] = (guint8) ((totals[channel] + count / 2) / count);
+                }
+        }
+}
+
+/* XXH64, fed incrementally since a tile is made of many short rows */
+#define XXH64_PRIME_1 G_GUINT64_CONSTANT (11400714785074694791)
+#define XXH64_PRIME_2 G_GUINT64_CONSTANT (14029467366897019727)
+#define XXH64_PRIME_3 G_GUINT64_CONSTANT (1609587929392839161)
+#define XXH64_PRIME_4 G_GUINT64_CONSTANT (9650029242287828579)
+#define XXH64_PRIME_5 G_GUINT64_CONSTANT (2870177450012600261)
+#define XXH64_STRIPE_SIZE 32
+
+typedef struct
+{
+        guint64 accumulators[4];
+        guint64 total_length;
+        guint8  buffer[XXH64_STRIPE_SIZE];
+        gsize   buffer_length;
+} KioskXxh64State;
+
+static inline guint64
+xxh64_rotate_left (guint64 value,
+                   int     bits)
+{
+        return (value << bits) | (value >> (64 - bits));
+}
+
+static inline guint64
+xxh64_read64 (const guint8 *data)
+{
+        guint64 value;
+
+        memcpy (&value, data, sizeof (value));
+        return GUINT64_FROM_LE (value);
+}
+
+static inline guint32
+xxh64_read32 (const guint8 *data)
+{
+        guint32 value;
+
+        memcpy (&value, data, sizeof (value));
+        return GUINT32_FROM_LE (value);
+}
+
+static inline guint64
+xxh64_round (guint64 accumulator,
+             guint64 input)
+{
+        accumulator += input * XXH64_PRIME_2;
+        accumulator = xxh64_rotate_left (accumulator, 31);
+        return accumulator * XXH64_PRIME_1;
+}
+
+static inline guint64
+xxh64_merge_round (guint64 accumulator,
+                   guint64 value)
+{
+        accumulator ^= xxh64_round (0, value);
+        return accumulator * XXH64_PRIME_1 + XXH64_PRIME_4;
+}
+
+static void
+xxh64_reset (KioskXxh64State *state)
+{
+        memset (state, 0, sizeof (*state));
+        state->accumulators[0] = XXH64_PRIME_1 + XXH64_PRIME_2;
+        state->accumulators[1] = XXH64_PRIME_2;
+        state->accumulators[2] = 0;
+        state->accumulators[3] = -XXH64_PRIME_1;
+}
+
+static inline void
+xxh64_consume_stripe (KioskXxh64State *state,
+                      const guint8    *stripe)
+{
+        state->accumulators[0] = xxh64_round (state->accumulators[0], xxh64_read64 (stripe + 0));
+        state->accumulators[1] = xxh64_round (state->accumulators[1], xxh64_read64 (stripe + 8));
+        state->accumulators[2] = xxh64_round (state->accumulators[2], xxh64_read64 (stripe + 16));
+        state->accumulators[3] = xxh64_round (state->accumulators[3], xxh64_read64 (stripe + 24));
+}
+
+static void
+xxh64_update (KioskXxh64State *state,
+              const guint8    *data,
+              gsize            length)
+{
+        state->total_length += length;
+
+        if (state->buffer_length > 0) {
+                gsize needed = XXH64_STRIPE_SIZE - state->buffer_length;
+
+                if (length < needed) {
+                        memcpy (state->buffer + state->buffer_length, data, length);
+                        state->buffer_length += length;
+                        return;
+                }
+
+                memcpy (state->buffer + state->buffer_length, data, needed);
+                xxh64_consume_stripe (state, state->buffer);
+                state->buffer_length = 0;
+                data += needed;
+                length -= needed;
+        }
+
+        while (length >= XXH64_STRIPE_SIZE) {
+                xxh64_consume_stripe (state, data);
+                data += XXH64_STRIPE_SIZE;
+                length -= XXH64_STRIPE_SIZE;
+        }
+
+        memcpy (state->buffer, data, length);
+        state->buffer_length = length;
+}
+
+static guint64
+xxh64_digest (const KioskXxh64State *state)
+{
+        const guint8 *data = state->buffer;
+        gsize length = state->buffer_length;
+        guint64 hash;
+
+        if (state->total_length >= XXH64_STRIPE_SIZE) {
+                hash = xxh64_rotate_left (state->accumulators[0], 1) +
+                       xxh64_rotate_left (state->accumulators[1], 7) +
+                       xxh64_rotate_left (state->accumulators[2], 12) +
+                       xxh64_rotate_left (state->accumulators[3], 18);
+                hash = xxh64_merge_round (hash, state->accumulators[0]);
+                hash = xxh64_merge_round (hash, state->accumulators[1]);
+                hash = xxh64_merge_round (hash, state->accumulators[2]);
+                hash = xxh64_merge_round (hash, state->accumulators[3]);
+        } else {
+                hash = state->accumulators[2] + XXH64_PRIME_5;
+        }
+
+        hash += state->total_length;
+
+        for (; length >= 8; data += 8, length -= 8) {
+                hash ^= xxh64_round (0, xxh64_read64 (data));
+                hash = xxh64_rotate_left (hash, 27) * XXH64_PRIME_1 + XXH64_PRIME_4;
+        }
+
+        if (length >= 4) {
+                hash ^= (guint64) xxh64_read32 (data) * XXH64_PRIME_1;
+                hash = xxh64_rotate_left (hash, 23) * XXH64_PRIME_2 + XXH64_PRIME_3;
+                data += 4;
+                length -= 4;
+        }
+
+        for (; length > 0; data++, length--) {
+                hash ^= *data * XXH64_PRIME_5;
+                hash = xxh64_rotate_left (hash, 11) * XXH64_PRIME_1;
+        }
+
+        hash ^= hash >> 33;
+        hash *= XXH64_PRIME_2;
+        hash ^= hash >> 29;
+        hash *= XXH64_PRIME_3;
+        hash ^= hash >> 32;
+
+        return hash;
+}
+
+/**
+ * kiosk_pixel_utils_hash_tiles:
+ * @data: the 32-bit pixels
+ * @stride: the row stride in bytes
+ * @width: the width of the image
+ * @height: the height of the image
+ * @tile_size: the width and height of a tile
+ * @hashes: (out caller-allocates): return location for one hash per
+ *   tile, in row major order
+ *
+ * Splits the image into @tile_size x @tile_size tiles (smaller ones on
+ * the right and bottom edges) and computes the XXH64 hash of the pixels
+ * of each. The image is walked row by row, so the memory is read
+ * sequentially once.
+ *
+ * Returns: the number of tiles per row
+ */
+int
+kiosk_pixel_utils_hash_tiles (const guint8 *data,
+                              int           stride,
+                              int           width,
+                              int           height,
+                              int           tile_size,
+                              guint64      *hashes)
+{
+        g_autofree KioskXxh64State *states = NULL;
+        int columns;
+        int y;
+
+        g_return_val_if_fail (tile_size > 0, 0);
+
+        columns = (width + tile_size - 1) / tile_size;
+        states = g_new (KioskXxh64State, columns);
+
+        for (y = 0; y < height; y++) {
+                const guint8 *row = data + (gsize) y * stride;
+                int column;
+
+                if (y % tile_size == 0) {
+                        for (column = 0; column < columns; column++)
+                                xxh64_reset (&states[column]);
+                }
+
+                for (column = 0; column < columns; column++) {
+                        int x = column * tile_size;
+                        int tile_width = MIN (tile_size, width - x);
+
+                        xxh64_update (&states[column], row + (gsize) x * 4, (gsize) tile_width * 4);
+                }
+
+                if (y % tile_size == tile_size - 1 || y == height - 1) {
+                        guint64 *tile_hashes = hashes + (gsize) (y / tile_size) * columns;
+
+                        for (column = 0; column < columns; column++)
+                                tile_hashes[column] = xxh64_digest (&states[column]);
+                }
+        }
+
+        return columns;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+void kiosk_pixel_utils_unpremultiply_argb32_to_rgba (guint8       *dest_data,
+                                                     int           dest_stride,
+                                                     const guint8 *src_data,
+                                                     int           src_stride,
+                                                     int           width,
+                                                     int           height);
+void kiosk_pixel_utils_convert_xrgb32_to_rgb (guint8       *dest_data,
+                                              int           dest_stride,
+                                              const guint8 *src_data,
+                                              int           src_stride,
+                                              int           width,
+                                              int           height);
+void kiosk_pixel_utils_downscale_argb32 (guint8       *dest_data,
+                                         int           dest_stride,
+                                         int           dest_width,
+                                         int           dest_height,
+                                         const guint8 *src_data,
+                                         int           src_stride,
+                                         int           src_width,
+                                         int           src_height);
+int  kiosk_pixel_utils_hash_tiles (const guint8 *data,
+                                  int           stride,
+                                  int           width,
+                                  int           height,
+                                  int           tile_size,
+                                  guint64      *hashes);
+
+G_END_DECLS
@@ -0,0 +1,621 @@
+#include "config.h"
+#include "kiosk-png-encoder.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+
+#include "kiosk-pixel-utils.h"
+
+/* The encoder works like pigz: the image is split into bands of rows, each
+ * band is filtered and deflated on its own in a thread pool, and the
+ * resulting raw deflate streams are stitched together into one zlib stream.
+ *
+ * Every band except the last ends with a sync flush, so it stops on a byte
+ * boundary without a final block, and every band except the first is primed
+ * with the last 32KiB of filtered data before it as a deflate dictionary, so
+ * matches can still reach back across band boundaries. The per band adler32
+ * checksums are combined for the zlib trailer.
+ */
+
+#define PNG_BAND_SIZE (256 * 1024) /* uncompressed bytes */
+#define DEFLATE_WINDOW_SIZE 32768
+#define DEFLATE_OUTPUT_INCREMENT 16384
+
+typedef enum
+{
+        PNG_FILTER_NONE = 0,
+        PNG_FILTER_SUB,
+        PNG_FILTER_UP,
+        PNG_FILTER_AVERAGE,
+        PNG_FILTER_PAETH,
+        NUMBER_OF_PNG_FILTERS
+} PngFilter;
+
+typedef struct _KioskPngEncode KioskPngEncode;
+
+typedef struct
+{
+        KioskPngEncode *encode;
+        int             index;
+        int             first_row;
+        int             last_row;
+
+        GByteArray     *output;
+        gulong          adler;
+        gsize           length;
+
+        gboolean        done;
+        gboolean        failed;
+} KioskPngBand;
+
+struct _KioskPngEncode
+{
+        const guint8 *pixels;
+        int           stride;
+        int           width;
+        int           height;
+        gboolean      has_alpha;
+        int           bytes_per_pixel;
+        gsize         row_length;
+        int           compression_level;
+
+        GMutex        mutex;
+        GCond         cond;
+        gboolean      cancelled;
+
+        KioskPngBand *bands;
+        int           number_of_bands;
+};
+
+static const guint8 png_signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+static void
+convert_row (KioskPngEncode *encode,
+             int             y,
+             guint8         *row)
+{
+        const guint8 *pixels = encode->pixels + (gsize) y * encode->stride;
+
+        if (encode->has_alpha)
+                kiosk_pixel_utils_unpremultiply_argb32_to_rgba (row, 0, pixels, 0, encode->width, 1);
+        else
+                kiosk_pixel_utils_convert_xrgb32_to_rgb (row, 0, pixels, 0, encode->width, 1);
+}
+
+static guint8
+paeth_predictor (guint8 left,
+                 guint8 up,
+                 guint8 up_left)
+{
+        int prediction = left + up - up_left;
+        int left_distance = abs (prediction - left);
+        int up_distance = abs (prediction - up);
+        int up_left_distance = abs (prediction - up_left);
+
+        if (left_distance <= up_distance && left_distance <= up_left_distance)
+                return left;
+
+        if (up_distance <= up_left_distance)
+                return up;
+
+        return up_left;
+}
+
+static gsize
+apply_filter (PngFilter     filter,
+              guint8       *output,
+              const guint8 *row,
+              const guint8 *previous_row,
+              gsize         length,
+              int           bytes_per_pixel)
+{
+        gsize left_edge = MIN ((gsize) bytes_per_pixel, length);
+        gsize sum = 0;
+        gsize i;
+
+        output[0] = filter;
+        output++;
+
+        switch (filter) {
+        case PNG_FILTER_NONE:
+                memcpy (output, row, length);
+                break;
+        case PNG_FILTER_SUB:
+                memcpy (output, row, left_edge);
+                for (i = left_edge; i < length; i++)
+                        output[i] = row[i] - row[i - bytes_per_pixel];
+                break;
+        case PNG_FILTER_UP:
+                for (i = 0; i < length; i++)
+                        output[i] = row[i] - previous_row[i];
+                break;
+        case PNG_FILTER_AVERAGE:
+                for (i = 0; i < left_edge; i++)
+                        output[i] = row[i] - (previous_row[i] >> 1);
+                for (i = left_edge; i < length; i++)
+                        output[i] = row[i] - ((row[i - bytes_per_pixel] + previous_row[i]) >> 1);
+                break;
+        case PNG_FILTER_PAETH:
+        default:
+                for (i = 0; i < left_edge; i++)
+                        output[i] = row[i] - previous_row[i];
+                for (i = left_edge; i < length; i++)
+                        output[i] = row[i] - paeth_predictor (row[i - bytes_per_pixel],
+                                                              previous_row[i],
+                                                              previous_row[i - bytes_per_pixel]);
+                break;
+        }
+
+        /* Same heuristic as libpng: treat the filtered bytes as signed and
+         * prefer the filter with the smallest sum of absolute values
+         */
+        for (i = 0; i < length; i++)
+                sum += abs ((signed char) output[i]);
+
+        return sum;
+}
+
+static void
+filter_row (KioskPngEncode *encode,
+            guint8         *output,
+            const guint8   *row,
+            const guint8   *previous_row,
+            guint8         *candidate)
+{
+        gsize length = encode->row_length - 1;
+        gsize best_sum = G_MAXSIZE;
+        PngFilter filter;
+
+        /* Without compression there is nothing to gain from filtering, and
+         * for fast levels Sub alone gets most of the benefit for screen
+         * content at a fraction of the cost
+         */
+        if (encode->compression_level == KIOSK_PNG_ENCODER_COMPRESSION_LEVEL_NONE) {
+                apply_filter (PNG_FILTER_NONE, output, row, previous_row, length, encode->bytes_per_pixel);
+                return;
+        }
+
+        if (encode->compression_level > 0 && encode->compression_level <= 3) {
+                apply_filter (PNG_FILTER_SUB, output, row, previous_row, length, encode->bytes_per_pixel);
+                return;
+        }
+
+        for (filter = PNG_FILTER_NONE; filter < NUMBER_OF_PNG_FILTERS; filter++) {
+                gsize sum;
+
+                sum = apply_filter (filter, candidate, row, previous_row, length, encode->bytes_per_pixel);
+
+                if (sum < best_sum) {
+                        best_sum = sum;
+                        memcpy (output, candidate, encode->row_length);
+                }
+        }
+}
+
+static gboolean
+deflate_band (KioskPngBand *band,
+              const guint8 *dictionary,
+              gsize         dictionary_length,
+              const guint8 *data,
+              gsize         length)
+{
+        KioskPngEncode *encode = band->encode;
+        gboolean is_last_band = band->index == encode->number_of_bands - 1;
+        z_stream stream = { 0 };
+        int strategy;
+        int flush;
+        int status = Z_OK;
+        gsize offset;
+
+        strategy = encode->compression_level == KIOSK_PNG_ENCODER_COMPRESSION_LEVEL_NONE ? Z_DEFAULT_STRATEGY : Z_FILTERED;
+        if (deflateInit2 (&stream, encode->compression_level, Z_DEFLATED, -15, 8, strategy) != Z_OK)
+                return FALSE;
+
+        if (dictionary_length > 0)
+                deflateSetDictionary (&stream, dictionary, (uInt) dictionary_length);
+
+        offset = band->output->len;
+        g_byte_array_set_size (band->output, offset + deflateBound (&stream, length) + DEFLATE_OUTPUT_INCREMENT);
+
+        stream.next_in = (Bytef *) data;
+        stream.avail_in = (uInt) length;
+        flush = is_last_band ? Z_FINISH : Z_SYNC_FLUSH;
+
+        while (TRUE) {
+                stream.next_out = band->output->data + offset;
+                stream.avail_out = (uInt) (band->output->len - offset);
+
+                status = deflate (&stream, flush);
+                offset = band->output->len - stream.avail_out;
+
+                if (status == Z_STREAM_END)
+                        break;
+
+                if (status != Z_OK)
+                        break;
+
+                /* A sync flush is complete once deflate stops filling up
+                 * the whole output buffer
+                 */
+                if (!is_last_band && stream.avail_out > 0)
+                        break;
+
+                g_byte_array_set_size (band->output, band->output->len + DEFLATE_OUTPUT_INCREMENT);
+        }
+
+        deflateEnd (&stream);
+
+        g_byte_array_set_size (band->output, offset);
+
+        if (is_last_band)
+                return status == Z_STREAM_END;
+
+        return status == Z_OK;
+}
+
+static void
+encode_band (KioskPngBand *band,
+             gpointer      user_data)
+{
+        KioskPngEncode *encode = band->encode;
+        g_autofree guint8 *filtered = NULL;
+        g_autofree guint8 *scratch = NULL;
+        guint8 *previous_row, *row, *candidate;
+        int dictionary_rows = 0;
+        int first_row;
+        gsize dictionary_length;
+        gsize length;
+        gboolean cancelled;
+        gboolean succeeded = FALSE;
+        int y;
+
+        g_mutex_lock (&encode->mutex);
+        cancelled = encode->cancelled;
+        g_mutex_unlock (&encode->mutex);
+
+        if (cancelled)
+                goto out;
+
+        /* Filter a few extra rows in front of the band to use as dictionary,
+         * rather than waiting on the band before us to do it
+         */
+        if (band->first_row > 0) {
+                dictionary_rows = (int) ((DEFLATE_WINDOW_SIZE + encode->row_length - 1) / encode->row_length);
+                dictionary_rows = MIN (dictionary_rows, band->first_row);
+        }
+        first_row = band->first_row - dictionary_rows;
+
+        filtered = g_malloc ((gsize) (band->last_row - first_row) * encode->row_length);
+        scratch = g_malloc0 (3 * encode->row_length);
+        previous_row = scratch;
+        row = scratch + encode->row_length;
+        candidate = scratch + 2 * encode->row_length;
+
+        if (first_row > 0)
+                convert_row (encode, first_row - 1, previous_row);
+
+        for (y = first_row; y < band->last_row; y++) {
+                guint8 *swap;
+
+                convert_row (encode, y, row);
+                filter_row (encode,
+                            filtered + (gsize) (y - first_row) * encode->row_length,
+                            row, previous_row, candidate);
+
+                swap = previous_row;
+                previous_row = row;
+                row = swap;
+        }
+
+        dictionary_length = (gsize) dictionary_rows * encode->row_length;
+        length = (gsize) (band->last_row - band->first_row) * encode->row_length;
+
+        band->length = length;
+        band->adler = adler32 (adler32 (0, NULL, 0), filtered + dictionary_length, (uInt) length);
+
+        if (dictionary_length > DEFLATE_WINDOW_SIZE) {
+                gsize excess = dictionary_length - DEFLATE_WINDOW_SIZE;
+
+                succeeded = deflate_band (band,
+                                          filtered + excess,
+                                          DEFLATE_WINDOW_SIZE,
+                                          filtered + dictionary_length,
+                                          length);
+        } else {
+                succeeded = deflate_band (band,
+                                          filtered,
+                                          dictionary_length,
+                                          filtered + dictionary_length,
+                                          length);
+        }
+
+out:
+        g_mutex_lock (&encode->mutex);
+        band->failed = !succeeded;
+        band->done = TRUE;
+        g_cond_broadcast (&encode->cond);
+        g_mutex_unlock (&encode->mutex);
+}
+
+static GThreadPool *
+get_thread_pool (void)
+{
+        static gsize initialized = 0;
+        static GThreadPool *thread_pool = NULL;
+
+        if (g_once_init_enter (&initialized)) {
+                thread_pool = g_thread_pool_new ((GFunc) encode_band,
+                                                 NULL,
+                                                 (int) g_get_num_processors (),
+                                                 FALSE,
+                                                 NULL);
+                g_once_init_leave (&initialized, 1);
+        }
+
+        return thread_pool;
+}
+
+static void
+write_uint32 (guint8  *data,
+              guint32  value)
+{
+        data[0] = (value >> 24) & 0xff;
+        data[1] = (value >> 16) & 0xff;
+        data[2] = (value >> 8) & 0xff;
+        data[3] = value & 0xff;
+}
+
+static gboolean
+write_chunk (GOutputStream *stream,
+             const char    *type,
+             const guint8  *data,
+             gsize          length,
+             GCancellable  *cancellable,
+             GError       **error)
+{
+        guint8 header[8];
+        guint8 footer[4];
+        gulong crc;
+
+        write_uint32 (header, (guint32) length);
+        memcpy (header + 4, type, 4);
+
+        /* crc32() restarts when handed a NULL buffer, so skip it for
+         * empty chunks
+         */
+        crc = crc32 (0, (const Bytef *) type, 4);
+        if (length > 0)
+                crc = crc32 (crc, data, (uInt) length);
+        write_uint32 (footer, (guint32) crc);
+
+        if (!g_output_stream_write_all (stream, header, sizeof (header), NULL, cancellable, error))
+                return FALSE;
+
+        if (length > 0 && !g_output_stream_write_all (stream, data, length, NULL, cancellable, error))
+                return FALSE;
+
+        return g_output_stream_write_all (stream, footer, sizeof (footer), NULL, cancellable, error);
+}
+
+static gboolean
+write_text_chunk (GOutputStream *stream,
+                  const char    *key,
+                  const char    *value,
+                  GCancellable  *cancellable,
+                  GError       **error)
+{
+        g_autoptr (GByteArray) data = NULL;
+        g_autofree char *latin1_value = NULL;
+        gsize latin1_length = 0;
+
+        data = g_byte_array_new ();
+        g_byte_array_append (data, (const guint8 *) key, strlen (key) + 1);
+
+        latin1_value = g_convert (value, -1, "ISO-8859-1", "UTF-8", NULL, &latin1_length, NULL);
+
+        if (latin1_value != NULL) {
+                g_byte_array_append (data, (const guint8 *) latin1_value, latin1_length);
+                return write_chunk (stream, "tEXt", data->data, data->len, cancellable, error);
+        }
+
+        /* Uncompressed, no language tag, no translated keyword */
+        g_byte_array_append (data, (const guint8 *) "\0\0\0", 4);
+        g_byte_array_append (data, (const guint8 *) value, strlen (value));
+
+        return write_chunk (stream, "iTXt", data->data, data->len, cancellable, error);
+}
+
+static gboolean
+write_header (KioskPngEncode     *encode,
+              GOutputStream      *stream,
+              const char * const *text_chunks,
+              GCancellable       *cancellable,
+              GError            **error)
+{
+        guint8 header[13];
+        gsize i;
+
+        if (!g_output_stream_write_all (stream, png_signature, sizeof (png_signature), NULL, cancellable, error))
+                return FALSE;
+
+        write_uint32 (header, encode->width);
+        write_uint32 (header + 4, encode->height);
+        header[8] = 8;                              /* bit depth */
+        header[9] = encode->has_alpha ? 6 : 2;      /* RGBA or RGB */
+        header[10] = 0;                             /* deflate */
+        header[11] = 0;                             /* adaptive filtering */
+        header[12] = 0;                             /* no interlacing */
+
+        if (!write_chunk (stream, "IHDR", header, sizeof (header), cancellable, error))
+                return FALSE;
+
+        for (i = 0; text_chunks != NULL && text_chunks[i] != NULL && text_chunks[i + 1] != NULL; i += 2) {
+                if (!write_text_chunk (stream, text_chunks[i], text_chunks[i + 1], cancellable, error))
+                        return FALSE;
+        }
+
+        return TRUE;
+}
+
+static gboolean
+write_image_data (KioskPngEncode *encode,
+                  GOutputStream  *stream,
+                  GCancellable   *cancellable,
+                  GError        **error)
+{
+        gulong adler = adler32 (0, NULL, 0);
+        int i;
+
+        for (i = 0; i < encode->number_of_bands; i++) {
+                KioskPngBand *band = &encode->bands[i];
+                gboolean failed;
+
+                g_mutex_lock (&encode->mutex);
+                while (!band->done)
+                        g_cond_wait (&encode->cond, &encode->mutex);
+                failed = band->failed;
+                g_mutex_unlock (&encode->mutex);
+
+                if (failed) {
+                        g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                                     "Compressing image data failed");
+                        return FALSE;
+                }
+
+                adler = adler32_combine (adler, band->adler, (z_off_t) band->length);
+
+                if (i == encode->number_of_bands - 1) {
+                        guint8 trailer[4];
+
+                        write_uint32 (trailer, (guint32) adler);
+                        g_byte_array_append (band->output, trailer, sizeof (trailer));
+                }
+
+                if (!write_chunk (stream, "IDAT", band->output->data, band->output->len, cancellable, error))
+                        return FALSE;
+
+                g_clear_pointer (&band->output, g_byte_array_unref);
+        }
+
+        return TRUE;
+}
+
+/**
+ * kiosk_png_encoder_write_surface:
+ * @surface: an ARGB32 or RGB24 image surface
+ * @stream: the stream to write the png image to
+ * @compression_level: the zlib compression level, from
+ *   %KIOSK_PNG_ENCODER_COMPRESSION_LEVEL_NONE (stored) to
+ *   %KIOSK_PNG_ENCODER_COMPRESSION_LEVEL_BEST, or
+ *   %KIOSK_PNG_ENCODER_COMPRESSION_LEVEL_DEFAULT
+ * @text_chunks: (nullable): %NULL terminated list of key, value pairs to
+ *   add as text chunks
+ * @cancellable: a #GCancellable
+ * @error: #GError for error reporting
+ *
+ * Encodes @surface as png image straight from the cairo pixels, deflating
+ * bands of rows in parallel. This blocks until the whole image is written,
+ * so it is meant to be called from a worker thread.
+ *
+ * Returns: whether the image was written successfully
+ */
+gboolean
+kiosk_png_encoder_write_surface (cairo_surface_t    *surface,
+                                 GOutputStream      *stream,
+                                 int                 compression_level,
+                                 const char * const *text_chunks,
+                                 GCancellable       *cancellable,
+                                 GError            **error)
+{
+        static const guint8 zlib_header[] = { 0x78, 0x01 };
+        KioskPngEncode encode = { 0 };
+        cairo_format_t format;
+        int rows_per_band;
+        gboolean succeeded;
+        int i;
+
+        g_return_val_if_fail (surface != NULL, FALSE);
+        g_return_val_if_fail (G_IS_OUTPUT_STREAM (stream), FALSE);
+        g_return_val_if_fail (compression_level >= KIOSK_PNG_ENCODER_COMPRESSION_LEVEL_DEFAULT &&
+                              compression_level <= KIOSK_PNG_ENCODER_COMPRESSION_LEVEL_BEST, FALSE);
+
+        format = cairo_image_surface_get_format (surface);
+        if (cairo_surface_get_type (surface) != CAIRO_SURFACE_TYPE_IMAGE ||
+            (format != CAIRO_FORMAT_ARGB32 && format != CAIRO_FORMAT_RGB24)) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                             "Unsupported surface format for png encoding");
+                return FALSE;
+        }
+
+        cairo_surface_flush (surface);
+
+        encode.pixels = cairo_image_surface_get_data (surface);
+        encode.stride = cairo_image_surface_get_stride (surface);
+        encode.width = cairo_image_surface_get_width (surface);
+        encode.height = cairo_image_surface_get_height (surface);
+        encode.has_alpha = format == CAIRO_FORMAT_ARGB32;
+        encode.bytes_per_pixel = encode.has_alpha ? 4 : 3;
+        encode.row_length = 1 + (gsize) encode.width * encode.bytes_per_pixel;
+        encode.compression_level = compression_level;
+
+        if (encode.pixels == NULL || encode.width <= 0 || encode.height <= 0) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                             "Cannot encode an empty image");
+                return FALSE;
+        }
+
+        g_mutex_init (&encode.mutex);
+        g_cond_init (&encode.cond);
+
+        rows_per_band = (int) MAX (1, PNG_BAND_SIZE / encode.row_length);
+        encode.number_of_bands = (encode.height + rows_per_band - 1) / rows_per_band;
+        encode.bands = g_new0 (KioskPngBand, encode.number_of_bands);
+
+        for (i = 0; i < encode.number_of_bands; i++) {
+                KioskPngBand *band = &encode.bands[i];
+
+                band->encode = &encode;
+                band->index = i;
+                band->first_row = i * rows_per_band;
+                band->last_row = MIN (encode.height, band->first_row + rows_per_band);
+                band->output = g_byte_array_new ();
+
+                if (i == 0)
+                        g_byte_array_append (band->output, zlib_header, sizeof (zlib_header));
+        }
+
+        if (encode.number_of_bands == 1) {
+                encode_band (&encode.bands[0], NULL);
+        } else {
+                GThreadPool *thread_pool = get_thread_pool ();
+
+                for (i = 0; i < encode.number_of_bands; i++)
+                        g_thread_pool_push (thread_pool, &encode.bands[i], NULL);
+        }
+
+        succeeded = write_header (&encode, stream, text_chunks, cancellable, error) &&
+                    write_image_data (&encode, stream, cancellable, error) &&
+                    write_chunk (stream, "IEND", NULL, 0, cancellable, error);
+
+        /* Bands still queued or running reference the encode state, so
+         * they have to finish (or bail out early) before it goes away
+         */
+        g_mutex_lock (&encode.mutex);
+        encode.cancelled = TRUE;
+        for (i = 0; i < encode.number_of_bands; i++) {
+                while (!encode.bands[i].done)
+                        g_cond_wait (&encode.cond, &encode.mutex);
+        }
+        g_mutex_unlock (&encode.mutex);
+
+        for (i = 0; i < encode.number_of_bands; i++)
+                g_clear_pointer (&encode.bands[i].output, g_byte_array_unref);
+        g_free (encode.bands);
+
+        g_cond_clear (&encode.cond);
+        g_mutex_clear (&encode.mutex);
+
+        return succeeded;
+}
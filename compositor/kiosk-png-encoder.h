@@ -0,0 +1,21 @@
+#pragma once
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <cairo.h>
+
+G_BEGIN_DECLS
+
+#define KIOSK_PNG_ENCODER_COMPRESSION_LEVEL_DEFAULT -1
+#define KIOSK_PNG_ENCODER_COMPRESSION_LEVEL_NONE 0
+#define KIOSK_PNG_ENCODER_COMPRESSION_LEVEL_FAST 1
+#define KIOSK_PNG_ENCODER_COMPRESSION_LEVEL_BEST 9
+
+gboolean kiosk_png_encoder_write_surface (cairo_surface_t    *surface,
+                                          GOutputStream      *stream,
+                                          int                 compression_level,
+                                          const char * const *text_chunks,
+                                          GCancellable       *cancellable,
+                                          GError            **error);
+
+G_END_DECLS
@@ -0,0 +1,252 @@
+#include "config.h"
+#include "kiosk-qoi-encoder.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "kiosk-pixel-utils.h"
+
+/* A straightforward encoder for the "Quite OK Image Format"
+ * (https://qoiformat.org/qoi-specification.pdf). It is a single pass
+ * over the pixels with a 64 entry color cache and no entropy coding, so
+ * it is many times faster than deflate while still shrinking typical
+ * screen contents a lot.
+ */
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xc0
+#define QOI_OP_RGB 0xfe
+#define QOI_OP_RGBA 0xff
+
+#define QOI_MAX_RUN_LENGTH 62
+#define QOI_HEADER_SIZE 14
+#define QOI_MAX_BYTES_PER_PIXEL 5
+#define QOI_OUTPUT_FLUSH_SIZE (256 * 1024)
+
+#define QOI_COLOR_HASH(pixel) (((pixel).red * 3 + (pixel).green * 5 + (pixel).blue * 7 + (pixel).alpha * 11) % 64)
+
+typedef union
+{
+        struct
+        {
+                guint8 red;
+                guint8 green;
+                guint8 blue;
+                guint8 alpha;
+        };
+        guint32 value;
+} QoiPixel;
+
+typedef struct
+{
+        QoiPixel previous_pixel;
+        QoiPixel index[64];
+        int      run_length;
+} QoiEncodeState;
+
+static const guint8 qoi_end_marker[] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+
+static void
+write_uint32 (guint8  *data,
+              guint32  value)
+{
+        data[0] = (value >> 24) & 0xff;
+        data[1] = (value >> 16) & 0xff;
+        data[2] = (value >> 8) & 0xff;
+        data[3] = value & 0xff;
+}
+
+static gsize
+encode_row (QoiEncodeState *state,
+            const guint8   *row,
+            int             width,
+            gboolean        last_row,
+            guint8         *output)
+{
+        guint8 *position = output;
+        int x;
+
+        for (x = 0; x < width; x++) {
+                QoiPixel pixel;
+                int index_position;
+                signed char red_difference, green_difference, blue_difference;
+                signed char red_green_difference, blue_green_difference;
+
+                memcpy (&pixel, row + x * 4, sizeof (pixel));
+
+                if (pixel.value == state->previous_pixel.value) {
+                        state->run_length++;
+
+                        if (state->run_length == QOI_MAX_RUN_LENGTH ||
+                            (last_row && x == width - 1)) {
+                                *position++ = QOI_OP_RUN | (state->run_length - 1);
+                                state->run_length = 0;
+                        }
+                        continue;
+                }
+
+                if (state->run_length > 0) {
+                        *position++ = QOI_OP_RUN | (state->run_length - 1);
+                        state->run_length = 0;
+                }
+
+                index_position = QOI_COLOR_HASH (pixel);
+
+                if (state->index[index_position].value == pixel.value) {
+                        *position++ = QOI_OP_INDEX | index_position;
+                        state->previous_pixel = pixel;
+                        continue;
+                }
+
+                state->index[index_position] = pixel;
+
+                if (pixel.alpha != state->previous_pixel.alpha) {
+                        *position++ = QOI_OP_RGBA;
+                        *position++ = pixel.red;
+                        *position++ = pixel.green;
+                        *position++ = pixel.blue;
+                        *position++ = pixel.alpha;
+                        state->previous_pixel = pixel;
+                        continue;
+                }
+
+                red_difference = pixel.red - state->previous_pixel.red;
+                green_difference = pixel.green - state->previous_pixel.green;
+                blue_difference = pixel.blue - state->previous_pixel.blue;
+                red_green_difference = red_difference - green_difference;
+                blue_green_difference = blue_difference - green_difference;
+
+                if (red_difference >= -2 && red_difference <= 1 &&
+                    green_difference >= -2 && green_difference <= 1 &&
+                    blue_difference >= -2 && blue_difference <= 1) {
+                        *position++ = QOI_OP_DIFF |
+                                      (red_difference + 2) << 4 |
+                                      (green_difference + 2) << 2 |
+                                      (blue_difference + 2);
+                } else if (green_difference >= -32 && green_difference <= 31 &&
+                           red_green_difference >= -8 && red_green_difference <= 7 &&
+                           blue_green_difference >= -8 && blue_green_difference <= 7) {
+                        *position++ = QOI_OP_LUMA | (green_difference + 32);
+                        *position++ = (red_green_difference + 8) << 4 | (blue_green_difference + 8);
+                } else {
+                        *position++ = QOI_OP_RGB;
+                        *position++ = pixel.red;
+                        *position++ = pixel.green;
+                        *position++ = pixel.blue;
+                }
+
+                state->previous_pixel = pixel;
+        }
+
+        return position - output;
+}
+
+/**
+ * kiosk_qoi_encoder_write_surface:
+ * @surface: an ARGB32 or RGB24 image surface
+ * @stream: the stream to write the qoi image to
+ * @cancellable: a #GCancellable
+ * @error: #GError for error reporting
+ *
+ * Encodes @surface as qoi image, converting the cairo pixels one row at
+ * a time. This blocks until the whole image is written, so it is meant
+ * to be called from a worker thread.
+ *
+ * Returns: whether the image was written successfully
+ */
+gboolean
+kiosk_qoi_encoder_write_surface (cairo_surface_t  *surface,
+                                 GOutputStream    *stream,
+                                 GCancellable     *cancellable,
+                                 GError          **error)
+{
+        QoiEncodeState state = { 0 };
+        g_autofree guint8 *row = NULL;
+        g_autofree guint8 *output = NULL;
+        guint8 header[QOI_HEADER_SIZE];
+        const guint8 *pixels;
+        cairo_format_t format;
+        gboolean has_alpha;
+        int width, height, stride;
+        gsize output_length = 0;
+        gsize output_size;
+        int y;
+
+        g_return_val_if_fail (surface != NULL, FALSE);
+        g_return_val_if_fail (G_IS_OUTPUT_STREAM (stream), FALSE);
+
+        format = cairo_image_surface_get_format (surface);
+        if (cairo_surface_get_type (surface) != CAIRO_SURFACE_TYPE_IMAGE ||
+            (format != CAIRO_FORMAT_ARGB32 && format != CAIRO_FORMAT_RGB24)) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                             "Unsupported surface format for qoi encoding");
+                return FALSE;
+        }
+
+        cairo_surface_flush (surface);
+
+        pixels = cairo_image_surface_get_data (surface);
+        width = cairo_image_surface_get_width (surface);
+        height = cairo_image_surface_get_height (surface);
+        stride = cairo_image_surface_get_stride (surface);
+        has_alpha = format == CAIRO_FORMAT_ARGB32;
+
+        if (pixels == NULL || width <= 0 || height <= 0) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                             "Cannot encode an empty image");
+                return FALSE;
+        }
+
+        memcpy (header, "qoif", 4);
+        write_uint32 (header + 4, width);
+        write_uint32 (header + 8, height);
+        header[12] = has_alpha ? 4 : 3;
+        header[13] = 0;                 /* sRGB with linear alpha */
+
+        if (!g_output_stream_write_all (stream, header, sizeof (header), NULL, cancellable, error))
+                return FALSE;
+
+        state.previous_pixel.alpha = 255;
+
+        row = g_malloc ((gsize) width * 4);
+        output_size = QOI_OUTPUT_FLUSH_SIZE +
+                      (gsize) width * QOI_MAX_BYTES_PER_PIXEL +
+                      sizeof (qoi_end_marker);
+        output = g_malloc (output_size);
+
+        for (y = 0; y < height; y++) {
+                const guint8 *source = pixels + (gsize) y * stride;
+
+                if (has_alpha) {
+                        kiosk_pixel_utils_unpremultiply_argb32_to_rgba (row, width * 4,
+                                                                        source, stride,
+                                                                        width, 1);
+                } else {
+                        const guint32 *source_pixels = (const guint32 *) source;
+                        int x;
+
+                        for (x = 0; x < width; x++) {
+                                row[x * 4 + 0] = (source_pixels[x] >> 16) & 0xff;
+                                row[x * 4 + 1] = (source_pixels[x] >> 8) & 0xff;
+                                row[x * 4 + 2] = source_pixels[x] & 0xff;
+                                row[x * 4 + 3] = 255;
+                        }
+                }
+
+                output_length += encode_row (&state, row, width, y == height - 1,
+                                             output + output_length);
+
+                if (output_length >= QOI_OUTPUT_FLUSH_SIZE) {
+                        if (!g_output_stream_write_all (stream, output, output_length, NULL, cancellable, error))
+                                return FALSE;
+                        output_length = 0;
+                }
+        }
+
+        memcpy (output + output_length, qoi_end_marker, sizeof (qoi_end_marker));
+        output_length += sizeof (qoi_end_marker);
+
+        return g_output_stream_write_all (stream, output, output_length, NULL, cancellable, error);
+}
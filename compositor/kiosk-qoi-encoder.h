@@ -0,0 +1,14 @@
+#pragma once
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <cairo.h>
+
+G_BEGIN_DECLS
+
+gboolean kiosk_qoi_encoder_write_surface (cairo_surface_t  *surface,
+                                          GOutputStream    *stream,
+                                          GCancellable     *cancellable,
+                                          GError          **error);
+
+G_END_DECLS
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Layout of the recordings written by KioskScreencast, shared with the
+ * offline decoder.
+ *
+ * A recording starts with a file header, followed by frames until the
+ * end of the file. All integers are little endian.
+ *
+ *   file header:  8 bytes magic, guint32 version, guint32 tile size
+ *   frame header: guint8 frame type, 3 bytes padding,
+ *                 gint64 wall clock time in microseconds,
+ *                 guint32 screen width, guint32 screen height,
+ *                 guint32 number of tiles
+ *   tile header:  guint32 x, guint32 y, guint32 width, guint32 height,
+ *                 guint32 size of the compressed pixels
+ *
+ * Each tile header is followed by the zlib compressed pixels of the tile,
+ * rows tightly packed, every pixel a premultiplied ARGB guint32 stored
+ * little endian. Key frames carry every tile of the screen, delta frames
+ * only the tiles that changed since the previous frame, so decoding has to
+ * start at a key frame.
+ */
+
+#define KIOSK_SCREENCAST_MAGIC "KSKCAST"
+#define KIOSK_SCREENCAST_MAGIC_SIZE 8
+#define KIOSK_SCREENCAST_VERSION 1
+
+#define KIOSK_SCREENCAST_FILE_HEADER_SIZE 16
+#define KIOSK_SCREENCAST_FRAME_HEADER_SIZE 24
+#define KIOSK_SCREENCAST_TILE_HEADER_SIZE 20
+
+typedef enum
+{
+        KIOSK_SCREENCAST_FRAME_TYPE_KEY = 1,
+        KIOSK_SCREENCAST_FRAME_TYPE_DELTA = 2,
+} KioskScreencastFrameType;
+
+G_END_DECLS
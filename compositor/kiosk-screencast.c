@@ -0,0 +1,810 @@
+#include "config.h"
+#include "kiosk-screencast.h"
+
+#include <string.h>
+#include <zlib.h>
+
+#include <meta/display.h>
+#include <meta/meta-plugin.h>
+#include <meta/compositor.h>
+
+#include <clutter/clutter.h>
+#include <cogl/cogl.h>
+#include <mtk/mtk.h>
+
+#include "kiosk-compositor.h"
+#include "kiosk-pixel-utils.h"
+#include "kiosk-screencast-format.h"
+
+#define KIOSK_SCREENCAST_TILE_SIZE 64
+
+/* Frames get skipped while this many are still waiting to be written,
+ * the damage keeps accumulating so nothing is lost but frame rate
+ */
+#define KIOSK_SCREENCAST_MAX_QUEUED_FRAMES 4
+
+typedef struct
+{
+        MtkRectangle rect;
+        guint8      *pixels;
+} KioskScreencastTile;
+
+typedef struct
+{
+        KioskScreencastFrameType type;
+        gint64                   timestamp;
+        int                      width;
+        int                      height;
+        GArray                  *tiles;   /* KioskScreencastTile */
+        gboolean                 is_last;
+} KioskScreencastFrame;
+
+/* Only ever touched by the writer thread, it gets freed by the last
+ * frame, so the compositor thread never waits on the file system
+ */
+typedef struct
+{
+        GOutputStream *stream;
+        gboolean       header_written;
+        gboolean       failed;
+} KioskScreencastWriter;
+
+struct _KioskScreencast
+{
+        GObject             parent;
+
+        /* weak references */
+        KioskCompositor    *compositor;
+        MetaDisplay        *display;
+        ClutterActor       *stage;
+
+        /* strong references */
+        MtkRegion          *damage;
+        GThreadPool        *writer_pool;    /* KioskScreencastFrame */
+        GCancellable       *start_cancellable;
+
+        /* handles */
+        guint               capture_timeout_id;
+        gulong              paint_view_handler_id;
+        gulong              before_paint_handler_id;
+        gulong              after_paint_handler_id;
+
+        /* private */
+        guint64            *tile_hashes;
+        int                 width;
+        int                 height;
+        int                 columns;
+        int                 rows;
+        guint               keyframe_interval;
+        guint               frames_since_keyframe;
+        double              frame_rate;
+        gboolean            view_painted;
+};
+
+enum
+{
+        PROP_COMPOSITOR = 1,
+        NUMBER_OF_PROPERTIES
+};
+static GParamSpec *kiosk_screencast_properties[NUMBER_OF_PROPERTIES] = { NULL, };
+
+G_DEFINE_FINAL_TYPE (KioskScreencast, kiosk_screencast, G_TYPE_OBJECT);
+
+static void
+kiosk_screencast_tile_clear (KioskScreencastTile *tile)
+{
+        g_clear_pointer (&tile->pixels, g_free);
+}
+
+static KioskScreencastFrame *
+kiosk_screencast_frame_new (KioskScreencastFrameType type,
+                            int                      width,
+                            int                      height)
+{
+        KioskScreencastFrame *frame;
+
+        frame = g_new0 (KioskScreencastFrame, 1);
+        frame->type = type;
+        frame->timestamp = g_get_real_time ();
+        frame->width = width;
+        frame->height = height;
+        frame->tiles = g_array_new (FALSE, FALSE, sizeof (KioskScreencastTile));
+        g_array_set_clear_func (frame->tiles, (GDestroyNotify) kiosk_screencast_tile_clear);
+
+        return frame;
+}
+
+static void
+kiosk_screencast_frame_free (KioskScreencastFrame *frame)
+{
+        g_clear_pointer (&frame->tiles, g_array_unref);
+        g_free (frame);
+}
+
+static void
+kiosk_screencast_writer_free (KioskScreencastWriter *writer)
+{
+        g_clear_object (&writer->stream);
+        g_free (writer);
+}
+
+static void
+write_uint32 (guint8  *data,
+              guint32  value)
+{
+        value = GUINT32_TO_LE (value);
+        memcpy (data, &value, sizeof (value));
+}
+
+static gboolean
+write_header (KioskScreencastWriter  *writer,
+              GError                **error)
+{
+        guint8 header[KIOSK_SCREENCAST_FILE_HEADER_SIZE] = { 0 };
+
+        memcpy (header, KIOSK_SCREENCAST_MAGIC, KIOSK_SCREENCAST_MAGIC_SIZE);
+        write_uint32 (header + 8, KIOSK_SCREENCAST_VERSION);
+        write_uint32 (header + 12, KIOSK_SCREENCAST_TILE_SIZE);
+
+        if (!g_output_stream_write_all (writer->stream, header, sizeof (header), NULL, NULL, error))
+                return FALSE;
+
+        writer->header_written = TRUE;
+        return TRUE;
+}
+
+static gboolean
+write_frame (KioskScreencastWriter  *writer,
+             KioskScreencastFrame   *frame,
+             GError                **error)
+{
+        guint8 header[KIOSK_SCREENCAST_FRAME_HEADER_SIZE] = { 0 };
+        g_autofree guint8 *compressed = NULL;
+        gsize compressed_capacity = 0;
+        gint64 timestamp;
+        guint i;
+
+        header[0] = frame->type;
+        timestamp = GINT64_TO_LE (frame->timestamp);
+        memcpy (header + 4, &timestamp, sizeof (timestamp));
+        write_uint32 (header + 12, frame->width);
+        write_uint32 (header + 16, frame->height);
+        write_uint32 (header + 20, frame->tiles->len);
+
+        if (!g_output_stream_write_all (writer->stream, header, sizeof (header), NULL, NULL, error))
+                return FALSE;
+
+        for (i = 0; i < frame->tiles->len; i++) {
+                KioskScreencastTile *tile = &g_array_index (frame->tiles, KioskScreencastTile, i);
+                guint8 tile_header[KIOSK_SCREENCAST_TILE_HEADER_SIZE];
+                gsize size = (gsize) tile->rect.width * tile->rect.height * 4;
+                uLongf compressed_size;
+                int result;
+
+                if (compressed_capacity < compressBound (size)) {
+                        compressed_capacity = compressBound (size);
+                        compressed = g_realloc (compressed, compressed_capacity);
+                }
+
+                compressed_size = compressed_capacity;
+                result = compress2 (compressed, &compressed_size, tile->pixels, size, Z_BEST_SPEED);
+                if (result != Z_OK) {
+                        g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                                     "Could not compress tile: %s", zError (result));
+                        return FALSE;
+                }
+
+                write_uint32 (tile_header, tile->rect.x);
+                write_uint32 (tile_header + 4, tile->rect.y);
+                write_uint32 (tile_header + 8, tile->rect.width);
+                write_uint32 (tile_header + 12, tile->rect.height);
+                write_uint32 (tile_header + 16, compressed_size);
+
+                if (!g_output_stream_write_all (writer->stream, tile_header, sizeof (tile_header), NULL, NULL, error))
+                        return FALSE;
+
+                if (!g_output_stream_write_all (writer->stream, compressed, compressed_size, NULL, NULL, error))
+                        return FALSE;
+        }
+
+        /* Every frame hits the disk right away, so a recording that got cut
+         * short loses at most the frame that was being written
+         */
+        return g_output_stream_flush (writer->stream, NULL, error);
+}
+
+static void
+write_frame_in_thread (KioskScreencastFrame  *frame,
+                       KioskScreencastWriter *writer)
+{
+        g_autoptr (GError) error = NULL;
+
+        if (frame->is_last) {
+                /* Even a recording without frames is a valid file */
+                if ((!writer->failed && !writer->header_written && !write_header (writer, &error)) ||
+                    !g_output_stream_close (writer->stream, NULL, &error))
+                        g_warning ("KioskScreencast: Could not finish recording: %s", error->message);
+
+                g_debug ("KioskScreencast: Recording finished");
+                kiosk_screencast_writer_free (writer);
+                kiosk_screencast_frame_free (frame);
+                return;
+        }
+
+        if (writer->failed) {
+                kiosk_screencast_frame_free (frame);
+                return;
+        }
+
+        if ((!writer->header_written && !write_header (writer, &error)) ||
+            !write_frame (writer, frame, &error)) {
+                g_warning ("KioskScreencast: Could not write recording: %s", error->message);
+                writer->failed = TRUE;
+        }
+
+        kiosk_screencast_frame_free (frame);
+}
+
+static void
+on_before_paint (ClutterStage     *stage,
+                 ClutterStageView *view,
+                 ClutterFrame     *frame,
+                 KioskScreencast  *self)
+{
+        self->view_painted = FALSE;
+}
+
+static void
+on_paint_view (ClutterStage     *stage,
+               ClutterStageView *view,
+               MtkRegion        *redraw_clip,
+               ClutterFrame     *frame,
+               KioskScreencast  *self)
+{
+        self->view_painted = TRUE;
+
+        if (redraw_clip == NULL) {
+                MtkRectangle stage_rect = { 0, 0, 0, 0 };
+
+                meta_display_get_size (self->display, &stage_rect.width, &stage_rect.height);
+                mtk_region_union_rectangle (self->damage, &stage_rect);
+                return;
+        }
+
+        mtk_region_union (self->damage, redraw_clip);
+}
+
+static void
+on_after_paint (ClutterStage     *stage,
+                ClutterStageView *view,
+                ClutterFrame     *frame,
+                KioskScreencast  *self)
+{
+        MtkRectangle view_layout;
+
+        if (self->view_painted)
+                return;
+
+        /* A view that got updated without paint-view had a window
+         * scanned out directly, and that doesn't come with any damage.
+         * The whole view is taken as damaged then, the tile hashes still
+         * keep what didn't change out of the recording.
+         */
+        clutter_stage_view_get_layout (view, &view_layout);
+        mtk_region_union_rectangle (self->damage, &view_layout);
+}
+
+static void
+reset_tile_grid (KioskScreencast *self,
+                 int              width,
+                 int              height)
+{
+        self->width = width;
+        self->height = height;
+        self->columns = (width + KIOSK_SCREENCAST_TILE_SIZE - 1) / KIOSK_SCREENCAST_TILE_SIZE;
+        self->rows = (height + KIOSK_SCREENCAST_TILE_SIZE - 1) / KIOSK_SCREENCAST_TILE_SIZE;
+
+        g_free (self->tile_hashes);
+        self->tile_hashes = g_new0 (guint64, (gsize) self->columns * self->rows);
+}
+
+static guint8 *
+find_damaged_tiles (KioskScreencast *self)
+{
+        MtkRectangle stage_rect = { 0, 0, self->width, self->height };
+        guint8 *damaged_tiles;
+        int i, n_rectangles;
+
+        damaged_tiles = g_new0 (guint8, (gsize) self->columns * self->rows);
+
+        mtk_region_intersect_rectangle (self->damage, &stage_rect);
+        n_rectangles = mtk_region_num_rectangles (self->damage);
+
+        for (i = 0; i < n_rectangles; i++) {
+                MtkRectangle rect = mtk_region_get_rectangle (self->damage, i);
+                int first_column, last_column, first_row, last_row;
+                int row, column;
+
+                if (rect.width <= 0 || rect.height <= 0)
+                        continue;
+
+                first_column = rect.x / KIOSK_SCREENCAST_TILE_SIZE;
+                last_column = (rect.x + rect.width - 1) / KIOSK_SCREENCAST_TILE_SIZE;
+                first_row = rect.y / KIOSK_SCREENCAST_TILE_SIZE;
+                last_row = (rect.y + rect.height - 1) / KIOSK_SCREENCAST_TILE_SIZE;
+
+                for (row = first_row; row <= last_row; row++) {
+                        for (column = first_column; column <= last_column; column++)
+                                damaged_tiles[row * self->columns + column] = TRUE;
+                }
+        }
+
+        return damaged_tiles;
+}
+
+static void
+add_changed_tiles (KioskScreencast      *self,
+                   KioskScreencastFrame *frame,
+                   const MtkRectangle   *span,
+                   const guint8         *data,
+                   int                   stride)
+{
+        g_autofree guint64 *hashes = NULL;
+        int first_column = span->x / KIOSK_SCREENCAST_TILE_SIZE;
+        int row = span->y / KIOSK_SCREENCAST_TILE_SIZE;
+        int n_tiles;
+        int i;
+
+        n_tiles = (span->width + KIOSK_SCREENCAST_TILE_SIZE - 1) / KIOSK_SCREENCAST_TILE_SIZE;
+        hashes = g_new (guint64, n_tiles);
+        kiosk_pixel_utils_hash_tiles (data, stride, span->width, span->height,
+                                      KIOSK_SCREENCAST_TILE_SIZE, hashes);
+
+        for (i = 0; i < n_tiles; i++) {
+                guint64 *stored_hash = &self->tile_hashes[row * self->columns + first_column + i];
+                KioskScreencastTile tile;
+                int y;
+
+                /* Damage is often reported for content that ends up
+                 * looking the same, such tiles are left out
+                 */
+                if (frame->type == KIOSK_SCREENCAST_FRAME_TYPE_DELTA && *stored_hash == hashes[i])
+                        continue;
+
+                *stored_hash = hashes[i];
+
+                tile.rect.x = span->x + i * KIOSK_SCREENCAST_TILE_SIZE;
+                tile.rect.y = span->y;
+                tile.rect.width = MIN (KIOSK_SCREENCAST_TILE_SIZE, span->x + span->width - tile.rect.x);
+                tile.rect.height = span->height;
+                tile.pixels = g_malloc ((gsize) tile.rect.width * tile.rect.height * 4);
+
+                for (y = 0; y < tile.rect.height; y++) {
+                        guint32 *destination = (guint32 *) (tile.pixels + (gsize) y * tile.rect.width * 4);
+                        const guint32 *source = (const guint32 *) (data + (gsize) y * stride +
+                                                                   (gsize) (tile.rect.x - span->x) * 4);
+#if G_BYTE_ORDER == G_BIG_ENDIAN
+                        int x;
+
+                        for (x = 0; x < tile.rect.width; x++)
+                                destination[x] = GUINT32_TO_LE (source[x]);
+#else
+                        memcpy (destination, source, (gsize) tile.rect.width * 4);
+#endif
+                }
+
+                g_array_append_val (frame->tiles, tile);
+        }
+}
+
+static KioskScreencastFrame *
+capture_frame (KioskScreencast           *self,
+               KioskScreencastFrameType   type,
+               const guint8              *damaged_tiles,
+               GError                   **error)
+{
+        g_autoptr (GError) paint_error = NULL;
+        g_autofree guint8 *data = NULL;
+        KioskScreencastFrame *frame;
+        int row, column;
+
+        frame = kiosk_screencast_frame_new (type, self->width, self->height);
+
+        /* Damaged tiles next to each other in a row are read back in one
+         * go, so the cost follows the damaged area, not the screen size
+         */
+        data = g_malloc ((gsize) self->columns * KIOSK_SCREENCAST_TILE_SIZE *
+                         KIOSK_SCREENCAST_TILE_SIZE * 4);
+
+        for (row = 0; row < self->rows; row++) {
+                column = 0;
+
+                while (column < self->columns) {
+                        MtkRectangle span;
+                        int first_column;
+                        int stride;
+
+                        if (!damaged_tiles[row * self->columns + column]) {
+                                column++;
+                                continue;
+                        }
+
+                        first_column = column;
+                        while (column < self->columns && damaged_tiles[row * self->columns + column])
+                                column++;
+
+                        span.x = first_column * KIOSK_SCREENCAST_TILE_SIZE;
+                        span.y = row * KIOSK_SCREENCAST_TILE_SIZE;
+                        span.width = MIN (column * KIOSK_SCREENCAST_TILE_SIZE, self->width) - span.x;
+                        span.height = MIN (KIOSK_SCREENCAST_TILE_SIZE, self->height - span.y);
+                        stride = span.width * 4;
+
+                        if (!clutter_stage_paint_to_buffer (CLUTTER_STAGE (self->stage),
+                                                            &span, 1.0,
+                                                            data, stride,
+                                                            COGL_PIXEL_FORMAT_ARGB32_NATIVE,
+                                                            NULL,
+                                                            CLUTTER_PAINT_FLAG_NO_CURSORS,
+                                                            error)) {
+                                kiosk_screencast_frame_free (frame);
+                                return NULL;
+                        }
+
+                        add_changed_tiles (self, frame, &span, data, stride);
+                }
+        }
+
+        return frame;
+}
+
+static gboolean
+on_capture_timeout (KioskScreencast *self)
+{
+        g_autoptr (GError) error = NULL;
+        g_autofree guint8 *damaged_tiles = NULL;
+        KioskScreencastFrameType type = KIOSK_SCREENCAST_FRAME_TYPE_DELTA;
+        KioskScreencastFrame *frame;
+        int width, height;
+
+        if (g_thread_pool_unprocessed (self->writer_pool) >= KIOSK_SCREENCAST_MAX_QUEUED_FRAMES) {
+                g_debug ("KioskScreencast: Writer is falling behind, skipping frame");
+                return G_SOURCE_CONTINUE;
+        }
+
+        meta_display_get_size (self->display, &width, &height);
+
+        if (self->tile_hashes == NULL ||
+            width != self->width || height != self->height ||
+            self->frames_since_keyframe >= self->keyframe_interval) {
+                type = KIOSK_SCREENCAST_FRAME_TYPE_KEY;
+                reset_tile_grid (self, width, height);
+        }
+
+        if (type == KIOSK_SCREENCAST_FRAME_TYPE_DELTA && mtk_region_is_empty (self->damage)) {
+                self->frames_since_keyframe++;
+                return G_SOURCE_CONTINUE;
+        }
+
+        if (type == KIOSK_SCREENCAST_FRAME_TYPE_KEY) {
+                damaged_tiles = g_malloc ((gsize) self->columns * self->rows);
+                memset (damaged_tiles, TRUE, (gsize) self->columns * self->rows);
+        } else {
+                damaged_tiles = find_damaged_tiles (self);
+        }
+
+        g_clear_pointer (&self->damage, mtk_region_unref);
+        self->damage = mtk_region_create ();
+
+        frame = capture_frame (self, type, damaged_tiles, &error);
+        if (frame == NULL) {
+                g_warning ("KioskScreencast: Could not capture frame: %s", error->message);
+
+                /* Some tile hashes may be ahead of the recording now */
+                g_clear_pointer (&self->tile_hashes, g_free);
+                return G_SOURCE_CONTINUE;
+        }
+
+        if (type == KIOSK_SCREENCAST_FRAME_TYPE_KEY)
+                self->frames_since_keyframe = 0;
+        else
+                self->frames_since_keyframe++;
+
+        if (frame->tiles->len == 0) {
+                kiosk_screencast_frame_free (frame);
+                return G_SOURCE_CONTINUE;
+        }
+
+        g_debug ("KioskScreencast: Recording %s frame with %u tiles",
+                 type == KIOSK_SCREENCAST_FRAME_TYPE_KEY ? "key" : "delta",
+                 frame->tiles->len);
+
+        g_thread_pool_push (self->writer_pool, frame, NULL);
+
+        return G_SOURCE_CONTINUE;
+}
+
+static void
+begin_recording (KioskScreencast   *self,
+                 GFileOutputStream *file_stream,
+                 GError           **error)
+{
+        KioskScreencastWriter *writer;
+
+        writer = g_new0 (KioskScreencastWriter, 1);
+
+        /* Frames are small and frequent, so they are buffered and
+         * flushed once per frame rather than written piecemeal
+         */
+        writer->stream = g_buffered_output_stream_new (G_OUTPUT_STREAM (file_stream));
+
+        /* A single thread keeps the frames in order */
+        self->writer_pool = g_thread_pool_new ((GFunc) write_frame_in_thread,
+                                               writer, 1, FALSE, error);
+        if (self->writer_pool == NULL) {
+                kiosk_screencast_writer_free (writer);
+                return;
+        }
+
+        g_debug ("KioskScreencast: Recording at %.2f fps, key frame every %u frames",
+                 self->frame_rate, self->keyframe_interval);
+
+        self->frames_since_keyframe = 0;
+        g_clear_pointer (&self->tile_hashes, g_free);
+        self->damage = mtk_region_create ();
+
+        self->before_paint_handler_id = g_signal_connect (self->stage,
+                                                          "before-paint",
+                                                          G_CALLBACK (on_before_paint),
+                                                          self);
+        self->paint_view_handler_id = g_signal_connect (self->stage,
+                                                        "paint-view",
+                                                        G_CALLBACK (on_paint_view),
+                                                        self);
+        self->after_paint_handler_id = g_signal_connect (self->stage,
+                                                         "after-paint",
+                                                         G_CALLBACK (on_after_paint),
+                                                         self);
+
+        self->capture_timeout_id = g_timeout_add (MAX (1, (guint) (1000.0 / self->frame_rate)),
+                                                  (GSourceFunc) on_capture_timeout,
+                                                  self);
+        g_source_set_name_by_id (self->capture_timeout_id,
+                                 "[kiosk-screencast] on_capture_timeout");
+}
+
+static void
+on_recording_file_created (GObject      *source_object,
+                           GAsyncResult *result,
+                           gpointer      user_data)
+{
+        g_autoptr (GTask) task = user_data;
+        KioskScreencast *self = g_task_get_source_object (task);
+        g_autoptr (GFileOutputStream) file_stream = NULL;
+        GError *error = NULL;
+
+        g_clear_object (&self->start_cancellable);
+
+        file_stream = g_file_create_finish (G_FILE (source_object), result, &error);
+        if (file_stream == NULL) {
+                g_task_return_error (task, error);
+                return;
+        }
+
+        if (self->stage == NULL) {
+                g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_CLOSED,
+                                         "The stage went away");
+                return;
+        }
+
+        begin_recording (self, file_stream, &error);
+        if (error != NULL) {
+                g_task_return_error (task, error);
+                return;
+        }
+
+        g_task_return_boolean (task, TRUE);
+}
+
+/**
+ * kiosk_screencast_start:
+ * @screencast: the #KioskScreencast
+ * @file: the file to record to, it must not exist yet
+ * @frame_rate: how many frames to record per second at most
+ * @keyframe_interval: the number of frames between key frames
+ * @callback: (scope async): function to call once recording started or failed
+ * @user_data: the data to pass to callback function
+ *
+ * Starts recording the screen into @file. The file is created
+ * asynchronously, recording only starts once that worked, so failing to
+ * create it is reported by kiosk_screencast_start_finish().
+ */
+void
+kiosk_screencast_start (KioskScreencast     *screencast,
+                        GFile               *file,
+                        double               frame_rate,
+                        guint                keyframe_interval,
+                        GAsyncReadyCallback  callback,
+                        gpointer             user_data)
+{
+        GTask *task;
+
+        g_return_if_fail (KIOSK_IS_SCREENCAST (screencast));
+        g_return_if_fail (G_IS_FILE (file));
+        g_return_if_fail (frame_rate > 0.0);
+        g_return_if_fail (keyframe_interval > 0);
+
+        task = g_task_new (screencast, NULL, callback, user_data);
+        g_task_set_source_tag (task, kiosk_screencast_start);
+
+        if (kiosk_screencast_is_recording (screencast) || screencast->start_cancellable != NULL) {
+                g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_BUSY,
+                                         "A recording is already running");
+                g_object_unref (task);
+                return;
+        }
+
+        screencast->frame_rate = frame_rate;
+        screencast->keyframe_interval = keyframe_interval;
+        screencast->start_cancellable = g_cancellable_new ();
+
+        g_file_create_async (file,
+                             G_FILE_CREATE_NONE,
+                             G_PRIORITY_DEFAULT,
+                             screencast->start_cancellable,
+                             on_recording_file_created,
+                             task);
+}
+
+/**
+ * kiosk_screencast_start_finish:
+ * @screencast: the #KioskScreencast
+ * @result: the #GAsyncResult that was provided to the callback
+ * @error: #GError for error reporting
+ *
+ * Finish the asynchronous operation started by kiosk_screencast_start().
+ *
+ * Returns: whether recording started
+ */
+gboolean
+kiosk_screencast_start_finish (KioskScreencast  *screencast,
+                               GAsyncResult     *result,
+                               GError          **error)
+{
+        g_return_val_if_fail (KIOSK_IS_SCREENCAST (screencast), FALSE);
+        g_return_val_if_fail (g_task_is_valid (result, screencast), FALSE);
+        g_return_val_if_fail (g_async_result_is_tagged (result, kiosk_screencast_start), FALSE);
+
+        return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+/**
+ * kiosk_screencast_stop:
+ * @screencast: the #KioskScreencast
+ *
+ * Stops the running recording, if any. Frames that are still queued are
+ * written out in the background before the file is closed.
+ */
+void
+kiosk_screencast_stop (KioskScreencast *screencast)
+{
+        KioskScreencastFrame *last_frame;
+
+        g_return_if_fail (KIOSK_IS_SCREENCAST (screencast));
+
+        if (!kiosk_screencast_is_recording (screencast))
+                return;
+
+        g_debug ("KioskScreencast: Stopping recording");
+
+        g_clear_handle_id (&screencast->capture_timeout_id, g_source_remove);
+        if (screencast->stage != NULL) {
+                g_clear_signal_handler (&screencast->before_paint_handler_id, screencast->stage);
+                g_clear_signal_handler (&screencast->paint_view_handler_id, screencast->stage);
+                g_clear_signal_handler (&screencast->after_paint_handler_id, screencast->stage);
+        }
+        g_clear_pointer (&screencast->damage, mtk_region_unref);
+        g_clear_pointer (&screencast->tile_hashes, g_free);
+
+        last_frame = kiosk_screencast_frame_new (0, 0, 0);
+        last_frame->is_last = TRUE;
+        g_thread_pool_push (screencast->writer_pool, last_frame, NULL);
+
+        /* Don't wait, the pool goes away once the last frame is written */
+        g_thread_pool_free (g_steal_pointer (&screencast->writer_pool), FALSE, FALSE);
+}
+
+/**
+ * kiosk_screencast_is_recording:
+ * @screencast: the #KioskScreencast
+ *
+ * Returns: whether a recording is running
+ */
+gboolean
+kiosk_screencast_is_recording (KioskScreencast *screencast)
+{
+        g_return_val_if_fail (KIOSK_IS_SCREENCAST (screencast), FALSE);
+
+        return screencast->writer_pool != NULL;
+}
+
+static void
+kiosk_screencast_dispose (GObject *object)
+{
+        KioskScreencast *self = KIOSK_SCREENCAST (object);
+
+        g_cancellable_cancel (self->start_cancellable);
+        kiosk_screencast_stop (self);
+
+        g_clear_weak_pointer (&self->stage);
+        g_clear_weak_pointer (&self->display);
+        g_clear_weak_pointer (&self->compositor);
+
+        G_OBJECT_CLASS (kiosk_screencast_parent_class)->dispose (object);
+}
+
+static void
+kiosk_screencast_constructed (GObject *object)
+{
+        KioskScreencast *self = KIOSK_SCREENCAST (object);
+        MetaDisplay *display = meta_plugin_get_display (META_PLUGIN (self->compositor));
+        MetaCompositor *compositor = meta_display_get_compositor (display);
+
+        G_OBJECT_CLASS (kiosk_screencast_parent_class)->constructed (object);
+
+        g_set_weak_pointer (&self->display, display);
+        g_set_weak_pointer (&self->stage, CLUTTER_ACTOR (meta_compositor_get_stage (compositor)));
+}
+
+static void
+kiosk_screencast_set_property (GObject      *object,
+                               guint         property_id,
+                               const GValue *value,
+                               GParamSpec   *param_spec)
+{
+        KioskScreencast *self = KIOSK_SCREENCAST (object);
+
+        switch (property_id) {
+        case PROP_COMPOSITOR:
+                g_set_weak_pointer (&self->compositor, g_value_get_object (value));
+                break;
+
+        default:
+                G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, param_spec);
+                break;
+        }
+}
+
+static void
+kiosk_screencast_class_init (KioskScreencastClass *screencast_class)
+{
+        GObjectClass *object_class = G_OBJECT_CLASS (screencast_class);
+
+        object_class->constructed = kiosk_screencast_constructed;
+        object_class->set_property = kiosk_screencast_set_property;
+        object_class->dispose = kiosk_screencast_dispose;
+
+        kiosk_screencast_properties[PROP_COMPOSITOR] = g_param_spec_object ("compositor",
+                                                                            NULL, NULL,
+                                                                            KIOSK_TYPE_COMPOSITOR,
+                                                                            G_PARAM_CONSTRUCT_ONLY | G_PARAM_WRITABLE | G_PARAM_STATIC_NAME);
+        g_object_class_install_properties (object_class,
+                                           NUMBER_OF_PROPERTIES,
+                                           kiosk_screencast_properties);
+}
+
+static void
+kiosk_screencast_init (KioskScreencast *screencast)
+{
+}
+
+KioskScreencast *
+kiosk_screencast_new (KioskCompositor *compositor)
+{
+        GObject *object;
+
+        object = g_object_new (KIOSK_TYPE_SCREENCAST,
+                               "compositor", compositor,
+                               NULL);
+
+        return KIOSK_SCREENCAST (object);
+}
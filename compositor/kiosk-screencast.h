@@ -0,0 +1,40 @@
+#pragma once
+
+#include <glib-object.h>
+#include <gio/gio.h>
+
+typedef struct _KioskCompositor KioskCompositor;
+
+G_BEGIN_DECLS
+
+/**
+ * KioskScreencast:
+ *
+ * Records what is on screen at a low frame rate
+ *
+ * The #KioskScreencast object keeps track of the parts of the stage that
+ * got repainted, and periodically reads back only the tiles covering
+ * them. Tiles that really changed are appended to a recording, see
+ * kiosk-screencast-format.h, along with regular key frames.
+ *
+ */
+#define KIOSK_TYPE_SCREENCAST (kiosk_screencast_get_type ())
+
+G_DECLARE_FINAL_TYPE (KioskScreencast, kiosk_screencast,
+                      KIOSK, SCREENCAST, GObject);
+
+KioskScreencast *kiosk_screencast_new (KioskCompositor *compositor);
+
+void     kiosk_screencast_start (KioskScreencast     *screencast,
+                                 GFile               *file,
+                                 double               frame_rate,
+                                 guint                keyframe_interval,
+                                 GAsyncReadyCallback  callback,
+                                 gpointer             user_data);
+gboolean kiosk_screencast_start_finish (KioskScreencast  *screencast,
+                                        GAsyncResult     *result,
+                                        GError          **error);
+void     kiosk_screencast_stop (KioskScreencast *screencast);
+gboolean kiosk_screencast_is_recording (KioskScreencast *screencast);
+
+G_END_DECLS
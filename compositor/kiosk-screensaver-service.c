@@ -5,11 +5,16 @@
 #include <stdlib.h>
 #include <string.h>
 #include <meta/display.h>
+#include <meta/meta-backend.h>
+#include <meta/meta-context.h>
+#include <meta/meta-idle-monitor.h>
 #include <meta/util.h>
 
+#include "kiosk-brightness.h"
 #include "kiosk-compositor.h"
 #include "kiosk-screensaver.h"
 #include "kiosk-session-presence.h"
+#include "main.h"
 
 #define KIOSK_SCREENSAVER_SERVICE_BUS_NAME "org.gnome.ScreenSaver"
 #define KIOSK_SCREENSAVER_SERVICE_OBJECT_PATH "/org/gnome/ScreenSaver"
@@ -18,6 +23,11 @@
 #define GNOME_DESKTOP_SCREENSAVER_LOCK_ENABLED "lock-enabled"
 #define GNOME_DESKTOP_SCREENSAVER_LOCK_DELAY "lock-delay"
 
+#define GNOME_DESKTOP_SESSION_SCHEMA "org.gnome.desktop.session"
+#define GNOME_DESKTOP_SESSION_IDLE_DELAY "idle-delay"
+
+#define KIOSK_NUMBER_OF_IDLE_STAGES (KIOSK_IDLE_STAGE_POWER_OFF + 1)
+
 struct _KioskScreenSaverService
 {
         KioskScreenSaverSkeleton parent;
@@ -26,31 +36,57 @@ struct _KioskScreenSaverService
         KioskCompositor         *compositor;
         MetaDisplay             *display;
         KioskSessionPresence    *session_presence;
+        MetaIdleMonitor         *idle_monitor;
+        KioskBrightness         *brightness;
 
         /* strong references */
         KioskScreensaver        *screensaver;
         GSettings               *screensaver_settings;
+        GSettings               *session_settings;
 
         /* handles */
         guint                    bus_id;
         guint                    lock_timeout_id;
+        guint                    idle_watch_ids[KIOSK_NUMBER_OF_IDLE_STAGES];
+        guint                    user_active_watch_id;
+
+        /* state */
+        gboolean                 use_idle_monitor;
+        guint                    idle_times[KIOSK_NUMBER_OF_IDLE_STAGES];
+        KioskIdleStage           idle_stage;
 };
 
 enum
 {
         PROP_COMPOSITOR = 1,
+        PROP_DIM_IDLE_TIME,
+        PROP_BLANK_IDLE_TIME,
+        PROP_LOCK_IDLE_TIME,
+        PROP_POWER_OFF_IDLE_TIME,
+        PROP_IDLE_STAGE,
         NUMBER_OF_PROPERTIES
 };
 static GParamSpec *kiosk_screensaver_service_properties[NUMBER_OF_PROPERTIES] = { NULL, };
 
 static void kiosk_screensaver_dbus_interface_init (KioskScreenSaverIface *interface);
 
+G_DEFINE_ENUM_TYPE (KioskIdleStage, kiosk_idle_stage,
+                    G_DEFINE_ENUM_VALUE (KIOSK_IDLE_STAGE_NONE, "none"),
+                    G_DEFINE_ENUM_VALUE (KIOSK_IDLE_STAGE_DIM, "dim"),
+                    G_DEFINE_ENUM_VALUE (KIOSK_IDLE_STAGE_BLANK, "blank"),
+                    G_DEFINE_ENUM_VALUE (KIOSK_IDLE_STAGE_LOCK, "lock"),
+                    G_DEFINE_ENUM_VALUE (KIOSK_IDLE_STAGE_POWER_OFF, "power-off"))
+
 G_DEFINE_FINAL_TYPE_WITH_CODE (KioskScreenSaverService,
                                kiosk_screensaver_service,
                                KIOSK_TYPE_SCREEN_SAVER_SKELETON,
                                G_IMPLEMENT_INTERFACE (KIOSK_TYPE_SCREEN_SAVER,
                                                       kiosk_screensaver_dbus_interface_init));
 
+static void set_idle_time (KioskScreenSaverService *self,
+                           KioskIdleStage           stage,
+                           guint                    idle_time);
+
 static void
 kiosk_screensaver_service_set_property (GObject      *object,
                                         guint         property_id,
@@ -64,6 +100,22 @@ kiosk_screensaver_service_set_property (GObject      *object,
                 g_set_weak_pointer (&self->compositor, g_value_get_object (value));
                 break;
 
+        case PROP_DIM_IDLE_TIME:
+                set_idle_time (self, KIOSK_IDLE_STAGE_DIM, g_value_get_uint (value));
+                break;
+
+        case PROP_BLANK_IDLE_TIME:
+                set_idle_time (self, KIOSK_IDLE_STAGE_BLANK, g_value_get_uint (value));
+                break;
+
+        case PROP_LOCK_IDLE_TIME:
+                set_idle_time (self, KIOSK_IDLE_STAGE_LOCK, g_value_get_uint (value));
+                break;
+
+        case PROP_POWER_OFF_IDLE_TIME:
+                set_idle_time (self, KIOSK_IDLE_STAGE_POWER_OFF, g_value_get_uint (value));
+                break;
+
         default:
                 G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, param_spec);
                 break;
@@ -83,6 +135,26 @@ kiosk_screensaver_service_get_property (GObject    *object,
                 g_value_set_object (value, self->compositor);
                 break;
 
+        case PROP_DIM_IDLE_TIME:
+                g_value_set_uint (value, self->idle_times[KIOSK_IDLE_STAGE_DIM]);
+                break;
+
+        case PROP_BLANK_IDLE_TIME:
+                g_value_set_uint (value, self->idle_times[KIOSK_IDLE_STAGE_BLANK]);
+                break;
+
+        case PROP_LOCK_IDLE_TIME:
+                g_value_set_uint (value, self->idle_times[KIOSK_IDLE_STAGE_LOCK]);
+                break;
+
+        case PROP_POWER_OFF_IDLE_TIME:
+                g_value_set_uint (value, self->idle_times[KIOSK_IDLE_STAGE_POWER_OFF]);
+                break;
+
+        case PROP_IDLE_STAGE:
+                g_value_set_enum (value, self->idle_stage);
+                break;
+
         default:
                 G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, param_spec);
                 break;
@@ -145,12 +217,247 @@ on_screensaver_status_changed (KioskScreensaver        *screensaver,
 
         kiosk_screen_saver_emit_active_changed (KIOSK_SCREEN_SAVER (self), active);
 
+        /* With the idle monitor, locking is one of the idle stages */
+        if (self->use_idle_monitor)
+                return;
+
         if (active)
                 start_lock_timeout (self);
         else
                 cancel_lock_timeout (self);
 }
 
+static const char *
+kiosk_idle_stage_to_string (KioskIdleStage stage)
+{
+        g_autoptr (GEnumClass) enum_class = NULL;
+        GEnumValue *enum_value;
+
+        enum_class = g_type_class_ref (KIOSK_TYPE_IDLE_STAGE);
+        enum_value = g_enum_get_value (enum_class, stage);
+        if (enum_value == NULL)
+                return "unknown";
+
+        return enum_value->value_nick;
+}
+
+static void
+set_idle_stage (KioskScreenSaverService *self,
+                KioskIdleStage           stage)
+{
+        if (self->idle_stage == stage)
+                return;
+
+        g_debug ("KioskScreenSaverService: Idle stage changed to %s", kiosk_idle_stage_to_string (stage));
+
+        self->idle_stage = stage;
+
+        /* Undim before anything else, so the screens come back right away */
+        if (stage == KIOSK_IDLE_STAGE_NONE && self->brightness != NULL)
+                kiosk_brightness_set_idle_dimming (self->brightness, FALSE);
+
+        g_object_notify_by_pspec (G_OBJECT (self), kiosk_screensaver_service_properties[PROP_IDLE_STAGE]);
+}
+
+static void
+on_user_active (MetaIdleMonitor         *idle_monitor,
+                guint                    watch_id,
+                KioskScreenSaverService *self)
+{
+        self->user_active_watch_id = 0;
+
+        g_debug ("KioskScreenSaverService: User became active");
+
+        set_idle_stage (self, KIOSK_IDLE_STAGE_NONE);
+
+        /* A locked screensaver only goes away on unlock events, which
+         * it handles itself
+         */
+        if (kiosk_screensaver_get_active (self->screensaver) &&
+            !kiosk_screensaver_get_locked (self->screensaver)) {
+                g_debug ("KioskScreenSaverService: Deactivating screensaver: not idle");
+                kiosk_screensaver_deactivate (self->screensaver);
+        }
+}
+
+static void
+enter_idle_stage (KioskScreenSaverService *self,
+                  KioskIdleStage           stage)
+{
+        /* Stages only ever get deeper until the user is back. The watches
+         * fire in the order of their idle times though, and the lock one
+         * can come after a shorter --power-off-delay. Locking must still
+         * happen then, even though the stage stays at power off.
+         */
+        if (stage > self->idle_stage)
+                set_idle_stage (self, stage);
+        else if (stage != KIOSK_IDLE_STAGE_LOCK)
+                return;
+
+        if (self->user_active_watch_id == 0) {
+                self->user_active_watch_id =
+                        meta_idle_monitor_add_user_active_watch (self->idle_monitor,
+                                                                 (MetaIdleMonitorWatchFunc) on_user_active,
+                                                                 self,
+                                                                 NULL);
+        }
+
+        switch (stage) {
+        case KIOSK_IDLE_STAGE_DIM:
+                if (self->brightness != NULL) {
+                        g_debug ("KioskScreenSaverService: Dimming screens: idle");
+                        kiosk_brightness_set_idle_dimming (self->brightness, TRUE);
+                }
+                break;
+
+        case KIOSK_IDLE_STAGE_BLANK:
+                if (!kiosk_screensaver_get_active (self->screensaver)) {
+                        g_debug ("KioskScreenSaverService: Activating screensaver: idle");
+                        kiosk_screensaver_activate (self->screensaver);
+                }
+                break;
+
+        case KIOSK_IDLE_STAGE_LOCK:
+                if (!kiosk_screensaver_get_locked (self->screensaver) &&
+                    g_settings_get_boolean (self->screensaver_settings, GNOME_DESKTOP_SCREENSAVER_LOCK_ENABLED)) {
+                        g_debug ("KioskScreenSaverService: Locking screensaver: idle");
+                        kiosk_screensaver_lock (self->screensaver);
+                }
+                break;
+
+        case KIOSK_IDLE_STAGE_POWER_OFF:
+                if (!kiosk_screensaver_get_active (self->screensaver))
+                        kiosk_screensaver_activate (self->screensaver);
+
+                kiosk_screensaver_power_off (self->screensaver);
+                break;
+
+        case KIOSK_IDLE_STAGE_NONE:
+        default:
+                g_assert_not_reached ();
+        }
+}
+
+static void
+on_idle_watch_fired (MetaIdleMonitor         *idle_monitor,
+                     guint                    watch_id,
+                     KioskScreenSaverService *self)
+{
+        KioskIdleStage stage;
+
+        for (stage = KIOSK_IDLE_STAGE_DIM; stage < KIOSK_NUMBER_OF_IDLE_STAGES; stage++) {
+                if (self->idle_watch_ids[stage] != watch_id)
+                        continue;
+
+                g_debug ("KioskScreenSaverService: Idle for %u ms, entering %s stage",
+                         self->idle_times[stage], kiosk_idle_stage_to_string (stage));
+
+                enter_idle_stage (self, stage);
+                break;
+        }
+}
+
+static void
+remove_idle_watches (KioskScreenSaverService *self)
+{
+        KioskIdleStage stage;
+
+        if (self->idle_monitor == NULL)
+                return;
+
+        for (stage = KIOSK_IDLE_STAGE_DIM; stage < KIOSK_NUMBER_OF_IDLE_STAGES; stage++) {
+                if (self->idle_watch_ids[stage] == 0)
+                        continue;
+
+                meta_idle_monitor_remove_watch (self->idle_monitor, self->idle_watch_ids[stage]);
+                self->idle_watch_ids[stage] = 0;
+        }
+
+        if (self->user_active_watch_id != 0) {
+                meta_idle_monitor_remove_watch (self->idle_monitor, self->user_active_watch_id);
+                self->user_active_watch_id = 0;
+        }
+}
+
+static void
+install_idle_watches (KioskScreenSaverService *self)
+{
+        KioskIdleStage stage;
+
+        remove_idle_watches (self);
+
+        if (self->idle_monitor == NULL)
+                return;
+
+        for (stage = KIOSK_IDLE_STAGE_DIM; stage < KIOSK_NUMBER_OF_IDLE_STAGES; stage++) {
+                if (self->idle_times[stage] == 0)
+                        continue;
+
+                g_debug ("KioskScreenSaverService: Entering %s stage after %u ms of idle time",
+                         kiosk_idle_stage_to_string (stage), self->idle_times[stage]);
+
+                self->idle_watch_ids[stage] =
+                        meta_idle_monitor_add_idle_watch (self->idle_monitor,
+                                                          self->idle_times[stage],
+                                                          (MetaIdleMonitorWatchFunc) on_idle_watch_fired,
+                                                          self,
+                                                          NULL);
+        }
+
+        /* Idle watches don't fire for time that has already passed, so
+         * start over as if the user just became active
+         */
+        set_idle_stage (self, KIOSK_IDLE_STAGE_NONE);
+}
+
+static void
+set_idle_time (KioskScreenSaverService *self,
+               KioskIdleStage           stage,
+               guint                    idle_time)
+{
+        const guint properties[KIOSK_NUMBER_OF_IDLE_STAGES] = {
+                [KIOSK_IDLE_STAGE_DIM] = PROP_DIM_IDLE_TIME,
+                [KIOSK_IDLE_STAGE_BLANK] = PROP_BLANK_IDLE_TIME,
+                [KIOSK_IDLE_STAGE_LOCK] = PROP_LOCK_IDLE_TIME,
+                [KIOSK_IDLE_STAGE_POWER_OFF] = PROP_POWER_OFF_IDLE_TIME,
+        };
+
+        if (self->idle_times[stage] == idle_time)
+                return;
+
+        self->idle_times[stage] = idle_time;
+
+        install_idle_watches (self);
+
+        g_object_notify_by_pspec (G_OBJECT (self), kiosk_screensaver_service_properties[properties[stage]]);
+}
+
+static void
+update_idle_times_from_settings (KioskScreenSaverService *self)
+{
+        guint idle_delay;
+        guint lock_delay = 0;
+
+        /* idle-delay is what gnome-session uses to decide the session is
+         * idle, lock-delay counts from the screensaver being activated
+         */
+        idle_delay = g_settings_get_uint (self->session_settings, GNOME_DESKTOP_SESSION_IDLE_DELAY);
+
+        /* Both end up in milliseconds, so they need to fit in a guint
+         * once multiplied by 1000
+         */
+        idle_delay = MIN (idle_delay, G_MAXUINT / 1000);
+
+        if (idle_delay != 0 &&
+            g_settings_get_boolean (self->screensaver_settings, GNOME_DESKTOP_SCREENSAVER_LOCK_ENABLED))
+                lock_delay = MIN ((guint64) idle_delay + g_settings_get_uint (self->screensaver_settings,
+                                                                              GNOME_DESKTOP_SCREENSAVER_LOCK_DELAY),
+                                  G_MAXUINT / 1000);
+
+        set_idle_time (self, KIOSK_IDLE_STAGE_BLANK, idle_delay * 1000);
+        set_idle_time (self, KIOSK_IDLE_STAGE_LOCK, lock_delay * 1000);
+}
+
 static void
 on_session_presence_status_changed (GObject                 *object,
                                     GParamSpec              *pspec,
@@ -185,6 +492,7 @@ static void
 kiosk_screensaver_service_constructed (GObject *object)
 {
         KioskScreenSaverService *self = KIOSK_SCREENSAVER_SERVICE (object);
+        MetaBackend *backend;
 
         G_OBJECT_CLASS (kiosk_screensaver_service_parent_class)->constructed (object);
 
@@ -200,10 +508,55 @@ kiosk_screensaver_service_constructed (GObject *object)
                           G_CALLBACK (on_screensaver_status_changed),
                           self);
 
-        g_signal_connect (self->session_presence,
-                          "notify::status",
-                          G_CALLBACK (on_session_presence_status_changed),
-                          self);
+        self->use_idle_monitor = is_idle_monitor_enabled ();
+
+        if (!self->use_idle_monitor) {
+                g_signal_connect (self->session_presence,
+                                  "notify::status",
+                                  G_CALLBACK (on_session_presence_status_changed),
+                                  self);
+
+                /* Without the idle monitor, there is no telling how long
+                 * the session was idle before gnome-session said so, the
+                 * outputs get turned off once the screensaver was shown
+                 * that long
+                 */
+                kiosk_screensaver_set_power_off_delay (self->screensaver, get_power_off_delay ());
+                return;
+        }
+
+        g_debug ("KioskScreenSaverService: Using idle monitor instead of session presence");
+
+        backend = meta_context_get_backend (meta_display_get_context (self->display));
+        g_set_weak_pointer (&self->idle_monitor, meta_backend_get_core_idle_monitor (backend));
+        g_set_weak_pointer (&self->brightness, kiosk_compositor_get_brightness (self->compositor));
+
+        self->session_settings = g_settings_new (GNOME_DESKTOP_SESSION_SCHEMA);
+
+        g_signal_connect_object (G_OBJECT (self->session_settings),
+                                 "changed::" GNOME_DESKTOP_SESSION_IDLE_DELAY,
+                                 G_CALLBACK (update_idle_times_from_settings),
+                                 self,
+                                 G_CONNECT_SWAPPED);
+        g_signal_connect_object (G_OBJECT (self->screensaver_settings),
+                                 "changed::" GNOME_DESKTOP_SCREENSAVER_LOCK_ENABLED,
+                                 G_CALLBACK (update_idle_times_from_settings),
+                                 self,
+                                 G_CONNECT_SWAPPED);
+        g_signal_connect_object (G_OBJECT (self->screensaver_settings),
+                                 "changed::" GNOME_DESKTOP_SCREENSAVER_LOCK_DELAY,
+                                 G_CALLBACK (update_idle_times_from_settings),
+                                 self,
+                                 G_CONNECT_SWAPPED);
+
+        /* Dimming and turning the screens off have no settings of their
+         * own, they come from the command line
+         */
+        set_idle_time (self, KIOSK_IDLE_STAGE_DIM, get_dim_delay () * 1000);
+        set_idle_time (self, KIOSK_IDLE_STAGE_POWER_OFF, get_power_off_delay () * 1000);
+
+        update_idle_times_from_settings (self);
+        install_idle_watches (self);
 }
 
 static void
@@ -214,6 +567,10 @@ kiosk_screensaver_service_dispose (GObject *object)
         kiosk_screensaver_service_stop (self);
 
         cancel_lock_timeout (self);
+        remove_idle_watches (self);
+
+        if (self->brightness != NULL)
+                kiosk_brightness_set_idle_dimming (self->brightness, FALSE);
 
         g_signal_handlers_disconnect_by_func (self->session_presence,
                                               on_session_presence_status_changed,
@@ -224,8 +581,11 @@ kiosk_screensaver_service_dispose (GObject *object)
                                               self);
 
         g_clear_object (&self->screensaver_settings);
+        g_clear_object (&self->session_settings);
         g_clear_object (&self->screensaver);
 
+        g_clear_weak_pointer (&self->brightness);
+        g_clear_weak_pointer (&self->idle_monitor);
         g_clear_weak_pointer (&self->session_presence);
         g_clear_weak_pointer (&self->compositor);
         g_clear_weak_pointer (&self->display);
@@ -322,6 +682,31 @@ kiosk_screensaver_service_class_init (KioskScreenSaverServiceClass *screensaver_
                                                                                      NULL, NULL,
                                                                                      KIOSK_TYPE_COMPOSITOR,
                                                                                      G_PARAM_CONSTRUCT_ONLY | G_PARAM_WRITABLE | G_PARAM_STATIC_NAME);
+        kiosk_screensaver_service_properties[PROP_DIM_IDLE_TIME] = g_param_spec_uint ("dim-idle-time",
+                                                                                      NULL, NULL,
+                                                                                      0, G_MAXUINT,
+                                                                                      0,
+                                                                                      G_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY | G_PARAM_STATIC_STRINGS);
+        kiosk_screensaver_service_properties[PROP_BLANK_IDLE_TIME] = g_param_spec_uint ("blank-idle-time",
+                                                                                        NULL, NULL,
+                                                                                        0, G_MAXUINT,
+                                                                                        0,
+                                                                                        G_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY | G_PARAM_STATIC_STRINGS);
+        kiosk_screensaver_service_properties[PROP_LOCK_IDLE_TIME] = g_param_spec_uint ("lock-idle-time",
+                                                                                       NULL, NULL,
+                                                                                       0, G_MAXUINT,
+                                                                                       0,
+                                                                                       G_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY | G_PARAM_STATIC_STRINGS);
+        kiosk_screensaver_service_properties[PROP_POWER_OFF_IDLE_TIME] = g_param_spec_uint ("power-off-idle-time",
+                                                                                            NULL, NULL,
+                                                                                            0, G_MAXUINT,
+                                                                                            0,
+                                                                                            G_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY | G_PARAM_STATIC_STRINGS);
+        kiosk_screensaver_service_properties[PROP_IDLE_STAGE] = g_param_spec_enum ("idle-stage",
+                                                                                   NULL, NULL,
+                                                                                   KIOSK_TYPE_IDLE_STAGE,
+                                                                                   KIOSK_IDLE_STAGE_NONE,
+                                                                                   G_PARAM_READABLE | G_PARAM_EXPLICIT_NOTIFY | G_PARAM_STATIC_STRINGS);
         g_object_class_install_properties (object_class, NUMBER_OF_PROPERTIES, kiosk_screensaver_service_properties);
 }
 
@@ -407,3 +792,20 @@ kiosk_screensaver_service_stop (KioskScreenSaverService *self)
         g_dbus_interface_skeleton_unexport (G_DBUS_INTERFACE_SKELETON (self));
         g_clear_handle_id (&self->bus_id, g_bus_unown_name);
 }
+
+/**
+ * kiosk_screensaver_service_get_idle_stage:
+ * @service: a #KioskScreenSaverService
+ *
+ * Returns how far the session has gone into being idle, when idleness is
+ * detected with the idle monitor.
+ *
+ * Returns: the current idle stage
+ */
+KioskIdleStage
+kiosk_screensaver_service_get_idle_stage (KioskScreenSaverService *self)
+{
+        g_return_val_if_fail (KIOSK_IS_SCREENSAVER_SERVICE (self), KIOSK_IDLE_STAGE_NONE);
+
+        return self->idle_stage;
+}
@@ -15,9 +15,32 @@ G_DECLARE_FINAL_TYPE (KioskScreenSaverService,
                       KIOSK, SCREENSAVER_SERVICE,
                       KioskScreenSaverSkeleton);
 
+/**
+ * KioskIdleStage:
+ * @KIOSK_IDLE_STAGE_NONE: the user is active
+ * @KIOSK_IDLE_STAGE_DIM: the screens get dimmed
+ * @KIOSK_IDLE_STAGE_BLANK: the screensaver is shown
+ * @KIOSK_IDLE_STAGE_LOCK: the screensaver is locked
+ * @KIOSK_IDLE_STAGE_POWER_OFF: the outputs are turned off
+ *
+ * The stages the session goes through while the user stays idle.
+ */
+typedef enum
+{
+        KIOSK_IDLE_STAGE_NONE = 0,
+        KIOSK_IDLE_STAGE_DIM,
+        KIOSK_IDLE_STAGE_BLANK,
+        KIOSK_IDLE_STAGE_LOCK,
+        KIOSK_IDLE_STAGE_POWER_OFF,
+} KioskIdleStage;
+
+#define KIOSK_TYPE_IDLE_STAGE (kiosk_idle_stage_get_type ())
+GType kiosk_idle_stage_get_type (void);
+
 KioskScreenSaverService *kiosk_screensaver_service_new (KioskCompositor *compositor);
 gboolean kiosk_screensaver_service_start (KioskScreenSaverService *service,
                                           GError                 **error);
 void kiosk_screensaver_service_stop (KioskScreenSaverService *service);
+KioskIdleStage kiosk_screensaver_service_get_idle_stage (KioskScreenSaverService *service);
 
 G_END_DECLS
@@ -12,6 +12,15 @@
 
 #include "kiosk-compositor.h"
 
+#include "org.gnome.Mutter.DisplayConfig.h"
+
+#define MUTTER_DISPLAY_CONFIG_BUS_NAME "org.gnome.Mutter.DisplayConfig"
+#define MUTTER_DISPLAY_CONFIG_OBJECT_PATH "/org/gnome/Mutter/DisplayConfig"
+
+/* Values of the PowerSaveMode property */
+#define MUTTER_POWER_SAVE_MODE_ON 0
+#define MUTTER_POWER_SAVE_MODE_OFF 3
+
 struct _KioskScreensaver
 {
         GObject             parent;
@@ -23,19 +32,29 @@ struct _KioskScreensaver
         MetaBackend        *backend;
         MetaMonitorManager *monitor_manager;
         ClutterActor       *stage;
+        ClutterActor       *window_group;
 
         /* strong references */
         ClutterActor       *screensaver_group;
         ClutterGrab        *stage_grab;
+        GCancellable       *cancellable;
+        KioskDisplayConfig *display_config;
+
+        /* handles */
+        guint               power_off_timeout_id;
 
         gboolean            active;
         gboolean            locked;
         gint64              activate_time;
+        gboolean            windows_hidden;
+        gboolean            powered_off;
+        guint               power_off_delay;
 };
 
 enum
 {
         PROP_COMPOSITOR = 1,
+        PROP_POWER_OFF_DELAY,
         NUMBER_OF_PROPERTIES
 };
 static GParamSpec *kiosk_screensaver_properties[NUMBER_OF_PROPERTIES] = { NULL, };
@@ -62,6 +81,10 @@ kiosk_screensaver_set_property (GObject      *object,
                 g_set_weak_pointer (&self->compositor, g_value_get_object (value));
                 break;
 
+        case PROP_POWER_OFF_DELAY:
+                kiosk_screensaver_set_power_off_delay (self, g_value_get_uint (value));
+                break;
+
         default:
                 G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, param_spec);
                 break;
@@ -74,20 +97,38 @@ kiosk_screensaver_get_property (GObject    *object,
                                 GValue     *value,
                                 GParamSpec *param_spec)
 {
+        KioskScreensaver *self = KIOSK_SCREENSAVER (object);
+
         switch (property_id) {
+        case PROP_POWER_OFF_DELAY:
+                g_value_set_uint (value, self->power_off_delay);
+                break;
+
         default:
                 G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, param_spec);
                 break;
         }
 }
 
+static void
+update_screensaver_actor_geometry (KioskScreensaver *self,
+                                   ClutterActor     *screensaver_actor,
+                                   int               monitor_index)
+{
+        MtkRectangle geometry;
+
+        meta_display_get_monitor_geometry (self->display, monitor_index, &geometry);
+
+        clutter_actor_set_position (screensaver_actor, geometry.x, geometry.y);
+        clutter_actor_set_size (screensaver_actor, geometry.width, geometry.height);
+}
+
 static void
 create_screensaver_for_monitor (KioskScreensaver *self,
                                 int               monitor_index)
 {
         ClutterActor *screensaver_actor;
         CoglColor black;
-        MtkRectangle geometry;
 
         g_debug ("KioskScreensaver: Creating screensaver for monitor %d", monitor_index);
 
@@ -97,10 +138,7 @@ create_screensaver_for_monitor (KioskScreensaver *self,
         clutter_actor_set_background_color (screensaver_actor, &black);
         clutter_actor_set_reactive (screensaver_actor, TRUE);
 
-        meta_display_get_monitor_geometry (self->display, monitor_index, &geometry);
-
-        clutter_actor_set_position (screensaver_actor, geometry.x, geometry.y);
-        clutter_actor_set_size (screensaver_actor, geometry.width, geometry.height);
+        update_screensaver_actor_geometry (self, screensaver_actor, monitor_index);
 
         clutter_actor_add_child (self->screensaver_group, screensaver_actor);
 }
@@ -135,6 +173,9 @@ is_unlock_event (ClutterEvent *event)
         return FALSE;
 }
 
+static void power_on (KioskScreensaver *self);
+static void start_power_off_timeout (KioskScreensaver *self);
+
 static gboolean
 on_input_event (ClutterActor *actor,
                 ClutterEvent *event,
@@ -147,6 +188,12 @@ on_input_event (ClutterActor *actor,
         if (!self->locked && !self->active)
                 return CLUTTER_EVENT_PROPAGATE;
 
+        /* Any input turns the outputs back on, even if it doesn't unlock */
+        if (self->powered_off) {
+                power_on (self);
+                start_power_off_timeout (self);
+        }
+
         /* When locked, only deactivate on specific key press or button click */
         if (self->locked && !is_unlock_event (event))
                 return CLUTTER_EVENT_STOP;
@@ -159,32 +206,129 @@ on_input_event (ClutterActor *actor,
 }
 
 static void
-reinitialize_screensavers (KioskScreensaver *self)
+reconcile_screensavers (KioskScreensaver *self)
 {
-        g_autoptr (GList) old_children = NULL;
-        GList *l;
+        ClutterActor *screensaver_actor;
         int i, number_of_monitors;
 
-        g_debug ("KioskScreensaver: Recreating screensavers");
-
-        old_children = clutter_actor_get_children (self->screensaver_group);
+        g_debug ("KioskScreensaver: Reconciling screensavers with monitors");
 
+        /* The actors are kept across activations, one per monitor in
+         * monitor order, and only follow changes to the monitors
+         */
         number_of_monitors = meta_display_get_n_monitors (self->display);
+        screensaver_actor = clutter_actor_get_first_child (self->screensaver_group);
         for (i = 0; i < number_of_monitors; i++) {
-                create_screensaver_for_monitor (self, i);
+                if (screensaver_actor == NULL) {
+                        create_screensaver_for_monitor (self, i);
+                        continue;
+                }
+
+                update_screensaver_actor_geometry (self, screensaver_actor, i);
+                screensaver_actor = clutter_actor_get_next_sibling (screensaver_actor);
         }
 
-        for (l = old_children; l != NULL; l = l->next) {
-                clutter_actor_destroy (CLUTTER_ACTOR (l->data));
+        while (screensaver_actor != NULL) {
+                ClutterActor *next_actor = clutter_actor_get_next_sibling (screensaver_actor);
+
+                g_debug ("KioskScreensaver: Destroying screensaver of removed monitor");
+                clutter_actor_destroy (screensaver_actor);
+                screensaver_actor = next_actor;
         }
+}
 
-        if (self->stage_grab == NULL) {
-                g_debug ("KioskScreensaver: Grabbing stage");
-                self->stage_grab = clutter_stage_grab (CLUTTER_STAGE (self->stage),
-                                                       self->screensaver_group);
+static void
+set_power_save_mode (KioskScreensaver *self,
+                     int               power_save_mode)
+{
+        if (self->display_config == NULL) {
+                g_debug ("KioskScreensaver: Can't change power save mode, display config not available");
+                return;
         }
 
-        g_debug ("KioskScreensaver: Finished recreating screensavers");
+        kiosk_display_config_set_power_save_mode (self->display_config, power_save_mode);
+}
+
+static void
+power_off (KioskScreensaver *self)
+{
+        g_clear_handle_id (&self->power_off_timeout_id, g_source_remove);
+
+        if (self->powered_off)
+                return;
+
+        g_debug ("KioskScreensaver: Turning off outputs");
+
+        self->powered_off = TRUE;
+        set_power_save_mode (self, MUTTER_POWER_SAVE_MODE_OFF);
+}
+
+static void
+on_power_off_timeout (gpointer user_data)
+{
+        KioskScreensaver *self = user_data;
+
+        self->power_off_timeout_id = 0;
+
+        power_off (self);
+}
+
+static void
+start_power_off_timeout (KioskScreensaver *self)
+{
+        g_clear_handle_id (&self->power_off_timeout_id, g_source_remove);
+
+        if (self->power_off_delay == 0 || self->powered_off)
+                return;
+
+        g_debug ("KioskScreensaver: Turning off outputs in %u seconds", self->power_off_delay);
+
+        self->power_off_timeout_id = g_timeout_add_seconds_once (self->power_off_delay,
+                                                                 on_power_off_timeout,
+                                                                 self);
+        g_source_set_name_by_id (self->power_off_timeout_id, "[kiosk-screensaver] on_power_off_timeout");
+}
+
+static void
+power_on (KioskScreensaver *self)
+{
+        g_clear_handle_id (&self->power_off_timeout_id, g_source_remove);
+
+        if (!self->powered_off)
+                return;
+
+        g_debug ("KioskScreensaver: Turning on outputs");
+
+        self->powered_off = FALSE;
+        set_power_save_mode (self, MUTTER_POWER_SAVE_MODE_ON);
+}
+
+static void
+hide_windows (KioskScreensaver *self)
+{
+        if (self->windows_hidden)
+                return;
+
+        /* Once the screensaver covers everything, nothing below it needs
+         * to be painted. Windows that don't get painted stop getting frame
+         * callbacks, so their clients stop drawing as well.
+         */
+        g_debug ("KioskScreensaver: Hiding windows below screensaver");
+
+        self->windows_hidden = TRUE;
+        clutter_actor_hide (self->window_group);
+}
+
+static void
+show_windows (KioskScreensaver *self)
+{
+        if (!self->windows_hidden)
+                return;
+
+        g_debug ("KioskScreensaver: Showing windows below screensaver");
+
+        self->windows_hidden = FALSE;
+        clutter_actor_show (self->window_group);
 }
 
 static void
@@ -194,6 +338,10 @@ kiosk_screensaver_show_now (KioskScreensaver *self)
 
         clutter_actor_set_opacity (self->screensaver_group, 255);
         clutter_actor_show (self->screensaver_group);
+
+        hide_windows (self);
+        start_power_off_timeout (self);
+
         g_signal_emit (self, kiosk_screensaver_signals[STATUS_CHANGED], 0, TRUE);
 }
 
@@ -215,22 +363,11 @@ kiosk_screensaver_show (KioskScreensaver *self)
         self->activate_time = g_get_monotonic_time ();
         clutter_actor_set_child_above_sibling (self->stage, self->screensaver_group, NULL);
 
-        g_signal_connect (self->screensaver_group, "button-press-event",
-                          G_CALLBACK (on_input_event), self);
-        g_signal_connect (self->screensaver_group, "key-press-event",
-                          G_CALLBACK (on_input_event), self);
-        g_signal_connect (self->screensaver_group, "motion-event",
-                          G_CALLBACK (on_input_event), self);
-        g_signal_connect (self->screensaver_group, "touch-event",
-                          G_CALLBACK (on_input_event), self);
-
-        g_signal_connect_object (G_OBJECT (self->monitor_manager),
-                                 "monitors-changed",
-                                 G_CALLBACK (reinitialize_screensavers),
-                                 self,
-                                 G_CONNECT_SWAPPED);
-
-        reinitialize_screensavers (self);
+        if (self->stage_grab == NULL) {
+                g_debug ("KioskScreensaver: Grabbing stage");
+                self->stage_grab = clutter_stage_grab (CLUTTER_STAGE (self->stage),
+                                                       self->screensaver_group);
+        }
 
         if (!kiosk_compositor_are_animations_enabled (self->compositor)) {
                 /* Show immediately without fade */
@@ -260,7 +397,6 @@ kiosk_screensaver_hide_now (KioskScreensaver *self)
         g_debug ("KioskScreensaver: Hiding screensaver");
 
         clutter_actor_hide (self->screensaver_group);
-        clutter_actor_destroy_all_children (self->screensaver_group);
         g_signal_emit (self, kiosk_screensaver_signals[STATUS_CHANGED], 0, FALSE);
 }
 
@@ -281,13 +417,13 @@ kiosk_screensaver_hide (KioskScreensaver *self)
         self->active = FALSE;
         self->locked = FALSE;
 
-        g_clear_pointer (&self->stage_grab, clutter_grab_dismiss);
+        /* Bring everything back right away, so the windows are there by
+         * the time the screensaver fades out
+         */
+        power_on (self);
+        show_windows (self);
 
-        g_signal_handlers_disconnect_by_func (self->screensaver_group,
-                                              G_CALLBACK (on_input_event), self);
-
-        g_signal_handlers_disconnect_by_func (self->monitor_manager,
-                                              G_CALLBACK (reinitialize_screensavers), self);
+        g_clear_pointer (&self->stage_grab, clutter_grab_dismiss);
 
         if (!kiosk_compositor_are_animations_enabled (self->compositor)) {
                 /* Hide immediately without fade */
@@ -309,6 +445,25 @@ kiosk_screensaver_hide (KioskScreensaver *self)
                           self);
 }
 
+static void
+on_display_config_proxy_ready (GObject          *source_object,
+                               GAsyncResult     *result,
+                               KioskScreensaver *self)
+{
+        g_autoptr (GError) error = NULL;
+        KioskDisplayConfig *display_config;
+
+        display_config = kiosk_display_config_proxy_new_for_bus_finish (result, &error);
+
+        if (error != NULL) {
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        g_debug ("KioskScreensaver: Could not contact display config: %s", error->message);
+                return;
+        }
+
+        self->display_config = display_config;
+}
+
 static void
 kiosk_screensaver_constructed (GObject *object)
 {
@@ -323,12 +478,40 @@ kiosk_screensaver_constructed (GObject *object)
         g_set_weak_pointer (&self->backend, meta_context_get_backend (self->context));
         g_set_weak_pointer (&self->stage, CLUTTER_ACTOR (meta_compositor_get_stage (compositor)));
         g_set_weak_pointer (&self->monitor_manager, meta_backend_get_monitor_manager (self->backend));
+        g_set_weak_pointer (&self->window_group, meta_compositor_get_window_group (compositor));
+
+        self->cancellable = g_cancellable_new ();
+
+        kiosk_display_config_proxy_new_for_bus (G_BUS_TYPE_SESSION,
+                                                G_DBUS_PROXY_FLAGS_DO_NOT_CONNECT_SIGNALS,
+                                                MUTTER_DISPLAY_CONFIG_BUS_NAME,
+                                                MUTTER_DISPLAY_CONFIG_OBJECT_PATH,
+                                                self->cancellable,
+                                                (GAsyncReadyCallback) on_display_config_proxy_ready,
+                                                self);
 
         self->screensaver_group = clutter_actor_new ();
         g_object_ref_sink (self->screensaver_group);
         clutter_actor_set_reactive (self->screensaver_group, TRUE);
         clutter_actor_add_child (self->stage, self->screensaver_group);
         clutter_actor_hide (self->screensaver_group);
+
+        reconcile_screensavers (self);
+
+        g_signal_connect (self->screensaver_group, "button-press-event",
+                          G_CALLBACK (on_input_event), self);
+        g_signal_connect (self->screensaver_group, "key-press-event",
+                          G_CALLBACK (on_input_event), self);
+        g_signal_connect (self->screensaver_group, "motion-event",
+                          G_CALLBACK (on_input_event), self);
+        g_signal_connect (self->screensaver_group, "touch-event",
+                          G_CALLBACK (on_input_event), self);
+
+        g_signal_connect_object (G_OBJECT (self->monitor_manager),
+                                 "monitors-changed",
+                                 G_CALLBACK (reconcile_screensavers),
+                                 self,
+                                 G_CONNECT_SWAPPED);
 }
 
 static void
@@ -338,8 +521,23 @@ kiosk_screensaver_dispose (GObject *object)
 
         kiosk_screensaver_hide (self);
 
+        if (self->cancellable != NULL) {
+                g_cancellable_cancel (self->cancellable);
+                g_clear_object (&self->cancellable);
+        }
+
+        if (self->screensaver_group != NULL)
+                g_signal_handlers_disconnect_by_func (self->screensaver_group,
+                                                      G_CALLBACK (on_input_event), self);
+
+        if (self->monitor_manager != NULL)
+                g_signal_handlers_disconnect_by_func (self->monitor_manager,
+                                                      G_CALLBACK (reconcile_screensavers), self);
+
+        g_clear_object (&self->display_config);
         g_clear_object (&self->screensaver_group);
 
+        g_clear_weak_pointer (&self->window_group);
         g_clear_weak_pointer (&self->stage);
         g_clear_weak_pointer (&self->context);
         g_clear_weak_pointer (&self->backend);
@@ -364,6 +562,11 @@ kiosk_screensaver_class_init (KioskScreensaverClass *screensaver_class)
                                                                              NULL, NULL,
                                                                              KIOSK_TYPE_COMPOSITOR,
                                                                              G_PARAM_CONSTRUCT_ONLY | G_PARAM_WRITABLE | G_PARAM_STATIC_NAME);
+        kiosk_screensaver_properties[PROP_POWER_OFF_DELAY] = g_param_spec_uint ("power-off-delay",
+                                                                                NULL, NULL,
+                                                                                0, G_MAXUINT,
+                                                                                0,
+                                                                                G_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY | G_PARAM_STATIC_STRINGS);
         g_object_class_install_properties (object_class, NUMBER_OF_PROPERTIES, kiosk_screensaver_properties);
 
         kiosk_screensaver_signals[STATUS_CHANGED] =
@@ -463,3 +666,46 @@ kiosk_screensaver_get_active_time (KioskScreensaver *self)
         /* Convert from microseconds to seconds */
         return (guint32) (delta / G_USEC_PER_SEC);
 }
+
+/**
+ * kiosk_screensaver_power_off:
+ * @screensaver: a #KioskScreensaver
+ *
+ * Turns off the outputs right away while the screensaver is active,
+ * instead of waiting for the power off delay. They get turned back on
+ * when the screensaver is deactivated.
+ */
+void
+kiosk_screensaver_power_off (KioskScreensaver *self)
+{
+        g_return_if_fail (KIOSK_IS_SCREENSAVER (self));
+        g_return_if_fail (self->active);
+
+        power_off (self);
+}
+
+/**
+ * kiosk_screensaver_set_power_off_delay:
+ * @screensaver: a #KioskScreensaver
+ * @delay: the number of seconds, or 0 to keep the outputs on
+ *
+ * Sets how long the screensaver stays shown before the outputs get
+ * turned off. They get turned back on when the screensaver is
+ * deactivated.
+ */
+void
+kiosk_screensaver_set_power_off_delay (KioskScreensaver *self,
+                                       guint             delay)
+{
+        g_return_if_fail (KIOSK_IS_SCREENSAVER (self));
+
+        if (self->power_off_delay == delay)
+                return;
+
+        self->power_off_delay = delay;
+
+        if (self->windows_hidden)
+                start_power_off_timeout (self);
+
+        g_object_notify_by_pspec (G_OBJECT (self), kiosk_screensaver_properties[PROP_POWER_OFF_DELAY]);
+}
@@ -20,5 +20,8 @@ void     kiosk_screensaver_lock (KioskScreensaver *self);
 gboolean kiosk_screensaver_get_active (KioskScreensaver *self);
 gboolean kiosk_screensaver_get_locked (KioskScreensaver *self);
 guint32  kiosk_screensaver_get_active_time (KioskScreensaver *self);
+void     kiosk_screensaver_power_off (KioskScreensaver *self);
+void     kiosk_screensaver_set_power_off_delay (KioskScreensaver *self,
+                                                guint             delay);
 
 G_END_DECLS
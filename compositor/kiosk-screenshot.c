@@ -1,10 +1,23 @@
 #include "config.h"
 #include "kiosk-compositor.h"
 #include "kiosk-screenshot.h"
+#include "kiosk-buffer-pool.h"
 #include "kiosk-gobject-utils.h"
+#include "kiosk-pixel-utils.h"
+#include "kiosk-png-encoder.h"
+#include "kiosk-qoi-encoder.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <glib/gstdio.h>
+#include <gio/gunixoutputstream.h>
 
 #include <cairo.h>
 #include <cogl/cogl.h>
@@ -24,7 +37,18 @@
 
 /* This code is a largely based on GNOME Shell implementation of ShellScreenshot */
 
+#define KIOSK_SCREENSHOT_TILE_SIZE 64
+#define KIOSK_SCREENSHOT_MAX_FREE_BUFFERS 3
+#define KIOSK_SCREENSHOT_BUFFER_IDLE_TIMEOUT 30
+
 static cairo_user_data_key_t data_key;
+static cairo_user_data_key_t mapping_key;
+
+typedef struct
+{
+        gpointer data;
+        gsize    size;
+} KioskScreenshotMapping;
 
 static void
 bitmap_unmap_and_unref (void *data)
@@ -34,6 +58,14 @@ bitmap_unmap_and_unref (void *data)
         g_object_unref (bitmap);
 }
 
+static void
+mapping_unmap_and_free (void *data)
+{
+        KioskScreenshotMapping *mapping = data;
+        munmap (mapping->data, mapping->size);
+        g_free (mapping);
+}
+
 typedef enum _KioskScreenshotFlag
 {
         KIOSK_SCREENSHOT_FLAG_NONE,
@@ -56,6 +88,47 @@ enum
 
 static guint signals[LAST_SIGNAL] = { 0, };
 
+/* A single capture request, owned by the GTask returned to the caller */
+typedef struct
+{
+        KioskScreenshotMode      mode;
+        KioskScreenshotFlag      flags;
+        GOutputStream           *stream;
+        GFile                   *file;
+        gboolean                 creating_file;
+        gboolean                 waiting_for_file;
+        MtkRectangle             screenshot_area;
+        int                      max_width;
+        int                      max_height;
+        gboolean                 detect_changes;
+        guint64                  since_serial;
+        gboolean                 include_frame;
+        MetaWindow              *window;
+        int                      compression_level;
+        KioskScreenshotFormat    format;
+        int                      memfd;
+
+        cairo_surface_t         *image;
+        gboolean                 image_in_memfd;
+        GDateTime               *datetime;
+        KioskScreenshotImageInfo info;
+        guint64                  serial;
+        GArray                  *changed_tiles;
+} KioskScreenshotRequest;
+
+static void
+kiosk_screenshot_request_free (KioskScreenshotRequest *request)
+{
+        g_clear_object (&request->stream);
+        g_clear_object (&request->file);
+        g_clear_weak_pointer (&request->window);
+        g_clear_pointer (&request->image, cairo_surface_destroy);
+        g_clear_pointer (&request->datetime, g_date_time_unref);
+        g_clear_fd (&request->memfd, NULL);
+        g_clear_pointer (&request->changed_tiles, g_array_unref);
+        g_free (request);
+}
+
 typedef struct _KioskScreenshot KioskScreenshot;
 
 struct _KioskScreenshot
@@ -70,36 +143,90 @@ struct _KioskScreenshot
         ClutterActor       *stage;
 
         /* strong references */
-        GOutputStream      *stream;
-        KioskScreenshotFlag flags;
-        KioskScreenshotMode mode;
-
-        GDateTime          *datetime;
-
-        cairo_surface_t    *image;
-        MtkRectangle        screenshot_area;
-
-        gboolean            include_frame;
-
-        float               scale;
-        ClutterContent     *cursor_content;
-        graphene_point_t    cursor_point;
+        GQueue              pending_requests;    /* GTask, task data is KioskScreenshotRequest */
+        GCancellable       *cancellable;
+        KioskBufferPool    *buffer_pool;
+        CoglTexture        *cursor_texture;
+        cairo_surface_t    *cursor_surface;
+
+        /* private */
+        int                 compression_level;
         float               cursor_scale;
+
+        /* Tile hashes of the last full screen capture that was checked
+         * for changes, guarded by tile_mutex since they are compared in
+         * the worker threads
+         */
+        GMutex              tile_mutex;
+        guint64            *tile_hashes;
+        int                 tile_columns;
+        int                 tile_rows;
+        guint64             tile_serial;
 };
 
 enum
 {
         PROP_COMPOSITOR = 1,
+        PROP_COMPRESSION_LEVEL,
         NUMBER_OF_PROPERTIES
 };
 static GParamSpec *kiosk_screenshot_properties[NUMBER_OF_PROPERTIES] = { NULL, };
 
 G_DEFINE_FINAL_TYPE (KioskScreenshot, kiosk_screenshot, G_TYPE_OBJECT);
+G_DEFINE_QUARK (kiosk-screenshot-error-quark, kiosk_screenshot_error);
+
+static KioskScreenshotRequest *
+kiosk_screenshot_request_new (KioskScreenshot       *screenshot,
+                              KioskScreenshotMode    mode,
+                              KioskScreenshotFormat  format,
+                              int                    compression_level)
+{
+        KioskScreenshotRequest *request;
+
+        request = g_new0 (KioskScreenshotRequest, 1);
+        request->mode = mode;
+        request->flags = KIOSK_SCREENSHOT_FLAG_NONE;
+        request->format = format;
+        request->memfd = -1;
+
+        if (compression_level == KIOSK_PNG_ENCODER_COMPRESSION_LEVEL_DEFAULT)
+                request->compression_level = screenshot->compression_level;
+        else
+                request->compression_level = compression_level;
+
+        return request;
+}
+
+static void
+clear_cursor_cache (KioskScreenshot *screenshot)
+{
+        g_clear_pointer (&screenshot->cursor_surface, cairo_surface_destroy);
+        g_clear_object (&screenshot->cursor_texture);
+        screenshot->cursor_scale = 0.0;
+}
 
 static void
 kiosk_screenshot_dispose (GObject *object)
 {
         KioskScreenshot *self = KIOSK_SCREENSHOT (object);
+        GTask *result;
+
+        while ((result = g_queue_pop_head (&self->pending_requests)) != NULL) {
+                g_task_return_new_error (result,
+                                         G_IO_ERROR,
+                                         G_IO_ERROR_CANCELLED,
+                                         "Screenshot was cancelled");
+                g_object_unref (result);
+        }
+
+        /* Fails the requests still waiting for their files */
+        g_cancellable_cancel (self->cancellable);
+        g_clear_object (&self->cancellable);
+
+        if (self->buffer_pool != NULL)
+                kiosk_buffer_pool_trim (self->buffer_pool);
+        g_clear_object (&self->buffer_pool);
+        clear_cursor_cache (self);
 
         g_clear_weak_pointer (&self->context);
         g_clear_weak_pointer (&self->backend);
@@ -110,6 +237,17 @@ kiosk_screenshot_dispose (GObject *object)
         G_OBJECT_CLASS (kiosk_screenshot_parent_class)->dispose (object);
 }
 
+static void
+kiosk_screenshot_finalize (GObject *object)
+{
+        KioskScreenshot *self = KIOSK_SCREENSHOT (object);
+
+        g_clear_pointer (&self->tile_hashes, g_free);
+        g_mutex_clear (&self->tile_mutex);
+
+        G_OBJECT_CLASS (kiosk_screenshot_parent_class)->finalize (object);
+}
+
 static void
 kiosk_screenshot_constructed (GObject *object)
 {
@@ -123,6 +261,12 @@ kiosk_screenshot_constructed (GObject *object)
         g_set_weak_pointer (&self->context, meta_display_get_context (self->display));
         g_set_weak_pointer (&self->backend, meta_context_get_backend (self->context));
         g_set_weak_pointer (&self->stage, CLUTTER_ACTOR (meta_compositor_get_stage (compositor)));
+
+        g_signal_connect_object (G_OBJECT (meta_backend_get_cursor_tracker (self->backend)),
+                                 "cursor-changed",
+                                 G_CALLBACK (clear_cursor_cache),
+                                 self,
+                                 G_CONNECT_SWAPPED);
 }
 
 static void
@@ -138,6 +282,10 @@ kiosk_screenshot_set_property (GObject      *object,
                 g_set_weak_pointer (&self->compositor, g_value_get_object (value));
                 break;
 
+        case PROP_COMPRESSION_LEVEL:
+                self->compression_level = g_value_get_int (value);
+                break;
+
         default:
                 G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, param_spec);
                 break;
@@ -150,7 +298,13 @@ kiosk_screenshot_get_property (GObject    *object,
                                GValue     *value,
                                GParamSpec *param_spec)
 {
+        KioskScreenshot *self = KIOSK_SCREENSHOT (object);
+
         switch (property_id) {
+        case PROP_COMPRESSION_LEVEL:
+                g_value_set_int (value, self->compression_level);
+                break;
+
         default:
                 G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, param_spec);
                 break;
@@ -166,11 +320,18 @@ kiosk_screenshot_class_init (KioskScreenshotClass *screenshot_class)
         object_class->set_property = kiosk_screenshot_set_property;
         object_class->get_property = kiosk_screenshot_get_property;
         object_class->dispose = kiosk_screenshot_dispose;
+        object_class->finalize = kiosk_screenshot_finalize;
 
         kiosk_screenshot_properties[PROP_COMPOSITOR] = g_param_spec_object ("compositor",
                                                                             NULL, NULL,
                                                                             KIOSK_TYPE_COMPOSITOR,
                                                                             G_PARAM_CONSTRUCT_ONLY | G_PARAM_WRITABLE | G_PARAM_STATIC_NAME);
+        kiosk_screenshot_properties[PROP_COMPRESSION_LEVEL] = g_param_spec_int ("compression-level",
+                                                                                NULL, NULL,
+                                                                                KIOSK_PNG_ENCODER_COMPRESSION_LEVEL_DEFAULT,
+                                                                                KIOSK_PNG_ENCODER_COMPRESSION_LEVEL_BEST,
+                                                                                KIOSK_PNG_ENCODER_COMPRESSION_LEVEL_DEFAULT,
+                                                                                G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_NAME);
         g_object_class_install_properties (object_class, NUMBER_OF_PROPERTIES, kiosk_screenshot_properties);
 
         signals[SCREENSHOT_TAKEN] =
@@ -188,183 +349,279 @@ static void
 kiosk_screenshot_init (KioskScreenshot *screenshot)
 {
         g_debug ("KiosScreenshot: Initializing");
+
+        g_queue_init (&screenshot->pending_requests);
+        screenshot->cancellable = g_cancellable_new ();
+        screenshot->buffer_pool = kiosk_buffer_pool_new (KIOSK_SCREENSHOT_MAX_FREE_BUFFERS,
+                                                         KIOSK_SCREENSHOT_BUFFER_IDLE_TIMEOUT);
+        g_mutex_init (&screenshot->tile_mutex);
 }
 
 static void
-on_screenshot_written (GObject      *source,
-                       GAsyncResult *task,
-                       gpointer      user_data)
+set_error_from_errno (GError     **error,
+                      const char  *message)
 {
-        KioskScreenshot *screenshot = KIOSK_SCREENSHOT (source);
-        GTask *result = user_data;
+        int saved_errno = errno;
 
-        g_task_return_boolean (result, g_task_propagate_boolean (G_TASK (task), NULL));
-        g_object_unref (result);
+        g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                     "%s: %s", message, g_strerror (saved_errno));
+}
 
-        g_clear_pointer (&screenshot->image, cairo_surface_destroy);
-        g_clear_object (&screenshot->stream);
-        g_clear_pointer (&screenshot->datetime, g_date_time_unref);
+static gboolean
+create_memfd (KioskScreenshotRequest *request,
+              GError                **error)
+{
+        request->memfd = memfd_create ("kiosk-screenshot", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+        if (request->memfd < 0) {
+                set_error_from_errno (error, "Could not create memfd for screenshot");
+                return FALSE;
+        }
+
+        request->stream = g_unix_output_stream_new (request->memfd, FALSE);
+
+        return TRUE;
 }
 
-static cairo_format_t
-util_cairo_format_for_content (cairo_content_t  content)
+static gboolean
+seal_memfd (KioskScreenshotRequest *request,
+            GError                **error)
 {
-        switch (content) {
-        case CAIRO_CONTENT_COLOR:
-                return CAIRO_FORMAT_RGB24;
-        case CAIRO_CONTENT_ALPHA:
-                return CAIRO_FORMAT_A8;
-        case CAIRO_CONTENT_COLOR_ALPHA:
-        default:
-                return CAIRO_FORMAT_ARGB32;
+        struct stat file_info;
+
+        /* The image must be unmapped at this point, F_SEAL_WRITE is
+         * refused while writable shared mappings exist
+         */
+        g_assert (request->image == NULL);
+
+        if (lseek (request->memfd, 0, SEEK_SET) < 0) {
+                set_error_from_errno (error, "Could not rewind screenshot memfd");
+                return FALSE;
+        }
+
+        if (fcntl (request->memfd, F_ADD_SEALS,
+                   F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0) {
+                set_error_from_errno (error, "Could not seal screenshot memfd");
+                return FALSE;
         }
+
+        if (fstat (request->memfd, &file_info) < 0) {
+                set_error_from_errno (error, "Could not query screenshot memfd");
+                return FALSE;
+        }
+
+        request->info.size = file_info.st_size;
+
+        return TRUE;
 }
 
 static cairo_surface_t *
-util_cairo_surface_coerce_to_image (cairo_surface_t *surface,
-                                    cairo_content_t  content,
-                                    int              src_x,
-                                    int              src_y,
-                                    int              width,
-                                    int              height)
-{
-        cairo_surface_t *copy;
-        cairo_t *cr;
+create_memfd_surface (KioskScreenshotRequest *request,
+                      int                     width,
+                      int                     height,
+                      GError                **error)
+{
+        KioskScreenshotMapping *mapping;
+        cairo_surface_t *image;
+        gpointer data;
+        gsize size;
+        int stride;
 
-        copy = cairo_image_surface_create (util_cairo_format_for_content (content),
-                                           width,
-                                           height);
+        stride = cairo_format_stride_for_width (CAIRO_FORMAT_ARGB32, width);
+        size = (gsize) stride * height;
 
-        cr = cairo_create (copy);
-        cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
-        cairo_set_source_surface (cr, surface, -src_x, -src_y);
-        cairo_paint (cr);
-        cairo_destroy (cr);
+        if (ftruncate (request->memfd, size) < 0) {
+                set_error_from_errno (error, "Could not resize screenshot memfd");
+                return NULL;
+        }
+
+        data = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, request->memfd, 0);
+        if (data == MAP_FAILED) {
+                set_error_from_errno (error, "Could not map screenshot memfd");
+                return NULL;
+        }
+
+        image = cairo_image_surface_create_for_data (data, CAIRO_FORMAT_ARGB32,
+                                                     width, height, stride);
 
-        return copy;
+        mapping = g_new0 (KioskScreenshotMapping, 1);
+        mapping->data = data;
+        mapping->size = size;
+        cairo_surface_set_user_data (image, &mapping_key, mapping, mapping_unmap_and_free);
+
+        return image;
 }
 
-static void
-convert_alpha (guchar *dest_data,
-               int     dest_stride,
-               guchar *src_data,
-               int     src_stride,
-               int     src_x,
-               int     src_y,
-               int     width,
-               int     height)
+static gboolean
+write_raw_image (KioskScreenshotRequest *request,
+                 GCancellable           *cancellable,
+                 GError                **error)
 {
-        int x, y;
+        const guint8 *data;
+        int width, height, stride;
+        int y;
 
-        src_data += src_stride * src_y + src_x * 4;
+        cairo_surface_flush (request->image);
 
-        for (y = 0; y < height; y++) {
-                uint32_t *src = (guint32 *) src_data;
-
-                for (x = 0; x < width; x++) {
-                        unsigned int alpha = src[x] >> 24;
-
-                        if (alpha == 0) {
-                                dest_data[x * 4 + 0] = 0;
-                                dest_data[x * 4 + 1] = 0;
-                                dest_data[x * 4 + 2] = 0;
-                        } else {
-                                dest_data[x * 4 + 0] = (((src[x] & 0xff0000) >> 16) * 255 + alpha / 2) / alpha;
-                                dest_data[x * 4 + 1] = (((src[x] & 0x00ff00) >> 8) * 255 + alpha / 2) / alpha;
-                                dest_data[x * 4 + 2] = (((src[x] & 0x0000ff) >> 0) * 255 + alpha / 2) / alpha;
-                        }
-                        dest_data[x * 4 + 3] = alpha;
-                }
+        data = cairo_image_surface_get_data (request->image);
+        width = cairo_image_surface_get_width (request->image);
+        height = cairo_image_surface_get_height (request->image);
+        stride = cairo_image_surface_get_stride (request->image);
 
-                src_data += src_stride;
-                dest_data += dest_stride;
+        /* Rows are written tightly packed, whatever padding the source
+         * had (window bitmaps come with the stride of their texture)
+         */
+        for (y = 0; y < height; y++) {
+                if (!g_output_stream_write_all (request->stream,
+                                                data + (gsize) y * stride,
+                                                (gsize) width * 4,
+                                                NULL,
+                                                cancellable,
+                                                error))
+                        return FALSE;
         }
+
+        return TRUE;
 }
 
-static void
-convert_no_alpha (guchar *dest_data,
-                  int     dest_stride,
-                  guchar *src_data,
-                  int     src_stride,
-                  int     src_x,
-                  int     src_y,
-                  int     width,
-                  int     height)
+static gboolean
+write_changed_tiles (KioskScreenshot         *screenshot,
+                     KioskScreenshotRequest  *request,
+                     GCancellable            *cancellable,
+                     GError                 **error)
 {
-        int x, y;
+        g_autofree guint64 *hashes = NULL;
+        const guint8 *data;
+        int width, height, stride;
+        int columns, rows;
+        gboolean all_changed;
+        guint i;
+        int tile;
 
-        src_data += src_stride * src_y + src_x * 4;
+        cairo_surface_flush (request->image);
 
-        for (y = 0; y < height; y++) {
-                uint32_t *src = (uint32_t *) src_data;
+        data = cairo_image_surface_get_data (request->image);
+        width = cairo_image_surface_get_width (request->image);
+        height = cairo_image_surface_get_height (request->image);
+        stride = cairo_image_surface_get_stride (request->image);
 
-                for (x = 0; x < width; x++) {
-                        dest_data[x * 3 + 0] = src[x] >> 16;
-                        dest_data[x * 3 + 1] = src[x] >> 8;
-                        dest_data[x * 3 + 2] = src[x];
-                }
+        columns = (width + KIOSK_SCREENSHOT_TILE_SIZE - 1) / KIOSK_SCREENSHOT_TILE_SIZE;
+        rows = (height + KIOSK_SCREENSHOT_TILE_SIZE - 1) / KIOSK_SCREENSHOT_TILE_SIZE;
+        hashes = g_new (guint64, (gsize) columns * rows);
+
+        kiosk_pixel_utils_hash_tiles (data, stride, width, height,
+                                      KIOSK_SCREENSHOT_TILE_SIZE, hashes);
+
+        request->changed_tiles = g_array_new (FALSE, FALSE, sizeof (MtkRectangle));
+
+        g_mutex_lock (&screenshot->tile_mutex);
+
+        /* Only a caller that saw the previous capture can be given the
+         * difference to it, everybody else gets the whole screen
+         */
+        all_changed = request->since_serial == 0 ||
+                      request->since_serial != screenshot->tile_serial ||
+                      columns != screenshot->tile_columns ||
+                      rows != screenshot->tile_rows;
+
+        for (tile = 0; tile < columns * rows; tile++) {
+                MtkRectangle rect;
+
+                if (!all_changed && hashes[tile] == screenshot->tile_hashes[tile])
+                        continue;
 
-                src_data += src_stride;
-                dest_data += dest_stride;
+                rect.x = (tile % columns) * KIOSK_SCREENSHOT_TILE_SIZE;
+                rect.y = (tile / columns) * KIOSK_SCREENSHOT_TILE_SIZE;
+                rect.width = MIN (KIOSK_SCREENSHOT_TILE_SIZE, width - rect.x);
+                rect.height = MIN (KIOSK_SCREENSHOT_TILE_SIZE, height - rect.y);
+                g_array_append_val (request->changed_tiles, rect);
         }
+
+        g_free (screenshot->tile_hashes);
+        screenshot->tile_hashes = g_steal_pointer (&hashes);
+        screenshot->tile_columns = columns;
+        screenshot->tile_rows = rows;
+        request->serial = ++screenshot->tile_serial;
+
+        g_mutex_unlock (&screenshot->tile_mutex);
+
+        g_debug ("KioskScreenshot: %u of %d tiles changed",
+                 request->changed_tiles->len, columns * rows);
+
+        /* The pixels of the changed tiles go out one after the other,
+         * each with tightly packed rows
+         */
+        for (i = 0; i < request->changed_tiles->len; i++) {
+                MtkRectangle *rect = &g_array_index (request->changed_tiles, MtkRectangle, i);
+                int y;
+
+                for (y = rect->y; y < rect->y + rect->height; y++) {
+                        if (!g_output_stream_write_all (request->stream,
+                                                        data + (gsize) y * stride + (gsize) rect->x * 4,
+                                                        (gsize) rect->width * 4,
+                                                        NULL,
+                                                        cancellable,
+                                                        error))
+                                return FALSE;
+                }
+        }
+
+        return TRUE;
 }
 
-static GdkPixbuf *
-util_pixbuf_from_surface (cairo_surface_t *surface,
-                          gint             src_x,
-                          gint             src_y,
-                          gint             width,
-                          gint             height)
+static void
+on_screenshot_written (GObject      *source,
+                       GAsyncResult *task,
+                       gpointer      user_data)
 {
-        cairo_content_t content;
-        GdkPixbuf *dest;
+        GTask *result = user_data;
+        KioskScreenshotRequest *request = g_task_get_task_data (result);
+        GError *error = NULL;
 
-        /* General sanity checks */
-        g_return_val_if_fail (surface != NULL, NULL);
-        g_return_val_if_fail (width > 0 && height > 0, NULL);
+        /* The encoded image is no longer needed, only the area is kept
+         * around for the _finish() call
+         */
+        g_clear_pointer (&request->image, cairo_surface_destroy);
+        g_clear_object (&request->stream);
 
-        content = cairo_surface_get_content (surface) | CAIRO_CONTENT_COLOR;
-        dest = gdk_pixbuf_new (GDK_COLORSPACE_RGB,
-                               !!(content & CAIRO_CONTENT_ALPHA),
-                               8,
-                               width, height);
+        if (!g_task_propagate_boolean (G_TASK (task), &error))
+                g_task_return_error (result, error);
+        else if (request->memfd >= 0 && !seal_memfd (request, &error))
+                g_task_return_error (result, error);
+        else
+                g_task_return_boolean (result, TRUE);
 
-        if (cairo_surface_get_type (surface) == CAIRO_SURFACE_TYPE_IMAGE &&
-            cairo_image_surface_get_format (surface) == util_cairo_format_for_content (content)) {
-                surface = cairo_surface_reference (surface);
-        } else {
-                surface = util_cairo_surface_coerce_to_image (surface, content,
-                                                              src_x, src_y,
-                                                              width, height);
-                src_x = 0;
-                src_y = 0;
-        }
-        cairo_surface_flush (surface);
-        if (cairo_surface_status (surface) || dest == NULL) {
-                cairo_surface_destroy (surface);
-                g_clear_object (&dest);
-                return NULL;
-        }
+        g_object_unref (result);
+}
 
-        if (gdk_pixbuf_get_has_alpha (dest)) {
-                convert_alpha (gdk_pixbuf_get_pixels (dest),
-                               gdk_pixbuf_get_rowstride (dest),
-                               cairo_image_surface_get_data (surface),
-                               cairo_image_surface_get_stride (surface),
-                               src_x, src_y,
-                               width, height);
-        } else {
-                convert_no_alpha (gdk_pixbuf_get_pixels (dest),
-                                  gdk_pixbuf_get_rowstride (dest),
-                                  cairo_image_surface_get_data (surface),
-                                  cairo_image_surface_get_stride (surface),
-                                  src_x, src_y,
-                                  width, height);
+static gboolean
+write_image (KioskScreenshotRequest  *request,
+             const char * const      *text_chunks,
+             GCancellable            *cancellable,
+             GError                 **error)
+{
+        switch (request->format) {
+        case KIOSK_SCREENSHOT_FORMAT_PNG:
+                return kiosk_png_encoder_write_surface (request->image,
+                                                        request->stream,
+                                                        request->compression_level,
+                                                        text_chunks,
+                                                        cancellable,
+                                                        error);
+        case KIOSK_SCREENSHOT_FORMAT_QOI:
+                return kiosk_qoi_encoder_write_surface (request->image,
+                                                        request->stream,
+                                                        cancellable,
+                                                        error);
+        case KIOSK_SCREENSHOT_FORMAT_RAW:
+                /* Nothing to do if the stage was painted straight into the memfd */
+                if (request->image_in_memfd)
+                        return TRUE;
+
+                return write_raw_image (request, cancellable, error);
         }
 
-        cairo_surface_destroy (surface);
-
-        return dest;
+        g_assert_not_reached ();
 }
 
 static void
@@ -373,29 +630,38 @@ write_screenshot_thread (GTask        *result,
                          gpointer      task_data,
                          GCancellable *cancellable)
 {
-        KioskScreenshot *screenshot = KIOSK_SCREENSHOT (object);
-        g_autoptr (GOutputStream) stream = NULL;
-        g_autoptr (GdkPixbuf) pixbuf = NULL;
+        KioskScreenshotRequest *request = task_data;
         g_autofree char *creation_time = NULL;
+        const char *text_chunks[] = {
+                "Software", "gnome-screenshot",
+                "Creation Time", NULL,
+                NULL
+        };
         GError *error = NULL;
 
-        g_assert (screenshot != NULL);
+        g_assert (request != NULL);
 
-        stream = g_object_ref (screenshot->stream);
-
-        pixbuf = util_pixbuf_from_surface (screenshot->image,
-                                           0, 0,
-                                           cairo_image_surface_get_width (screenshot->image),
-                                           cairo_image_surface_get_height (screenshot->image));
-        creation_time = g_date_time_format (screenshot->datetime, "%c");
+        creation_time = g_date_time_format (request->datetime, "%c");
 
         if (!creation_time)
-                creation_time = g_date_time_format (screenshot->datetime, "%FT%T%z");
+                creation_time = g_date_time_format (request->datetime, "%FT%T%z");
+
+        text_chunks[3] = creation_time;
 
-        gdk_pixbuf_save_to_stream (pixbuf, stream, "png", NULL, &error,
-                                   "tEXt::Software", "gnome-screenshot",
-                                   "tEXt::Creation Time", creation_time,
-                                   NULL);
+        if (request->detect_changes)
+                write_changed_tiles (KIOSK_SCREENSHOT (object), request, cancellable, &error);
+        else
+                write_image (request, (const char * const *) text_chunks, cancellable, &error);
+
+        /* Closing flushes the stream, so that happens here rather than
+         * on the compositor thread when the request gets freed
+         */
+        if (request->file != NULL) {
+                if (error == NULL)
+                        g_output_stream_close (request->stream, cancellable, &error);
+                else
+                        g_output_stream_close (request->stream, cancellable, NULL);
+        }
 
         if (error)
                 g_task_return_error (result, error);
@@ -403,50 +669,190 @@ write_screenshot_thread (GTask        *result,
                 g_task_return_boolean (result, TRUE);
 }
 
-static void
-do_grab_screenshot (KioskScreenshot     *screenshot,
-                    int                  x,
-                    int                  y,
-                    int                  width,
-                    int                  height,
-                    KioskScreenshotFlag  flags)
-{
-        MtkRectangle screenshot_rect = { x, y, width, height };
-        int image_width;
-        int image_height;
-        float scale;
-        cairo_surface_t *image;
+static gboolean
+paint_stage (KioskScreenshot         *screenshot,
+             KioskScreenshotRequest  *request,
+             float                    scale,
+             cairo_surface_t         *image,
+             GError                 **error)
+{
         ClutterPaintFlag paint_flags = CLUTTER_PAINT_FLAG_NONE;
-        g_autoptr (GError) error = NULL;
 
-        clutter_stage_get_capture_final_size (CLUTTER_STAGE (screenshot->stage),
-                                              &screenshot_rect,
-                                              &image_width,
-                                              &image_height,
-                                              &scale);
-        image = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
-                                            image_width, image_height);
-
-        if (flags & KIOSK_SCREENSHOT_FLAG_INCLUDE_CURSOR)
+        if (request->flags & KIOSK_SCREENSHOT_FLAG_INCLUDE_CURSOR)
                 paint_flags |= CLUTTER_PAINT_FLAG_FORCE_CURSORS;
         else
                 paint_flags |= CLUTTER_PAINT_FLAG_NO_CURSORS;
         if (!clutter_stage_paint_to_buffer (CLUTTER_STAGE (screenshot->stage),
-                                            &screenshot_rect, scale,
+                                            &request->screenshot_area, scale,
                                             cairo_image_surface_get_data (image),
                                             cairo_image_surface_get_stride (image),
                                             COGL_PIXEL_FORMAT_ARGB32_NATIVE,
                                             NULL,
                                             paint_flags,
-                                            &error)) {
-                cairo_surface_destroy (image);
-                g_warning ("Failed to take screenshot: %s", error->message);
-                return;
+                                            error))
+                return FALSE;
+
+        cairo_surface_mark_dirty (image);
+
+        return TRUE;
+}
+
+static gboolean
+paint_stage_downscaled (KioskScreenshot         *screenshot,
+                        KioskScreenshotRequest  *request,
+                        int                      width,
+                        int                      height,
+                        float                    scale,
+                        cairo_surface_t         *image,
+                        GError                 **error)
+{
+        cairo_surface_t *full_image;
+
+        full_image = kiosk_buffer_pool_create_surface (screenshot->buffer_pool, width, height);
+
+        if (!paint_stage (screenshot, request, scale, full_image, error)) {
+                cairo_surface_destroy (full_image);
+                return FALSE;
+        }
+
+        cairo_surface_flush (image);
+        kiosk_pixel_utils_downscale_argb32 (cairo_image_surface_get_data (image),
+                                            cairo_image_surface_get_stride (image),
+                                            cairo_image_surface_get_width (image),
+                                            cairo_image_surface_get_height (image),
+                                            cairo_image_surface_get_data (full_image),
+                                            cairo_image_surface_get_stride (full_image),
+                                            width,
+                                            height);
+        cairo_surface_mark_dirty (image);
+
+        cairo_surface_destroy (full_image);
+
+        return TRUE;
+}
+
+static cairo_surface_t *
+do_grab_screenshot (KioskScreenshot         *screenshot,
+                    KioskScreenshotRequest  *request,
+                    GError                 **error)
+{
+        int full_width, full_height;
+        int image_width;
+        int image_height;
+        float scale;
+        float paint_scale;
+        cairo_surface_t *image;
+        gboolean image_in_memfd = FALSE;
+        g_autoptr (GError) paint_error = NULL;
+
+        clutter_stage_get_capture_final_size (CLUTTER_STAGE (screenshot->stage),
+                                              &request->screenshot_area,
+                                              &full_width,
+                                              &full_height,
+                                              &scale);
+
+        image_width = full_width;
+        image_height = full_height;
+        paint_scale = scale;
+
+        /* Thumbnails are painted at a reduced scale, so the stage is
+         * rendered straight into the small buffer and the full size
+         * image never gets read back
+         */
+        if (request->max_width > 0 && request->max_height > 0 &&
+            (full_width > request->max_width || full_height > request->max_height)) {
+                float factor = MIN ((float) request->max_width / full_width,
+                                    (float) request->max_height / full_height);
+
+                paint_scale = scale * factor;
+                image_width = CLAMP ((int) roundf (request->screenshot_area.width * paint_scale),
+                                     1, full_width);
+                image_height = CLAMP ((int) roundf (request->screenshot_area.height * paint_scale),
+                                      1, full_height);
+        }
+
+        /* Raw memfd requests get the stage painted straight into the
+         * shared memory, so no copy is made at all
+         */
+        if (request->memfd >= 0 &&
+            request->format == KIOSK_SCREENSHOT_FORMAT_RAW &&
+            !request->detect_changes &&
+            image_width > 0 && image_height > 0) {
+                image = create_memfd_surface (request, image_width, image_height, error);
+                if (image == NULL)
+                        return NULL;
+                image_in_memfd = TRUE;
+        } else {
+                image = kiosk_buffer_pool_create_surface (screenshot->buffer_pool,
+                                                          image_width, image_height);
         }
 
-        screenshot->image = image;
+        if (!paint_stage (screenshot, request, paint_scale, image, &paint_error)) {
+                gboolean painted = FALSE;
+
+                if (paint_scale != scale) {
+                        g_debug ("KioskScreenshot: Could not paint stage at scale %f, "
+                                 "downscaling full size capture instead: %s",
+                                 paint_scale, paint_error->message);
+                        painted = paint_stage_downscaled (screenshot, request,
+                                                          full_width, full_height, scale,
+                                                          image, error);
+                } else {
+                        g_propagate_error (error, g_steal_pointer (&paint_error));
+                }
+
+                if (!painted) {
+                        cairo_surface_destroy (image);
+                        return NULL;
+                }
+        }
+
+        request->image_in_memfd = image_in_memfd;
+
+        return image;
+}
+
+static cairo_surface_t *
+get_cursor_surface (KioskScreenshot *screenshot,
+                    CoglTexture     *texture,
+                    float            scale)
+{
+        cairo_surface_t *cursor_surface;
+        int width, height;
+        int stride;
+
+        /* Reading the sprite back is a GPU round trip, so it is only done
+         * once per cursor and scale rather than for every screenshot
+         */
+        if (screenshot->cursor_surface != NULL &&
+            screenshot->cursor_texture == texture &&
+            screenshot->cursor_scale == scale)
+                return screenshot->cursor_surface;
+
+        clear_cursor_cache (screenshot);
+
+        width = cogl_texture_get_width (texture);
+        height = cogl_texture_get_height (texture);
+
+        /* FIXME: cairo-gl? */
+        cursor_surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
+        stride = cairo_image_surface_get_stride (cursor_surface);
+
+        cairo_surface_flush (cursor_surface);
+        cogl_texture_get_data (texture, COGL_PIXEL_FORMAT_ARGB32_NATIVE, stride,
+                               cairo_image_surface_get_data (cursor_surface));
+        cairo_surface_mark_dirty (cursor_surface);
+
+        cairo_surface_set_device_scale (cursor_surface, scale, scale);
+
+        g_debug ("KioskScreenshot: Caching %dx%d cursor sprite at scale %f",
+                 width, height, scale);
+
+        screenshot->cursor_surface = cursor_surface;
+        screenshot->cursor_texture = g_object_ref (texture);
+        screenshot->cursor_scale = scale;
 
-        screenshot->datetime = g_date_time_new_now_local ();
+        return cursor_surface;
 }
 
 static void
@@ -455,15 +861,13 @@ draw_cursor_image (KioskScreenshot *screenshot,
                    MtkRectangle     area)
 {
         CoglTexture *texture;
-        int width, height;
-        int stride;
-        g_autofree guint8 *data = NULL;
         MetaCursorTracker *tracker;
         cairo_surface_t *cursor_surface;
         cairo_t *cr;
         int x, y;
         int xhot, yhot;
         double xscale, yscale;
+        float cursor_scale = 1.0;
         graphene_point_t point;
 
         tracker = meta_backend_get_cursor_tracker (screenshot->backend);
@@ -480,35 +884,25 @@ draw_cursor_image (KioskScreenshot *screenshot,
                 return;
 
         meta_cursor_tracker_get_hot (tracker, &xhot, &yhot);
-        width = cogl_texture_get_width (texture);
-        height = cogl_texture_get_height (texture);
-        stride = 4 * width;
-        data = g_new (guint8, stride * height);
-        cogl_texture_get_data (texture, COGL_PIXEL_FORMAT_ARGB32_NATIVE, stride, data);
-
-        /* FIXME: cairo-gl? */
-        cursor_surface = cairo_image_surface_create_for_data (data,
-                                                              CAIRO_FORMAT_ARGB32,
-                                                              width, height,
-                                                              stride);
 
         cairo_surface_get_device_scale (surface, &xscale, &yscale);
 
         if (xscale != 1.0 || yscale != 1.0) {
                 int monitor;
-                float monitor_scale;
                 MtkRectangle cursor_rect = {
-                        .x = x, .y = y, .width = width, .height = height
+                        .x = x, .y = y,
+                        .width = cogl_texture_get_width (texture),
+                        .height = cogl_texture_get_height (texture)
                 };
 
                 monitor = meta_display_get_monitor_index_for_rect (screenshot->display,
                                                                    &cursor_rect);
-                monitor_scale = meta_display_get_monitor_scale (screenshot->display,
-                                                                monitor);
-
-                cairo_surface_set_device_scale (cursor_surface, monitor_scale, monitor_scale);
+                cursor_scale = meta_display_get_monitor_scale (screenshot->display,
+                                                               monitor);
         }
 
+        cursor_surface = get_cursor_surface (screenshot, texture, cursor_scale);
+
         cr = cairo_create (surface);
         cairo_set_source_surface (cr,
                                   cursor_surface,
@@ -517,64 +911,113 @@ draw_cursor_image (KioskScreenshot *screenshot,
         cairo_paint (cr);
 
         cairo_destroy (cr);
-        cairo_surface_destroy (cursor_surface);
 }
 
-static void
-grab_screenshot (KioskScreenshot     *screenshot,
-                 KioskScreenshotFlag  flags,
-                 GTask               *result)
+static gboolean
+grab_screenshot (KioskScreenshot        *screenshot,
+                 KioskScreenshotRequest *request,
+                 GPtrArray              *screen_captures,
+                 GError                **error)
 {
         int width, height;
-        g_autoptr (GTask) task = NULL;
+        guint i;
 
         meta_display_get_size (screenshot->display, &width, &height);
 
-        do_grab_screenshot (screenshot,
-                            0, 0, width, height,
-                            flags);
+        request->screenshot_area.x = 0;
+        request->screenshot_area.y = 0;
+        request->screenshot_area.width = width;
+        request->screenshot_area.height = height;
 
-        screenshot->screenshot_area.x = 0;
-        screenshot->screenshot_area.y = 0;
-        screenshot->screenshot_area.width = width;
-        screenshot->screenshot_area.height = height;
+        /* Requests processed in the same batch see the same frame, so
+         * identical full screen captures can share a single readback
+         */
+        for (i = 0; i < screen_captures->len; i++) {
+                KioskScreenshotRequest *capture = g_ptr_array_index (screen_captures, i);
 
-        task = g_task_new (screenshot, NULL, on_screenshot_written, result);
-        g_task_set_source_tag (task, grab_screenshot);
-        g_task_run_in_thread (task, write_screenshot_thread);
+                if (capture->flags != request->flags)
+                        continue;
+
+                if (!mtk_rectangle_equal (&capture->screenshot_area, &request->screenshot_area))
+                        continue;
+
+                if (capture->max_width != request->max_width ||
+                    capture->max_height != request->max_height)
+                        continue;
+
+                g_debug ("KioskScreenshot: Reusing screen capture for identical request");
+                request->image = cairo_surface_reference (capture->image);
+                request->datetime = g_date_time_ref (capture->datetime);
+                return TRUE;
+        }
+
+        request->image = do_grab_screenshot (screenshot, request, error);
+        if (request->image == NULL)
+                return FALSE;
+
+        request->datetime = g_date_time_new_now_local ();
+
+        /* Images living in a memfd can't be shared, the memfd gets
+         * sealed as soon as its own request is done with it
+         */
+        if (!request->image_in_memfd)
+                g_ptr_array_add (screen_captures, request);
+
+        return TRUE;
 }
 
-static void
-grab_window_screenshot (KioskScreenshot     *screenshot,
-                        KioskScreenshotFlag  flags,
-                        GTask               *result)
+static gboolean
+grab_area_screenshot (KioskScreenshot        *screenshot,
+                      KioskScreenshotRequest *request,
+                      GError                **error)
 {
-        g_autoptr (GTask) task = NULL;
-        MetaWindow *window = meta_display_get_focus_window (screenshot->display);
+        request->image = do_grab_screenshot (screenshot, request, error);
+        if (request->image == NULL)
+                return FALSE;
+
+        request->datetime = g_date_time_new_now_local ();
+
+        return TRUE;
+}
+
+static gboolean
+grab_window_screenshot (KioskScreenshot        *screenshot,
+                        KioskScreenshotRequest *request,
+                        GError                **error)
+{
+        MetaWindow *window = request->window;
         ClutterActor *window_actor;
-        gfloat actor_x, actor_y;
         MtkRectangle rect;
         g_autoptr (CoglBitmap) bitmap = NULL;
         uint8_t *data;
         int width, height, stride;
 
+        if (window == NULL) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                             "Window went away before it could be captured");
+                return FALSE;
+        }
+
         window_actor = CLUTTER_ACTOR (meta_window_get_compositor_private (window));
-        clutter_actor_get_position (window_actor, &actor_x, &actor_y);
+        if (window_actor == NULL) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                             "Capturing window failed");
+                return FALSE;
+        }
 
         meta_window_get_frame_rect (window, &rect);
 
-        if (!screenshot->include_frame)
+        if (!request->include_frame)
                 meta_window_frame_rect_to_client_rect (window, &rect, &rect);
 
-        screenshot->screenshot_area = rect;
+        request->screenshot_area = rect;
 
         bitmap = meta_window_actor_paint_to_bitmap (META_WINDOW_ACTOR (window_actor), NULL,
                                                     COGL_PIXEL_FORMAT_ARGB32_NATIVE);
         if (!bitmap) {
-                g_task_report_new_error (screenshot, on_screenshot_written, result, NULL,
-                                         G_IO_ERROR, G_IO_ERROR_FAILED,
-                                         "Capturing window failed");
-                return;
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                             "Capturing window failed");
+                return FALSE;
         }
 
         width = cogl_bitmap_get_width (bitmap);
@@ -582,51 +1025,207 @@ grab_window_screenshot (KioskScreenshot     *screenshot,
         stride = cogl_bitmap_get_rowstride (bitmap);
         data = cogl_bitmap_map (bitmap, COGL_BUFFER_ACCESS_READ, 0, NULL);
         if (!data) {
-                g_task_report_new_error (screenshot, on_screenshot_written, result, NULL,
-                                         G_IO_ERROR, G_IO_ERROR_FAILED,
-                                         "Capturing window failed");
-                return;
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                             "Capturing window failed");
+                return FALSE;
         }
 
-        screenshot->image = cairo_image_surface_create_for_data (data, CAIRO_FORMAT_ARGB32,
-                                                                 width, height, stride);
-        cairo_surface_set_user_data (screenshot->image, &data_key,
+        request->image = cairo_image_surface_create_for_data (data, CAIRO_FORMAT_ARGB32,
+                                                              width, height, stride);
+        cairo_surface_set_user_data (request->image, &data_key,
                                      g_steal_pointer (&bitmap),
                                      bitmap_unmap_and_unref);
 
-        screenshot->datetime = g_date_time_new_now_local ();
+        request->datetime = g_date_time_new_now_local ();
 
-        if (flags & KIOSK_SCREENSHOT_FLAG_INCLUDE_CURSOR) {
+        if (request->flags & KIOSK_SCREENSHOT_FLAG_INCLUDE_CURSOR) {
                 if (meta_window_get_client_type (window) == META_WINDOW_CLIENT_TYPE_WAYLAND) {
                         float resource_scale;
                         resource_scale = clutter_actor_get_resource_scale (window_actor);
 
-                        cairo_surface_set_device_scale (screenshot->image, resource_scale, resource_scale);
+                        cairo_surface_set_device_scale (request->image, resource_scale, resource_scale);
                 }
 
                 draw_cursor_image (screenshot,
-                                   screenshot->image,
-                                   screenshot->screenshot_area);
+                                   request->image,
+                                   request->screenshot_area);
         }
 
-        g_signal_emit (screenshot, signals[SCREENSHOT_TAKEN], 0, &rect);
-
-        task = g_task_new (screenshot, NULL, on_screenshot_written, result);
-        g_task_set_source_tag (task, grab_window_screenshot);
-        g_task_run_in_thread (task, write_screenshot_thread);
+        return TRUE;
 }
 
-static gboolean
+static void
+write_screenshot (KioskScreenshot *screenshot,
+                  GTask           *result)
+{
+        KioskScreenshotRequest *request = g_task_get_task_data (result);
+        g_autoptr (GTask) task = NULL;
+
+        task = g_task_new (screenshot, NULL, on_screenshot_written, result);
+        g_task_set_source_tag (task, g_task_get_source_tag (result));
+        g_task_set_task_data (task, request, NULL);
+        g_task_run_in_thread (task, write_screenshot_thread);
+}
+
+static void
+process_pending_requests (KioskScreenshot *screenshot)
+{
+        g_autoptr (GPtrArray) screen_captures = NULL;
+        GTask *result;
+
+        screen_captures = g_ptr_array_new ();
+
+        g_debug ("KioskScreenshot: Processing %u pending screenshot request(s)",
+                 g_queue_get_length (&screenshot->pending_requests));
+
+        /* Stage readbacks happen here, one after the other, on the
+         * main thread. Encoding is handed off to worker threads, so
+         * several of them may be in flight at once.
+         */
+        while ((result = g_queue_pop_head (&screenshot->pending_requests)) != NULL) {
+                KioskScreenshotRequest *request = g_task_get_task_data (result);
+                GError *error = NULL;
+                gboolean grabbed = FALSE;
+
+                switch (request->mode) {
+                case KIOSK_SCREENSHOT_SCREEN:
+                        grabbed = grab_screenshot (screenshot, request, screen_captures, &error);
+                        break;
+                case KIOSK_SCREENSHOT_AREA:
+                        grabbed = grab_area_screenshot (screenshot, request, &error);
+                        break;
+                case KIOSK_SCREENSHOT_WINDOW:
+                        grabbed = grab_window_screenshot (screenshot, request, &error);
+                        break;
+                }
+
+                if (!grabbed) {
+                        g_warning ("Failed to take screenshot: %s", error->message);
+                        g_task_return_error (result, error);
+                        g_object_unref (result);
+                        continue;
+                }
+
+                request->info.format = request->format;
+                request->info.width = cairo_image_surface_get_width (request->image);
+                request->info.height = cairo_image_surface_get_height (request->image);
+                request->info.stride = request->info.width * 4;
+
+                g_signal_emit (screenshot, signals[SCREENSHOT_TAKEN], 0,
+                               &request->screenshot_area);
+
+                if (request->creating_file) {
+                        g_debug ("KioskScreenshot: Waiting for the file to be created before writing");
+                        request->waiting_for_file = TRUE;
+                        continue;
+                }
+
+                write_screenshot (screenshot, result);
+        }
+}
+
+static void
+queue_request (KioskScreenshot        *screenshot,
+               KioskScreenshotRequest *request,
+               GTask                  *result)
+{
+        g_task_set_task_data (result, request,
+                              (GDestroyNotify) kiosk_screenshot_request_free);
+        g_queue_push_tail (&screenshot->pending_requests, result);
+
+        kiosk_gobject_utils_queue_immediate_callback (G_OBJECT (screenshot),
+                                                      "[kiosk-screenshot] process_pending_requests",
+                                                      NULL,
+                                                      KIOSK_OBJECT_CALLBACK (process_pending_requests),
+                                                      NULL);
+}
+
+static void
+on_output_file_created (GObject      *source,
+                        GAsyncResult *create_result,
+                        gpointer      user_data)
+{
+        g_autoptr (GTask) result = user_data;
+        KioskScreenshot *screenshot = g_task_get_source_object (result);
+        KioskScreenshotRequest *request = g_task_get_task_data (result);
+        g_autoptr (GFileOutputStream) stream = NULL;
+        g_autoptr (GError) error = NULL;
+
+        request->creating_file = FALSE;
+
+        stream = g_file_create_finish (G_FILE (source), create_result, &error);
+
+        if (stream == NULL) {
+                /* Drop the request whether or not the stage was read back
+                 * yet. If it isn't waiting or queued, the readback failed
+                 * and the caller already got that error.
+                 */
+                if (!request->waiting_for_file &&
+                    !g_queue_remove (&screenshot->pending_requests, result))
+                        return;
+
+                request->waiting_for_file = FALSE;
+                g_clear_pointer (&request->image, cairo_surface_destroy);
+
+                if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        g_task_return_error (result, g_steal_pointer (&error));
+                else
+                        g_task_return_new_error (result,
+                                                 KIOSK_SCREENSHOT_ERROR,
+                                                 KIOSK_SCREENSHOT_ERROR_CREATING_FILE,
+                                                 "%s", error->message);
+
+                /* The reference the queue or the wait held */
+                g_object_unref (result);
+                return;
+        }
+
+        request->stream = G_OUTPUT_STREAM (g_steal_pointer (&stream));
+
+        /* The reference the wait held goes to the write */
+        if (request->waiting_for_file) {
+                request->waiting_for_file = FALSE;
+                write_screenshot (screenshot, result);
+        }
+}
+
+/* The file gets created while the stage is read back, and the image is
+ * only written out once both are done
+ */
+static void
+queue_file_request (KioskScreenshot        *screenshot,
+                    KioskScreenshotRequest *request,
+                    GFile                  *file,
+                    GTask                  *result)
+{
+        request->file = g_object_ref (file);
+        request->creating_file = TRUE;
+
+        queue_request (screenshot, request, result);
+
+        g_file_create_async (file,
+                             G_FILE_CREATE_NONE,
+                             G_PRIORITY_DEFAULT,
+                             screenshot->cancellable,
+                             on_output_file_created,
+                             g_object_ref (result));
+}
+
+static gboolean
 finish_screenshot (KioskScreenshot *screenshot,
                    GAsyncResult    *result,
                    MtkRectangle   **area,
                    GError         **error)
 {
+        KioskScreenshotRequest *request;
+
         if (!g_task_propagate_boolean (G_TASK (result), error))
                 return FALSE;
 
+        request = g_task_get_task_data (G_TASK (result));
+
         if (area)
-                *area = &screenshot->screenshot_area;
+                *area = &request->screenshot_area;
 
         return TRUE;
 }
@@ -635,56 +1234,46 @@ finish_screenshot (KioskScreenshot *screenshot,
  * kiosk_screenshot_screenshot:
  * @screenshot: the #KioskScreenshot
  * @include_cursor: Whether to include the cursor or not
- * @stream: The stream for the screenshot
+ * @file: The file to write the screenshot to, it must not exist yet.
+ * It is created while the screen is read back.
+ * @format: The format of the image
+ * @compression_level: The png compression level, or
+ * %KIOSK_PNG_ENCODER_COMPRESSION_LEVEL_DEFAULT for the #KioskScreenshot:compression-level
  * @callback: (scope async): function to call returning success or failure
  * of the async grabbing
  * @user_data: the data to pass to callback function
  *
  * Takes a screenshot of the whole screen
- * in @stream as png image.
+ * in @file in the requested format.
+ *
+ * Several screenshot operations may be pending at the same time.
  *
  */
 void
-kiosk_screenshot_screenshot (KioskScreenshot     *screenshot,
-                             gboolean             include_cursor,
-                             GOutputStream       *stream,
-                             GAsyncReadyCallback  callback,
-                             gpointer             user_data)
+kiosk_screenshot_screenshot (KioskScreenshot       *screenshot,
+                             gboolean               include_cursor,
+                             GFile                 *file,
+                             KioskScreenshotFormat  format,
+                             int                    compression_level,
+                             GAsyncReadyCallback    callback,
+                             gpointer               user_data)
 {
+        KioskScreenshotRequest *request;
         GTask *result;
-        KioskScreenshotFlag flags;
 
         g_return_if_fail (KIOSK_IS_SCREENSHOT (screenshot));
-        g_return_if_fail (G_IS_OUTPUT_STREAM (stream));
-
-        if (screenshot->stream != NULL) {
-                if (callback) {
-                        g_task_report_new_error (screenshot,
-                                                 callback,
-                                                 user_data,
-                                                 kiosk_screenshot_screenshot,
-                                                 G_IO_ERROR,
-                                                 G_IO_ERROR_PENDING,
-                                                 "Only one screenshot operation at a time "
-                                                 "is permitted");
-                }
-                return;
-        }
+        g_return_if_fail (G_IS_FILE (file));
 
         result = g_task_new (screenshot, NULL, callback, user_data);
         g_task_set_source_tag (result, kiosk_screenshot_screenshot);
-        g_task_set_task_data (result, screenshot, NULL);
 
-        screenshot->stream = g_object_ref (stream);
+        request = kiosk_screenshot_request_new (screenshot, KIOSK_SCREENSHOT_SCREEN,
+                                                format, compression_level);
 
-        flags = KIOSK_SCREENSHOT_FLAG_NONE;
         if (include_cursor)
-                flags |= KIOSK_SCREENSHOT_FLAG_INCLUDE_CURSOR;
-
-        grab_screenshot (screenshot, flags, result);
+                request->flags |= KIOSK_SCREENSHOT_FLAG_INCLUDE_CURSOR;
 
-        g_signal_emit (screenshot, signals[SCREENSHOT_TAKEN], 0,
-                       (MtkRectangle *) &screenshot->screenshot_area);
+        queue_file_request (screenshot, request, file, result);
 }
 
 /**
@@ -721,69 +1310,48 @@ kiosk_screenshot_screenshot_finish (KioskScreenshot *screenshot,
  * @y: The Y coordinate of the area
  * @width: The width of the area
  * @height: The height of the area
- * @stream: The stream for the screenshot
+ * @file: The file to write the screenshot to, it must not exist yet.
+ * It is created while the screen is read back.
+ * @format: The format of the image
+ * @compression_level: The png compression level, or
+ * %KIOSK_PNG_ENCODER_COMPRESSION_LEVEL_DEFAULT for the #KioskScreenshot:compression-level
  * @callback: (scope async): function to call returning success or failure
  * of the async grabbing
  * @user_data: the data to pass to callback function
  *
  * Takes a screenshot of the passed in area and saves it
- * in @stream as png image.
+ * in @file in the requested format.
  *
  */
 void
-kiosk_screenshot_screenshot_area (KioskScreenshot     *screenshot,
-                                  int                  x,
-                                  int                  y,
-                                  int                  width,
-                                  int                  height,
-                                  GOutputStream       *stream,
-                                  GAsyncReadyCallback  callback,
-                                  gpointer             user_data)
+kiosk_screenshot_screenshot_area (KioskScreenshot       *screenshot,
+                                  int                    x,
+                                  int                    y,
+                                  int                    width,
+                                  int                    height,
+                                  GFile                 *file,
+                                  KioskScreenshotFormat  format,
+                                  int                    compression_level,
+                                  GAsyncReadyCallback    callback,
+                                  gpointer               user_data)
 {
+        KioskScreenshotRequest *request;
         GTask *result;
-        g_autoptr (GTask) task = NULL;
 
         g_return_if_fail (KIOSK_IS_SCREENSHOT (screenshot));
-        g_return_if_fail (G_IS_OUTPUT_STREAM (stream));
-
-        if (screenshot->stream != NULL) {
-                if (callback) {
-                        g_task_report_new_error (screenshot,
-                                                 callback,
-                                                 NULL,
-                                                 kiosk_screenshot_screenshot_area,
-                                                 G_IO_ERROR,
-                                                 G_IO_ERROR_PENDING,
-                                                 "Only one screenshot operation at a time "
-                                                 "is permitted");
-                }
-                return;
-        }
+        g_return_if_fail (G_IS_FILE (file));
 
         result = g_task_new (screenshot, NULL, callback, user_data);
         g_task_set_source_tag (result, kiosk_screenshot_screenshot_area);
-        g_task_set_task_data (result, screenshot, NULL);
 
-        screenshot->stream = g_object_ref (stream);
-        screenshot->screenshot_area.x = x;
-        screenshot->screenshot_area.y = y;
-        screenshot->screenshot_area.width = width;
-        screenshot->screenshot_area.height = height;
+        request = kiosk_screenshot_request_new (screenshot, KIOSK_SCREENSHOT_AREA,
+                                                format, compression_level);
+        request->screenshot_area.x = x;
+        request->screenshot_area.y = y;
+        request->screenshot_area.width = width;
+        request->screenshot_area.height = height;
 
-
-        do_grab_screenshot (screenshot,
-                            screenshot->screenshot_area.x,
-                            screenshot->screenshot_area.y,
-                            screenshot->screenshot_area.width,
-                            screenshot->screenshot_area.height,
-                            KIOSK_SCREENSHOT_FLAG_NONE);
-
-        g_signal_emit (screenshot, signals[SCREENSHOT_TAKEN], 0,
-                       (MtkRectangle *) &screenshot->screenshot_area);
-
-        task = g_task_new (screenshot, NULL, on_screenshot_written, result);
-        g_task_set_source_tag (task, kiosk_screenshot_screenshot_area);
-        g_task_run_in_thread (task, write_screenshot_thread);
+        queue_file_request (screenshot, request, file, result);
 }
 
 /**
@@ -818,41 +1386,47 @@ kiosk_screenshot_screenshot_area_finish (KioskScreenshot *screenshot,
  * @screenshot: the #KioskScreenshot
  * @include_frame: Whether to include the frame or not
  * @include_cursor: Whether to include the cursor or not
- * @stream: The stream for the screenshot
+ * @file: The file to write the screenshot to, it must not exist yet.
+ * It is created while the screen is read back.
+ * @format: The format of the image
+ * @compression_level: The png compression level, or
+ * %KIOSK_PNG_ENCODER_COMPRESSION_LEVEL_DEFAULT for the #KioskScreenshot:compression-level
  * @callback: (scope async): function to call returning success or failure
  * of the async grabbing
  * @user_data: the data to pass to callback function
  *
  * Takes a screenshot of the focused window (optionally omitting the frame)
- * in @stream as png image.
+ * in @file in the requested format.
  *
  */
 void
-kiosk_screenshot_screenshot_window (KioskScreenshot     *screenshot,
-                                    gboolean             include_frame,
-                                    gboolean             include_cursor,
-                                    GOutputStream       *stream,
-                                    GAsyncReadyCallback  callback,
-                                    gpointer             user_data)
+kiosk_screenshot_screenshot_window (KioskScreenshot       *screenshot,
+                                    gboolean               include_frame,
+                                    gboolean               include_cursor,
+                                    GFile                 *file,
+                                    KioskScreenshotFormat  format,
+                                    int                    compression_level,
+                                    GAsyncReadyCallback    callback,
+                                    gpointer               user_data)
 {
+        KioskScreenshotRequest *request;
         MetaWindow *window;
         GTask *result;
 
         g_return_if_fail (KIOSK_IS_SCREENSHOT (screenshot));
-        g_return_if_fail (G_IS_OUTPUT_STREAM (stream));
+        g_return_if_fail (G_IS_FILE (file));
 
         window = meta_display_get_focus_window (screenshot->display);
 
-        if (screenshot->stream != NULL || !window) {
+        if (!window) {
                 if (callback) {
                         g_task_report_new_error (screenshot,
                                                  callback,
-                                                 NULL,
+                                                 user_data,
                                                  kiosk_screenshot_screenshot_window,
                                                  G_IO_ERROR,
-                                                 G_IO_ERROR_PENDING,
-                                                 "Only one screenshot operation at a time "
-                                                 "is permitted");
+                                                 G_IO_ERROR_NOT_FOUND,
+                                                 "No window is focused");
                 }
                 return;
         }
@@ -860,10 +1434,15 @@ kiosk_screenshot_screenshot_window (KioskScreenshot     *screenshot,
         result = g_task_new (screenshot, NULL, callback, user_data);
         g_task_set_source_tag (result, kiosk_screenshot_screenshot_window);
 
-        screenshot->stream = g_object_ref (stream);
-        screenshot->include_frame = include_frame;
+        request = kiosk_screenshot_request_new (screenshot, KIOSK_SCREENSHOT_WINDOW,
+                                                format, compression_level);
+        request->include_frame = include_frame;
+        g_set_weak_pointer (&request->window, window);
 
-        grab_window_screenshot (screenshot, include_cursor, result);
+        if (include_cursor)
+                request->flags |= KIOSK_SCREENSHOT_FLAG_INCLUDE_CURSOR;
+
+        queue_file_request (screenshot, request, file, result);
 }
 
 /**
@@ -893,6 +1472,674 @@ kiosk_screenshot_screenshot_window_finish (KioskScreenshot *screenshot,
         return finish_screenshot (screenshot, result, area, error);
 }
 
+static int
+finish_memfd_screenshot (KioskScreenshot           *screenshot,
+                         GAsyncResult              *result,
+                         MtkRectangle             **area,
+                         KioskScreenshotImageInfo  *info,
+                         GError                   **error)
+{
+        KioskScreenshotRequest *request;
+
+        if (!finish_screenshot (screenshot, result, area, error))
+                return -1;
+
+        request = g_task_get_task_data (G_TASK (result));
+
+        if (info)
+                *info = request->info;
+
+        return g_steal_fd (&request->memfd);
+}
+
+static void
+queue_memfd_request (KioskScreenshot        *screenshot,
+                     KioskScreenshotRequest *request,
+                     GTask                  *result)
+{
+        GError *error = NULL;
+
+        if (!create_memfd (request, &error)) {
+                kiosk_screenshot_request_free (request);
+                g_task_return_error (result, error);
+                g_object_unref (result);
+                return;
+        }
+
+        queue_request (screenshot, request, result);
+}
+
+/**
+ * kiosk_screenshot_screenshot_to_memfd:
+ * @screenshot: the #KioskScreenshot
+ * @include_cursor: Whether to include the cursor or not
+ * @format: The format of the image
+ * @compression_level: The png compression level, or
+ * %KIOSK_PNG_ENCODER_COMPRESSION_LEVEL_DEFAULT for the #KioskScreenshot:compression-level
+ * @callback: (scope async): function to call returning success or failure
+ * of the async grabbing
+ * @user_data: the data to pass to callback function
+ *
+ * Takes a screenshot of the whole screen into an anonymous,
+ * sealed memory file. Raw screenshots are painted directly
+ * into the shared memory.
+ *
+ */
+void
+kiosk_screenshot_screenshot_to_memfd (KioskScreenshot       *screenshot,
+                                      gboolean               include_cursor,
+                                      KioskScreenshotFormat  format,
+                                      int                    compression_level,
+                                      GAsyncReadyCallback    callback,
+                                      gpointer               user_data)
+{
+        KioskScreenshotRequest *request;
+        GTask *result;
+
+        g_return_if_fail (KIOSK_IS_SCREENSHOT (screenshot));
+
+        result = g_task_new (screenshot, NULL, callback, user_data);
+        g_task_set_source_tag (result, kiosk_screenshot_screenshot_to_memfd);
+
+        request = kiosk_screenshot_request_new (screenshot, KIOSK_SCREENSHOT_SCREEN,
+                                                format, compression_level);
+
+        if (include_cursor)
+                request->flags |= KIOSK_SCREENSHOT_FLAG_INCLUDE_CURSOR;
+
+        queue_memfd_request (screenshot, request, result);
+}
+
+/**
+ * kiosk_screenshot_screenshot_to_memfd_finish:
+ * @screenshot: the #KioskScreenshot
+ * @result: the #GAsyncResult that was provided to the callback
+ * @area: (out) (transfer none): the area that was grabbed in screen coordinates
+ * @info: (out) (optional): return location for the image layout
+ * @error: #GError for error reporting
+ *
+ * Finish the asynchronous operation started by
+ * kiosk_screenshot_screenshot_to_memfd() and obtain its result.
+ *
+ * Returns: (transfer full): the sealed memfd holding the image, or -1
+ *
+ */
+int
+kiosk_screenshot_screenshot_to_memfd_finish (KioskScreenshot           *screenshot,
+                                             GAsyncResult              *result,
+                                             MtkRectangle             **area,
+                                             KioskScreenshotImageInfo  *info,
+                                             GError                   **error)
+{
+        g_return_val_if_fail (KIOSK_IS_SCREENSHOT (screenshot), -1);
+        g_return_val_if_fail (G_IS_TASK (result), -1);
+        g_return_val_if_fail (g_async_result_is_tagged (result,
+                                                        kiosk_screenshot_screenshot_to_memfd),
+                              -1);
+        return finish_memfd_screenshot (screenshot, result, area, info, error);
+}
+
+/**
+ * kiosk_screenshot_screenshot_area_to_memfd:
+ * @screenshot: the #KioskScreenshot
+ * @x: The X coordinate of the area
+ * @y: The Y coordinate of the area
+ * @width: The width of the area
+ * @height: The height of the area
+ * @format: The format of the image
+ * @compression_level: The png compression level, or
+ * %KIOSK_PNG_ENCODER_COMPRESSION_LEVEL_DEFAULT for the #KioskScreenshot:compression-level
+ * @callback: (scope async): function to call returning success or failure
+ * of the async grabbing
+ * @user_data: the data to pass to callback function
+ *
+ * Takes a screenshot of the passed in area into an anonymous,
+ * sealed memory file.
+ *
+ */
+void
+kiosk_screenshot_screenshot_area_to_memfd (KioskScreenshot       *screenshot,
+                                           int                    x,
+                                           int                    y,
+                                           int                    width,
+                                           int                    height,
+                                           KioskScreenshotFormat  format,
+                                           int                    compression_level,
+                                           GAsyncReadyCallback    callback,
+                                           gpointer               user_data)
+{
+        KioskScreenshotRequest *request;
+        GTask *result;
+
+        g_return_if_fail (KIOSK_IS_SCREENSHOT (screenshot));
+
+        result = g_task_new (screenshot, NULL, callback, user_data);
+        g_task_set_source_tag (result, kiosk_screenshot_screenshot_area_to_memfd);
+
+        request = kiosk_screenshot_request_new (screenshot, KIOSK_SCREENSHOT_AREA,
+                                                format, compression_level);
+        request->screenshot_area.x = x;
+        request->screenshot_area.y = y;
+        request->screenshot_area.width = width;
+        request->screenshot_area.height = height;
+
+        queue_memfd_request (screenshot, request, result);
+}
+
+/**
+ * kiosk_screenshot_screenshot_area_to_memfd_finish:
+ * @screenshot: the #KioskScreenshot
+ * @result: the #GAsyncResult that was provided to the callback
+ * @area: (out) (transfer none): the area that was grabbed in screen coordinates
+ * @info: (out) (optional): return location for the image layout
+ * @error: #GError for error reporting
+ *
+ * Finish the asynchronous operation started by
+ * kiosk_screenshot_screenshot_area_to_memfd() and obtain its result.
+ *
+ * Returns: (transfer full): the sealed memfd holding the image, or -1
+ *
+ */
+int
+kiosk_screenshot_screenshot_area_to_memfd_finish (KioskScreenshot           *screenshot,
+                                                  GAsyncResult              *result,
+                                                  MtkRectangle             **area,
+                                                  KioskScreenshotImageInfo  *info,
+                                                  GError                   **error)
+{
+        g_return_val_if_fail (KIOSK_IS_SCREENSHOT (screenshot), -1);
+        g_return_val_if_fail (G_IS_TASK (result), -1);
+        g_return_val_if_fail (g_async_result_is_tagged (result,
+                                                        kiosk_screenshot_screenshot_area_to_memfd),
+                              -1);
+        return finish_memfd_screenshot (screenshot, result, area, info, error);
+}
+
+/**
+ * kiosk_screenshot_screenshot_window_to_memfd:
+ * @screenshot: the #KioskScreenshot
+ * @include_frame: Whether to include the frame or not
+ * @include_cursor: Whether to include the cursor or not
+ * @format: The format of the image
+ * @compression_level: The png compression level, or
+ * %KIOSK_PNG_ENCODER_COMPRESSION_LEVEL_DEFAULT for the #KioskScreenshot:compression-level
+ * @callback: (scope async): function to call returning success or failure
+ * of the async grabbing
+ * @user_data: the data to pass to callback function
+ *
+ * Takes a screenshot of the focused window (optionally omitting the frame)
+ * into an anonymous, sealed memory file.
+ *
+ */
+void
+kiosk_screenshot_screenshot_window_to_memfd (KioskScreenshot       *screenshot,
+                                             gboolean               include_frame,
+                                             gboolean               include_cursor,
+                                             KioskScreenshotFormat  format,
+                                             int                    compression_level,
+                                             GAsyncReadyCallback    callback,
+                                             gpointer               user_data)
+{
+        KioskScreenshotRequest *request;
+        MetaWindow *window;
+        GTask *result;
+
+        g_return_if_fail (KIOSK_IS_SCREENSHOT (screenshot));
+
+        window = meta_display_get_focus_window (screenshot->display);
+
+        if (!window) {
+                if (callback) {
+                        g_task_report_new_error (screenshot,
+                                                 callback,
+                                                 user_data,
+                                                 kiosk_screenshot_screenshot_window_to_memfd,
+                                                 G_IO_ERROR,
+                                                 G_IO_ERROR_NOT_FOUND,
+                                                 "No window is focused");
+                }
+                return;
+        }
+
+        result = g_task_new (screenshot, NULL, callback, user_data);
+        g_task_set_source_tag (result, kiosk_screenshot_screenshot_window_to_memfd);
+
+        request = kiosk_screenshot_request_new (screenshot, KIOSK_SCREENSHOT_WINDOW,
+                                                format, compression_level);
+        request->include_frame = include_frame;
+        g_set_weak_pointer (&request->window, window);
+
+        if (include_cursor)
+                request->flags |= KIOSK_SCREENSHOT_FLAG_INCLUDE_CURSOR;
+
+        queue_memfd_request (screenshot, request, result);
+}
+
+/**
+ * kiosk_screenshot_screenshot_window_to_memfd_finish:
+ * @screenshot: the #KioskScreenshot
+ * @result: the #GAsyncResult that was provided to the callback
+ * @area: (out) (transfer none): the area that was grabbed in screen coordinates
+ * @info: (out) (optional): return location for the image layout
+ * @error: #GError for error reporting
+ *
+ * Finish the asynchronous operation started by
+ * kiosk_screenshot_screenshot_window_to_memfd() and obtain its result.
+ *
+ * Returns: (transfer full): the sealed memfd holding the image, or -1
+ *
+ */
+int
+kiosk_screenshot_screenshot_window_to_memfd_finish (KioskScreenshot           *screenshot,
+                                                    GAsyncResult              *result,
+                                                    MtkRectangle             **area,
+                                                    KioskScreenshotImageInfo  *info,
+                                                    GError                   **error)
+{
+        g_return_val_if_fail (KIOSK_IS_SCREENSHOT (screenshot), -1);
+        g_return_val_if_fail (G_IS_TASK (result), -1);
+        g_return_val_if_fail (g_async_result_is_tagged (result,
+                                                        kiosk_screenshot_screenshot_window_to_memfd),
+                              -1);
+        return finish_memfd_screenshot (screenshot, result, area, info, error);
+}
+
+/**
+ * kiosk_screenshot_screenshot_thumbnail_to_memfd:
+ * @screenshot: the #KioskScreenshot
+ * @max_width: The maximum width of the thumbnail
+ * @max_height: The maximum height of the thumbnail
+ * @format: The format of the image
+ * @compression_level: The png compression level, or
+ * %KIOSK_PNG_ENCODER_COMPRESSION_LEVEL_DEFAULT for the #KioskScreenshot:compression-level
+ * @callback: (scope async): function to call returning success or failure
+ * of the async grabbing
+ * @user_data: the data to pass to callback function
+ *
+ * Takes a scaled down screenshot of the whole screen, keeping the aspect
+ * ratio and fitting in @max_width x @max_height, into an anonymous,
+ * sealed memory file. The stage is painted at the reduced size, falling
+ * back to shrinking a full size capture if that is not possible.
+ *
+ */
+void
+kiosk_screenshot_screenshot_thumbnail_to_memfd (KioskScreenshot       *screenshot,
+                                                int                    max_width,
+                                                int                    max_height,
+                                                KioskScreenshotFormat  format,
+                                                int                    compression_level,
+                                                GAsyncReadyCallback    callback,
+                                                gpointer               user_data)
+{
+        KioskScreenshotRequest *request;
+        GTask *result;
+
+        g_return_if_fail (KIOSK_IS_SCREENSHOT (screenshot));
+        g_return_if_fail (max_width > 0 && max_height > 0);
+
+        result = g_task_new (screenshot, NULL, callback, user_data);
+        g_task_set_source_tag (result, kiosk_screenshot_screenshot_thumbnail_to_memfd);
+
+        request = kiosk_screenshot_request_new (screenshot, KIOSK_SCREENSHOT_SCREEN,
+                                                format, compression_level);
+        request->max_width = max_width;
+        request->max_height = max_height;
+
+        queue_memfd_request (screenshot, request, result);
+}
+
+/**
+ * kiosk_screenshot_screenshot_thumbnail_to_memfd_finish:
+ * @screenshot: the #KioskScreenshot
+ * @result: the #GAsyncResult that was provided to the callback
+ * @area: (out) (transfer none): the area that was grabbed in screen coordinates
+ * @info: (out) (optional): return location for the image layout
+ * @error: #GError for error reporting
+ *
+ * Finish the asynchronous operation started by
+ * kiosk_screenshot_screenshot_thumbnail_to_memfd() and obtain its result.
+ *
+ * Returns: (transfer full): the sealed memfd holding the image, or -1
+ *
+ */
+int
+kiosk_screenshot_screenshot_thumbnail_to_memfd_finish (KioskScreenshot           *screenshot,
+                                                       GAsyncResult              *result,
+                                                       MtkRectangle             **area,
+                                                       KioskScreenshotImageInfo  *info,
+                                                       GError                   **error)
+{
+        g_return_val_if_fail (KIOSK_IS_SCREENSHOT (screenshot), -1);
+        g_return_val_if_fail (G_IS_TASK (result), -1);
+        g_return_val_if_fail (g_async_result_is_tagged (result,
+                                                        kiosk_screenshot_screenshot_thumbnail_to_memfd),
+                              -1);
+        return finish_memfd_screenshot (screenshot, result, area, info, error);
+}
+
+/**
+ * kiosk_screenshot_screenshot_if_changed_to_memfd:
+ * @screenshot: the #KioskScreenshot
+ * @include_cursor: Whether to include the cursor or not
+ * @since_serial: the serial returned for the previous capture, or 0
+ * @callback: (scope async): function to call returning success or failure
+ * of the async grabbing
+ * @user_data: the data to pass to callback function
+ *
+ * Takes a screenshot of the whole screen, splits it into tiles and
+ * compares their hashes with the ones of the last capture done this way.
+ * Only the raw pixels of the tiles that changed are written into an
+ * anonymous, sealed memory file, nothing is encoded.
+ *
+ * If @since_serial does not match the last capture, every tile counts
+ * as changed.
+ *
+ */
+void
+kiosk_screenshot_screenshot_if_changed_to_memfd (KioskScreenshot     *screenshot,
+                                                 gboolean             include_cursor,
+                                                 guint64              since_serial,
+                                                 GAsyncReadyCallback  callback,
+                                                 gpointer             user_data)
+{
+        KioskScreenshotRequest *request;
+        GTask *result;
+
+        g_return_if_fail (KIOSK_IS_SCREENSHOT (screenshot));
+
+        result = g_task_new (screenshot, NULL, callback, user_data);
+        g_task_set_source_tag (result, kiosk_screenshot_screenshot_if_changed_to_memfd);
+
+        request = kiosk_screenshot_request_new (screenshot, KIOSK_SCREENSHOT_SCREEN,
+                                                KIOSK_SCREENSHOT_FORMAT_RAW,
+                                                KIOSK_PNG_ENCODER_COMPRESSION_LEVEL_DEFAULT);
+        request->detect_changes = TRUE;
+        request->since_serial = since_serial;
+
+        if (include_cursor)
+                request->flags |= KIOSK_SCREENSHOT_FLAG_INCLUDE_CURSOR;
+
+        queue_memfd_request (screenshot, request, result);
+}
+
+/**
+ * kiosk_screenshot_screenshot_if_changed_to_memfd_finish:
+ * @screenshot: the #KioskScreenshot
+ * @result: the #GAsyncResult that was provided to the callback
+ * @serial: (out): return location for the serial of this capture
+ * @changed_tiles: (out) (transfer full) (element-type MtkRectangle): return
+ * location for the changed tiles, in image coordinates and in the order
+ * their pixels are stored
+ * @info: (out) (optional): return location for the image layout
+ * @error: #GError for error reporting
+ *
+ * Finish the asynchronous operation started by
+ * kiosk_screenshot_screenshot_if_changed_to_memfd() and obtain its result.
+ *
+ * Returns: (transfer full): the sealed memfd holding the tiles, or -1
+ *
+ */
+int
+kiosk_screenshot_screenshot_if_changed_to_memfd_finish (KioskScreenshot           *screenshot,
+                                                        GAsyncResult              *result,
+                                                        guint64                   *serial,
+                                                        GArray                   **changed_tiles,
+                                                        KioskScreenshotImageInfo  *info,
+                                                        GError                   **error)
+{
+        KioskScreenshotRequest *request;
+        int fd;
+
+        g_return_val_if_fail (KIOSK_IS_SCREENSHOT (screenshot), -1);
+        g_return_val_if_fail (G_IS_TASK (result), -1);
+        g_return_val_if_fail (g_async_result_is_tagged (result,
+                                                        kiosk_screenshot_screenshot_if_changed_to_memfd),
+                              -1);
+
+        fd = finish_memfd_screenshot (screenshot, result, NULL, info, error);
+        if (fd < 0)
+                return -1;
+
+        request = g_task_get_task_data (G_TASK (result));
+
+        if (serial)
+                *serial = request->serial;
+
+        if (changed_tiles)
+                *changed_tiles = g_steal_pointer (&request->changed_tiles);
+
+        return fd;
+}
+
+/**
+ * kiosk_screenshot_window_capture_free:
+ * @capture: a #KioskScreenshotWindowCapture
+ *
+ * Closes the memfd of @capture and frees it.
+ */
+void
+kiosk_screenshot_window_capture_free (KioskScreenshotWindowCapture *capture)
+{
+        g_clear_fd (&capture->fd, NULL);
+        g_free (capture);
+}
+
+typedef struct
+{
+        GPtrArray *captures;    /* KioskScreenshotWindowCapture */
+        gsize      pending_captures;
+        GError    *error;
+} KioskScreenshotBatch;
+
+typedef struct
+{
+        GTask                        *batch;
+        KioskScreenshotWindowCapture *capture;
+} KioskScreenshotBatchItem;
+
+static void
+kiosk_screenshot_batch_free (KioskScreenshotBatch *batch)
+{
+        g_clear_pointer (&batch->captures, g_ptr_array_unref);
+        g_clear_error (&batch->error);
+        g_free (batch);
+}
+
+static void
+on_batch_window_captured (GObject      *source,
+                          GAsyncResult *result,
+                          gpointer      user_data)
+{
+        KioskScreenshotBatchItem *item = user_data;
+        KioskScreenshotBatch *batch = g_task_get_task_data (item->batch);
+        KioskScreenshotWindowCapture *capture = item->capture;
+        MtkRectangle *area = NULL;
+        GError *error = NULL;
+
+        capture->fd = finish_memfd_screenshot (KIOSK_SCREENSHOT (source), result,
+                                               &area, &capture->info, &error);
+
+        if (capture->fd >= 0)
+                capture->area = *area;
+        else if (batch->error == NULL)
+                batch->error = error;
+        else
+                g_error_free (error);
+
+        batch->pending_captures--;
+
+        if (batch->pending_captures == 0) {
+                if (batch->error != NULL)
+                        g_task_return_error (item->batch, g_steal_pointer (&batch->error));
+                else
+                        g_task_return_boolean (item->batch, TRUE);
+        }
+
+        g_object_unref (item->batch);
+        g_free (item);
+}
+
+static MetaWindow *
+find_window_by_id (KioskScreenshot *screenshot,
+                   guint64          window_id)
+{
+        g_autoptr (GList) windows = NULL;
+        GList *node;
+
+        windows = meta_display_list_all_windows (screenshot->display);
+
+        for (node = windows; node != NULL; node = node->next) {
+                MetaWindow *window = node->data;
+
+                if (meta_window_get_id (window) == window_id)
+                        return window;
+        }
+
+        return NULL;
+}
+
+/**
+ * kiosk_screenshot_screenshot_windows_to_memfd:
+ * @screenshot: the #KioskScreenshot
+ * @window_ids: (array length=n_window_ids): the ids of the windows to capture
+ * @n_window_ids: the number of window ids
+ * @include_frame: Whether to include the frame or not
+ * @include_cursor: Whether to include the cursor or not
+ * @format: The format of the images
+ * @compression_level: The png compression level, or
+ * %KIOSK_PNG_ENCODER_COMPRESSION_LEVEL_DEFAULT for the #KioskScreenshot:compression-level
+ * @callback: (scope async): function to call returning success or failure
+ * of the async grabbing
+ * @user_data: the data to pass to callback function
+ *
+ * Takes a screenshot of each of the given windows, focused or not, and
+ * writes every one of them into its own anonymous, sealed memory file.
+ * The windows are all read back in one go and their images are encoded
+ * in parallel.
+ *
+ */
+void
+kiosk_screenshot_screenshot_windows_to_memfd (KioskScreenshot       *screenshot,
+                                              const guint64         *window_ids,
+                                              gsize                  n_window_ids,
+                                              gboolean               include_frame,
+                                              gboolean               include_cursor,
+                                              KioskScreenshotFormat  format,
+                                              int                    compression_level,
+                                              GAsyncReadyCallback    callback,
+                                              gpointer               user_data)
+{
+        g_autoptr (GPtrArray) windows = NULL;
+        KioskScreenshotBatch *batch;
+        GTask *result;
+        gsize i;
+
+        g_return_if_fail (KIOSK_IS_SCREENSHOT (screenshot));
+
+        if (n_window_ids == 0) {
+                g_task_report_new_error (screenshot,
+                                         callback,
+                                         user_data,
+                                         kiosk_screenshot_screenshot_windows_to_memfd,
+                                         G_IO_ERROR,
+                                         G_IO_ERROR_INVALID_ARGUMENT,
+                                         "No windows to capture");
+                return;
+        }
+
+        /* Every window is looked up before anything is queued, so the
+         * whole batch either gets captured or fails right away
+         */
+        windows = g_ptr_array_sized_new (n_window_ids);
+        for (i = 0; i < n_window_ids; i++) {
+                MetaWindow *window = find_window_by_id (screenshot, window_ids[i]);
+
+                if (window == NULL) {
+                        g_task_report_new_error (screenshot,
+                                                 callback,
+                                                 user_data,
+                                                 kiosk_screenshot_screenshot_windows_to_memfd,
+                                                 G_IO_ERROR,
+                                                 G_IO_ERROR_NOT_FOUND,
+                                                 "No window with id %" G_GUINT64_FORMAT,
+                                                 window_ids[i]);
+                        return;
+                }
+
+                g_ptr_array_add (windows, window);
+        }
+
+        result = g_task_new (screenshot, NULL, callback, user_data);
+        g_task_set_source_tag (result, kiosk_screenshot_screenshot_windows_to_memfd);
+
+        batch = g_new0 (KioskScreenshotBatch, 1);
+        batch->captures = g_ptr_array_new_with_free_func ((GDestroyNotify) kiosk_screenshot_window_capture_free);
+        batch->pending_captures = n_window_ids;
+        g_task_set_task_data (result, batch, (GDestroyNotify) kiosk_screenshot_batch_free);
+
+        for (i = 0; i < n_window_ids; i++) {
+                KioskScreenshotRequest *request;
+                KioskScreenshotBatchItem *item;
+                GTask *window_result;
+
+                item = g_new0 (KioskScreenshotBatchItem, 1);
+                item->batch = g_object_ref (result);
+                item->capture = g_new0 (KioskScreenshotWindowCapture, 1);
+                item->capture->window_id = window_ids[i];
+                item->capture->fd = -1;
+                g_ptr_array_add (batch->captures, item->capture);
+
+                window_result = g_task_new (screenshot, NULL, on_batch_window_captured, item);
+                g_task_set_source_tag (window_result, kiosk_screenshot_screenshot_windows_to_memfd);
+
+                request = kiosk_screenshot_request_new (screenshot, KIOSK_SCREENSHOT_WINDOW,
+                                                        format, compression_level);
+                request->include_frame = include_frame;
+                g_set_weak_pointer (&request->window, g_ptr_array_index (windows, i));
+
+                if (include_cursor)
+                        request->flags |= KIOSK_SCREENSHOT_FLAG_INCLUDE_CURSOR;
+
+                queue_memfd_request (screenshot, request, window_result);
+        }
+
+        g_object_unref (result);
+}
+
+/**
+ * kiosk_screenshot_screenshot_windows_to_memfd_finish:
+ * @screenshot: the #KioskScreenshot
+ * @result: the #GAsyncResult that was provided to the callback
+ * @error: #GError for error reporting
+ *
+ * Finish the asynchronous operation started by
+ * kiosk_screenshot_screenshot_windows_to_memfd() and obtain its result.
+ *
+ * Returns: (transfer full) (element-type KioskScreenshotWindowCapture): the
+ * captures, in the order the windows were given, or %NULL
+ *
+ */
+GPtrArray *
+kiosk_screenshot_screenshot_windows_to_memfd_finish (KioskScreenshot  *screenshot,
+                                                     GAsyncResult     *result,
+                                                     GError          **error)
+{
+        KioskScreenshotBatch *batch;
+
+        g_return_val_if_fail (KIOSK_IS_SCREENSHOT (screenshot), NULL);
+        g_return_val_if_fail (G_IS_TASK (result), NULL);
+        g_return_val_if_fail (g_async_result_is_tagged (result,
+                                                        kiosk_screenshot_screenshot_windows_to_memfd),
+                              NULL);
+
+        if (!g_task_propagate_boolean (G_TASK (result), error))
+                return NULL;
+
+        batch = g_task_get_task_data (G_TASK (result));
+
+        return g_steal_pointer (&batch->captures);
+}
+
 KioskScreenshot *
 kiosk_screenshot_new (KioskCompositor *compositor)
 {
@@ -8,13 +8,93 @@
 
 typedef struct _KioskCompositor KioskCompositor;
 
+/**
+ * KioskScreenshotFormat:
+ * @KIOSK_SCREENSHOT_FORMAT_PNG: a png encoded image
+ * @KIOSK_SCREENSHOT_FORMAT_RAW: unencoded pixels, laid out like
+ * %CAIRO_FORMAT_ARGB32 (premultiplied alpha, native endian)
+ * @KIOSK_SCREENSHOT_FORMAT_QOI: a qoi encoded image, much cheaper to
+ * produce than png at a somewhat larger size
+ *
+ * The format a screenshot is delivered in.
+ */
+typedef enum
+{
+        KIOSK_SCREENSHOT_FORMAT_PNG,
+        KIOSK_SCREENSHOT_FORMAT_RAW,
+        KIOSK_SCREENSHOT_FORMAT_QOI,
+} KioskScreenshotFormat;
+
+/**
+ * KioskScreenshotImageInfo:
+ * @format: the format of the data
+ * @width: the width of the image in pixels
+ * @height: the height of the image in pixels
+ * @stride: the number of bytes per row, only meaningful for
+ * %KIOSK_SCREENSHOT_FORMAT_RAW
+ * @size: the number of bytes of image data
+ *
+ * Describes the image data handed out by the memfd screenshot
+ * functions.
+ */
+typedef struct
+{
+        KioskScreenshotFormat format;
+        int                   width;
+        int                   height;
+        int                   stride;
+        gsize                 size;
+} KioskScreenshotImageInfo;
+
+/**
+ * KioskScreenshotWindowCapture:
+ * @window_id: the id of the captured window
+ * @fd: a sealed memfd holding the image, owned by the capture
+ * @area: the area of the window that got captured
+ * @info: the layout of the image data
+ *
+ * One of the images handed out by
+ * kiosk_screenshot_screenshot_windows_to_memfd().
+ */
+typedef struct
+{
+        guint64                  window_id;
+        int                      fd;
+        MtkRectangle             area;
+        KioskScreenshotImageInfo info;
+} KioskScreenshotWindowCapture;
+
+void kiosk_screenshot_window_capture_free (KioskScreenshotWindowCapture *capture);
+
+/**
+ * KIOSK_SCREENSHOT_ERROR:
+ *
+ * Error domain for the errors only #KioskScreenshot reports, the
+ * others are from the #G_IO_ERROR domain.
+ */
+#define KIOSK_SCREENSHOT_ERROR (kiosk_screenshot_error_quark ())
+
+/**
+ * KioskScreenshotError:
+ * @KIOSK_SCREENSHOT_ERROR_CREATING_FILE: the file to write the
+ * screenshot to could not be created
+ *
+ * Errors reported by #KioskScreenshot.
+ */
+typedef enum
+{
+        KIOSK_SCREENSHOT_ERROR_CREATING_FILE,
+} KioskScreenshotError;
+
+GQuark kiosk_screenshot_error_quark (void);
+
 /**
  * KioskScreenshot:
  *
  * Grabs screenshots of areas and/or windows
  *
  * The #KioskScreenshot object is used to take screenshots of screen
- * areas or windows and write them out as png files.
+ * areas or windows and write them out as png, qoi or raw images.
  *
  */
 #define KIOSK_TYPE_SCREENSHOT (kiosk_screenshot_get_type ())
@@ -24,36 +104,120 @@ G_DECLARE_FINAL_TYPE (KioskScreenshot, kiosk_screenshot,
 
 KioskScreenshot *kiosk_screenshot_new (KioskCompositor *compositor);
 
-void    kiosk_screenshot_screenshot_area (KioskScreenshot     *screenshot,
-                                          int                  x,
-                                          int                  y,
-                                          int                  width,
-                                          int                  height,
-                                          GOutputStream       *stream,
-                                          GAsyncReadyCallback  callback,
-                                          gpointer             user_data);
+void    kiosk_screenshot_screenshot_area (KioskScreenshot       *screenshot,
+                                          int                    x,
+                                          int                    y,
+                                          int                    width,
+                                          int                    height,
+                                          GFile                 *file,
+                                          KioskScreenshotFormat  format,
+                                          int                    compression_level,
+                                          GAsyncReadyCallback    callback,
+                                          gpointer               user_data);
 gboolean kiosk_screenshot_screenshot_area_finish (KioskScreenshot *screenshot,
                                                   GAsyncResult    *result,
                                                   MtkRectangle   **area,
                                                   GError         **error);
 
-void    kiosk_screenshot_screenshot_window (KioskScreenshot     *screenshot,
-                                            gboolean             include_frame,
-                                            gboolean             include_cursor,
-                                            GOutputStream       *stream,
-                                            GAsyncReadyCallback  callback,
-                                            gpointer             user_data);
+void    kiosk_screenshot_screenshot_window (KioskScreenshot       *screenshot,
+                                            gboolean               include_frame,
+                                            gboolean               include_cursor,
+                                            GFile                 *file,
+                                            KioskScreenshotFormat  format,
+                                            int                    compression_level,
+                                            GAsyncReadyCallback    callback,
+                                            gpointer               user_data);
 gboolean kiosk_screenshot_screenshot_window_finish (KioskScreenshot *screenshot,
                                                     GAsyncResult    *result,
                                                     MtkRectangle   **area,
                                                     GError         **error);
 
-void    kiosk_screenshot_screenshot (KioskScreenshot     *screenshot,
-                                     gboolean             include_cursor,
-                                     GOutputStream       *stream,
-                                     GAsyncReadyCallback  callback,
-                                     gpointer             user_data);
+void    kiosk_screenshot_screenshot (KioskScreenshot       *screenshot,
+                                     gboolean               include_cursor,
+                                     GFile                 *file,
+                                     KioskScreenshotFormat  format,
+                                     int                    compression_level,
+                                     GAsyncReadyCallback    callback,
+                                     gpointer               user_data);
 gboolean kiosk_screenshot_screenshot_finish (KioskScreenshot *screenshot,
                                              GAsyncResult    *result,
                                              MtkRectangle   **area,
                                              GError         **error);
+
+void    kiosk_screenshot_screenshot_to_memfd (KioskScreenshot       *screenshot,
+                                              gboolean               include_cursor,
+                                              KioskScreenshotFormat  format,
+                                              int                    compression_level,
+                                              GAsyncReadyCallback    callback,
+                                              gpointer               user_data);
+int     kiosk_screenshot_screenshot_to_memfd_finish (KioskScreenshot           *screenshot,
+                                                     GAsyncResult              *result,
+                                                     MtkRectangle             **area,
+                                                     KioskScreenshotImageInfo  *info,
+                                                     GError                   **error);
+
+void    kiosk_screenshot_screenshot_area_to_memfd (KioskScreenshot       *screenshot,
+                                                   int                    x,
+                                                   int                    y,
+                                                   int                    width,
+                                                   int                    height,
+                                                   KioskScreenshotFormat  format,
+                                                   int                    compression_level,
+                                                   GAsyncReadyCallback    callback,
+                                                   gpointer               user_data);
+int     kiosk_screenshot_screenshot_area_to_memfd_finish (KioskScreenshot           *screenshot,
+                                                          GAsyncResult              *result,
+                                                          MtkRectangle             **area,
+                                                          KioskScreenshotImageInfo  *info,
+                                                          GError                   **error);
+
+void    kiosk_screenshot_screenshot_window_to_memfd (KioskScreenshot       *screenshot,
+                                                     gboolean               include_frame,
+                                                     gboolean               include_cursor,
+                                                     KioskScreenshotFormat  format,
+                                                     int                    compression_level,
+                                                     GAsyncReadyCallback    callback,
+                                                     gpointer               user_data);
+int     kiosk_screenshot_screenshot_window_to_memfd_finish (KioskScreenshot           *screenshot,
+                                                            GAsyncResult              *result,
+                                                            MtkRectangle             **area,
+                                                            KioskScreenshotImageInfo  *info,
+                                                            GError                   **error);
+
+void    kiosk_screenshot_screenshot_thumbnail_to_memfd (KioskScreenshot       *screenshot,
+                                                        int                    max_width,
+                                                        int                    max_height,
+                                                        KioskScreenshotFormat  format,
+                                                        int                    compression_level,
+                                                        GAsyncReadyCallback    callback,
+                                                        gpointer               user_data);
+int     kiosk_screenshot_screenshot_thumbnail_to_memfd_finish (KioskScreenshot           *screenshot,
+                                                               GAsyncResult              *result,
+                                                               MtkRectangle             **area,
+                                                               KioskScreenshotImageInfo  *info,
+                                                               GError                   **error);
+
+void    kiosk_screenshot_screenshot_if_changed_to_memfd (KioskScreenshot     *screenshot,
+                                                         gboolean             include_cursor,
+                                                         guint64              since_serial,
+                                                         GAsyncReadyCallback  callback,
+                                                         gpointer             user_data);
+int     kiosk_screenshot_screenshot_if_changed_to_memfd_finish (KioskScreenshot           *screenshot,
+                                                                GAsyncResult              *result,
+                                                                guint64                   *serial,
+                                                                GArray                   **changed_tiles,
+                                                                KioskScreenshotImageInfo  *info,
+                                                                GError                   **error);
+
+void       kiosk_screenshot_screenshot_windows_to_memfd (KioskScreenshot       *screenshot,
+                                                         const guint64         *window_ids,
+                                                         gsize                  n_window_ids,
+                                                         gboolean               include_frame,
+                                                         gboolean               include_cursor,
+                                                         KioskScreenshotFormat  format,
+                                                         int                    compression_level,
+                                                         GAsyncReadyCallback    callback,
+                                                         gpointer               user_data);
+GPtrArray *kiosk_screenshot_screenshot_windows_to_memfd_finish (KioskScreenshot  *screenshot,
+                                                                GAsyncResult     *result,
+                                                                GError          **error);
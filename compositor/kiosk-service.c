@@ -23,6 +23,8 @@ struct _KioskService
 
         /* strong references */
         KioskDBusServiceSkeleton             *service_skeleton;
+        KioskDBusDirectScanoutSkeleton       *direct_scanout_skeleton;
+        KioskDBusBackgroundsSkeleton         *backgrounds_skeleton;
 
         KioskDBusInputSourcesManagerSkeleton *input_sources_manager_skeleton;
         GDBusObjectManagerServer             *input_sources_object_manager;
@@ -124,6 +126,8 @@ kiosk_service_init (KioskService *self)
 {
         g_debug ("KioskService: Initializing");
         self->service_skeleton = KIOSK_DBUS_SERVICE_SKELETON (kiosk_dbus_service_skeleton_new ());
+        self->direct_scanout_skeleton = KIOSK_DBUS_DIRECT_SCANOUT_SKELETON (kiosk_dbus_direct_scanout_skeleton_new ());
+        self->backgrounds_skeleton = KIOSK_DBUS_BACKGROUNDS_SKELETON (kiosk_dbus_backgrounds_skeleton_new ());
 
         self->input_sources_manager_skeleton = KIOSK_DBUS_INPUT_SOURCES_MANAGER_SKELETON (kiosk_dbus_input_sources_manager_skeleton_new ());
         self->input_sources_object_manager = g_dbus_object_manager_server_new (KIOSK_SERVICE_INPUT_SOURCES_OBJECTS_PATH_PREFIX);
@@ -144,6 +148,22 @@ export_service (KioskService    *self,
                 g_debug ("KioskService: Could not export service over user bus: %s", error->message);
                 g_clear_error (&error);
         }
+
+        g_dbus_interface_skeleton_export (G_DBUS_INTERFACE_SKELETON (self->direct_scanout_skeleton),
+                                          connection, KIOSK_SERVICE_OBJECT_PATH, &error);
+
+        if (error != NULL) {
+                g_debug ("KioskService: Could not export direct scanout status over user bus: %s", error->message);
+                g_clear_error (&error);
+        }
+
+        g_dbus_interface_skeleton_export (G_DBUS_INTERFACE_SKELETON (self->backgrounds_skeleton),
+                                          connection, KIOSK_SERVICE_OBJECT_PATH, &error);
+
+        if (error != NULL) {
+                g_debug ("KioskService: Could not export backgrounds status over user bus: %s", error->message);
+                g_clear_error (&error);
+        }
 }
 
 static void
@@ -235,6 +255,8 @@ kiosk_service_stop (KioskService *self)
         g_debug ("KioskService: Stopping");
 
         g_dbus_interface_skeleton_unexport (G_DBUS_INTERFACE_SKELETON (self->service_skeleton));
+        g_dbus_interface_skeleton_unexport (G_DBUS_INTERFACE_SKELETON (self->direct_scanout_skeleton));
+        g_dbus_interface_skeleton_unexport (G_DBUS_INTERFACE_SKELETON (self->backgrounds_skeleton));
         g_dbus_object_manager_server_unexport (G_DBUS_OBJECT_MANAGER_SERVER (self->input_sources_manager_skeleton),
                                                KIOSK_SERVICE_INPUT_SOURCES_MANAGER_OBJECT_PATH);
 
@@ -253,6 +275,18 @@ kiosk_service_get_input_sources_object_manager (KioskService *self)
         return self->input_sources_object_manager;
 }
 
+KioskDBusDirectScanoutSkeleton *
+kiosk_service_get_direct_scanout_skeleton (KioskService *self)
+{
+        return self->direct_scanout_skeleton;
+}
+
+KioskDBusBackgroundsSkeleton *
+kiosk_service_get_backgrounds_skeleton (KioskService *self)
+{
+        return self->backgrounds_skeleton;
+}
+
 static void
 kiosk_service_dispose (GObject *object)
 {
@@ -264,6 +298,8 @@ kiosk_service_dispose (GObject *object)
 
         g_clear_object (&self->input_sources_manager_skeleton);
         g_clear_object (&self->input_sources_object_manager);
+        g_clear_object (&self->direct_scanout_skeleton);
+        g_clear_object (&self->backgrounds_skeleton);
         g_clear_weak_pointer (&self->compositor);
 
         G_OBJECT_CLASS (kiosk_service_parent_class)->dispose (object);
@@ -22,5 +22,7 @@ void kiosk_service_stop (KioskService *self);
 
 KioskDBusInputSourcesManagerSkeleton *kiosk_service_get_input_sources_manager_skeleton (KioskService *self);
 GDBusObjectManagerServer *kiosk_service_get_input_sources_object_manager (KioskService *self);
+KioskDBusDirectScanoutSkeleton *kiosk_service_get_direct_scanout_skeleton (KioskService *self);
+KioskDBusBackgroundsSkeleton *kiosk_service_get_backgrounds_skeleton (KioskService *self);
 
 G_END_DECLS
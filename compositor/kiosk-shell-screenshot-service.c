@@ -3,15 +3,22 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <gio/gunixfdlist.h>
 #include <meta/display.h>
 #include <meta/meta-context.h>
 
 #include "kiosk-compositor.h"
+#include "kiosk-png-encoder.h"
+#include "kiosk-screencast.h"
 #include "kiosk-screenshot.h"
 
 #define KIOSK_SHELL_SCREENSHOT_SERVICE_BUS_NAME "org.gnome.Shell.Screenshot"
 #define KIOSK_SHELL_SCREENSHOT_SERVICE_OBJECT_PATH "/org/gnome/Shell/Screenshot"
 
+#define KIOSK_SHELL_SCREENSHOT_SERVICE_DEFAULT_RECORDING_FRAME_RATE 1.0
+#define KIOSK_SHELL_SCREENSHOT_SERVICE_MAX_RECORDING_FRAME_RATE 10.0
+#define KIOSK_SHELL_SCREENSHOT_SERVICE_DEFAULT_KEYFRAME_INTERVAL 60
+
 struct _KioskShellScreenshotService
 {
         KioskShellScreenshotDBusServiceSkeleton parent;
@@ -24,6 +31,7 @@ struct _KioskShellScreenshotService
         /* strong references */
         GCancellable                           *cancellable;
         KioskScreenshot                        *screenshot;
+        KioskScreencast                        *screencast;
 
         /* handles */
         guint                                   bus_id;
@@ -110,6 +118,7 @@ kiosk_shell_screenshot_service_dispose (GObject *object)
         kiosk_shell_screenshot_service_stop (self);
 
         g_clear_object (&self->screenshot);
+        g_clear_object (&self->screencast);
         g_clear_weak_pointer (&self->context);
         g_clear_weak_pointer (&self->display);
         g_clear_weak_pointer (&self->compositor);
@@ -123,6 +132,7 @@ kiosk_shell_screenshot_service_constructed (GObject *object)
         KioskShellScreenshotService *self = KIOSK_SHELL_SCREENSHOT_SERVICE (object);
 
         self->screenshot = kiosk_screenshot_new (self->compositor);
+        self->screencast = kiosk_screencast_new (self->compositor);
 
         g_set_weak_pointer (&self->display, meta_plugin_get_display (META_PLUGIN (self->compositor)));
         g_set_weak_pointer (&self->context, meta_display_get_context (self->display));
@@ -226,6 +236,38 @@ kiosk_shell_screenshot_service_handle_interactive_screenshot (KioskShellScreensh
         return G_DBUS_METHOD_INVOCATION_HANDLED;
 }
 
+static KioskScreenshotFormat
+get_format_for_filename (const char *filename)
+{
+        /* The file based methods have a fixed signature, so the
+         * format can only be picked through the file extension
+         */
+        if (g_str_has_suffix (filename, ".qoi"))
+                return KIOSK_SCREENSHOT_FORMAT_QOI;
+
+        return KIOSK_SCREENSHOT_FORMAT_PNG;
+}
+
+/* A file that can't be created is a D-Bus error, rather than
+ * success=FALSE like a capture or write that failed
+ */
+static gboolean
+return_error_if_file_not_created (struct KioskShellScreenshotCompletion *completion,
+                                  GError                                *error)
+{
+        if (!g_error_matches (error, KIOSK_SCREENSHOT_ERROR, KIOSK_SCREENSHOT_ERROR_CREATING_FILE))
+                return FALSE;
+
+        g_dbus_method_invocation_return_error (completion->invocation,
+                                               G_DBUS_ERROR,
+                                               G_DBUS_ERROR_FAILED,
+                                               "Error creating file: %s",
+                                               error->message);
+        completion_dispose (completion);
+
+        return TRUE;
+}
+
 static void
 screenshot_ready_callback (GObject      *source_object,
                            GAsyncResult *result,
@@ -241,6 +283,9 @@ screenshot_ready_callback (GObject      *source_object,
                                             NULL,
                                             &error);
 
+        if (return_error_if_file_not_created (completion, error))
+                return;
+
         if (error) {
                 g_warning ("Screenshot failed: %s", error->message);
                 success = FALSE;
@@ -265,9 +310,6 @@ kiosk_shell_screenshot_service_handle_screenshot (KioskShellScreenshotDBusServic
         const char *client_unique_name = g_dbus_method_invocation_get_sender (invocation);
         struct KioskShellScreenshotCompletion *completion;
         g_autoptr (GFile) file = NULL;
-        g_autoptr (GFileOutputStream) stream = NULL;
-        g_autoptr (GError) error = NULL;
-        g_autoptr (GAsyncResult) result = NULL;
 
         g_debug ("KioskShellScreenshotService: Handling Screenshot(cursor=%i, flash=%i, file='%s') from %s",
                  arg_include_cursor, arg_flash, arg_filename, client_unique_name);
@@ -280,22 +322,17 @@ kiosk_shell_screenshot_service_handle_screenshot (KioskShellScreenshotDBusServic
                 return G_DBUS_METHOD_INVOCATION_HANDLED;
         }
 
+        /* The file is created while the screen is read back, so the
+         * compositor thread doesn't wait on the file system
+         */
         file = g_file_new_for_path (arg_filename);
-        stream = g_file_create (file, G_FILE_CREATE_NONE, NULL, &error);
-        if (error) {
-                g_dbus_method_invocation_return_error (invocation,
-                                                       G_DBUS_ERROR,
-                                                       G_DBUS_ERROR_FAILED,
-                                                       "Error creating file: %s",
-                                                       error->message);
-
-                return G_DBUS_METHOD_INVOCATION_HANDLED;
-        }
 
         completion = completion_new (object, invocation, arg_filename);
         kiosk_screenshot_screenshot (self->screenshot,
                                      arg_include_cursor,
-                                     G_OUTPUT_STREAM (stream),
+                                     file,
+                                     get_format_for_filename (arg_filename),
+                                     KIOSK_PNG_ENCODER_COMPRESSION_LEVEL_DEFAULT,
                                      screenshot_ready_callback,
                                      completion);
 
@@ -317,6 +354,9 @@ screenshot_area_ready_callback (GObject      *source_object,
                                                  NULL,
                                                  &error);
 
+        if (return_error_if_file_not_created (completion, error))
+                return;
+
         if (error) {
                 g_warning ("Screenshot area failed: %s", error->message);
                 success = FALSE;
@@ -344,9 +384,6 @@ kiosk_shell_screenshot_service_handle_screenshot_area (KioskShellScreenshotDBusS
         const char *client_unique_name = g_dbus_method_invocation_get_sender (invocation);
         struct KioskShellScreenshotCompletion *completion;
         g_autoptr (GFile) file = NULL;
-        g_autoptr (GFileOutputStream) stream = NULL;
-        g_autoptr (GError) error = NULL;
-        g_autoptr (GAsyncResult) result = NULL;
 
         g_debug ("KioskShellScreenshotService: Handling ScreenshotArea(x=%i, y=%i, w=%i, h=%i, flash=%i, file='%s') from %s",
                  arg_x, arg_y, arg_width, arg_height, arg_flash, arg_filename, client_unique_name);
@@ -360,16 +397,6 @@ kiosk_shell_screenshot_service_handle_screenshot_area (KioskShellScreenshotDBusS
         }
 
         file = g_file_new_for_path (arg_filename);
-        stream = g_file_create (file, G_FILE_CREATE_NONE, NULL, &error);
-        if (error) {
-                g_dbus_method_invocation_return_error (invocation,
-                                                       G_DBUS_ERROR,
-                                                       G_DBUS_ERROR_FAILED,
-                                                       "Error creating file: %s",
-                                                       error->message);
-
-                return G_DBUS_METHOD_INVOCATION_HANDLED;
-        }
 
         completion = completion_new (object, invocation, arg_filename);
         kiosk_screenshot_screenshot_area (self->screenshot,
@@ -377,7 +404,9 @@ kiosk_shell_screenshot_service_handle_screenshot_area (KioskShellScreenshotDBusS
                                           arg_y,
                                           arg_width,
                                           arg_height,
-                                          G_OUTPUT_STREAM (stream),
+                                          file,
+                                          get_format_for_filename (arg_filename),
+                                          KIOSK_PNG_ENCODER_COMPRESSION_LEVEL_DEFAULT,
                                           screenshot_area_ready_callback,
                                           completion);
 
@@ -399,6 +428,9 @@ screenshot_window_ready_callback (GObject      *source_object,
                                                    NULL,
                                                    &error);
 
+        if (return_error_if_file_not_created (completion, error))
+                return;
+
         if (error) {
                 g_warning ("Screenshot window failed: %s", error->message);
                 success = FALSE;
@@ -424,9 +456,6 @@ kiosk_shell_screenshot_service_handle_screenshot_window (KioskShellScreenshotDBu
         const char *client_unique_name = g_dbus_method_invocation_get_sender (invocation);
         struct KioskShellScreenshotCompletion *completion;
         g_autoptr (GFile) file = NULL;
-        g_autoptr (GFileOutputStream) stream = NULL;
-        g_autoptr (GError) error = NULL;
-        g_autoptr (GAsyncResult) result = NULL;
 
         g_debug ("KioskShellScreenshotService: Handling ScreenshotWindow(frame=%i, cursor=%i, flash=%i, file='%s') from %s",
                  arg_include_frame, arg_include_cursor, arg_flash, arg_filename, client_unique_name);
@@ -440,24 +469,689 @@ kiosk_shell_screenshot_service_handle_screenshot_window (KioskShellScreenshotDBu
         }
 
         file = g_file_new_for_path (arg_filename);
-        stream = g_file_create (file, G_FILE_CREATE_NONE, NULL, &error);
+
+        completion = completion_new (object, invocation, arg_filename);
+        kiosk_screenshot_screenshot_window (self->screenshot,
+                                            arg_include_frame,
+                                            arg_include_cursor,
+                                            file,
+                                            get_format_for_filename (arg_filename),
+                                            KIOSK_PNG_ENCODER_COMPRESSION_LEVEL_DEFAULT,
+                                            screenshot_window_ready_callback,
+                                            completion);
+
+        return G_DBUS_METHOD_INVOCATION_HANDLED;
+}
+
+typedef void (*KioskShellScreenshotMemfdCompleteFunc) (KioskShellScreenshotDBusService *object,
+                                                       GDBusMethodInvocation           *invocation,
+                                                       GUnixFDList                     *fd_list,
+                                                       GVariant                        *fd,
+                                                       GVariant                        *metadata);
+
+static gboolean
+parse_memfd_options (GVariant              *options,
+                     KioskScreenshotFormat *format,
+                     int                   *compression_level,
+                     GError               **error)
+{
+        const char *format_name = "png";
+
+        g_variant_lookup (options, "format", "&s", &format_name);
+
+        if (g_strcmp0 (format_name, "png") == 0) {
+                *format = KIOSK_SCREENSHOT_FORMAT_PNG;
+        } else if (g_strcmp0 (format_name, "qoi") == 0) {
+                *format = KIOSK_SCREENSHOT_FORMAT_QOI;
+        } else if (g_strcmp0 (format_name, "raw") == 0) {
+                *format = KIOSK_SCREENSHOT_FORMAT_RAW;
+        } else {
+                g_set_error (error,
+                             G_DBUS_ERROR,
+                             G_DBUS_ERROR_INVALID_ARGS,
+                             "Unknown screenshot format '%s'",
+                             format_name);
+                return FALSE;
+        }
+
+        *compression_level = KIOSK_PNG_ENCODER_COMPRESSION_LEVEL_DEFAULT;
+        g_variant_lookup (options, "compression-level", "i", compression_level);
+
+        if (*compression_level < KIOSK_PNG_ENCODER_COMPRESSION_LEVEL_DEFAULT ||
+            *compression_level > KIOSK_PNG_ENCODER_COMPRESSION_LEVEL_BEST) {
+                g_set_error (error,
+                             G_DBUS_ERROR,
+                             G_DBUS_ERROR_INVALID_ARGS,
+                             "Compression level %d is out of range",
+                             *compression_level);
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+static GVariant *
+build_memfd_metadata (const MtkRectangle             *area,
+                      const KioskScreenshotImageInfo *info)
+{
+        GVariantBuilder builder;
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+
+        g_variant_builder_add (&builder, "{sv}", "x", g_variant_new_int32 (area->x));
+        g_variant_builder_add (&builder, "{sv}", "y", g_variant_new_int32 (area->y));
+        g_variant_builder_add (&builder, "{sv}", "width", g_variant_new_int32 (area->width));
+        g_variant_builder_add (&builder, "{sv}", "height", g_variant_new_int32 (area->height));
+        g_variant_builder_add (&builder, "{sv}", "image-width", g_variant_new_int32 (info->width));
+        g_variant_builder_add (&builder, "{sv}", "image-height", g_variant_new_int32 (info->height));
+        g_variant_builder_add (&builder, "{sv}", "size", g_variant_new_uint64 (info->size));
+
+        switch (info->format) {
+        case KIOSK_SCREENSHOT_FORMAT_PNG:
+                g_variant_builder_add (&builder, "{sv}", "format", g_variant_new_string ("png"));
+                break;
+        case KIOSK_SCREENSHOT_FORMAT_QOI:
+                g_variant_builder_add (&builder, "{sv}", "format", g_variant_new_string ("qoi"));
+                break;
+        case KIOSK_SCREENSHOT_FORMAT_RAW:
+                g_variant_builder_add (&builder, "{sv}", "format", g_variant_new_string ("raw"));
+                g_variant_builder_add (&builder, "{sv}", "stride", g_variant_new_int32 (info->stride));
+                g_variant_builder_add (&builder, "{sv}", "pixel-format",
+                                       g_variant_new_string ("argb32-premultiplied"));
+                break;
+        }
+
+        return g_variant_builder_end (&builder);
+}
+
+static void
+complete_memfd_screenshot (struct KioskShellScreenshotCompletion *completion,
+                           KioskShellScreenshotMemfdCompleteFunc  complete_func,
+                           int                                    fd,
+                           const MtkRectangle                    *area,
+                           const KioskScreenshotImageInfo        *info,
+                           GError                                *error)
+{
+        g_autoptr (GUnixFDList) fd_list = NULL;
+
         if (error) {
+                g_warning ("Screenshot to memfd failed: %s", error->message);
+                g_dbus_method_invocation_return_error (completion->invocation,
+                                                       G_DBUS_ERROR,
+                                                       G_DBUS_ERROR_FAILED,
+                                                       "Screenshot failed: %s",
+                                                       error->message);
+                completion_dispose (completion);
+                return;
+        }
+
+        /* The list takes ownership of the fd */
+        fd_list = g_unix_fd_list_new_from_array (&fd, 1);
+
+        complete_func (completion->service,
+                       completion->invocation,
+                       fd_list,
+                       g_variant_new_handle (0),
+                       build_memfd_metadata (area, info));
+
+        completion_dispose (completion);
+}
+
+static gboolean
+start_memfd_screenshot (KioskShellScreenshotService *self,
+                        GDBusMethodInvocation       *invocation,
+                        GVariant                    *options,
+                        KioskScreenshotFormat       *format,
+                        int                         *compression_level)
+{
+        const char *client_unique_name = g_dbus_method_invocation_get_sender (invocation);
+        g_autoptr (GError) error = NULL;
+
+        if (!kiosk_shell_screenshot_check_access (self, client_unique_name)) {
                 g_dbus_method_invocation_return_error (invocation,
+                                                       G_DBUS_ERROR,
+                                                       G_DBUS_ERROR_ACCESS_DENIED,
+                                                       "Permission denied");
+                return FALSE;
+        }
+
+        if (!parse_memfd_options (options, format, compression_level, &error)) {
+                g_dbus_method_invocation_return_gerror (invocation, error);
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+static void
+screenshot_to_memfd_ready_callback (GObject      *source_object,
+                                    GAsyncResult *result,
+                                    gpointer      data)
+{
+        struct KioskShellScreenshotCompletion *completion = data;
+        KioskShellScreenshotService *self = KIOSK_SHELL_SCREENSHOT_SERVICE (completion->service);
+        g_autoptr (GError) error = NULL;
+        KioskScreenshotImageInfo info;
+        MtkRectangle *area = NULL;
+        int fd;
+
+        fd = kiosk_screenshot_screenshot_to_memfd_finish (self->screenshot,
+                                                          result,
+                                                          &area,
+                                                          &info,
+                                                          &error);
+
+        complete_memfd_screenshot (completion,
+                                   kiosk_shell_screenshot_dbus_service_complete_screenshot_to_memfd,
+                                   fd, area, &info, error);
+}
+
+static gboolean
+kiosk_shell_screenshot_service_handle_screenshot_to_memfd (KioskShellScreenshotDBusService *object,
+                                                           GDBusMethodInvocation           *invocation,
+                                                           GUnixFDList                     *fd_list,
+                                                           gboolean                         arg_include_cursor,
+                                                           GVariant                        *arg_options)
+{
+        KioskShellScreenshotService *self = KIOSK_SHELL_SCREENSHOT_SERVICE (object);
+        KioskScreenshotFormat format;
+        int compression_level;
+
+        g_debug ("KioskShellScreenshotService: Handling ScreenshotToMemfd(cursor=%i) from %s",
+                 arg_include_cursor, g_dbus_method_invocation_get_sender (invocation));
+
+        if (!start_memfd_screenshot (self, invocation, arg_options, &format, &compression_level))
+                return G_DBUS_METHOD_INVOCATION_HANDLED;
+
+        kiosk_screenshot_screenshot_to_memfd (self->screenshot,
+                                              arg_include_cursor,
+                                              format,
+                                              compression_level,
+                                              screenshot_to_memfd_ready_callback,
+                                              completion_new (object, invocation, NULL));
+
+        return G_DBUS_METHOD_INVOCATION_HANDLED;
+}
+
+static void
+screenshot_area_to_memfd_ready_callback (GObject      *source_object,
+                                         GAsyncResult *result,
+                                         gpointer      data)
+{
+        struct KioskShellScreenshotCompletion *completion = data;
+        KioskShellScreenshotService *self = KIOSK_SHELL_SCREENSHOT_SERVICE (completion->service);
+        g_autoptr (GError) error = NULL;
+        KioskScreenshotImageInfo info;
+        MtkRectangle *area = NULL;
+        int fd;
+
+        fd = kiosk_screenshot_screenshot_area_to_memfd_finish (self->screenshot,
+                                                               result,
+                                                               &area,
+                                                               &info,
+                                                               &error);
+
+        complete_memfd_screenshot (completion,
+                                   kiosk_shell_screenshot_dbus_service_complete_screenshot_area_to_memfd,
+                                   fd, area, &info, error);
+}
+
+static gboolean
+kiosk_shell_screenshot_service_handle_screenshot_area_to_memfd (KioskShellScreenshotDBusService *object,
+                                                                GDBusMethodInvocation           *invocation,
+                                                                GUnixFDList                     *fd_list,
+                                                                gint                             arg_x,
+                                                                gint                             arg_y,
+                                                                gint                             arg_width,
+                                                                gint                             arg_height,
+                                                                GVariant                        *arg_options)
+{
+        KioskShellScreenshotService *self = KIOSK_SHELL_SCREENSHOT_SERVICE (object);
+        KioskScreenshotFormat format;
+        int compression_level;
+
+        g_debug ("KioskShellScreenshotService: Handling ScreenshotAreaToMemfd(x=%i, y=%i, w=%i, h=%i) from %s",
+                 arg_x, arg_y, arg_width, arg_height,
+                 g_dbus_method_invocation_get_sender (invocation));
+
+        if (!start_memfd_screenshot (self, invocation, arg_options, &format, &compression_level))
+                return G_DBUS_METHOD_INVOCATION_HANDLED;
+
+        kiosk_screenshot_screenshot_area_to_memfd (self->screenshot,
+                                                   arg_x,
+                                                   arg_y,
+                                                   arg_width,
+                                                   arg_height,
+                                                   format,
+                                                   compression_level,
+                                                   screenshot_area_to_memfd_ready_callback,
+                                                   completion_new (object, invocation, NULL));
+
+        return G_DBUS_METHOD_INVOCATION_HANDLED;
+}
+
+static void
+screenshot_window_to_memfd_ready_callback (GObject      *source_object,
+                                           GAsyncResult *result,
+                                           gpointer      data)
+{
+        struct KioskShellScreenshotCompletion *completion = data;
+        KioskShellScreenshotService *self = KIOSK_SHELL_SCREENSHOT_SERVICE (completion->service);
+        g_autoptr (GError) error = NULL;
+        KioskScreenshotImageInfo info;
+        MtkRectangle *area = NULL;
+        int fd;
+
+        fd = kiosk_screenshot_screenshot_window_to_memfd_finish (self->screenshot,
+                                                                 result,
+                                                                 &area,
+                                                                 &info,
+                                                                 &error);
+
+        complete_memfd_screenshot (completion,
+                                   kiosk_shell_screenshot_dbus_service_complete_screenshot_window_to_memfd,
+                                   fd, area, &info, error);
+}
+
+static gboolean
+kiosk_shell_screenshot_service_handle_screenshot_window_to_memfd (KioskShellScreenshotDBusService *object,
+                                                                  GDBusMethodInvocation           *invocation,
+                                                                  GUnixFDList                     *fd_list,
+                                                                  gboolean                         arg_include_frame,
+                                                                  gboolean                         arg_include_cursor,
+                                                                  GVariant                        *arg_options)
+{
+        KioskShellScreenshotService *self = KIOSK_SHELL_SCREENSHOT_SERVICE (object);
+        KioskScreenshotFormat format;
+        int compression_level;
+
+        g_debug ("KioskShellScreenshotService: Handling ScreenshotWindowToMemfd(frame=%i, cursor=%i) from %s",
+                 arg_include_frame, arg_include_cursor,
+                 g_dbus_method_invocation_get_sender (invocation));
+
+        if (!start_memfd_screenshot (self, invocation, arg_options, &format, &compression_level))
+                return G_DBUS_METHOD_INVOCATION_HANDLED;
+
+        kiosk_screenshot_screenshot_window_to_memfd (self->screenshot,
+                                                     arg_include_frame,
+                                                     arg_include_cursor,
+                                                     format,
+                                                     compression_level,
+                                                     screenshot_window_to_memfd_ready_callback,
+                                                     completion_new (object, invocation, NULL));
+
+        return G_DBUS_METHOD_INVOCATION_HANDLED;
+}
+
+static void
+screenshot_windows_ready_callback (GObject      *source_object,
+                                   GAsyncResult *result,
+                                   gpointer      data)
+{
+        struct KioskShellScreenshotCompletion *completion = data;
+        KioskShellScreenshotService *self = KIOSK_SHELL_SCREENSHOT_SERVICE (completion->service);
+        g_autoptr (GError) error = NULL;
+        g_autoptr (GPtrArray) captures = NULL;
+        g_autoptr (GUnixFDList) fd_list = NULL;
+        GVariantBuilder builder;
+        guint i;
+
+        captures = kiosk_screenshot_screenshot_windows_to_memfd_finish (self->screenshot,
+                                                                        result,
+                                                                        &error);
+
+        if (captures == NULL) {
+                g_warning ("Screenshot of windows failed: %s", error->message);
+                g_dbus_method_invocation_return_error (completion->invocation,
                                                        G_DBUS_ERROR,
                                                        G_DBUS_ERROR_FAILED,
-                                                       "Error creating file: %s",
+                                                       "Screenshot failed: %s",
                                                        error->message);
+                completion_dispose (completion);
+                return;
+        }
+
+        fd_list = g_unix_fd_list_new ();
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(tha{sv})"));
+
+        for (i = 0; i < captures->len; i++) {
+                KioskScreenshotWindowCapture *capture = g_ptr_array_index (captures, i);
+                int handle;
+
+                /* The list duplicates the fd, the capture closes its own */
+                handle = g_unix_fd_list_append (fd_list, capture->fd, &error);
+                if (handle < 0) {
+                        g_dbus_method_invocation_return_error (completion->invocation,
+                                                               G_DBUS_ERROR,
+                                                               G_DBUS_ERROR_FAILED,
+                                                               "Screenshot failed: %s",
+                                                               error->message);
+                        g_variant_builder_clear (&builder);
+                        completion_dispose (completion);
+                        return;
+                }
+
+                g_variant_builder_add (&builder, "(t@h@a{sv})",
+                                       capture->window_id,
+                                       g_variant_new_handle (handle),
+                                       build_memfd_metadata (&capture->area, &capture->info));
+        }
+
+        kiosk_shell_screenshot_dbus_service_complete_screenshot_windows (completion->service,
+                                                                         completion->invocation,
+                                                                         fd_list,
+                                                                         g_variant_builder_end (&builder));
+
+        completion_dispose (completion);
+}
+
+static gboolean
+kiosk_shell_screenshot_service_handle_screenshot_windows (KioskShellScreenshotDBusService *object,
+                                                          GDBusMethodInvocation           *invocation,
+                                                          GUnixFDList                     *fd_list,
+                                                          GVariant                        *arg_ids,
+                                                          gboolean                         arg_include_frame,
+                                                          gboolean                         arg_include_cursor,
+                                                          GVariant                        *arg_options)
+{
+        KioskShellScreenshotService *self = KIOSK_SHELL_SCREENSHOT_SERVICE (object);
+        KioskScreenshotFormat format;
+        int compression_level;
+        const guint64 *window_ids;
+        gsize n_window_ids;
+
+        window_ids = g_variant_get_fixed_array (arg_ids, &n_window_ids, sizeof (guint64));
+
+        g_debug ("KioskShellScreenshotService: Handling ScreenshotWindows(%" G_GSIZE_FORMAT " windows, frame=%i, cursor=%i) from %s",
+                 n_window_ids, arg_include_frame, arg_include_cursor,
+                 g_dbus_method_invocation_get_sender (invocation));
 
+        if (!start_memfd_screenshot (self, invocation, arg_options, &format, &compression_level))
+                return G_DBUS_METHOD_INVOCATION_HANDLED;
+
+        if (n_window_ids == 0) {
+                g_dbus_method_invocation_return_error (invocation,
+                                                       G_DBUS_ERROR,
+                                                       G_DBUS_ERROR_INVALID_ARGS,
+                                                       "No window ids given");
                 return G_DBUS_METHOD_INVOCATION_HANDLED;
         }
 
-        completion = completion_new (object, invocation, arg_filename);
-        kiosk_screenshot_screenshot_window (self->screenshot,
-                                            arg_include_frame,
-                                            arg_include_cursor,
-                                            G_OUTPUT_STREAM (stream),
-                                            screenshot_window_ready_callback,
-                                            completion);
+        kiosk_screenshot_screenshot_windows_to_memfd (self->screenshot,
+                                                      window_ids,
+                                                      n_window_ids,
+                                                      arg_include_frame,
+                                                      arg_include_cursor,
+                                                      format,
+                                                      compression_level,
+                                                      screenshot_windows_ready_callback,
+                                                      completion_new (object, invocation, NULL));
+
+        return G_DBUS_METHOD_INVOCATION_HANDLED;
+}
+
+static void
+screenshot_thumbnail_ready_callback (GObject      *source_object,
+                                     GAsyncResult *result,
+                                     gpointer      data)
+{
+        struct KioskShellScreenshotCompletion *completion = data;
+        KioskShellScreenshotService *self = KIOSK_SHELL_SCREENSHOT_SERVICE (completion->service);
+        g_autoptr (GError) error = NULL;
+        KioskScreenshotImageInfo info;
+        MtkRectangle *area = NULL;
+        int fd;
+
+        fd = kiosk_screenshot_screenshot_thumbnail_to_memfd_finish (self->screenshot,
+                                                                    result,
+                                                                    &area,
+                                                                    &info,
+                                                                    &error);
+
+        complete_memfd_screenshot (completion,
+                                   kiosk_shell_screenshot_dbus_service_complete_screenshot_thumbnail,
+                                   fd, area, &info, error);
+}
+
+static gboolean
+kiosk_shell_screenshot_service_handle_screenshot_thumbnail (KioskShellScreenshotDBusService *object,
+                                                            GDBusMethodInvocation           *invocation,
+                                                            GUnixFDList                     *fd_list,
+                                                            gint                             arg_max_width,
+                                                            gint                             arg_max_height,
+                                                            GVariant                        *arg_options)
+{
+        KioskShellScreenshotService *self = KIOSK_SHELL_SCREENSHOT_SERVICE (object);
+        KioskScreenshotFormat format;
+        int compression_level;
+
+        g_debug ("KioskShellScreenshotService: Handling ScreenshotThumbnail(max_width=%i, max_height=%i) from %s",
+                 arg_max_width, arg_max_height,
+                 g_dbus_method_invocation_get_sender (invocation));
+
+        if (!start_memfd_screenshot (self, invocation, arg_options, &format, &compression_level))
+                return G_DBUS_METHOD_INVOCATION_HANDLED;
+
+        if (arg_max_width <= 0 || arg_max_height <= 0) {
+                g_dbus_method_invocation_return_error (invocation,
+                                                       G_DBUS_ERROR,
+                                                       G_DBUS_ERROR_INVALID_ARGS,
+                                                       "Invalid thumbnail size %ix%i",
+                                                       arg_max_width, arg_max_height);
+                return G_DBUS_METHOD_INVOCATION_HANDLED;
+        }
+
+        kiosk_screenshot_screenshot_thumbnail_to_memfd (self->screenshot,
+                                                        arg_max_width,
+                                                        arg_max_height,
+                                                        format,
+                                                        compression_level,
+                                                        screenshot_thumbnail_ready_callback,
+                                                        completion_new (object, invocation, NULL));
+
+        return G_DBUS_METHOD_INVOCATION_HANDLED;
+}
+
+static void
+screenshot_if_changed_ready_callback (GObject      *source_object,
+                                      GAsyncResult *result,
+                                      gpointer      data)
+{
+        struct KioskShellScreenshotCompletion *completion = data;
+        KioskShellScreenshotService *self = KIOSK_SHELL_SCREENSHOT_SERVICE (completion->service);
+        g_autoptr (GError) error = NULL;
+        g_autoptr (GArray) changed_tiles = NULL;
+        g_autoptr (GUnixFDList) fd_list = NULL;
+        KioskScreenshotImageInfo info;
+        GVariantBuilder metadata;
+        GVariantBuilder tiles;
+        guint64 serial = 0;
+        guint i;
+        int fd;
+
+        fd = kiosk_screenshot_screenshot_if_changed_to_memfd_finish (self->screenshot,
+                                                                     result,
+                                                                     &serial,
+                                                                     &changed_tiles,
+                                                                     &info,
+                                                                     &error);
+
+        if (error) {
+                g_warning ("Screenshot if changed failed: %s", error->message);
+                g_dbus_method_invocation_return_error (completion->invocation,
+                                                       G_DBUS_ERROR,
+                                                       G_DBUS_ERROR_FAILED,
+                                                       "Screenshot failed: %s",
+                                                       error->message);
+                completion_dispose (completion);
+                return;
+        }
+
+        g_variant_builder_init (&tiles, G_VARIANT_TYPE ("a(iiii)"));
+        for (i = 0; i < changed_tiles->len; i++) {
+                MtkRectangle *tile = &g_array_index (changed_tiles, MtkRectangle, i);
+
+                g_variant_builder_add (&tiles, "(iiii)", tile->x, tile->y, tile->width, tile->height);
+        }
+
+        g_variant_builder_init (&metadata, G_VARIANT_TYPE_VARDICT);
+        g_variant_builder_add (&metadata, "{sv}", "serial", g_variant_new_uint64 (serial));
+        g_variant_builder_add (&metadata, "{sv}", "format", g_variant_new_string ("raw"));
+        g_variant_builder_add (&metadata, "{sv}", "pixel-format",
+                               g_variant_new_string ("argb32-premultiplied"));
+        g_variant_builder_add (&metadata, "{sv}", "image-width", g_variant_new_int32 (info.width));
+        g_variant_builder_add (&metadata, "{sv}", "image-height", g_variant_new_int32 (info.height));
+        g_variant_builder_add (&metadata, "{sv}", "size", g_variant_new_uint64 (info.size));
+        g_variant_builder_add (&metadata, "{sv}", "tiles", g_variant_builder_end (&tiles));
+
+        /* The list takes ownership of the fd */
+        fd_list = g_unix_fd_list_new_from_array (&fd, 1);
+
+        kiosk_shell_screenshot_dbus_service_complete_screenshot_if_changed (completion->service,
+                                                                           completion->invocation,
+                                                                           fd_list,
+                                                                           changed_tiles->len > 0,
+                                                                           g_variant_new_handle (0),
+                                                                           g_variant_builder_end (&metadata));
+
+        completion_dispose (completion);
+}
+
+static gboolean
+kiosk_shell_screenshot_service_handle_screenshot_if_changed (KioskShellScreenshotDBusService *object,
+                                                             GDBusMethodInvocation           *invocation,
+                                                             GUnixFDList                     *fd_list,
+                                                             gboolean                         arg_include_cursor,
+                                                             GVariant                        *arg_options)
+{
+        KioskShellScreenshotService *self = KIOSK_SHELL_SCREENSHOT_SERVICE (object);
+        const char *client_unique_name = g_dbus_method_invocation_get_sender (invocation);
+        guint64 since_serial = 0;
+
+        g_debug ("KioskShellScreenshotService: Handling ScreenshotIfChanged(cursor=%i) from %s",
+                 arg_include_cursor, client_unique_name);
+
+        if (!kiosk_shell_screenshot_check_access (self, client_unique_name)) {
+                g_dbus_method_invocation_return_error (invocation,
+                                                       G_DBUS_ERROR,
+                                                       G_DBUS_ERROR_ACCESS_DENIED,
+                                                       "Permission denied");
+                return G_DBUS_METHOD_INVOCATION_HANDLED;
+        }
+
+        g_variant_lookup (arg_options, "since", "t", &since_serial);
+
+        kiosk_screenshot_screenshot_if_changed_to_memfd (self->screenshot,
+                                                         arg_include_cursor,
+                                                         since_serial,
+                                                         screenshot_if_changed_ready_callback,
+                                                         completion_new (object, invocation, NULL));
+
+        return G_DBUS_METHOD_INVOCATION_HANDLED;
+}
+
+static void
+start_recording_ready_callback (GObject      *source_object,
+                                GAsyncResult *result,
+                                gpointer      data)
+{
+        struct KioskShellScreenshotCompletion *completion = data;
+        KioskShellScreenshotService *self = KIOSK_SHELL_SCREENSHOT_SERVICE (completion->service);
+        g_autoptr (GError) error = NULL;
+
+        if (!kiosk_screencast_start_finish (self->screencast, result, &error)) {
+                g_dbus_method_invocation_return_error (completion->invocation,
+                                                       G_DBUS_ERROR,
+                                                       G_DBUS_ERROR_FAILED,
+                                                       "Could not start recording: %s",
+                                                       error->message);
+                completion_dispose (completion);
+                return;
+        }
+
+        kiosk_shell_screenshot_dbus_service_complete_start_recording (completion->service,
+                                                                      completion->invocation);
+
+        completion_dispose (completion);
+}
+
+static gboolean
+kiosk_shell_screenshot_service_handle_start_recording (KioskShellScreenshotDBusService *object,
+                                                       GDBusMethodInvocation           *invocation,
+                                                       const gchar                     *arg_filename,
+                                                       GVariant                        *arg_options)
+{
+        KioskShellScreenshotService *self = KIOSK_SHELL_SCREENSHOT_SERVICE (object);
+        const char *client_unique_name = g_dbus_method_invocation_get_sender (invocation);
+        g_autoptr (GFile) file = NULL;
+        double frame_rate = KIOSK_SHELL_SCREENSHOT_SERVICE_DEFAULT_RECORDING_FRAME_RATE;
+        guint keyframe_interval = KIOSK_SHELL_SCREENSHOT_SERVICE_DEFAULT_KEYFRAME_INTERVAL;
+
+        g_debug ("KioskShellScreenshotService: Handling StartRecording(file='%s') from %s",
+                 arg_filename, client_unique_name);
+
+        if (!kiosk_shell_screenshot_check_access (self, client_unique_name)) {
+                g_dbus_method_invocation_return_error (invocation,
+                                                       G_DBUS_ERROR,
+                                                       G_DBUS_ERROR_ACCESS_DENIED,
+                                                       "Permission denied");
+                return G_DBUS_METHOD_INVOCATION_HANDLED;
+        }
+
+        g_variant_lookup (arg_options, "frame-rate", "d", &frame_rate);
+        g_variant_lookup (arg_options, "keyframe-interval", "u", &keyframe_interval);
+
+        if (frame_rate <= 0.0 || frame_rate > KIOSK_SHELL_SCREENSHOT_SERVICE_MAX_RECORDING_FRAME_RATE ||
+            keyframe_interval == 0) {
+                g_dbus_method_invocation_return_error (invocation,
+                                                       G_DBUS_ERROR,
+                                                       G_DBUS_ERROR_INVALID_ARGS,
+                                                       "Invalid frame rate or key frame interval");
+                return G_DBUS_METHOD_INVOCATION_HANDLED;
+        }
+
+        file = g_file_new_for_path (arg_filename);
+
+        /* Only answered once the file exists, so a bad path is an error */
+        kiosk_screencast_start (self->screencast,
+                                file,
+                                frame_rate,
+                                keyframe_interval,
+                                start_recording_ready_callback,
+                                completion_new (object, invocation, NULL));
+
+        return G_DBUS_METHOD_INVOCATION_HANDLED;
+}
+
+static gboolean
+kiosk_shell_screenshot_service_handle_stop_recording (KioskShellScreenshotDBusService *object,
+                                                      GDBusMethodInvocation           *invocation)
+{
+        KioskShellScreenshotService *self = KIOSK_SHELL_SCREENSHOT_SERVICE (object);
+        const char *client_unique_name = g_dbus_method_invocation_get_sender (invocation);
+
+        g_debug ("KioskShellScreenshotService: Handling StopRecording() from %s",
+                 client_unique_name);
+
+        if (!kiosk_shell_screenshot_check_access (self, client_unique_name)) {
+                g_dbus_method_invocation_return_error (invocation,
+                                                       G_DBUS_ERROR,
+                                                       G_DBUS_ERROR_ACCESS_DENIED,
+                                                       "Permission denied");
+                return G_DBUS_METHOD_INVOCATION_HANDLED;
+        }
+
+        if (!kiosk_screencast_is_recording (self->screencast)) {
+                g_dbus_method_invocation_return_error (invocation,
+                                                       G_DBUS_ERROR,
+                                                       G_DBUS_ERROR_FAILED,
+                                                       "No recording is running");
+                return G_DBUS_METHOD_INVOCATION_HANDLED;
+        }
+
+        kiosk_screencast_stop (self->screencast);
+
+        kiosk_shell_screenshot_dbus_service_complete_stop_recording (object, invocation);
 
         return G_DBUS_METHOD_INVOCATION_HANDLED;
 }
@@ -501,6 +1195,22 @@ kiosk_shell_screenshot_dbus_service_interface_init (KioskShellScreenshotDBusServ
                 kiosk_shell_screenshot_service_handle_screenshot_area;
         interface->handle_screenshot_window =
                 kiosk_shell_screenshot_service_handle_screenshot_window;
+        interface->handle_screenshot_to_memfd =
+                kiosk_shell_screenshot_service_handle_screenshot_to_memfd;
+        interface->handle_screenshot_area_to_memfd =
+                kiosk_shell_screenshot_service_handle_screenshot_area_to_memfd;
+        interface->handle_screenshot_window_to_memfd =
+                kiosk_shell_screenshot_service_handle_screenshot_window_to_memfd;
+        interface->handle_screenshot_windows =
+                kiosk_shell_screenshot_service_handle_screenshot_windows;
+        interface->handle_screenshot_thumbnail =
+                kiosk_shell_screenshot_service_handle_screenshot_thumbnail;
+        interface->handle_screenshot_if_changed =
+                kiosk_shell_screenshot_service_handle_screenshot_if_changed;
+        interface->handle_start_recording =
+                kiosk_shell_screenshot_service_handle_start_recording;
+        interface->handle_stop_recording =
+                kiosk_shell_screenshot_service_handle_stop_recording;
         interface->handle_select_area =
                 kiosk_shell_screenshot_service_handle_select_area;
 }
@@ -17,6 +17,15 @@ static char **argv_ignored = NULL;
 static gboolean enable_vt_switch = FALSE;
 static gboolean force_animations = FALSE;
 static gboolean no_cursor = FALSE;
+static gboolean use_idle_monitor = FALSE;
+static gboolean prefer_direct_scanout = FALSE;
+static gboolean release_occluded_backgrounds = FALSE;
+static int background_cache_size = 64;
+static int slideshow_interval = 300;
+static gboolean no_background_disk_cache = FALSE;
+static int dim_delay = 0;
+static int power_off_delay = 0;
+static double brightness_update_rate = 10.0;
 
 static void
 command_exited_cb (GPid      command_pid,
@@ -99,6 +108,60 @@ static GOptionEntry
                 N_ ("Hide the cursor in the compositor"),
                 NULL
         },
+        {
+                "idle-monitor", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE,
+                &use_idle_monitor,
+                N_ ("Detect idleness in the compositor instead of relying on gnome-session"),
+                NULL
+        },
+        {
+                "release-occluded-backgrounds", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE,
+                &release_occluded_backgrounds,
+                N_ ("Free the background pictures while fullscreen windows cover all monitors"),
+                NULL
+        },
+        {
+                "background-cache-size", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+                &background_cache_size,
+                N_ ("Keep up to MIB mebibytes of decoded background pictures around"),
+                N_ ("MIB")
+        },
+        {
+                "slideshow-interval", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+                &slideshow_interval,
+                N_ ("Show each picture of a background slideshow for SECONDS"),
+                N_ ("SECONDS")
+        },
+        {
+                "no-background-disk-cache", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE,
+                &no_background_disk_cache,
+                N_ ("Don't keep the decoded background picture on disk for the next start"),
+                NULL
+        },
+        {
+                "prefer-direct-scanout", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE,
+                &prefer_direct_scanout,
+                N_ ("Skip effects keeping fullscreen windows from being scanned out directly"),
+                NULL
+        },
+        {
+                "dim-delay", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+                &dim_delay,
+                N_ ("Dim the screens after being idle for SECONDS, with --idle-monitor"),
+                N_ ("SECONDS")
+        },
+        {
+                "power-off-delay", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+                &power_off_delay,
+                N_ ("Turn the screens off after being idle for SECONDS"),
+                N_ ("SECONDS")
+        },
+        {
+                "brightness-update-rate", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_DOUBLE,
+                &brightness_update_rate,
+                N_ ("Change the brightness of the screens at most RATE times per second"),
+                N_ ("RATE")
+        },
         {
                 G_OPTION_REMAINING,
                 .arg = G_OPTION_ARG_STRING_ARRAY,
@@ -126,6 +189,63 @@ is_no_cursor_enabled (void)
         return no_cursor;
 }
 
+gboolean
+is_idle_monitor_enabled (void)
+{
+        return use_idle_monitor;
+}
+
+gboolean
+are_occluded_backgrounds_released (void)
+{
+        return release_occluded_backgrounds;
+}
+
+guint64
+get_background_cache_size (void)
+{
+        return (guint64) MAX (background_cache_size, 0) * 1024 * 1024;
+}
+
+guint
+get_slideshow_interval (void)
+{
+        return MAX (slideshow_interval, 1);
+}
+
+gboolean
+is_background_disk_cache_disabled (void)
+{
+        return no_background_disk_cache;
+}
+
+gboolean
+is_direct_scanout_preferred (void)
+{
+        return prefer_direct_scanout;
+}
+
+/* The delays are turned into milliseconds, so they need to fit
+ * in a guint once multiplied by 1000
+ */
+guint
+get_dim_delay (void)
+{
+        return CLAMP (dim_delay, 0, (int) MIN (G_MAXUINT / 1000, G_MAXINT));
+}
+
+guint
+get_power_off_delay (void)
+{
+        return CLAMP (power_off_delay, 0, (int) MIN (G_MAXUINT / 1000, G_MAXINT));
+}
+
+double
+get_brightness_update_rate (void)
+{
+        return CLAMP (brightness_update_rate, 1.0, 1000.0);
+}
+
 static void
 set_working_directory (void)
 {
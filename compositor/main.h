@@ -7,5 +7,14 @@ G_BEGIN_DECLS
 gboolean is_vt_switch_enabled (void);
 gboolean are_animations_forced (void);
 gboolean is_no_cursor_enabled (void);
+gboolean is_idle_monitor_enabled (void);
+gboolean are_occluded_backgrounds_released (void);
+guint64 get_background_cache_size (void);
+guint get_slideshow_interval (void);
+gboolean is_background_disk_cache_disabled (void);
+gboolean is_direct_scanout_preferred (void);
+guint get_dim_delay (void);
+guint get_power_off_delay (void);
+double get_brightness_update_rate (void);
 
 G_END_DECLS
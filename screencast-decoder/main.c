@@ -0,0 +1,338 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <cairo.h>
+#include <zlib.h>
+
+#include "kiosk-screencast-format.h"
+
+/* Turns a recording made by the compositor's screencast recorder back
+ * into one png image per frame, see kiosk-screencast-format.h for the
+ * layout of the file.
+ */
+
+typedef struct
+{
+        GInputStream     *stream;
+        cairo_surface_t  *canvas;
+        guint32           tile_size;
+        guint8           *pixels;
+        gsize             pixels_size;
+        guint8           *compressed;
+        gsize             compressed_size;
+} ScreencastDecoder;
+
+static gboolean
+read_exactly (ScreencastDecoder  *decoder,
+              void               *buffer,
+              gsize               size,
+              GError            **error)
+{
+        gsize bytes_read = 0;
+
+        if (!g_input_stream_read_all (decoder->stream, buffer, size,
+                                      &bytes_read, NULL, error))
+                return FALSE;
+
+        if (bytes_read != size) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT,
+                             "Recording ends in the middle of a frame");
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+static guint32
+read_uint32 (const guint8 *data)
+{
+        guint32 value;
+
+        memcpy (&value, data, sizeof (value));
+        return GUINT32_FROM_LE (value);
+}
+
+static gboolean
+read_file_header (ScreencastDecoder  *decoder,
+                  GError            **error)
+{
+        guint8 header[KIOSK_SCREENCAST_FILE_HEADER_SIZE];
+        guint32 version;
+
+        if (!read_exactly (decoder, header, sizeof (header), error))
+                return FALSE;
+
+        if (memcmp (header, KIOSK_SCREENCAST_MAGIC, KIOSK_SCREENCAST_MAGIC_SIZE) != 0) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                             "Not a kiosk screencast recording");
+                return FALSE;
+        }
+
+        version = read_uint32 (header + 8);
+        if (version != KIOSK_SCREENCAST_VERSION) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                             "Unsupported recording version %u", version);
+                return FALSE;
+        }
+
+        decoder->tile_size = read_uint32 (header + 12);
+
+        return TRUE;
+}
+
+static gboolean
+decode_tile (ScreencastDecoder  *decoder,
+             gboolean            apply,
+             GError            **error)
+{
+        guint8 header[KIOSK_SCREENCAST_TILE_HEADER_SIZE];
+        guint32 x, y, width, height, compressed_size;
+        uLongf size;
+        guint8 *canvas_data;
+        int canvas_stride;
+        guint32 row;
+        int result;
+
+        if (!read_exactly (decoder, header, sizeof (header), error))
+                return FALSE;
+
+        x = read_uint32 (header);
+        y = read_uint32 (header + 4);
+        width = read_uint32 (header + 8);
+        height = read_uint32 (header + 12);
+        compressed_size = read_uint32 (header + 16);
+
+        if (width == 0 || height == 0 ||
+            width > decoder->tile_size || height > decoder->tile_size) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                             "Invalid tile size %ux%u", width, height);
+                return FALSE;
+        }
+
+        if (decoder->compressed_size < compressed_size) {
+                decoder->compressed_size = compressed_size;
+                decoder->compressed = g_realloc (decoder->compressed, compressed_size);
+        }
+
+        if (!read_exactly (decoder, decoder->compressed, compressed_size, error))
+                return FALSE;
+
+        if (!apply)
+                return TRUE;
+
+        /* width and height are non-zero and at most tile_size, written
+         * so that corrupt coordinates can't wrap around
+         */
+        if (width > (guint32) cairo_image_surface_get_width (decoder->canvas) ||
+            height > (guint32) cairo_image_surface_get_height (decoder->canvas) ||
+            x > (guint32) cairo_image_surface_get_width (decoder->canvas) - width ||
+            y > (guint32) cairo_image_surface_get_height (decoder->canvas) - height) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                             "Tile at %u,%u is off screen", x, y);
+                return FALSE;
+        }
+
+        size = (uLongf) width * height * 4;
+        if (decoder->pixels_size < size) {
+                decoder->pixels_size = size;
+                decoder->pixels = g_realloc (decoder->pixels, size);
+        }
+
+        result = uncompress (decoder->pixels, &size, decoder->compressed, compressed_size);
+        if (result != Z_OK || size != (uLongf) width * height * 4) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                             "Corrupt tile at %u,%u", x, y);
+                return FALSE;
+        }
+
+        canvas_data = cairo_image_surface_get_data (decoder->canvas);
+        canvas_stride = cairo_image_surface_get_stride (decoder->canvas);
+
+        for (row = 0; row < height; row++) {
+                guint32 *destination = (guint32 *) (canvas_data + (gsize) (y + row) * canvas_stride) + x;
+                const guint32 *source = (const guint32 *) (decoder->pixels + (gsize) row * width * 4);
+                guint32 column;
+
+                for (column = 0; column < width; column++)
+                        destination[column] = GUINT32_FROM_LE (source[column]);
+        }
+
+        return TRUE;
+}
+
+static gboolean
+decode_frames (ScreencastDecoder  *decoder,
+               const char         *output_directory,
+               GError            **error)
+{
+        guint frame_number = 0;
+
+        while (TRUE) {
+                guint8 header[KIOSK_SCREENCAST_FRAME_HEADER_SIZE];
+                g_autoptr (GDateTime) date_time = NULL;
+                g_autofree char *date_string = NULL;
+                g_autofree char *filename = NULL;
+                g_autofree char *path = NULL;
+                gsize bytes_read = 0;
+                gint64 timestamp;
+                guint32 width, height, n_tiles, i;
+                gboolean apply;
+                guint8 type;
+                cairo_status_t status;
+
+                if (!g_input_stream_read_all (decoder->stream, header, sizeof (header),
+                                              &bytes_read, NULL, error))
+                        return FALSE;
+
+                if (bytes_read == 0)
+                        return TRUE;
+
+                if (bytes_read != sizeof (header)) {
+                        g_printerr ("Recording ends in the middle of a frame, stopping\n");
+                        return TRUE;
+                }
+
+                type = header[0];
+                memcpy (&timestamp, header + 4, sizeof (timestamp));
+                timestamp = GINT64_FROM_LE (timestamp);
+                width = read_uint32 (header + 12);
+                height = read_uint32 (header + 16);
+                n_tiles = read_uint32 (header + 20);
+
+                if (type == KIOSK_SCREENCAST_FRAME_TYPE_KEY) {
+                        if (decoder->canvas == NULL ||
+                            width != (guint32) cairo_image_surface_get_width (decoder->canvas) ||
+                            height != (guint32) cairo_image_surface_get_height (decoder->canvas)) {
+                                g_clear_pointer (&decoder->canvas, cairo_surface_destroy);
+                                if (width == 0 || height == 0 ||
+                                    width > G_MAXINT || height > G_MAXINT) {
+                                        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                                                     "Invalid frame size %ux%u", width, height);
+                                        return FALSE;
+                                }
+
+                                decoder->canvas = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                                                              (int) width, (int) height);
+
+                                status = cairo_surface_status (decoder->canvas);
+                                if (status != CAIRO_STATUS_SUCCESS) {
+                                        g_clear_pointer (&decoder->canvas, cairo_surface_destroy);
+                                        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                                                     "Could not create %ux%u frame: %s",
+                                                     width, height, cairo_status_to_string (status));
+                                        return FALSE;
+                                }
+                        }
+                } else if (type != KIOSK_SCREENCAST_FRAME_TYPE_DELTA) {
+                        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                                     "Unknown frame type %u", type);
+                        return FALSE;
+                }
+
+                /* Deltas can only be applied on top of a key frame */
+                apply = decoder->canvas != NULL;
+
+                if (apply)
+                        cairo_surface_flush (decoder->canvas);
+
+                for (i = 0; i < n_tiles; i++) {
+                        g_autoptr (GError) tile_error = NULL;
+
+                        if (!decode_tile (decoder, apply, &tile_error)) {
+                                if (g_error_matches (tile_error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT)) {
+                                        g_printerr ("Recording ends in the middle of a frame, stopping\n");
+                                        return TRUE;
+                                }
+
+                                g_propagate_error (error, g_steal_pointer (&tile_error));
+                                return FALSE;
+                        }
+                }
+
+                if (!apply) {
+                        g_printerr ("Skipping frame without preceding key frame\n");
+                        continue;
+                }
+
+                cairo_surface_mark_dirty (decoder->canvas);
+
+                frame_number++;
+                filename = g_strdup_printf ("frame-%06u.png", frame_number);
+                path = g_build_filename (output_directory, filename, NULL);
+
+                status = cairo_surface_write_to_png (decoder->canvas, path);
+                if (status != CAIRO_STATUS_SUCCESS) {
+                        g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                                     "Could not write %s: %s", path, cairo_status_to_string (status));
+                        return FALSE;
+                }
+
+                date_time = g_date_time_new_from_unix_local_usec (timestamp);
+                if (date_time != NULL)
+                        date_string = g_date_time_format_iso8601 (date_time);
+
+                g_print ("%s %s %s\n", filename,
+                         date_string != NULL ? date_string : "-",
+                         type == KIOSK_SCREENCAST_FRAME_TYPE_KEY ? "key" : "delta");
+        }
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+        g_autoptr (GOptionContext) context = NULL;
+        g_autoptr (GFile) file = NULL;
+        g_autoptr (GFileInputStream) file_stream = NULL;
+        g_autoptr (GError) error = NULL;
+        ScreencastDecoder decoder = { 0 };
+        gboolean decoded;
+
+        context = g_option_context_new ("RECORDING OUTPUT-DIRECTORY");
+        g_option_context_set_summary (context,
+                                      "Writes every frame of a kiosk screencast recording as png image,\n"
+                                      "and lists the images along with the time they were recorded.");
+
+        if (!g_option_context_parse (context, &argc, &argv, &error)) {
+                g_printerr ("%s\n", error->message);
+                return EXIT_FAILURE;
+        }
+
+        if (argc != 3) {
+                g_printerr ("Usage: %s RECORDING OUTPUT-DIRECTORY\n", g_get_prgname ());
+                return EXIT_FAILURE;
+        }
+
+        if (g_mkdir_with_parents (argv[2], 0755) != 0) {
+                g_printerr ("Could not create %s: %s\n", argv[2], g_strerror (errno));
+                return EXIT_FAILURE;
+        }
+
+        file = g_file_new_for_commandline_arg (argv[1]);
+        file_stream = g_file_read (file, NULL, &error);
+        if (file_stream == NULL) {
+                g_printerr ("Could not open %s: %s\n", argv[1], error->message);
+                return EXIT_FAILURE;
+        }
+
+        decoder.stream = g_buffered_input_stream_new (G_INPUT_STREAM (file_stream));
+
+        decoded = read_file_header (&decoder, &error) &&
+                  decode_frames (&decoder, argv[2], &error);
+
+        g_clear_pointer (&decoder.canvas, cairo_surface_destroy);
+        g_clear_object (&decoder.stream);
+        g_free (decoder.pixels);
+        g_free (decoder.compressed);
+
+        if (!decoded) {
+                g_printerr ("Could not decode %s: %s\n", argv[1], error->message);
+                return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+}
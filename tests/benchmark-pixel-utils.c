@@ -0,0 +1,105 @@
+#include "config.h"
+
+#include <glib.h>
+
+#include "kiosk-pixel-utils-private.h"
+
+#define BENCHMARK_WIDTH 1920
+#define BENCHMARK_HEIGHT 1080
+#define BENCHMARK_ITERATIONS 20
+
+typedef enum
+{
+        BENCHMARK_UNPREMULTIPLY,
+        BENCHMARK_CONVERT_NO_ALPHA,
+        BENCHMARK_ACCUMULATE,
+        NUMBER_OF_BENCHMARKS
+} BenchmarkKind;
+
+static const char *benchmark_names[NUMBER_OF_BENCHMARKS] = {
+        "unpremultiply",
+        "convert-no-alpha",
+        "accumulate",
+};
+
+static double
+run_benchmark (const KioskPixelKernels *kernel_set,
+               BenchmarkKind            kind,
+               const guint32           *pixels,
+               guint8                  *dest,
+               guint32                 *sums)
+{
+        gint64 start_time, best_time = G_MAXINT64;
+        int iteration, y;
+
+        for (iteration = 0; iteration < BENCHMARK_ITERATIONS; iteration++) {
+                gint64 elapsed;
+
+                start_time = g_get_monotonic_time ();
+
+                for (y = 0; y < BENCHMARK_HEIGHT; y++) {
+                        const guint32 *row = pixels + (gsize) y * BENCHMARK_WIDTH;
+
+                        switch (kind) {
+                        case BENCHMARK_UNPREMULTIPLY:
+                                kernel_set->unpremultiply_row (dest, row, BENCHMARK_WIDTH);
+                                break;
+                        case BENCHMARK_CONVERT_NO_ALPHA:
+                                kernel_set->convert_no_alpha_row (dest, row, BENCHMARK_WIDTH);
+                                break;
+                        case BENCHMARK_ACCUMULATE:
+                                kernel_set->accumulate_row (sums, (const guint8 *) row, BENCHMARK_WIDTH * 4);
+                                break;
+                        case NUMBER_OF_BENCHMARKS:
+                                g_assert_not_reached ();
+                        }
+                }
+
+                elapsed = g_get_monotonic_time () - start_time;
+                best_time = MIN (best_time, elapsed);
+        }
+
+        /* Megapixels per second, from the fastest run */
+        return (double) BENCHMARK_WIDTH * BENCHMARK_HEIGHT / MAX (best_time, 1);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+        g_autoptr (GRand) rand = g_rand_new_with_seed (0x6b696f73);
+        g_autofree guint32 *pixels = NULL;
+        g_autofree guint8 *dest = NULL;
+        g_autofree guint32 *sums = NULL;
+        const KioskPixelKernels *kernels;
+        int number_of_kernels;
+        gsize i;
+        int kind, k;
+
+        pixels = g_new (guint32, (gsize) BENCHMARK_WIDTH * BENCHMARK_HEIGHT);
+        for (i = 0; i < (gsize) BENCHMARK_WIDTH * BENCHMARK_HEIGHT; i++)
+                pixels[i] = g_rand_int (rand);
+
+        dest = g_malloc ((gsize) BENCHMARK_WIDTH * 4);
+        sums = g_new0 (guint32, (gsize) BENCHMARK_WIDTH * 4);
+
+        kernels = kiosk_pixel_utils_get_kernels (&number_of_kernels);
+
+        for (kind = 0; kind < NUMBER_OF_BENCHMARKS; kind++) {
+                double scalar_rate = 0.0;
+
+                for (k = 0; k < number_of_kernels; k++) {
+                        double rate;
+
+                        rate = run_benchmark (&kernels[k], kind, pixels, dest, sums);
+                        if (k == 0)
+                                scalar_rate = rate;
+
+                        g_print ("%-18s %-8s %9.1f Mpixel/s %6.2fx\n",
+                                 benchmark_names[kind], kernels[k].name,
+                                 rate, rate / scalar_rate);
+                }
+        }
+
+        return 0;
+}
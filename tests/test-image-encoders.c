@@ -0,0 +1,351 @@
+#include "config.h"
+
+#include <string.h>
+#include <glib.h>
+#include <gio/gio.h>
+#include <cairo.h>
+
+#include "kiosk-png-encoder.h"
+#include "kiosk-qoi-encoder.h"
+
+typedef struct
+{
+        const guint8 *data;
+        gsize         length;
+        gsize         offset;
+} MemoryReader;
+
+/* Mixes the content the encoders have special paths for: long runs of one
+ * color, smooth gradients, noise and a small repeating palette
+ */
+static cairo_surface_t *
+create_test_surface (cairo_format_t format,
+                     int            width,
+                     int            height,
+                     gboolean       with_transparency)
+{
+        static const guint32 palette[] = { 0xff336699, 0xff996633, 0xff000000, 0xffffffff };
+        g_autoptr (GRand) rand = g_rand_new_with_seed (0x6b696f73);
+        cairo_surface_t *surface;
+        guint8 *data;
+        int stride;
+        int x, y;
+
+        surface = cairo_image_surface_create (format, width, height);
+        g_assert_cmpint (cairo_surface_status (surface), ==, CAIRO_STATUS_SUCCESS);
+
+        cairo_surface_flush (surface);
+        data = cairo_image_surface_get_data (surface);
+        stride = cairo_image_surface_get_stride (surface);
+
+        for (y = 0; y < height; y++) {
+                guint32 *row = (guint32 *) (data + (gsize) y * stride);
+
+                for (x = 0; x < width; x++) {
+                        guint32 pixel;
+
+                        if (x < width / 4)
+                                pixel = y % 2 ? 0xff102030 : 0xff203040;
+                        else if (x < width / 2)
+                                pixel = 0xff000000 | (x & 0xff) << 16 | (y & 0xff) << 8 | ((x + y) & 0xff);
+                        else if (x < 3 * width / 4)
+                                pixel = g_rand_int (rand) | 0xff000000;
+                        else
+                                pixel = palette[(x + y) % G_N_ELEMENTS (palette)];
+
+                        /* Only fully transparent pixels survive the
+                         * unpremultiply and premultiply round trip exactly
+                         */
+                        if (with_transparency && (x + 3 * y) % 11 == 0)
+                                pixel = 0;
+
+                        row[x] = pixel;
+                }
+        }
+
+        cairo_surface_mark_dirty (surface);
+
+        return surface;
+}
+
+static GBytes *
+encode_surface (cairo_surface_t *surface,
+                gboolean         use_qoi,
+                int              compression_level)
+{
+        g_autoptr (GOutputStream) stream = NULL;
+        g_autoptr (GError) error = NULL;
+        const char * const text_chunks[] = { "Software", "test-image-encoders", NULL };
+        gboolean succeeded;
+
+        stream = g_memory_output_stream_new_resizable ();
+
+        if (use_qoi)
+                succeeded = kiosk_qoi_encoder_write_surface (surface, stream, NULL, &error);
+        else
+                succeeded = kiosk_png_encoder_write_surface (surface, stream, compression_level,
+                                                             text_chunks, NULL, &error);
+
+        g_assert_no_error (error);
+        g_assert_true (succeeded);
+
+        g_output_stream_close (stream, NULL, &error);
+        g_assert_no_error (error);
+
+        return g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (stream));
+}
+
+static cairo_status_t
+read_from_memory (void          *closure,
+                  unsigned char *data,
+                  unsigned int   length)
+{
+        MemoryReader *reader = closure;
+
+        if (length > reader->length - reader->offset)
+                return CAIRO_STATUS_READ_ERROR;
+
+        memcpy (data, reader->data + reader->offset, length);
+        reader->offset += length;
+
+        return CAIRO_STATUS_SUCCESS;
+}
+
+static void
+assert_surfaces_equal (cairo_surface_t *expected,
+                       cairo_surface_t *result)
+{
+        guint32 mask = 0xffffffff;
+        int width, height;
+        int x, y;
+
+        width = cairo_image_surface_get_width (expected);
+        height = cairo_image_surface_get_height (expected);
+
+        g_assert_cmpint (cairo_image_surface_get_width (result), ==, width);
+        g_assert_cmpint (cairo_image_surface_get_height (result), ==, height);
+
+        if (cairo_image_surface_get_format (expected) == CAIRO_FORMAT_RGB24)
+                mask = 0x00ffffff;
+
+        cairo_surface_flush (result);
+
+        for (y = 0; y < height; y++) {
+                const guint32 *expected_row, *result_row;
+
+                expected_row = (const guint32 *) (cairo_image_surface_get_data (expected) +
+                                                  (gsize) y * cairo_image_surface_get_stride (expected));
+                result_row = (const guint32 *) (cairo_image_surface_get_data (result) +
+                                                (gsize) y * cairo_image_surface_get_stride (result));
+
+                for (x = 0; x < width; x++) {
+                        if ((expected_row[x] & mask) != (result_row[x] & mask))
+                                g_error ("Pixel %d,%d is %08x, expected %08x",
+                                         x, y, result_row[x] & mask, expected_row[x] & mask);
+                }
+        }
+}
+
+static void
+check_png_round_trip (cairo_format_t format,
+                      int            width,
+                      int            height,
+                      int            compression_level)
+{
+        cairo_surface_t *surface, *decoded;
+        g_autoptr (GBytes) png = NULL;
+        MemoryReader reader = { 0 };
+
+        surface = create_test_surface (format, width, height, format == CAIRO_FORMAT_ARGB32);
+        png = encode_surface (surface, FALSE, compression_level);
+
+        /* cairo reads the file back with libpng, which checks the
+         * stitched zlib stream, including its adler32 trailer
+         */
+        reader.data = g_bytes_get_data (png, &reader.length);
+        decoded = cairo_image_surface_create_from_png_stream (read_from_memory, &reader);
+        g_assert_cmpint (cairo_surface_status (decoded), ==, CAIRO_STATUS_SUCCESS);
+
+        assert_surfaces_equal (surface, decoded);
+
+        cairo_surface_destroy (decoded);
+        cairo_surface_destroy (surface);
+}
+
+static void
+test_png_single_band (void)
+{
+        check_png_round_trip (CAIRO_FORMAT_ARGB32, 33, 17, KIOSK_PNG_ENCODER_COMPRESSION_LEVEL_DEFAULT);
+        check_png_round_trip (CAIRO_FORMAT_RGB24, 33, 17, KIOSK_PNG_ENCODER_COMPRESSION_LEVEL_DEFAULT);
+}
+
+static void
+test_png_band_stitching (void)
+{
+        static const int compression_levels[] = {
+                KIOSK_PNG_ENCODER_COMPRESSION_LEVEL_DEFAULT,
+                KIOSK_PNG_ENCODER_COMPRESSION_LEVEL_NONE,
+                KIOSK_PNG_ENCODER_COMPRESSION_LEVEL_FAST,
+                KIOSK_PNG_ENCODER_COMPRESSION_LEVEL_BEST,
+        };
+        gsize i;
+
+        /* Several bands with a partial last one, then bands of a
+         * couple of rows each
+         */
+        for (i = 0; i < G_N_ELEMENTS (compression_levels); i++) {
+                check_png_round_trip (CAIRO_FORMAT_ARGB32, 301, 700, compression_levels[i]);
+                check_png_round_trip (CAIRO_FORMAT_RGB24, 301, 700, compression_levels[i]);
+                check_png_round_trip (CAIRO_FORMAT_ARGB32, 32767, 5, compression_levels[i]);
+        }
+}
+
+static guint32
+read_uint32_be (const guint8 *data)
+{
+        return (guint32) data[0] << 24 | (guint32) data[1] << 16 | (guint32) data[2] << 8 | data[3];
+}
+
+/* A straight implementation of the decoder from the qoi specification */
+static guint8 *
+decode_qoi (GBytes *qoi,
+            int    *width,
+            int    *height,
+            int    *channels)
+{
+        static const guint8 end_marker[] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+        guint8 index[64][4] = { { 0, } };
+        guint8 pixel[4] = { 0, 0, 0, 255 };
+        const guint8 *data;
+        guint8 *pixels;
+        gsize length, offset = 14;
+        gsize i, number_of_pixels;
+        int run = 0;
+
+        data = g_bytes_get_data (qoi, &length);
+        g_assert_cmpuint (length, >=, 14 + sizeof (end_marker));
+        g_assert_cmpmem (data, 4, "qoif", 4);
+
+        *width = read_uint32_be (data + 4);
+        *height = read_uint32_be (data + 8);
+        *channels = data[12];
+        g_assert_cmpint (data[13], ==, 0);
+
+        number_of_pixels = (gsize) *width * *height;
+        pixels = g_malloc (number_of_pixels * 4);
+
+        for (i = 0; i < number_of_pixels; i++) {
+                if (run > 0) {
+                        run--;
+                } else {
+                        guint8 tag;
+
+                        g_assert_cmpuint (offset, <, length - sizeof (end_marker));
+                        tag = data[offset++];
+
+                        if (tag == 0xfe) {
+                                memcpy (pixel, data + offset, 3);
+                                offset += 3;
+                        } else if (tag == 0xff) {
+                                memcpy (pixel, data + offset, 4);
+                                offset += 4;
+                        } else if ((tag & 0xc0) == 0x00) {
+                                memcpy (pixel, index[tag], 4);
+                        } else if ((tag & 0xc0) == 0x40) {
+                                pixel[0] += ((tag >> 4) & 0x03) - 2;
+                                pixel[1] += ((tag >> 2) & 0x03) - 2;
+                                pixel[2] += (tag & 0x03) - 2;
+                        } else if ((tag & 0xc0) == 0x80) {
+                                guint8 second = data[offset++];
+                                int green_difference = (tag & 0x3f) - 32;
+
+                                pixel[0] += green_difference - 8 + ((second >> 4) & 0x0f);
+                                pixel[1] += green_difference;
+                                pixel[2] += green_difference - 8 + (second & 0x0f);
+                        } else {
+                                run = tag & 0x3f;
+                        }
+
+                        memcpy (index[(pixel[0] * 3 + pixel[1] * 5 + pixel[2] * 7 + pixel[3] * 11) % 64],
+                                pixel, 4);
+                }
+
+                memcpy (pixels + i * 4, pixel, 4);
+        }
+
+        g_assert_cmpuint (length - offset, ==, sizeof (end_marker));
+        g_assert_cmpmem (data + offset, sizeof (end_marker), end_marker, sizeof (end_marker));
+
+        return pixels;
+}
+
+static void
+check_qoi_round_trip (cairo_format_t format,
+                      int            width,
+                      int            height)
+{
+        cairo_surface_t *surface;
+        g_autoptr (GBytes) qoi = NULL;
+        g_autofree guint8 *pixels = NULL;
+        int decoded_width, decoded_height, channels;
+        int x, y;
+
+        surface = create_test_surface (format, width, height, format == CAIRO_FORMAT_ARGB32);
+        qoi = encode_surface (surface, TRUE, 0);
+        pixels = decode_qoi (qoi, &decoded_width, &decoded_height, &channels);
+
+        g_assert_cmpint (decoded_width, ==, width);
+        g_assert_cmpint (decoded_height, ==, height);
+        g_assert_cmpint (channels, ==, format == CAIRO_FORMAT_ARGB32 ? 4 : 3);
+
+        for (y = 0; y < height; y++) {
+                const guint32 *row = (const guint32 *) (cairo_image_surface_get_data (surface) +
+                                                        (gsize) y * cairo_image_surface_get_stride (surface));
+
+                for (x = 0; x < width; x++) {
+                        const guint8 *result = pixels + ((gsize) y * width + x) * 4;
+                        guint8 expected[4];
+
+                        /* The test surface is made of opaque and fully
+                         * transparent pixels only
+                         */
+                        if (format == CAIRO_FORMAT_ARGB32 && row[x] >> 24 == 0) {
+                                memset (expected, 0, sizeof (expected));
+                        } else {
+                                expected[0] = row[x] >> 16;
+                                expected[1] = row[x] >> 8;
+                                expected[2] = row[x];
+                                expected[3] = 255;
+                        }
+
+                        if (memcmp (result, expected, 4) != 0)
+                                g_error ("Pixel %d,%d is %02x%02x%02x%02x, expected %02x%02x%02x%02x",
+                                         x, y, result[0], result[1], result[2], result[3],
+                                         expected[0], expected[1], expected[2], expected[3]);
+                }
+        }
+
+        cairo_surface_destroy (surface);
+}
+
+static void
+test_qoi_round_trip (void)
+{
+        check_qoi_round_trip (CAIRO_FORMAT_ARGB32, 301, 97);
+        check_qoi_round_trip (CAIRO_FORMAT_RGB24, 301, 97);
+        check_qoi_round_trip (CAIRO_FORMAT_ARGB32, 1, 1);
+        check_qoi_round_trip (CAIRO_FORMAT_RGB24, 200, 3);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+        g_test_init (&argc, &argv, NULL);
+
+        g_test_add_func ("/image-encoders/png/single-band", test_png_single_band);
+        g_test_add_func ("/image-encoders/png/band-stitching", test_png_band_stitching);
+        g_test_add_func ("/image-encoders/qoi/round-trip", test_qoi_round_trip);
+
+        return g_test_run ();
+}
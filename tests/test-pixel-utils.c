@@ -0,0 +1,265 @@
+#include "config.h"
+
+#include <string.h>
+#include <glib.h>
+
+#include "kiosk-pixel-utils.h"
+#include "kiosk-pixel-utils-private.h"
+
+/* Widths up to this cover every vector width and every scalar tail */
+#define MAX_ODD_WIDTH 67
+#define WIDE_WIDTH 1920
+#define GUARD_SIZE 64
+#define GUARD_BYTE 0xa5
+
+typedef enum
+{
+        PIXELS_RANDOM,
+        PIXELS_PREMULTIPLIED,
+        PIXELS_TRANSPARENT,
+        PIXELS_OPAQUE,
+        PIXELS_ALPHA_RAMP,
+        NUMBER_OF_PIXEL_KINDS
+} PixelKind;
+
+static guint32
+make_pixel (GRand     *rand,
+            PixelKind  kind,
+            int        index)
+{
+        guint32 pixel = g_rand_int (rand);
+        guint alpha, red, green, blue;
+
+        switch (kind) {
+        case PIXELS_RANDOM:
+                /* Includes colors above alpha, which aren't valid
+                 * premultiplied pixels but must still convert the same
+                 */
+                return pixel;
+        case PIXELS_PREMULTIPLIED:
+                alpha = pixel >> 24;
+                red = alpha > 0 ? g_rand_int_range (rand, 0, alpha + 1) : 0;
+                green = alpha > 0 ? g_rand_int_range (rand, 0, alpha + 1) : 0;
+                blue = alpha > 0 ? g_rand_int_range (rand, 0, alpha + 1) : 0;
+                return alpha << 24 | red << 16 | green << 8 | blue;
+        case PIXELS_TRANSPARENT:
+                return pixel & 0x00ffffff;
+        case PIXELS_OPAQUE:
+                return pixel | 0xff000000;
+        case PIXELS_ALPHA_RAMP:
+                alpha = index % 256;
+                return alpha << 24 | alpha << 16 | (alpha / 2) << 8 | (alpha > 0 ? 1 : 0);
+        case NUMBER_OF_PIXEL_KINDS:
+                break;
+        }
+
+        g_assert_not_reached ();
+}
+
+static guint32 *
+make_pixels (GRand     *rand,
+             PixelKind  kind,
+             int        width)
+{
+        guint32 *pixels;
+        int x;
+
+        pixels = g_new (guint32, width);
+        for (x = 0; x < width; x++)
+                pixels[x] = make_pixel (rand, kind, x);
+
+        return pixels;
+}
+
+static guint8 *
+make_guarded_buffer (gsize length)
+{
+        guint8 *buffer;
+
+        buffer = g_malloc (length + GUARD_SIZE);
+        memset (buffer, GUARD_BYTE, length + GUARD_SIZE);
+
+        return buffer;
+}
+
+static void
+assert_guard_intact (const guint8 *buffer,
+                     gsize         length)
+{
+        gsize i;
+
+        for (i = length; i < length + GUARD_SIZE; i++)
+                g_assert_cmphex (buffer[i], ==, GUARD_BYTE);
+}
+
+static const KioskPixelKernels *
+get_kernels_or_skip (int *number_of_kernels)
+{
+        const KioskPixelKernels *kernels;
+        int i;
+
+        kernels = kiosk_pixel_utils_get_kernels (number_of_kernels);
+        g_assert_nonnull (kernels);
+        g_assert_cmpint (*number_of_kernels, >=, 1);
+        g_assert_cmpstr (kernels[0].name, ==, "scalar");
+
+        for (i = 1; i < *number_of_kernels; i++)
+                g_test_message ("Comparing %s kernels against scalar ones", kernels[i].name);
+
+        if (*number_of_kernels == 1)
+                g_test_skip ("Only the scalar kernels are supported on this CPU");
+
+        return kernels;
+}
+
+static void
+compare_row_kernels (gboolean has_alpha)
+{
+        g_autoptr (GRand) rand = g_rand_new_with_seed (0x6b696f73);
+        const KioskPixelKernels *kernels;
+        int number_of_kernels;
+        int bytes_per_pixel = has_alpha ? 4 : 3;
+        int kind, width, i;
+
+        kernels = get_kernels_or_skip (&number_of_kernels);
+
+        for (kind = 0; kind < NUMBER_OF_PIXEL_KINDS; kind++) {
+                for (width = 1; width <= MAX_ODD_WIDTH + 1; width++) {
+                        int row_width = width <= MAX_ODD_WIDTH ? width : WIDE_WIDTH;
+                        gsize length = (gsize) row_width * bytes_per_pixel;
+                        g_autofree guint32 *pixels = NULL;
+                        g_autofree guint8 *expected = NULL;
+
+                        pixels = make_pixels (rand, kind, row_width);
+                        expected = make_guarded_buffer (length);
+
+                        if (has_alpha)
+                                kernels[0].unpremultiply_row (expected, pixels, row_width);
+                        else
+                                kernels[0].convert_no_alpha_row (expected, pixels, row_width);
+
+                        assert_guard_intact (expected, length);
+
+                        for (i = 1; i < number_of_kernels; i++) {
+                                g_autofree guint8 *result = make_guarded_buffer (length);
+
+                                if (has_alpha)
+                                        kernels[i].unpremultiply_row (result, pixels, row_width);
+                                else
+                                        kernels[i].convert_no_alpha_row (result, pixels, row_width);
+
+                                g_assert_cmpmem (result, length, expected, length);
+                                assert_guard_intact (result, length);
+                        }
+                }
+        }
+}
+
+static void
+test_convert_alpha (void)
+{
+        compare_row_kernels (TRUE);
+}
+
+static void
+test_convert_no_alpha (void)
+{
+        compare_row_kernels (FALSE);
+}
+
+static void
+test_accumulate (void)
+{
+        g_autoptr (GRand) rand = g_rand_new_with_seed (0x6b696f73);
+        const KioskPixelKernels *kernels;
+        int number_of_kernels;
+        int length, i, j;
+
+        kernels = get_kernels_or_skip (&number_of_kernels);
+
+        for (length = 1; length <= 4 * MAX_ODD_WIDTH; length++) {
+                g_autofree guint8 *bytes = g_malloc (length);
+                g_autofree guint32 *initial_sums = g_new (guint32, length);
+                g_autofree guint32 *expected = g_new (guint32, length + 1);
+
+                for (j = 0; j < length; j++) {
+                        bytes[j] = j % 7 == 0 ? 255 : g_rand_int_range (rand, 0, 256);
+                        initial_sums[j] = g_rand_int_range (rand, 0, 1 << 20);
+                }
+
+                memcpy (expected, initial_sums, length * sizeof (guint32));
+                expected[length] = G_MAXUINT32;
+                kernels[0].accumulate_row (expected, bytes, length);
+                g_assert_cmphex (expected[length], ==, G_MAXUINT32);
+
+                for (i = 1; i < number_of_kernels; i++) {
+                        g_autofree guint32 *sums = g_new (guint32, length + 1);
+
+                        memcpy (sums, initial_sums, length * sizeof (guint32));
+                        sums[length] = G_MAXUINT32;
+                        kernels[i].accumulate_row (sums, bytes, length);
+
+                        g_assert_cmpmem (sums, length * sizeof (guint32),
+                                         expected, length * sizeof (guint32));
+                        g_assert_cmphex (sums[length], ==, G_MAXUINT32);
+                }
+        }
+}
+
+static void
+test_unpremultiply_reference (void)
+{
+        static const struct {
+                guint32 pixel;
+                guint8  rgba[4];
+        } cases[] = {
+                { 0x00000000, { 0, 0, 0, 0 } },
+                { 0x00ffffff, { 0, 0, 0, 0 } },
+                { 0xff123456, { 0x12, 0x34, 0x56, 0xff } },
+                { 0x80402010, { 0x80, 0x40, 0x20, 0x80 } },
+                { 0x01010000, { 0xff, 0, 0, 0x01 } },
+        };
+        guint8 rgba[4];
+        gsize i;
+
+        for (i = 0; i < G_N_ELEMENTS (cases); i++) {
+                kiosk_pixel_utils_unpremultiply_argb32_to_rgba (rgba, sizeof (rgba),
+                                                                (const guint8 *) &cases[i].pixel,
+                                                                sizeof (guint32),
+                                                                1, 1);
+                g_assert_cmpmem (rgba, sizeof (rgba), cases[i].rgba, sizeof (cases[i].rgba));
+        }
+}
+
+static void
+test_downscale (void)
+{
+        guint32 source[4 * 3] = {
+                0xff000000, 0xff000000, 0xff0000ff, 0xff0000ff,
+                0xff000000, 0xff000000, 0xff0000ff, 0xff0000ff,
+                0x00000000, 0x00000000, 0xffffffff, 0xfffffffd,
+        };
+        guint32 result[2] = { 0, };
+
+        /* 4x3 to 2x1: each destination pixel averages a 2x3 block */
+        kiosk_pixel_utils_downscale_argb32 ((guint8 *) result, sizeof (result), 2, 1,
+                                            (const guint8 *) source, 4 * sizeof (guint32), 4, 3);
+
+        g_assert_cmphex (result[0], ==, 0xaa000000);
+        g_assert_cmphex (result[1], ==, 0xff5555ff);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+        g_test_init (&argc, &argv, NULL);
+
+        g_test_add_func ("/pixel-utils/convert-alpha", test_convert_alpha);
+        g_test_add_func ("/pixel-utils/convert-no-alpha", test_convert_no_alpha);
+        g_test_add_func ("/pixel-utils/accumulate", test_accumulate);
+        g_test_add_func ("/pixel-utils/unpremultiply-reference", test_unpremultiply_reference);
+        g_test_add_func ("/pixel-utils/downscale", test_downscale);
+
+        return g_test_run ();
+}
@@ -0,0 +1,230 @@
+#include "config.h"
+
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <cairo.h>
+#include <zlib.h>
+
+#include "kiosk-screencast-format.h"
+
+#define TEST_TILE_SIZE 64
+#define TEST_WIDTH 100
+#define TEST_HEIGHT 70
+
+typedef guint32 (*PixelFunc) (int x,
+                              int y);
+
+static guint32
+key_frame_pixel (int x,
+                 int y)
+{
+        return 0xff000000 | (guint32) (x * 2) << 16 | (guint32) (y * 3) << 8 | (guint32) ((x + y) & 0xff);
+}
+
+static guint32
+delta_frame_pixel (int x,
+                   int y)
+{
+        if (x >= TEST_TILE_SIZE && y < TEST_TILE_SIZE)
+                return 0xff204060 | (guint32) (x & 0x0f);
+
+        return key_frame_pixel (x, y);
+}
+
+static void
+append_uint32 (GByteArray *recording,
+               guint32     value)
+{
+        value = GUINT32_TO_LE (value);
+        g_byte_array_append (recording, (const guint8 *) &value, sizeof (value));
+}
+
+static void
+append_frame_header (GByteArray               *recording,
+                     KioskScreencastFrameType  type,
+                     guint32                   number_of_tiles)
+{
+        guint8 header[KIOSK_SCREENCAST_FRAME_HEADER_SIZE] = { 0 };
+        gint64 timestamp = GINT64_TO_LE (G_GINT64_CONSTANT (1700000000000000));
+
+        header[0] = type;
+        memcpy (header + 4, &timestamp, sizeof (timestamp));
+        g_byte_array_append (recording, header, 12);
+        append_uint32 (recording, TEST_WIDTH);
+        append_uint32 (recording, TEST_HEIGHT);
+        append_uint32 (recording, number_of_tiles);
+}
+
+static void
+append_tile (GByteArray *recording,
+             int         tile_x,
+             int         tile_y,
+             PixelFunc   pixel_func)
+{
+        int width = MIN (TEST_TILE_SIZE, TEST_WIDTH - tile_x);
+        int height = MIN (TEST_TILE_SIZE, TEST_HEIGHT - tile_y);
+        g_autofree guint32 *pixels = NULL;
+        g_autofree guint8 *compressed = NULL;
+        uLongf compressed_size;
+        gsize size;
+        int x, y;
+
+        size = (gsize) width * height * 4;
+        pixels = g_malloc (size);
+
+        for (y = 0; y < height; y++) {
+                for (x = 0; x < width; x++)
+                        pixels[y * width + x] = GUINT32_TO_LE (pixel_func (tile_x + x, tile_y + y));
+        }
+
+        compressed_size = compressBound (size);
+        compressed = g_malloc (compressed_size);
+        g_assert_cmpint (compress2 (compressed, &compressed_size, (const guint8 *) pixels, size,
+                                    Z_BEST_SPEED), ==, Z_OK);
+
+        append_uint32 (recording, tile_x);
+        append_uint32 (recording, tile_y);
+        append_uint32 (recording, width);
+        append_uint32 (recording, height);
+        append_uint32 (recording, compressed_size);
+        g_byte_array_append (recording, compressed, compressed_size);
+}
+
+static GByteArray *
+create_recording (void)
+{
+        GByteArray *recording;
+        guint8 header[KIOSK_SCREENCAST_MAGIC_SIZE] = { 0 };
+        int x, y;
+
+        recording = g_byte_array_new ();
+
+        memcpy (header, KIOSK_SCREENCAST_MAGIC, sizeof (KIOSK_SCREENCAST_MAGIC));
+        g_byte_array_append (recording, header, sizeof (header));
+        append_uint32 (recording, KIOSK_SCREENCAST_VERSION);
+        append_uint32 (recording, TEST_TILE_SIZE);
+
+        /* Can't be shown, nothing to apply it to */
+        append_frame_header (recording, KIOSK_SCREENCAST_FRAME_TYPE_DELTA, 1);
+        append_tile (recording, 0, 0, delta_frame_pixel);
+
+        append_frame_header (recording, KIOSK_SCREENCAST_FRAME_TYPE_KEY, 4);
+        for (y = 0; y < TEST_HEIGHT; y += TEST_TILE_SIZE) {
+                for (x = 0; x < TEST_WIDTH; x += TEST_TILE_SIZE)
+                        append_tile (recording, x, y, key_frame_pixel);
+        }
+
+        append_frame_header (recording, KIOSK_SCREENCAST_FRAME_TYPE_DELTA, 1);
+        append_tile (recording, TEST_TILE_SIZE, 0, delta_frame_pixel);
+
+        /* A recording that got cut short in the middle of a tile */
+        append_frame_header (recording, KIOSK_SCREENCAST_FRAME_TYPE_DELTA, 1);
+        append_uint32 (recording, 0);
+
+        return recording;
+}
+
+static void
+assert_frame_matches (const char *path,
+                      PixelFunc   pixel_func)
+{
+        cairo_surface_t *surface;
+        const guint8 *data;
+        int stride;
+        int x, y;
+
+        surface = cairo_image_surface_create_from_png (path);
+        g_assert_cmpint (cairo_surface_status (surface), ==, CAIRO_STATUS_SUCCESS);
+        g_assert_cmpint (cairo_image_surface_get_width (surface), ==, TEST_WIDTH);
+        g_assert_cmpint (cairo_image_surface_get_height (surface), ==, TEST_HEIGHT);
+
+        cairo_surface_flush (surface);
+        data = cairo_image_surface_get_data (surface);
+        stride = cairo_image_surface_get_stride (surface);
+
+        for (y = 0; y < TEST_HEIGHT; y++) {
+                const guint32 *row = (const guint32 *) (data + (gsize) y * stride);
+
+                for (x = 0; x < TEST_WIDTH; x++) {
+                        if ((row[x] | 0xff000000) != pixel_func (x, y))
+                                g_error ("%s: pixel %d,%d is %08x, expected %08x",
+                                         path, x, y, row[x], pixel_func (x, y));
+                }
+        }
+
+        cairo_surface_destroy (surface);
+}
+
+static void
+test_round_trip (void)
+{
+        const char *decoder = g_getenv ("KIOSK_SCREENCAST_DECODER");
+        g_autoptr (GByteArray) recording = NULL;
+        g_autoptr (GError) error = NULL;
+        g_autofree char *directory = NULL;
+        g_autofree char *recording_path = NULL;
+        g_autofree char *output_directory = NULL;
+        g_autofree char *first_frame = NULL;
+        g_autofree char *second_frame = NULL;
+        g_autofree char *third_frame = NULL;
+        g_autofree char *standard_output = NULL;
+        g_auto (GStrv) lines = NULL;
+        int wait_status;
+
+        if (decoder == NULL) {
+                g_test_skip ("KIOSK_SCREENCAST_DECODER is not set");
+                return;
+        }
+
+        directory = g_dir_make_tmp ("test-screencast-decoder-XXXXXX", &error);
+        g_assert_no_error (error);
+
+        recording = create_recording ();
+        recording_path = g_build_filename (directory, "recording.kskcast", NULL);
+        g_file_set_contents (recording_path, (const char *) recording->data, recording->len, &error);
+        g_assert_no_error (error);
+
+        output_directory = g_build_filename (directory, "frames", NULL);
+
+        g_spawn_sync (NULL,
+                      (char *[]) { (char *) decoder, recording_path, output_directory, NULL },
+                      NULL, G_SPAWN_DEFAULT, NULL, NULL,
+                      &standard_output, NULL, &wait_status, &error);
+        g_assert_no_error (error);
+        g_spawn_check_wait_status (wait_status, &error);
+        g_assert_no_error (error);
+
+        /* The leading delta frame is skipped, the truncated one dropped */
+        lines = g_strsplit (g_strstrip (standard_output), "\n", -1);
+        g_assert_cmpuint (g_strv_length (lines), ==, 2);
+        g_assert_true (g_str_has_prefix (lines[0], "frame-000001.png "));
+        g_assert_true (g_str_has_suffix (lines[0], " key"));
+        g_assert_true (g_str_has_prefix (lines[1], "frame-000002.png "));
+        g_assert_true (g_str_has_suffix (lines[1], " delta"));
+
+        first_frame = g_build_filename (output_directory, "frame-000001.png", NULL);
+        second_frame = g_build_filename (output_directory, "frame-000002.png", NULL);
+        third_frame = g_build_filename (output_directory, "frame-000003.png", NULL);
+
+        assert_frame_matches (first_frame, key_frame_pixel);
+        assert_frame_matches (second_frame, delta_frame_pixel);
+        g_assert_false (g_file_test (third_frame, G_FILE_TEST_EXISTS));
+
+        g_remove (first_frame);
+        g_remove (second_frame);
+        g_rmdir (output_directory);
+        g_remove (recording_path);
+        g_rmdir (directory);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+        g_test_init (&argc, &argv, NULL);
+
+        g_test_add_func ("/screencast-decoder/round-trip", test_round_trip);
+
+        return g_test_run ();
+}